@@ -1,6 +1,19 @@
 // This file is here to help the Arduino IDE find the other files.
 #ifdef ARDUINO
 #define __STDC_LIMIT_MACROS
+#include "./include/arduino/IobeamConfig.h"
 #include "./src/http.c"
+#include "./src/clock.c"
+#include "./src/fmt.c"
+#include "./src/import.c"
+#include "./src/agg.c"
+#include "./src/filter.c"
+#include "./src/series.c"
+#include "./src/queue.c"
+#include "./src/limit.c"
+#include "./src/batch.c"
+#include "./src/stats.c"
+#include "./src/trace.c"
+#include "./src/sched.c"
 #include "./src/arduino/Iobeam.cpp"
 #endif
\ No newline at end of file
@@ -5,9 +5,16 @@
  * The setup() initializes the Ethernet and the iobeam library,
  * registering the device if necessary.
  *
- * The loop() reads the analog value of pin 0 and transmits this value to 
- * the iobeam cloud every 15 seconds. For real projects, you would replace
- * this logic with code to measure whatever values you are concerned with.
+ * The loop() runs the iobeam library's tasks: a sampling task of ours,
+ * which reads the analog value of pin 0 every 15 seconds, and the library's
+ * own, which transmit the readings to the iobeam cloud and keep the clock
+ * in sync. For real projects, you would replace the sampling task with code
+ * to measure whatever values you are concerned with.
+ *
+ * Registered series, the send queue and the task scheduler are compiled
+ * out of the library by default to save RAM. This sketch uses all three,
+ * so uncomment IOBEAM_SERIES_MAX, IOBEAM_QUEUE_LEN and IOBEAM_SCHED_MAX in
+ * the library's include/arduino/IobeamConfig.h first.
  */
 #define __STDC_LIMIT_MACROS
 #include <SPI.h>
@@ -18,6 +25,10 @@
 #define DEBUG_LEVEL 2
 #include <Iobeam.h>
 
+#if IOBEAM_SERIES_MAX == 0 || IOBEAM_QUEUE_LEN == 0 || IOBEAM_SCHED_MAX < 3
+#error "Set IOBEAM_SERIES_MAX, IOBEAM_QUEUE_LEN and IOBEAM_SCHED_MAX (3 or more) in IobeamConfig.h"
+#endif
+
 // Necessary for iobeam. The project token should be PROGMEM to save RAM.
 #define PROJECT_ID -1  // YOUR PROJECT ID
 PROGMEM const char token[] = {"YOUR PROJECT TOKEN HERE"};
@@ -27,6 +38,21 @@ byte mac[] = { 0x90, 0xA2, 0xDA, 0x0F, 0x9B, 0xFA };  // ethernet MAC address
 EthernetClient client;
 Iobeam iobeam(client);
 
+// A reading is the average of a few samples a little apart, taken without
+// holding up the other tasks in between.
+#define SAMPLE_PERIOD_MS 15000
+#define SAMPLE_DEADLINE_MS 1000
+#define SAMPLES_PER_READING 4
+#define SAMPLE_SPACING_MS 10
+
+typedef struct {
+  Iobeam::Series series;
+  uint8_t n;
+  long sum;
+  int pressure;
+} Sampler;
+Sampler sampler;
+
 void setup() {
   setupSerial();
   setupNetwork();
@@ -37,20 +63,41 @@ void setup() {
   if (iobeam.registerDevice(0) < 0) {
     errorForever();
   }
+  sampler.series = iobeam.addSeries("analog");
+  iobeam.addTask(sampleTask, &sampler, SAMPLE_PERIOD_MS, SAMPLE_DEADLINE_MS);
+  iobeam.setMissCallback(reportMiss, NULL);
   
   IOBEAM_VERBOSE("\n");
   IOBEAM_LOG("Setup done.\n");
 }
 
 void loop() {
-  int temp = analogRead(0);
-  boolean success = iobeam.send("analog", temp);
-  IOBEAM_VERBOSE("\n");
-  
-  IOBEAM_LOG("import success: ");
-  IOBEAM_LOG(success);
+  iobeam.runTasks();
+}
+
+// Each step runs until it yields; the next one picks up after the yield.
+int sampleTask(IobeamTask *t, uint64_t now, void *arg) {
+  Sampler *s = (Sampler *) arg;
+  IOBEAM_TASK_BEGIN(t);
+  s->sum = 0;
+  for (s->n = 0; s->n < SAMPLES_PER_READING; s->n++) {
+    s->sum += analogRead(0);
+    IOBEAM_TASK_SLEEP(t, now + SAMPLE_SPACING_MS);
+  }
+  s->pressure = iobeam.enqueue(s->series,
+      (int) (s->sum / SAMPLES_PER_READING));
+  IOBEAM_LOG("queued, pressure: ");
+  IOBEAM_LOG(s->pressure);
   IOBEAM_LOG("\n");
-  delay(15000);
+  IOBEAM_TASK_END(t);
+}
+
+void reportMiss(void *ctx, int task, uint32_t late) {
+  IOBEAM_LOG("task ");
+  IOBEAM_LOG(task);
+  IOBEAM_LOG(" missed its deadline by ");
+  IOBEAM_LOG(late);
+  IOBEAM_LOG(" ms\n");
 }
 
 void setupSerial() {
@@ -19,8 +19,8 @@
 // Includes to setup board
 #include "i2c_if.h"
 #include "pinmux.h"
+#include "tmp006acq.h"
 #include "tmp006drv.h"
-#include "utils.h"
 #include "udma_if.h"
 #include "wifi.h"
 
@@ -34,7 +34,9 @@
 
 #define APPLICATION_NAME        "iobeam temperature tracker"
 #define APPLICATION_VERSION     "1.0.0"
-#define MEASURE_DELAY_SECS       5
+#define SAMPLE_PERIOD_MS         5000
+#define MAX_LATENCY_MS           60000  // most a sample waits to be sent
+#define MAX_READ_ERRORS          10  // failed reads in a row before quitting
 
 // iobeam constants
 const char *PROJECT_TOKEN = "YOUR PROJECT TOKEN";
@@ -112,17 +114,59 @@ inline int initTemperatureSensor() {
     return TMP006DrvOpen();
 }
 
-inline int getTemperature(float *temperature)
+// State of the task that queues samples, see queueTask().
+typedef struct {
+    Iobeam *iobeam;
+    int temperatureSeries;
+    int ambientSeries;
+    unsigned long goodErrors;  // read errors as of the last sample
+    int failed;
+} Sampler;
+
+// Queues the samples the acquisition stage has taken since the last call,
+// stamped with when they were taken. Returns how many there were.
+static int queueSamples(Iobeam *iobeam, int temperatureSeries,
+        int ambientSeries)
 {
-    return TMP006DrvGetTemp(temperature);
+    tTMP006Sample sample;
+    float temperature, ambient;
+    int n = 0;
+    while (TMP006AcqRead(&sample)) {
+        uint64_t ts = iobeam_TimeAt(sample.ullTime);
+        TMP006DrvComputeTemps(sample.usVObject, sample.usTAmbient,
+                &temperature, &ambient);
+        IOBEAM_LOG("temperature: %f\r\n", temperature);
+        iobeam->QueueFloatWithTime(temperatureSeries, ts, temperature);
+        iobeam->QueueFloatWithTime(ambientSeries, ts, ambient);
+        n++;
+    }
+    return n;
 }
 
-// UtilsDelay uses loop counts which takes 3-5 CPU ticks on 80Mhz, this macro
-// is a rough conversion from seconds.
-#define SECS_TO_LOOPS(x) ((80000000 / 5) * x)
+// Task moving samples from the acquisition stage's ring to the send queue,
+// run by iobeam_RunTasks() alongside the client's own upload and clock sync
+// tasks. Gives up once reads keep failing.
+static int queueTask(IobeamTask *t, uint64_t now, void *arg)
+{
+    Sampler *s = (Sampler *) arg;
+    tTMP006AcqStats stats;
+    int n = queueSamples(s->iobeam, s->temperatureSeries,
+            s->ambientSeries);
+    TMP006AcqGetStats(&stats);
+    if (n > 0) {
+        s->goodErrors = stats.ulErrors;
+    } else if (stats.ulErrors - s->goodErrors >= MAX_READ_ERRORS) {
+        IOBEAM_ERR("Error getting temp: %lu failed reads\r\n",
+                stats.ulErrors - s->goodErrors);
+        s->failed = 1;
+    }
+    return IOBEAM_TASK_DONE;
+}
 
-inline void delay(uint16_t seconds) {
-    UtilsDelay(SECS_TO_LOOPS(seconds));
+static void reportMiss(void *ctx, int task, uint32_t late)
+{
+    IOBEAM_LOG("task %d missed its deadline by %lu ms\r\n", task,
+            (unsigned long) late);
 }
 
 //****************************************************************************
@@ -145,21 +189,33 @@ void main()
         iobeam.RegisterDevice();
         iobeam.StartTimeKeeping();
 
-        float temperature = 0.0;
-        while (1) {
-            IOBEAM_LOG("---------\r\n");
-            ret = getTemperature(&temperature);
-            if (ret < 0) {
-                IOBEAM_ERR("Error getting temp: %d\r\n", ret);
-                break;
-            }
-            IOBEAM_LOG("temperature: %f\r\n", temperature);
-            ret = iobeam.SendFloat("temperature", temperature);
-            IOBEAM_LOG("success: %d\r\n", ret);
-
-            delay(MEASURE_DELAY_SECS);
+        Sampler sampler = { &iobeam };
+        sampler.temperatureSeries = iobeam_AddSeries("temperature");
+        sampler.ambientSeries = iobeam_AddSeries("ambient_temperature");
+        // Samples wait in the queue, and go out in batches sized to the link
+        iobeam_SetAdaptiveBatching(MAX_LATENCY_MS, 10);
+
+        // From here on the timer samples the sensor on its own, however
+        // long uploads take.
+        ret = TMP006AcqStart(SAMPLE_PERIOD_MS);
+        if (ret < 0) {
+            IOBEAM_ERR("Acquisition failed to start: %d\r\n", ret);
+            goto err_acq;
+        }
+
+        // The samples are queued once a period; uploads and clock syncs
+        // run in between, without a deadline.
+        iobeam_AddTask(queueTask, &sampler, SAMPLE_PERIOD_MS, 0);
+        iobeam_SetMissCallback(reportMiss, NULL);
+        while (!sampler.failed) {
+            iobeam_RunTasks();
+            _SlNonOsMainLoopTask();
         }
 
+        if (TMP006AcqStop() < 0)
+            IOBEAM_ERR("Sensor read stuck, aborted\r\n");
+        iobeam.SendQueued();
+err_acq:
         iobeam_Finish();
     }
 
@@ -0,0 +1,193 @@
+// Runs the TMP006 acquisition stage against the simulated hardware of
+// tmp006acq_sim.c, with an uploader that takes the samples out of the ring
+// between uploads of random length, and checks every sample it gets: ticks
+// in order, timestamps exactly one period apart, register values those of
+// the sensor when they were read, and every tick accounted for as a sample,
+// a drop, an overrun or an error. For comparison it also prints the
+// intervals the old loop, which read the sensor, uploaded and then waited a
+// period, would have had with the same uploads.
+//
+// See tmp006acq_sim.h for how to build it. Exits with 1 if a check fails.
+#include <stdio.h>
+
+#include "tmp006acq_sim.h"
+#include "../tmp006acq.h"
+#include "../tmp006drv.h"
+
+typedef struct
+{
+    const char *pcName;
+    unsigned long ulPeriodMs;
+    unsigned long ulSeconds;
+    unsigned long ulUploadMinMs;    // uploads take between these
+    unsigned long ulUploadMaxMs;
+    tTMP006SimConfig sSim;
+    int iLossExpected;              // whether ticks should be lost
+}
+tScenario;
+
+static const tScenario g_psScenarios[] =
+{
+    // A sample a second, uploads of up to 4 s over a slow link
+    { "steady", 1000, 600, 0, 4000, { 100, 50, 1000, 0 }, 0 },
+    // 50 samples a second, the ring holds more than the longest upload
+    { "fast", 20, 120, 0, 1000, { 100, 50, 250, 0 }, 0 },
+    // Uploads longer than the ring holds
+    { "stalled", 20, 120, 0, 5000, { 100, 50, 250, 0 }, 1 },
+    // A read of both registers takes longer than a period
+    { "slow bus", 20, 60, 0, 500, { 15000, 50, 250, 0 }, 1 },
+    // Every 7th register read fails
+    { "bus errors", 100, 120, 0, 2000, { 100, 50, 1000, 7 }, 1 },
+};
+
+static unsigned long g_ulRandom = 7;
+
+static unsigned long Random(void)
+{
+    g_ulRandom = g_ulRandom * 1103515245UL + 12345UL;
+    return (g_ulRandom >> 16) & 0x7FFF;
+}
+
+static unsigned long UploadMs(const tScenario *psScen)
+{
+    return psScen->ulUploadMinMs + (Random() << 15 | Random()) %
+            (psScen->ulUploadMaxMs - psScen->ulUploadMinMs + 1);
+}
+
+// Checks of the samples read in one scenario
+typedef struct
+{
+    unsigned long long ullStart;
+    unsigned long ulRead;
+    unsigned long ulLastTick;
+    unsigned long long ullLastTime;
+    unsigned long ulMinInterval;
+    unsigned long ulMaxInterval;
+    unsigned long ulBadOrder;
+    unsigned long ulBadTime;
+    unsigned long ulBadValue;
+    float fMinTemp;
+    float fMaxTemp;
+}
+tChecks;
+
+static void CheckSample(const tScenario *psScen, tChecks *psChecks,
+                        const tTMP006Sample *psSample)
+{
+    unsigned long long ullConvUs = psScen->sSim.ulConversionMs * 1000ULL;
+    unsigned long long ullTimeUs = psSample->ullTime * 1000;
+    unsigned long ulInterval;
+    float fObj, fAmb;
+
+    if (psChecks->ulRead > 0) {
+        if (psSample->ulTick <= psChecks->ulLastTick) {
+            psChecks->ulBadOrder++;
+        } else {
+            ulInterval = (unsigned long)
+                    (psSample->ullTime - psChecks->ullLastTime) /
+                    (psSample->ulTick - psChecks->ulLastTick);
+            if (ulInterval < psChecks->ulMinInterval)
+                psChecks->ulMinInterval = ulInterval;
+            if (ulInterval > psChecks->ulMaxInterval)
+                psChecks->ulMaxInterval = ulInterval;
+        }
+    }
+    if (psSample->ullTime != psChecks->ullStart +
+            (psSample->ulTick + 1ULL) * psScen->ulPeriodMs) {
+        psChecks->ulBadTime++;
+    }
+
+    // The voltage is read one transfer after the tick, the ambient
+    // temperature two
+    if (psSample->usVObject != TMP006SimVObject((unsigned long)
+            ((ullTimeUs + psScen->sSim.ulI2CUs) / ullConvUs)) ||
+        psSample->usTAmbient != TMP006SimTAmbient((unsigned long)
+            ((ullTimeUs + 2 * psScen->sSim.ulI2CUs) / ullConvUs))) {
+        psChecks->ulBadValue++;
+    }
+
+    TMP006DrvComputeTemps(psSample->usVObject, psSample->usTAmbient,
+                          &fObj, &fAmb);
+    if (psChecks->ulRead == 0 || fObj < psChecks->fMinTemp)
+        psChecks->fMinTemp = fObj;
+    if (psChecks->ulRead == 0 || fObj > psChecks->fMaxTemp)
+        psChecks->fMaxTemp = fObj;
+
+    psChecks->ulRead++;
+    psChecks->ulLastTick = psSample->ulTick;
+    psChecks->ullLastTime = psSample->ullTime;
+}
+
+static int RunScenario(const tScenario *psScen)
+{
+    tChecks sChecks = { 0 };
+    tTMP006AcqStats sStats;
+    tTMP006Sample sSample;
+    unsigned long ulPollMin = ~0UL, ulPollMax = 0, ulPoll;
+    unsigned long ulLost;
+    int iOk;
+
+    TMP006SimReset(&psScen->sSim);
+    if (TMP006DrvOpen() != 0) {
+        printf("%-10s  sensor did not open\n", psScen->pcName);
+        return 0;
+    }
+
+    sChecks.ullStart = TMP006SimNow();
+    sChecks.ulMinInterval = ~0UL;
+    TMP006AcqStart(psScen->ulPeriodMs);
+    while (TMP006SimNow() - sChecks.ullStart <
+           psScen->ulSeconds * 1000ULL) {
+        while (TMP006AcqRead(&sSample))
+            CheckSample(psScen, &sChecks, &sSample);
+
+        // The old loop: read, upload, wait a period
+        ulPoll = UploadMs(psScen);
+        TMP006SimRun(ulPoll > 0 ? ulPoll : 1);
+        ulPoll += psScen->ulPeriodMs +
+                  (2 * psScen->sSim.ulI2CUs + 999) / 1000;
+        if (ulPoll < ulPollMin)
+            ulPollMin = ulPoll;
+        if (ulPoll > ulPollMax)
+            ulPollMax = ulPoll;
+    }
+    if (TMP006AcqStop() != 0)
+        printf("%-10s  stop timed out\n", psScen->pcName);
+    while (TMP006AcqRead(&sSample))
+        CheckSample(psScen, &sChecks, &sSample);
+
+    TMP006AcqGetStats(&sStats);
+    ulLost = sStats.ulDropped + sStats.ulOverruns + sStats.ulErrors;
+    iOk = sStats.ulTicks == sStats.ulSamples + ulLost &&
+          sChecks.ulRead == sStats.ulSamples &&
+          sChecks.ulBadOrder == 0 && sChecks.ulBadTime == 0 &&
+          sChecks.ulBadValue == 0 &&
+          sChecks.ulMinInterval == psScen->ulPeriodMs &&
+          sChecks.ulMaxInterval == psScen->ulPeriodMs &&
+          (ulLost > 0) == psScen->iLossExpected;
+
+    printf("%-10s %6lu %6lu %7lu %8lu %6lu %5lu-%-5lu %5lu-%-5lu "
+           "%5.1f-%-5.1f %s\n",
+           psScen->pcName, sStats.ulTicks, sChecks.ulRead, sStats.ulDropped,
+           sStats.ulOverruns, sStats.ulErrors, sChecks.ulMinInterval,
+           sChecks.ulMaxInterval, ulPollMin, ulPollMax, sChecks.fMinTemp,
+           sChecks.fMaxTemp, iOk ? "ok" : "FAILED");
+    if (!iOk) {
+        printf("           order %lu, time %lu, value %lu wrong\n",
+               sChecks.ulBadOrder, sChecks.ulBadTime, sChecks.ulBadValue);
+    }
+    return iOk;
+}
+
+int main(void)
+{
+    unsigned int i;
+    int iOk = 1;
+
+    printf("%-10s %6s %6s %7s %8s %6s %11s %11s %11s\n", "", "ticks",
+           "read", "dropped", "overruns", "errors", "acq ms", "poll ms",
+           "obj F");
+    for (i = 0; i < sizeof(g_psScenarios) / sizeof(g_psScenarios[0]); i++)
+        iOk &= RunScenario(&g_psScenarios[i]);
+    return iOk ? 0 : 1;
+}
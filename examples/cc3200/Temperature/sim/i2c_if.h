@@ -0,0 +1,13 @@
+// Host stand-in for the CC3200 SDK's i2c_if.h, see tmp006acq_sim.h.
+#ifndef __I2C_IF_H__
+#define __I2C_IF_H__
+
+#define I2C_MASTER_MODE_STD     0
+#define I2C_MASTER_MODE_FST     1
+
+int I2C_IF_Open(unsigned long ulMode);
+int I2C_IF_ReadFrom(unsigned char ucDevAddr, unsigned char *pucWrDataBuf,
+                    unsigned char ucWrLen, unsigned char *pucRdDataBuf,
+                    unsigned char ucRdLen);
+
+#endif
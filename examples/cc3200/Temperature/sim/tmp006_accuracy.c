@@ -0,0 +1,152 @@
+// Checks the driver's fixed point conversion (ComputeTemperature() in
+// tmp006drv.c) against the floating point reference it replaced, for every
+// pair of register values with the ambient temperature in the sensor's
+// operating range, -40 to 125 C: all 65536 sensor voltages for each of the
+// 5281 ambient readings. It then times both.
+//
+// Build and run from examples/cc3200/Temperature:
+//
+//     cc -O2 -Isim -o tmp006_accuracy sim/tmp006_accuracy.c -lm
+//     ./tmp006_accuracy
+//
+// Exits with 1 if a reading is off by more than the bound for its range of
+// object temperatures. The error grows towards 0 K, where the fourth root
+// gets steep, so the coldest range is only reported. Readings the
+// reference cannot convert (it takes the fourth root of a negative number)
+// must come out as 0 K.
+#include <math.h>
+#include <stdio.h>
+#include <time.h>
+
+#include "../tmp006drv.c"
+
+#define BENCH_READINGS 2000000
+
+int I2C_IF_ReadFrom(unsigned char ucDevAddr, unsigned char *pucWrDataBuf,
+                    unsigned char ucWrLen, unsigned char *pucRdDataBuf,
+                    unsigned char ucRdLen)
+{
+    (void) ucDevAddr;
+    (void) pucWrDataBuf;
+    (void) ucWrLen;
+    (void) pucRdDataBuf;
+    (void) ucRdLen;
+    return -1;
+}
+
+// The conversion as it was, in C, but with the ambient temperature's
+// fraction kept (it used to be truncated to whole degrees).
+static double Reference(short sVObject, short sTAmbient)
+{
+    double dVobject = sVObject * 156.25e-9;
+    double Tdie2 = sTAmbient / 128.0 + 273.15;
+    const double S0 = 6.4E-14;            // Calibration factor
+    const double a1 = 1.75E-3;
+    const double a2 = -1.678E-5;
+    const double b0 = -2.94E-5;
+    const double b1 = -5.7E-7;
+    const double b2 = 4.63E-9;
+    const double c2 = 13.4;
+    const double Tref = 298.15;
+    double S = S0*(1+a1*(Tdie2 - Tref)+a2*pow((Tdie2 - Tref),2));
+    double Vos = b0 + b1*(Tdie2 - Tref) + b2*pow((Tdie2 - Tref),2);
+    double fObj = (dVobject - Vos) + c2*pow((dVobject - Vos),2);
+    double tObj = pow(pow(Tdie2,4) + (fObj/S),.25);
+    tObj = (tObj - 273.15);
+    return tObj;
+}
+
+static double Seconds(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Ranges of reference temperatures the error is reported over, in C, and
+// the most it may be in each (0 for none)
+static const double g_pdRanges[][3] =
+{
+    { -40, 125, 0.0001 },
+    { -100, 300, 0.0001 },
+    { -200, 400, 0.001 },
+    { -273.15, 400, 0 }
+};
+#define RANGES (sizeof(g_pdRanges) / sizeof(g_pdRanges[0]))
+
+int main(void)
+{
+    double pdMaxError[RANGES] = { 0 };
+    short psWorst[RANGES][2] = { { 0 } };
+    unsigned long pulCount[RANGES] = { 0 };
+    unsigned long ulInvalid = 0, ulBadInvalid = 0;
+    volatile double dSink = 0;
+    double dStart, dRef, dFixed;
+    unsigned int i;
+    long lAmb, lObj;
+    int iOk = 1;
+
+    for (lAmb = TAMBIENT_MIN; lAmb <= TAMBIENT_MAX; lAmb += 4) {
+        for (lObj = -32768; lObj <= 32767; lObj++) {
+            double dOut = ComputeTemperature((short) lObj, (short) lAmb) /
+                          65536.0 - KELVIN;
+            double dIn = Reference((short) lObj, (short) lAmb);
+            double dError = fabs(dOut - dIn);
+            if (isnan(dIn)) {
+                ulInvalid++;
+                if (dOut != -KELVIN)
+                    ulBadInvalid++;
+                continue;
+            }
+            for (i = 0; i < RANGES; i++) {
+                if (dIn < g_pdRanges[i][0] || dIn > g_pdRanges[i][1])
+                    continue;
+                pulCount[i]++;
+                if (dError > pdMaxError[i]) {
+                    pdMaxError[i] = dError;
+                    psWorst[i][0] = (short) lObj;
+                    psWorst[i][1] = (short) lAmb;
+                }
+            }
+        }
+    }
+
+    printf("%-18s %10s %12s %8s %15s\n", "object C", "readings",
+           "max error C", "bound", "worst at");
+    for (i = 0; i < RANGES; i++) {
+        printf("%7.2f to %-7.0f %10lu %12.6f %8.4f %7d, %-7d\n",
+               g_pdRanges[i][0], g_pdRanges[i][1], pulCount[i],
+               pdMaxError[i], g_pdRanges[i][2], psWorst[i][0],
+               psWorst[i][1]);
+        if (g_pdRanges[i][2] > 0 && pdMaxError[i] > g_pdRanges[i][2])
+            iOk = 0;
+    }
+    printf("%-18s %10lu, %lu not 0 K\n", "below 0 K", ulInvalid,
+           ulBadInvalid);
+    if (ulBadInvalid > 0)
+        iOk = 0;
+
+    // Readings of a room, with the ambient temperature changing now and
+    // then as it does, so the driver's ambient terms are mostly reused
+    printf("\n%-18s %10s\n", "", "ns/reading");
+    dStart = Seconds();
+    for (i = 0; i < BENCH_READINGS; i++)
+        dSink += Reference((short) (i % 2000 - 1000),
+                           (short) (3200 + (i >> 12) % 64 * 4));
+    dRef = (Seconds() - dStart) * 1e9 / BENCH_READINGS;
+    dStart = Seconds();
+    for (i = 0; i < BENCH_READINGS; i++)
+        dSink += ComputeTemperature((short) (i % 2000 - 1000),
+                                    (short) (3200 + (i >> 12) % 64 * 4));
+    dFixed = (Seconds() - dStart) * 1e9 / BENCH_READINGS;
+    printf("%-18s %10.1f\n%-18s %10.1f\n", "reference (double)", dRef,
+           "fixed point", dFixed);
+    dStart = Seconds();
+    for (i = 0; i < BENCH_READINGS; i++)
+        dSink += ComputeTemperature((short) (i % 2000 - 1000),
+                                    (short) (3200 + i % 64 * 4));
+    printf("%-18s %10.1f\n", "fixed, new ambient",
+           (Seconds() - dStart) * 1e9 / BENCH_READINGS);
+
+    return iOk ? 0 : 1;
+}
@@ -0,0 +1,174 @@
+// Host simulation of the TMP006 acquisition stage's hardware, see
+// tmp006acq_sim.h.
+#include "tmp006acq_sim.h"
+#include "i2c_if.h"
+#include "../tmp006acq.h"
+#include "../tmp006acq_hal.h"
+#include "../tmp006drv.h"
+
+#define NONE (~0ULL)
+
+#define TMP006_CONFIG_DEFAULT 0x7400
+
+static tTMP006SimConfig g_sConfig;
+static unsigned long long g_ullNowUs;
+static unsigned long g_ulRandom;
+
+// Timer: when it is next due, and when its interrupt runs
+static unsigned long g_ulPeriodUs;
+static unsigned long long g_ullTimerDueUs = NONE;
+static unsigned long long g_ullTimerRunUs = NONE;
+
+// Register read in progress
+static unsigned long long g_ullReadDoneUs = NONE;
+static unsigned char g_ucReadReg;
+static unsigned long g_ulReads;
+
+static unsigned long Random(void)
+{
+    g_ulRandom = g_ulRandom * 1103515245UL + 12345UL;
+    return (g_ulRandom >> 16) & 0x7FFF;
+}
+
+unsigned short TMP006SimVObject(unsigned long ulConversion)
+{
+    // Sweeps -62.5 uV to +62.5 uV, in steps of 97 LSB
+    return (unsigned short)(short)((long)(ulConversion * 97 % 801) - 400);
+}
+
+unsigned short TMP006SimTAmbient(unsigned long ulConversion)
+{
+    // 24 to 26 C in 1/32 C steps, left-justified by two bits
+    return (unsigned short)((24 * 32 + ulConversion % 64) << 2);
+}
+
+static unsigned short Register(unsigned char ucRegAddr)
+{
+    unsigned long ulConversion = (unsigned long)
+            (g_ullNowUs / (g_sConfig.ulConversionMs * 1000ULL));
+    switch (ucRegAddr) {
+    case TMP006_VOBJECT_REG_ADDR:
+        return TMP006SimVObject(ulConversion);
+    case TMP006_TAMBIENT_REG_ADDR:
+        return TMP006SimTAmbient(ulConversion);
+    case TMP006_CONFIG_REG_ADDR:
+        return TMP006_CONFIG_DEFAULT;
+    case TMP006_MANUFAC_ID_REG_ADDR:
+        return TMP006_MANUFAC_ID;
+    case TMP006_DEVICE_ID_REG_ADDR:
+        return TMP006_DEVICE_ID;
+    }
+    return 0;
+}
+
+static void ScheduleTimer(void)
+{
+    g_ullTimerDueUs += g_ulPeriodUs;
+    g_ullTimerRunUs = g_ullTimerDueUs + (g_sConfig.ulLatencyUs > 0 ?
+            Random() % (g_sConfig.ulLatencyUs + 1) : 0);
+}
+
+// Runs the next interrupt due by `ullUntilUs`, if any. Both interrupts run
+// at one priority, so they simply run in the order they are due.
+static int RunNext(unsigned long long ullUntilUs)
+{
+    if (g_ullReadDoneUs != NONE && g_ullReadDoneUs <= ullUntilUs &&
+            g_ullReadDoneUs <= g_ullTimerRunUs) {
+        g_ullNowUs = g_ullReadDoneUs;
+        g_ullReadDoneUs = NONE;
+        g_ulReads++;
+        if (g_sConfig.ulErrorEvery > 0 &&
+                g_ulReads % g_sConfig.ulErrorEvery == 0) {
+            TMP006AcqOnRead(-1, 0);
+        } else {
+            TMP006AcqOnRead(0, Register(g_ucReadReg));
+        }
+        return 1;
+    }
+    if (g_ullTimerRunUs != NONE && g_ullTimerRunUs <= ullUntilUs) {
+        g_ullNowUs = g_ullTimerRunUs;
+        ScheduleTimer();
+        TMP006AcqOnTimer(g_ullNowUs / 1000);
+        return 1;
+    }
+    return 0;
+}
+
+void TMP006SimReset(const tTMP006SimConfig *psConfig)
+{
+    g_sConfig.ulI2CUs = 100;
+    g_sConfig.ulLatencyUs = 50;
+    g_sConfig.ulConversionMs = 1000;
+    g_sConfig.ulErrorEvery = 0;
+    if (psConfig != 0) {
+        g_sConfig = *psConfig;
+        if (g_sConfig.ulConversionMs == 0)
+            g_sConfig.ulConversionMs = 1;
+    }
+    g_ullNowUs = 0;
+    g_ulRandom = 1;
+    g_ullTimerDueUs = NONE;
+    g_ullTimerRunUs = NONE;
+    g_ullReadDoneUs = NONE;
+    g_ulReads = 0;
+}
+
+void TMP006SimRun(unsigned long ulMs)
+{
+    unsigned long long ullUntilUs = g_ullNowUs + ulMs * 1000ULL;
+    while (RunNext(ullUntilUs))
+        ;
+    g_ullNowUs = ullUntilUs;
+}
+
+unsigned long long TMP006SimNow(void)
+{
+    return g_ullNowUs / 1000;
+}
+
+int TMP006AcqHalOpen(unsigned long ulPeriodMs)
+{
+    g_ulPeriodUs = ulPeriodMs * 1000;
+    g_ullTimerDueUs = g_ullNowUs;
+    ScheduleTimer();
+    return 0;
+}
+
+int TMP006AcqHalClose(void)
+{
+    g_ullTimerDueUs = NONE;
+    g_ullTimerRunUs = NONE;
+
+    // Like the target, let a read in progress finish; simulated reads
+    // always do
+    while (g_ullReadDoneUs != NONE)
+        RunNext(g_ullReadDoneUs);
+    return 0;
+}
+
+void TMP006AcqHalRead(unsigned char ucRegAddr)
+{
+    g_ucReadReg = ucRegAddr;
+    g_ullReadDoneUs = g_ullNowUs + g_sConfig.ulI2CUs;
+}
+
+int I2C_IF_Open(unsigned long ulMode)
+{
+    (void) ulMode;
+    return 0;
+}
+
+int I2C_IF_ReadFrom(unsigned char ucDevAddr, unsigned char *pucWrDataBuf,
+                    unsigned char ucWrLen, unsigned char *pucRdDataBuf,
+                    unsigned char ucRdLen)
+{
+    unsigned short usValue;
+    if (ucDevAddr != TMP006_DEV_ADDR || ucWrLen != 1 || ucRdLen != 2)
+        return -1;
+
+    g_ullNowUs += g_sConfig.ulI2CUs;
+    usValue = Register(pucWrDataBuf[0]);
+    pucRdDataBuf[0] = (unsigned char)(usValue >> 8);
+    pucRdDataBuf[1] = (unsigned char)usValue;
+    return 0;
+}
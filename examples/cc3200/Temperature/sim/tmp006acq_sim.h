@@ -0,0 +1,48 @@
+// Host simulation of the TMP006 acquisition stage's hardware, so that the
+// pipeline (tmp006acq.c and the driver's conversion) can be run and checked
+// on Linux.
+//
+// tmp006acq_sim.c implements tmp006acq_hal.h in virtual time: the timer
+// fires exactly every period, each register read finishes a set transfer
+// time after it is started, and a simulated TMP006 answers with register
+// values that change every conversion. It also stands in for the blocking
+// I2C_IF calls TMP006DrvOpen() makes, with the headers in this directory
+// standing in for the SDK's. Nothing happens between calls to
+// TMP006SimRun(), which is how the application's own work, e.g. an upload,
+// is simulated: it takes time during which only the interrupts run.
+//
+// Build and run from examples/cc3200/Temperature:
+//
+//     cc -O2 -Isim -o acq_sim sim/acq_sim.c sim/tmp006acq_sim.c
+//         tmp006acq.c tmp006drv.c -lm
+//     ./acq_sim
+//
+// The CCS project excludes this directory from the target build.
+#ifndef TMP006ACQ_SIM_H_
+#define TMP006ACQ_SIM_H_
+
+typedef struct
+{
+    unsigned long ulI2CUs;          // time a register read takes
+    unsigned long ulLatencyUs;      // most a timer interrupt is held off
+    unsigned long ulConversionMs;   // time between sensor conversions
+    unsigned long ulErrorEvery;     // every Nth read fails, 0 for none
+}
+tTMP006SimConfig;
+
+// Sets the simulated hardware up and its clock to 0. Reads of about 100 us
+// (four bytes at 400 kHz), interrupts held off up to 50 us and a conversion
+// a second are used unless configured otherwise.
+void TMP006SimReset(const tTMP006SimConfig *psConfig);
+
+// Lets `ulMs` of virtual time pass, running the interrupts due in it.
+void TMP006SimRun(unsigned long ulMs);
+
+// Virtual time, in ms.
+unsigned long long TMP006SimNow(void);
+
+// Register values of the sensor during conversion `ulConversion`.
+unsigned short TMP006SimVObject(unsigned long ulConversion);
+unsigned short TMP006SimTAmbient(unsigned long ulConversion);
+
+#endif
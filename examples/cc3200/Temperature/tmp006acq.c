@@ -0,0 +1,246 @@
+//*****************************************************************************
+// tmp006acq.c - Timer paced, interrupt driven TMP006 acquisition.
+//
+// Copyright (C) 2015 iobeam - https://www.iobeam.com
+//
+//*****************************************************************************
+
+//*****************************************************************************
+//
+//! \addtogroup iobeam
+//! @{
+//
+//*****************************************************************************
+#include <string.h>
+#include "tmp006acq.h"
+#include "tmp006acq_hal.h"
+#include "tmp006drv.h"
+
+//*****************************************************************************
+//                      MACRO DEFINITIONS
+//*****************************************************************************
+#define RING_MASK               (TMP006_ACQ_RING_LEN - 1)
+
+//
+// What the interrupts are doing
+//
+#define STATE_IDLE              0
+#define STATE_VOBJECT           1   // reading the sensor voltage
+#define STATE_TAMBIENT          2   // reading the ambient temperature
+
+//****************************************************************************
+//                      GLOBAL VARIABLES
+//****************************************************************************
+
+//
+// The ring. g_ulHead counts samples written, only by the I2C interrupt, and
+// g_ulTail samples read, only by the application; both run freely and wrap.
+// The slots are volatile so a sample is written in full before g_ulHead
+// moves past it.
+//
+static volatile tTMP006Sample g_psRing[TMP006_ACQ_RING_LEN];
+static volatile unsigned long g_ulHead;
+static volatile unsigned long g_ulTail;
+
+static volatile int g_iState = STATE_IDLE;
+static tTMP006Sample g_sPending;    // sample being read
+static volatile tTMP006AcqStats g_sStats;
+
+//****************************************************************************
+//
+//! Start acquiring samples
+//!
+//! \param ulPeriodMs is the time between samples, in ms
+//!
+//! This function
+//!    1. Empties the ring and clears the counters
+//!    2. Starts the timer; the first sample is taken one period later
+//!
+//! The sensor must have been opened with TMP006DrvOpen(). Until
+//! TMP006AcqStop() the I2C bus belongs to the acquisition stage.
+//!
+//! \return 0: Success, < 0: Failure.
+//
+//****************************************************************************
+int
+TMP006AcqStart(unsigned long ulPeriodMs)
+{
+    if(ulPeriodMs == 0)
+    {
+        return -1;
+    }
+
+    g_ulHead = 0;
+    g_ulTail = 0;
+    g_iState = STATE_IDLE;
+    memset((void *)&g_sStats, 0, sizeof(g_sStats));
+
+    return TMP006AcqHalOpen(ulPeriodMs);
+}
+
+//****************************************************************************
+//
+//! Stop acquiring samples
+//!
+//! Samples already in the ring can still be read.
+//!
+//! \return 0: Success, < 0: a read in progress did not finish, and was
+//!         aborted; the bus may need to be recovered before it is used.
+//
+//****************************************************************************
+int
+TMP006AcqStop(void)
+{
+    int iRet = TMP006AcqHalClose();
+    g_iState = STATE_IDLE;
+    return iRet;
+}
+
+//****************************************************************************
+//
+//! Take the oldest sample out of the ring
+//!
+//! \param psSample is the pointer to the sample store
+//!
+//! \return 1 if a sample was read, 0 if the ring is empty.
+//
+//****************************************************************************
+int
+TMP006AcqRead(tTMP006Sample *psSample)
+{
+    unsigned long ulTail = g_ulTail;
+    volatile tTMP006Sample *psSlot;
+
+    if(ulTail == g_ulHead)
+    {
+        return 0;
+    }
+
+    psSlot = &g_psRing[ulTail & RING_MASK];
+    psSample->ullTime = psSlot->ullTime;
+    psSample->ulTick = psSlot->ulTick;
+    psSample->usVObject = psSlot->usVObject;
+    psSample->usTAmbient = psSlot->usTAmbient;
+
+    //
+    // Only now may the slot be written again
+    //
+    g_ulTail = ulTail + 1;
+    return 1;
+}
+
+//****************************************************************************
+//
+//! Returns the number of samples waiting in the ring
+//
+//****************************************************************************
+unsigned long
+TMP006AcqAvailable(void)
+{
+    return g_ulHead - g_ulTail;
+}
+
+//****************************************************************************
+//
+//! Copies the counters since the start to \e psStats
+//
+//****************************************************************************
+void
+TMP006AcqGetStats(tTMP006AcqStats *psStats)
+{
+    psStats->ulTicks = g_sStats.ulTicks;
+    psStats->ulSamples = g_sStats.ulSamples;
+    psStats->ulDropped = g_sStats.ulDropped;
+    psStats->ulOverruns = g_sStats.ulOverruns;
+    psStats->ulErrors = g_sStats.ulErrors;
+}
+
+//****************************************************************************
+//
+//! Timer interrupt: starts reading a sample
+//!
+//! \param ullTime is the local time in ms when the timer fired
+//!
+//! \return None.
+//
+//****************************************************************************
+void
+TMP006AcqOnTimer(unsigned long long ullTime)
+{
+    unsigned long ulTick = g_sStats.ulTicks++;
+
+    if(g_iState != STATE_IDLE)
+    {
+        g_sStats.ulOverruns++;
+        return;
+    }
+
+    g_sPending.ullTime = ullTime;
+    g_sPending.ulTick = ulTick;
+    g_iState = STATE_VOBJECT;
+    TMP006AcqHalRead(TMP006_VOBJECT_REG_ADDR);
+}
+
+//****************************************************************************
+//
+//! I2C interrupt: a register read has finished
+//!
+//! \param iStatus is 0 if the read succeeded, < 0 if it failed
+//! \param usValue is the register value read
+//!
+//! This function
+//!    1. Reads the ambient temperature after the sensor voltage
+//!    2. Puts the sample in the ring once both are in, or drops it if the
+//!       ring is full
+//!
+//! \return None.
+//
+//****************************************************************************
+void
+TMP006AcqOnRead(int iStatus, unsigned short usValue)
+{
+    unsigned long ulHead;
+    volatile tTMP006Sample *psSlot;
+
+    if(iStatus < 0)
+    {
+        g_sStats.ulErrors++;
+        g_iState = STATE_IDLE;
+        return;
+    }
+
+    if(g_iState == STATE_VOBJECT)
+    {
+        g_sPending.usVObject = usValue;
+        g_iState = STATE_TAMBIENT;
+        TMP006AcqHalRead(TMP006_TAMBIENT_REG_ADDR);
+        return;
+    }
+    if(g_iState != STATE_TAMBIENT)
+    {
+        return;
+    }
+    g_sPending.usTAmbient = usValue;
+    g_iState = STATE_IDLE;
+
+    ulHead = g_ulHead;
+    if(ulHead - g_ulTail >= TMP006_ACQ_RING_LEN)
+    {
+        g_sStats.ulDropped++;
+        return;
+    }
+    psSlot = &g_psRing[ulHead & RING_MASK];
+    psSlot->ullTime = g_sPending.ullTime;
+    psSlot->ulTick = g_sPending.ulTick;
+    psSlot->usVObject = g_sPending.usVObject;
+    psSlot->usTAmbient = g_sPending.usTAmbient;
+    g_ulHead = ulHead + 1;
+    g_sStats.ulSamples++;
+}
+
+//*****************************************************************************
+//
+// Close the Doxygen group.
+//! @}
+//
+//*****************************************************************************
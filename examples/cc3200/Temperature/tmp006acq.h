@@ -0,0 +1,107 @@
+//*****************************************************************************
+// tmp006acq.h - Timer paced, interrupt driven TMP006 acquisition.
+//
+// Copyright (C) 2015 iobeam - https://www.iobeam.com
+//
+//*****************************************************************************
+
+#ifndef __TMP006ACQ_H__
+#define __TMP006ACQ_H__
+
+//*****************************************************************************
+//
+// If building with a C++ compiler, make all of the definitions in this header
+// have a C binding.
+//
+//*****************************************************************************
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+//*****************************************************************************
+//
+// The acquisition stage reads the sensor at a fixed rate set by a hardware
+// timer, whatever the application is doing. Each timer interrupt starts an
+// asynchronous read of the sensor voltage and then the ambient temperature
+// register, stepped from the I2C interrupt, and the finished sample goes
+// into a ring stamped with the time the timer fired. The application takes
+// samples out of the ring when it gets to it, e.g. between uploads, and
+// converts them with TMP006DrvComputeTemps().
+//
+// The ring has one writer (the I2C interrupt) and one reader (the
+// application), so neither has to disable interrupts. When it is full new
+// samples are dropped and counted. A tick that finds the previous read
+// still running is skipped and counted as an overrun. Each sample carries
+// its tick number, so gaps show up in the series.
+//
+// Only the hardware access is platform specific, see tmp006acq_hal.h. The
+// TMP006 converts once a second by default, so reading it faster than that
+// returns the same values more than once.
+//
+//*****************************************************************************
+
+//*****************************************************************************
+// Samples the ring holds; a power of two
+//*****************************************************************************
+#ifndef TMP006_ACQ_RING_LEN
+#define TMP006_ACQ_RING_LEN     64
+#endif
+
+typedef char tTMP006AcqRingCheck[
+        (TMP006_ACQ_RING_LEN & (TMP006_ACQ_RING_LEN - 1)) == 0 ? 1 : -1];
+
+//*****************************************************************************
+// One reading of the sensor
+//*****************************************************************************
+typedef struct
+{
+    unsigned long long ullTime;     // local ms when the timer fired
+    unsigned long ulTick;           // timer ticks since the start, from 0
+    unsigned short usVObject;       // sensor voltage register
+    unsigned short usTAmbient;      // ambient temperature register
+}
+tTMP006Sample;
+
+//*****************************************************************************
+// Counters since the start
+//*****************************************************************************
+typedef struct
+{
+    unsigned long ulTicks;          // timer interrupts
+    unsigned long ulSamples;        // samples put in the ring
+    unsigned long ulDropped;        // samples lost to a full ring
+    unsigned long ulOverruns;       // ticks skipped, a read still running
+    unsigned long ulErrors;         // failed reads
+}
+tTMP006AcqStats;
+
+//*****************************************************************************
+//
+// API Function prototypes
+//
+//*****************************************************************************
+int TMP006AcqStart(unsigned long ulPeriodMs);
+int TMP006AcqStop(void);
+int TMP006AcqRead(tTMP006Sample *psSample);
+unsigned long TMP006AcqAvailable(void);
+void TMP006AcqGetStats(tTMP006AcqStats *psStats);
+
+//*****************************************************************************
+//
+// Called by the HAL from interrupt context, see tmp006acq_hal.h
+//
+//*****************************************************************************
+void TMP006AcqOnTimer(unsigned long long ullTime);
+void TMP006AcqOnRead(int iStatus, unsigned short usValue);
+
+//*****************************************************************************
+//
+// Mark the end of the C bindings section for C++ compilers.
+//
+//*****************************************************************************
+#ifdef __cplusplus
+}
+#endif
+
+#endif //  __TMP006ACQ_H__
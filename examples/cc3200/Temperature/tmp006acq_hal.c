@@ -0,0 +1,278 @@
+//*****************************************************************************
+// tmp006acq_hal.c - CC3200 timer and I2C interrupts for the TMP006
+//                   acquisition stage.
+//
+// Copyright (C) 2015 iobeam - https://www.iobeam.com
+//
+//*****************************************************************************
+
+//*****************************************************************************
+//
+//! \addtogroup iobeam
+//! @{
+//
+//*****************************************************************************
+
+// Driverlib includes
+#include "hw_types.h"
+#include "hw_memmap.h"
+#include "hw_ints.h"
+#include "rom.h"
+#include "rom_map.h"
+#include "interrupt.h"
+#include "prcm.h"
+#include "timer.h"
+#include "i2c.h"
+
+#include "tmp006acq.h"
+#include "tmp006acq_hal.h"
+#include "tmp006drv.h"
+
+//*****************************************************************************
+//                      MACRO DEFINITIONS
+//*****************************************************************************
+#define SYS_CLK_HZ              80000000
+#define SLOW_CLK_HZ             32768
+#define ACQ_TIMER_BASE          TIMERA0_BASE
+#define ACQ_I2C_BASE            I2CA0_BASE
+
+//
+// Longest period the 32-bit timer can count at the system clock
+//
+#define MAX_PERIOD_MS           (0xFFFFFFFFUL / (SYS_CLK_HZ / 1000))
+
+//
+// The I2C master gives up on a transfer once SCL has been held low for
+// 16 times this many of its clock periods: 2000, 5 ms at 400 kHz.
+// A read takes about 100 us.
+//
+#define ACQ_I2C_TIMEOUT         0x7D
+
+//
+// Longest TMP006AcqHalClose() waits for a read in progress, well past the
+// master's own timeout
+//
+#define CLOSE_TIMEOUT_MS        20
+#define CLOSE_TIMEOUT_TICKS     ((CLOSE_TIMEOUT_MS * SLOW_CLK_HZ) / 1000)
+
+//
+// Both interrupts at one priority, so neither preempts the other
+//
+#define ACQ_INT_PRIORITY        INT_PRIORITY_LVL_1
+
+//
+// Steps of a register read: the register address is written, then the
+// bus turned around with a repeated start and two bytes read, MSB first
+//
+#define PHASE_IDLE              0
+#define PHASE_ADDR              1
+#define PHASE_MSB               2
+#define PHASE_LSB               3
+
+//****************************************************************************
+//                      GLOBAL VARIABLES
+//****************************************************************************
+static volatile int g_iPhase = PHASE_IDLE;
+static unsigned char g_ucMsb;
+
+//****************************************************************************
+//                      LOCAL FUNCTION DEFINITIONS
+//****************************************************************************
+static void TimerIntHandler(void);
+static void I2CIntHandler(void);
+
+
+//****************************************************************************
+//
+//! Timer interrupt handler: stamps and starts a sample
+//
+//****************************************************************************
+static void
+TimerIntHandler(void)
+{
+    MAP_TimerIntClear(ACQ_TIMER_BASE, TIMER_TIMA_TIMEOUT);
+
+    //
+    // Same clock as the iobeam client, see iobeam_TimeAt()
+    //
+    TMP006AcqOnTimer((PRCMSlowClkCtrGet() * 1000) / SLOW_CLK_HZ);
+}
+
+//****************************************************************************
+//
+//! I2C interrupt handler: steps the register read in progress
+//
+//****************************************************************************
+static void
+I2CIntHandler(void)
+{
+    unsigned long ulStatus = MAP_I2CMasterIntStatusEx(ACQ_I2C_BASE, true);
+    unsigned short usValue;
+
+    MAP_I2CMasterIntClearEx(ACQ_I2C_BASE, ulStatus);
+    if(g_iPhase == PHASE_IDLE)
+    {
+        return;
+    }
+
+    if((ulStatus & (I2C_MASTER_INT_NACK | I2C_MASTER_INT_TIMEOUT)) ||
+       MAP_I2CMasterErr(ACQ_I2C_BASE) != I2C_MASTER_ERR_NONE)
+    {
+        if(g_iPhase == PHASE_ADDR)
+        {
+            MAP_I2CMasterControl(ACQ_I2C_BASE,
+                                 I2C_MASTER_CMD_BURST_SEND_ERROR_STOP);
+        }
+        else
+        {
+            MAP_I2CMasterControl(ACQ_I2C_BASE,
+                                 I2C_MASTER_CMD_BURST_RECEIVE_ERROR_STOP);
+        }
+        g_iPhase = PHASE_IDLE;
+        TMP006AcqOnRead(-1, 0);
+        return;
+    }
+
+    switch(g_iPhase)
+    {
+    case PHASE_ADDR:
+        MAP_I2CMasterSlaveAddrSet(ACQ_I2C_BASE, TMP006_DEV_ADDR, true);
+        MAP_I2CMasterControl(ACQ_I2C_BASE, I2C_MASTER_CMD_BURST_RECEIVE_START);
+        g_iPhase = PHASE_MSB;
+        break;
+    case PHASE_MSB:
+        g_ucMsb = (unsigned char)MAP_I2CMasterDataGet(ACQ_I2C_BASE);
+        MAP_I2CMasterControl(ACQ_I2C_BASE,
+                             I2C_MASTER_CMD_BURST_RECEIVE_FINISH);
+        g_iPhase = PHASE_LSB;
+        break;
+    case PHASE_LSB:
+        usValue = (unsigned short)(g_ucMsb << 8) |
+                  (unsigned char)MAP_I2CMasterDataGet(ACQ_I2C_BASE);
+        g_iPhase = PHASE_IDLE;
+        TMP006AcqOnRead(0, usValue);
+        break;
+    }
+}
+
+//****************************************************************************
+//
+//! Start the sample timer and take over the I2C bus
+//!
+//! \param ulPeriodMs is the time between samples, in ms
+//!
+//! The I2C master must have been set up with I2C_IF_Open(). Timer A0 is
+//! used, as a periodic 32-bit timer on the system clock.
+//!
+//! \return 0: Success, < 0: Failure.
+//
+//****************************************************************************
+int
+TMP006AcqHalOpen(unsigned long ulPeriodMs)
+{
+    if(ulPeriodMs > MAX_PERIOD_MS)
+    {
+        return -1;
+    }
+
+    g_iPhase = PHASE_IDLE;
+    MAP_I2CMasterTimeoutSet(ACQ_I2C_BASE, ACQ_I2C_TIMEOUT);
+    MAP_I2CMasterIntClearEx(ACQ_I2C_BASE,
+                            MAP_I2CMasterIntStatusEx(ACQ_I2C_BASE, false));
+    MAP_I2CIntRegister(ACQ_I2C_BASE, I2CIntHandler);
+    MAP_IntPrioritySet(INT_I2CA0, ACQ_INT_PRIORITY);
+    MAP_I2CMasterIntEnableEx(ACQ_I2C_BASE, I2C_MASTER_INT_DATA |
+                             I2C_MASTER_INT_NACK | I2C_MASTER_INT_TIMEOUT);
+
+    MAP_PRCMPeripheralClkEnable(PRCM_TIMERA0, PRCM_RUN_MODE_CLK);
+    MAP_PRCMPeripheralReset(PRCM_TIMERA0);
+    MAP_TimerConfigure(ACQ_TIMER_BASE, TIMER_CFG_PERIODIC);
+    MAP_TimerPrescaleSet(ACQ_TIMER_BASE, TIMER_A, 0);
+    MAP_TimerLoadSet(ACQ_TIMER_BASE, TIMER_A,
+                     ulPeriodMs * (SYS_CLK_HZ / 1000));
+    MAP_TimerIntRegister(ACQ_TIMER_BASE, TIMER_A, TimerIntHandler);
+    MAP_IntPrioritySet(INT_TIMERA0A, ACQ_INT_PRIORITY);
+    MAP_TimerIntEnable(ACQ_TIMER_BASE, TIMER_TIMA_TIMEOUT);
+    MAP_TimerEnable(ACQ_TIMER_BASE, TIMER_A);
+
+    return 0;
+}
+
+//****************************************************************************
+//
+//! Stop the sample timer and give the I2C bus back
+//!
+//! A read in progress is let finish first, so the bus is left idle for
+//! blocking I2C_IF calls. The master's timeout normally ends a stuck read
+//! with an error; should the interrupt still not come, the transfer is
+//! aborted after CLOSE_TIMEOUT_MS.
+//!
+//! \return 0: Success, < 0: the read in progress was aborted.
+//
+//****************************************************************************
+int
+TMP006AcqHalClose(void)
+{
+    unsigned long long ullStart;
+    int iRet = 0;
+
+    MAP_TimerDisable(ACQ_TIMER_BASE, TIMER_A);
+    MAP_TimerIntDisable(ACQ_TIMER_BASE, TIMER_TIMA_TIMEOUT);
+    MAP_TimerIntUnregister(ACQ_TIMER_BASE, TIMER_A);
+    MAP_PRCMPeripheralClkDisable(PRCM_TIMERA0, PRCM_RUN_MODE_CLK);
+
+    ullStart = PRCMSlowClkCtrGet();
+    while(g_iPhase != PHASE_IDLE)
+    {
+        if(PRCMSlowClkCtrGet() - ullStart > CLOSE_TIMEOUT_TICKS)
+        {
+            break;
+        }
+    }
+    MAP_I2CMasterIntDisableEx(ACQ_I2C_BASE, I2C_MASTER_INT_DATA |
+                              I2C_MASTER_INT_NACK | I2C_MASTER_INT_TIMEOUT);
+    if(g_iPhase != PHASE_IDLE)
+    {
+        if(g_iPhase == PHASE_ADDR)
+        {
+            MAP_I2CMasterControl(ACQ_I2C_BASE,
+                                 I2C_MASTER_CMD_BURST_SEND_ERROR_STOP);
+        }
+        else
+        {
+            MAP_I2CMasterControl(ACQ_I2C_BASE,
+                                 I2C_MASTER_CMD_BURST_RECEIVE_ERROR_STOP);
+        }
+        g_iPhase = PHASE_IDLE;
+        iRet = -1;
+    }
+    MAP_I2CIntUnregister(ACQ_I2C_BASE);
+
+    return iRet;
+}
+
+//****************************************************************************
+//
+//! Start reading a sensor register
+//!
+//! \param ucRegAddr is the register address
+//!
+//! The first step, writing the address, is started here; the I2C
+//! interrupt does the rest and calls TMP006AcqOnRead() at the end.
+//
+//****************************************************************************
+void
+TMP006AcqHalRead(unsigned char ucRegAddr)
+{
+    g_iPhase = PHASE_ADDR;
+    MAP_I2CMasterSlaveAddrSet(ACQ_I2C_BASE, TMP006_DEV_ADDR, false);
+    MAP_I2CMasterDataPut(ACQ_I2C_BASE, ucRegAddr);
+    MAP_I2CMasterControl(ACQ_I2C_BASE, I2C_MASTER_CMD_BURST_SEND_START);
+}
+
+//*****************************************************************************
+//
+// Close the Doxygen group.
+//! @}
+//
+//*****************************************************************************
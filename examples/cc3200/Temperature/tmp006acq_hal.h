@@ -0,0 +1,44 @@
+//*****************************************************************************
+// tmp006acq_hal.h - Hardware access of the TMP006 acquisition stage.
+//
+// Copyright (C) 2015 iobeam - https://www.iobeam.com
+//
+//*****************************************************************************
+
+#ifndef __TMP006ACQ_HAL_H__
+#define __TMP006ACQ_HAL_H__
+
+//*****************************************************************************
+//
+// If building with a C++ compiler, make all of the definitions in this header
+// have a C binding.
+//
+//*****************************************************************************
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+//*****************************************************************************
+//
+// tmp006acq_hal.c implements these with the CC3200 timer and I2C
+// interrupts; sim/tmp006acq_sim.c simulates them on a host. The timer calls
+// TMP006AcqOnTimer() every period with the local time in ms, and each read
+// started ends with a call to TMP006AcqOnRead(). Both callbacks run at the
+// same interrupt priority, so neither preempts the other.
+//
+//*****************************************************************************
+int TMP006AcqHalOpen(unsigned long ulPeriodMs);
+int TMP006AcqHalClose(void);
+void TMP006AcqHalRead(unsigned char ucRegAddr);
+
+//*****************************************************************************
+//
+// Mark the end of the C bindings section for C++ compilers.
+//
+//*****************************************************************************
+#ifdef __cplusplus
+}
+#endif
+
+#endif //  __TMP006ACQ_HAL_H__
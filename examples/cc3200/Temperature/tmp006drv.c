@@ -41,15 +41,10 @@
 //
 //*****************************************************************************
 #include <stdio.h>
-#include <math.h>
 #include "tmp006drv.h"
 #include "i2c_if.h"
 #include "uart_if.h"
 
-//****************************************************************************
-//                      GLOBAL VARIABLES                                   
-//****************************************************************************
-
 //*****************************************************************************
 //                      MACRO DEFINITIONS
 //*****************************************************************************
@@ -60,12 +55,105 @@
                                      return  iRetVal;}
 #define DBG_PRINT               Report
 
+//
+// Calibration of the object temperature, from
+// http://processors.wiki.ti.com/index.php/SensorTag_User_Guide
+// #IR_Temperature_Sensor
+//
+#define CAL_S0                  6.4E-14     // Calibration factor
+#define CAL_A1                  1.75E-3
+#define CAL_A2                  -1.678E-5
+#define CAL_B0                  -2.94E-5
+#define CAL_B1                  -5.7E-7
+#define CAL_B2                  4.63E-9
+#define CAL_C2                  13.4
+#define TREF                    298.15
+#define KELVIN                  273.15
+
+//
+// Register units: 156.25 nV for the sensor voltage, 1/128 C for the
+// ambient temperature (a 14 bit reading of 1/32 C, shifted up by 2)
+//
+#define VOBJECT_LSB             156.25E-9
+#define TAMBIENT_PER_C          128
+
+//
+// Range of ambient temperatures the object temperature is computed for,
+// the TMP006's operating range
+//
+#define TAMBIENT_MIN            (-40 * TAMBIENT_PER_C)
+#define TAMBIENT_MAX            (125 * TAMBIENT_PER_C)
+
+//
+// Fixed point value of x with q fraction bits, rounded
+//
+#define FIX(x, q)               ((long long)((x) * (double)(1ULL << (q)) + \
+                                             ((x) < 0 ? -0.5 : 0.5)))
+
+//****************************************************************************
+//                      GLOBAL VARIABLES                                   
+//****************************************************************************
+
+//
+// Coefficients of the conversion in register units, as polynomials of the
+// ambient register's distance from TREF, with the fraction bits given
+//
+static const long long g_llVosB0 = FIX(CAL_B0 / VOBJECT_LSB, 32);
+static const long long g_llVosB1 = FIX(CAL_B1 / VOBJECT_LSB /
+                                       TAMBIENT_PER_C, 32);
+static const long long g_llVosB2 = FIX(CAL_B2 / VOBJECT_LSB /
+                                       (TAMBIENT_PER_C * TAMBIENT_PER_C), 40);
+static const long long g_llSA1 = FIX(CAL_A1 / TAMBIENT_PER_C, 40);
+static const long long g_llSA2 = FIX(CAL_A2 /
+                                     (TAMBIENT_PER_C * TAMBIENT_PER_C), 50);
+static const long long g_llC2 = FIX(CAL_C2 * VOBJECT_LSB, 40);
+static const long g_lKelvin = (long)FIX(KELVIN, 16);
+static const long g_lKelvinQ20 = (long)FIX(KELVIN, 20);
+static const long g_lTRef = (long)FIX((TREF - KELVIN) * TAMBIENT_PER_C, 0);
+
+//
+// Seeds of the inverse fourth root, ((i + 4.5) / 64)^(-1/4) in Q30
+//
+static const unsigned long g_pulRootSeed[60] =
+{
+    0x7C493052, 0x76345F31, 0x715E9E58, 0x6D62AE66, 0x6A0405BA, 0x671BC064,
+    0x648F803F, 0x624CA025, 0x60457D0A, 0x5E6FD5DF, 0x5CC3C67E, 0x5B3B1D6A,
+    0x59D0E90F, 0x58812848, 0x574891E9, 0x56246BD7, 0x55126CC9, 0x5410A58E,
+    0x531D6FBF, 0x5237605A, 0x515D3D4A, 0x508DF51F, 0x4FC89873, 0x4F0C548E,
+    0x4E586F18, 0x4DAC4282, 0x4D073B1E, 0x4C68D4A9, 0x4BD09843, 0x4B3E1AB6,
+    0x4AB0FB03, 0x4A28E126, 0x49A57D04, 0x49268588, 0x48ABB7D6, 0x4834D6A3,
+    0x47C1A999, 0x4751FCD6, 0x46E5A079, 0x467C683D, 0x46162B20, 0x45B2C315,
+    0x45520CBC, 0x44F3E726, 0x4498339E, 0x443ED576, 0x43E7B1DE, 0x4392AFB8,
+    0x433FB779, 0x42EEB305, 0x429F8D96, 0x4252339E, 0x420692B2, 0x41BC9971,
+    0x41743775, 0x412D5D3E, 0x40E7FC23, 0x40A40642, 0x40616E73, 0x4020283C
+};
+
+//
+// 4 * VOBJECT_LSB / S0, exactly: K^4 per register unit, in Q2
+//
+#define LSB_PER_S0_Q2           9765625LL
+
+//
+// The terms of the conversion that depend only on the ambient temperature,
+// for the last reading. It changes slowly, so they seldom need working out.
+//
+static struct
+{
+    int iValid;
+    short sTAmbient;
+    long long llVos;                // offset voltage, register units Q16
+    unsigned long ulInvS;           // S0 / S, Q31
+    long long llTDie4;              // die temperature ^ 4, K^4 Q16
+}
+g_sAmbientTerms;
+
 //****************************************************************************
 //                      LOCAL FUNCTION DEFINITIONS                          
 //****************************************************************************
 static int GetRegisterValue(unsigned char ucRegAddr, 
                             unsigned short *pusRegValue);
-static double ComputeTemperature(double dVobject, double dTAmbient);
+static unsigned long FourthRoot(unsigned long long ullValue);
+static unsigned long ComputeTemperature(short sVObject, short sTAmbient);
 
 
 //****************************************************************************
@@ -150,39 +238,133 @@ TMP006DrvOpen()
 }
 //****************************************************************************
 //
-//! Compute the temperature value from the sensor voltage and die temp.
+//! Returns the fourth root of \e ullValue, both in Q16
+//!
+//! \e ullValue is scaled by a power of 16 to m in [1/16, 1), whose inverse
+//! fourth root q is refined from the table by Newton's method,
+//! q' = q * (5 - m * q^4) / 4, which needs no division. The root is then
+//! m * q^3, scaled back.
+//
+//****************************************************************************
+static unsigned long
+FourthRoot(unsigned long long ullValue)
+{
+    unsigned long long ullM, ullQ, ullQ2;
+    unsigned int uiShift = 0;
+    int i;
+
+    if(ullValue == 0)
+    {
+        return 0;
+    }
+    while((ullValue >> 60) == 0)
+    {
+        ullValue <<= 4;
+        uiShift++;
+    }
+
+    //
+    // m in Q32, q in Q30
+    //
+    ullM = ullValue >> 32;
+    ullQ = g_pulRootSeed[(ullM >> 26) - 4];
+    for(i = 0; i < 3; i++)
+    {
+        ullQ2 = (ullQ * ullQ) >> 32;
+        ullQ = (ullQ * ((5ULL << 28) -
+                        ((ullM * ((ullQ2 * ullQ2) >> 28)) >> 32))) >> 30;
+    }
+    ullQ2 = (ullQ * ullQ) >> 32;
+
+    //
+    // m^(1/4) in Q32, and (value * 2^(4 * shift))^(1/4) = 2^16 m^(1/4)
+    //
+    return (unsigned long)(((ullM * ((ullQ2 * ullQ) >> 28)) >> 30) >>
+                           (uiShift + 4));
+}
+
+//****************************************************************************
+//
+//! Compute the object temperature from the sensor voltage and die temp.
 //!
-//! \param dVobject is the sensor voltage value
-//! \param dTAmbient is the local die temperature
+//! \param sVObject is the sensor voltage register value
+//! \param sTAmbient is the ambient temperature register value
 //! 
 //! This function  
-//!    1. Computes the temperature from the VObject and TAmbient values
+//!    1. Computes the temperature from the VObject and TAmbient values, in
+//!       fixed point, as the Cortex-M4 of the CC3200 has no FPU
 //!
-//! \return 0: Success, < 0: Failure.
+//! The terms that depend only on the ambient temperature are kept for the
+//! next reading. Ambient temperatures outside the sensor's operating range
+//! are taken as its nearest end. Readings that would be colder than 0 K
+//! give 0. sim/tmp006_accuracy.c checks the result against the floating
+//! point reference for every pair of register values in that range.
+//!
+//! \return The object temperature in K, Q16.
 //
 //****************************************************************************
-double ComputeTemperature(double dVobject, double dTAmbient)
+static unsigned long
+ComputeTemperature(short sVObject, short sTAmbient)
 {
+    long long llDiff, llX, llCX, llF, llT4;
+    long lTDie;
+    unsigned long ulTDie2;
+
+    if(sTAmbient < TAMBIENT_MIN)
+    {
+        sTAmbient = TAMBIENT_MIN;
+    }
+    if(sTAmbient > TAMBIENT_MAX)
+    {
+        sTAmbient = TAMBIENT_MAX;
+    }
+
+    if(!g_sAmbientTerms.iValid || g_sAmbientTerms.sTAmbient != sTAmbient)
+    {
+        llDiff = sTAmbient - g_lTRef;
+
+        //
+        // Vos = B0 + B1 * dT + B2 * dT^2
+        //
+        g_sAmbientTerms.llVos = (g_llVosB0 + g_llVosB1 * llDiff +
+                                 ((g_llVosB2 * llDiff * llDiff) >> 8)) >> 16;
+
+        //
+        // S = S0 * (1 + A1 * dT + A2 * dT^2), kept as S0 / S
+        //
+        g_sAmbientTerms.ulInvS = (unsigned long)((1ULL << 61) /
+                                 (unsigned long long)((1LL << 30) +
+                                 ((g_llSA1 * llDiff) >> 10) +
+                                 ((g_llSA2 * llDiff * llDiff) >> 20)));
+
+        lTDie = (long)sTAmbient * ((1L << 20) / TAMBIENT_PER_C) +
+                g_lKelvinQ20;
+        ulTDie2 = (unsigned long)(((long long)lTDie * lTDie) >> 28);
+        g_sAmbientTerms.llTDie4 = ((long long)ulTDie2 * ulTDie2) >> 8;
+
+        g_sAmbientTerms.sTAmbient = sTAmbient;
+        g_sAmbientTerms.iValid = 1;
+    }
+
     //
-    // This algo is obtained from 
-    // http://processors.wiki.ti.com/index.php/SensorTag_User_Guide
-    // #IR_Temperature_Sensor
-    //
-    double Tdie2 = dTAmbient + 273.15;
-    const double S0 = 6.4E-14;            // Calibration factor
-    const double a1 = 1.75E-3;
-    const double a2 = -1.678E-5;
-    const double b0 = -2.94E-5;
-    const double b1 = -5.7E-7;
-    const double b2 = 4.63E-9;
-    const double c2 = 13.4;
-    const double Tref = 298.15;
-    double S = S0*(1+a1*(Tdie2 - Tref)+a2*pow((Tdie2 - Tref),2));
-    double Vos = b0 + b1*(Tdie2 - Tref) + b2*pow((Tdie2 - Tref),2);
-    double fObj = (dVobject - Vos) + c2*pow((dVobject - Vos),2);
-    double tObj = pow(pow(Tdie2,4) + (fObj/S),.25);
-    tObj = (tObj - 273.15);
-    return tObj;
+    // f = (Vobj - Vos) + C2 * (Vobj - Vos)^2, register units Q16
+    //
+    llX = ((long long)sVObject << 16) - g_sAmbientTerms.llVos;
+    llCX = (llX * g_llC2) >> 24;
+    llF = llX + ((llCX * llX) >> 32);
+
+    //
+    // Tobj^4 = Tdie^4 + f / S, K^4 Q16
+    //
+    llT4 = g_sAmbientTerms.llTDie4 +
+           ((((llF * (long long)g_sAmbientTerms.ulInvS) >> 25) *
+             LSB_PER_S0_Q2) >> 8);
+    if(llT4 <= 0)
+    {
+        return 0;
+    }
+
+    return FourthRoot((unsigned long long)llT4);
 }
 
 //****************************************************************************
@@ -192,17 +374,37 @@ double ComputeTemperature(double dVobject, double dTAmbient)
 //! \param pfCurrTemp is the pointer to the temperature value store
 //! 
 //! This function  
-//!    1. Get the sensor voltage reg and ambient temp reg values
-//!    2. Compute the temperature from the read values
+//!    1. Get the object temperature, see TMP006DrvGetTemps()
 //!
 //! \return 0: Success, < 0: Failure.
 //
 //****************************************************************************
 int 
 TMP006DrvGetTemp(float *pfCurrTemp)
+{
+    float fAmbTemp;
+    return TMP006DrvGetTemps(pfCurrTemp, &fAmbTemp);
+}
+
+//****************************************************************************
+//
+//! Get the object and ambient temperature values from one read
+//!
+//! \param pfObjTemp is the pointer to the object temperature value store
+//! \param pfAmbTemp is the pointer to the ambient (die) temperature value
+//!        store
+//! 
+//! This function  
+//!    1. Get the sensor voltage reg and ambient temp reg values
+//!    2. Compute the temperatures from the read values, in Farenheit
+//!
+//! \return 0: Success, < 0: Failure.
+//
+//****************************************************************************
+int 
+TMP006DrvGetTemps(float *pfObjTemp, float *pfAmbTemp)
 {
     unsigned short usVObjectRaw, usTAmbientRaw;
-    double dVObject, dTAmbient;
     //
     // Get the sensor voltage register value
     //
@@ -211,20 +413,47 @@ TMP006DrvGetTemp(float *pfCurrTemp)
     // Get the ambient temperature register value
     //
     RET_IF_ERR(GetRegisterValue(TMP006_TAMBIENT_REG_ADDR, &usTAmbientRaw));
-    //
-    // Apply the format conversion
-    //
-    dVObject = ((short)usVObjectRaw) * 156.25e-9;
-    dTAmbient = ((short)usTAmbientRaw) / 128;
 
-    *pfCurrTemp = ComputeTemperature(dVObject, dTAmbient);
-    
+    TMP006DrvComputeTemps(usVObjectRaw, usTAmbientRaw, pfObjTemp, pfAmbTemp);
+
+    return SUCCESS;
+}
+
+//****************************************************************************
+//
+//! Compute the object and ambient temperature values from register values
+//!
+//! \param usVObjectRaw is the sensor voltage register value
+//! \param usTAmbientRaw is the ambient temperature register value
+//! \param pfObjTemp is the pointer to the object temperature value store
+//! \param pfAmbTemp is the pointer to the ambient (die) temperature value
+//!        store
+//! 
+//! This function  
+//!    1. Computes the temperatures from register values read earlier, e.g.
+//!       by the acquisition stage (see tmp006acq.h), in Farenheit
+//!
+//! \return None.
+//
+//****************************************************************************
+void
+TMP006DrvComputeTemps(unsigned short usVObjectRaw,
+                      unsigned short usTAmbientRaw,
+                      float *pfObjTemp, float *pfAmbTemp)
+{
+    long lObjTemp, lAmbTemp;
+
     //
-    // Convert to Farenheit
+    // Convert to Farenheit, in Q16
     //
-    *pfCurrTemp = ((*pfCurrTemp * 9) / 5) + 32;
+    lObjTemp = (long)ComputeTemperature((short)usVObjectRaw,
+                                        (short)usTAmbientRaw) - g_lKelvin;
+    lObjTemp = (lObjTemp * 9) / 5 + (32L << 16);
+    lAmbTemp = ((long)(short)usTAmbientRaw * (65536 / TAMBIENT_PER_C) * 9) /
+               5 + (32L << 16);
 
-    return SUCCESS;
+    *pfObjTemp = (float)lObjTemp * (1.0f / 65536);
+    *pfAmbTemp = (float)lAmbTemp * (1.0f / 65536);
 }
 //*****************************************************************************
 //
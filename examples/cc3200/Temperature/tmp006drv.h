@@ -74,6 +74,10 @@ extern "C"
 //*****************************************************************************
 int TMP006DrvOpen();
 int TMP006DrvGetTemp(float *pfCurrTemp);
+int TMP006DrvGetTemps(float *pfObjTemp, float *pfAmbTemp);
+void TMP006DrvComputeTemps(unsigned short usVObjectRaw,
+                           unsigned short usTAmbientRaw,
+                           float *pfObjTemp, float *pfAmbTemp);
 
 //*****************************************************************************
 //
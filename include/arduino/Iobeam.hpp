@@ -16,19 +16,41 @@
 #define DEBUG_LEVEL 0
 #endif
 
+#include "IobeamConfig.h"
 #include "../iobeam_log.h"
 #include "../iobeam_common.h"
+#include "../iobeam_clock.h"
+#include "../iobeam_fmt.h"
+#include "../iobeam_import.h"
+#include "../iobeam_agg.h"
+#include "../iobeam_filter.h"
+#include "../iobeam_series.h"
+#include "../iobeam_queue.h"
+#include "../iobeam_limit.h"
+#include "../iobeam_batch.h"
+#include "../iobeam_stats.h"
+#include "../iobeam_trace.h"
+#include "../iobeam_sched.h"
 
 
 #undef RESOURCE_GET_TIME
 
-// PROGMEM these long strings to save RAM space.
-PROGMEM const char importStart[] = {
-    "{\"device_id\":\"%s\",\"project_id\":%"PRIu32",\"sources\":[{\"name\":\"%s\","
-    "\"data\":[{\"time\":%"PRIu32"%03"PRIu32",\"value\":"
-};
-PROGMEM const char importInt[] = {"%d}]}]}"};
-PROGMEM const char importFloat[] = {"%d.%d}]}]}"};
+// Size of the buffer that gathers small writes (e.g. headers and PROGMEM
+// constants) into larger ones to the client.
+#ifndef IOBEAM_CHUNK_LEN
+#define IOBEAM_CHUNK_LEN 64
+#endif
+
+// Fixed segments of an import body (see iobeam_import.h), kept in PROGMEM
+// to save RAM. Their lengths are known at compile time, so only the
+// variable fields between them are formatted on each send.
+PROGMEM const char importDevice[] = IMPORT_JSON_DEVICE;
+PROGMEM const char importProject[] = IMPORT_JSON_PROJECT;
+PROGMEM const char importName[] = IMPORT_JSON_SOURCES IMPORT_JSON_NAME;
+PROGMEM const char importTime[] = IMPORT_JSON_DATA IMPORT_JSON_TIME;
+PROGMEM const char importValue[] = IMPORT_JSON_VALUE;
+PROGMEM const char importEnd[] =
+    IMPORT_JSON_POINT_END IMPORT_JSON_SOURCE_END IMPORT_JSON_END;
 PROGMEM const char addDeviceJson[] = ADD_DEVICE_JSON;
 
 PROGMEM const char IOBEAM_MEM_PREFIX[] = "iobeamid";
@@ -64,12 +86,202 @@ public:
 
     // Fetches global timestamp from iobeam, starts tracking time.
     bool startTimeKeeping();
+    void setClockTolerance(uint32_t msec)
+    {
+        mClock.tolerance = msec;
+    }
+    int persistClock(unsigned int memoryOffset);
+    // Whether to also sync the clock from the `Date` header of imports.
+    void setDateSync(bool enabled)
+    {
+        mDateSync = enabled;
+    }
     int registerDevice(unsigned int memoryOffset);
     bool send(char *key, Timeval& timestamp, double value);
     bool send(char *key, Timeval& timestamp, int value);
     bool send(char *key, double value);
     bool send(char *key, int value);
 
+#if IOBEAM_SERIES_MAX > 0
+    // Handle of a series registered with `addSeries()`.
+    typedef int8_t Series;
+
+    // Registers the series `name` for sending by handle, checking and
+    // escaping the name once here rather than on every send. Returns -1 if
+    // the name is invalid or the table (IOBEAM_SERIES_MAX) is full.
+    Series addSeries(const char *name);
+    bool send(Series series, Timeval& timestamp, double value);
+    bool send(Series series, Timeval& timestamp, int value);
+    bool send(Series series, double value);
+    bool send(Series series, int value);
+#endif
+
+#if IOBEAM_QUEUE_LEN > 0
+    // Queues a point of a registered series to be sent by `sendQueued()`, with
+    // the others queued, in one request. Returns the pressure on the queue
+    // (IOBEAM_PRESSURE_*), so you can slow down before it overflows, or -1
+    // if the point was not queued.
+    int enqueue(Series series, Timeval& timestamp, double value);
+    int enqueue(Series series, Timeval& timestamp, int value);
+    int enqueue(Series series, double value);
+    int enqueue(Series series, int value);
+    // Sends the queued points, keeping them queued if that fails.
+    bool sendQueued();
+    // Sends the queued points if the batch is due and a request is allowed,
+    // see `setAdaptiveBatching()`. Call it regularly, so points do not wait
+    // past their latency when no new ones come.
+    bool sendDue();
+
+    // Queues a point of a registered series in the class `priority`,
+    // IOBEAM_PRIORITY_*. Bulk points wait for `sendQueued()`. Urgent points
+    // go ahead of them and are sent at once, on their own, or with the
+    // first request the rate limit allows. Returns false if the point was
+    // not queued, or was urgent and could not be sent yet.
+    bool send(Series series, Timeval& timestamp, double value,
+        uint8_t priority);
+    bool send(Series series, Timeval& timestamp, int value, uint8_t priority);
+    bool send(Series series, double value, uint8_t priority);
+    bool send(Series series, int value, uint8_t priority);
+
+    // What `enqueue()` does once the queue is full, IOBEAM_QUEUE_DROP_OLDEST
+    // by default; see iobeam_queue.h.
+    void setQueuePolicy(uint8_t policy)
+    {
+        mQueue.policy = policy;
+    }
+    void setQueueWatermarks(uint16_t high, uint16_t low,
+        IobeamPressureCallback callback, void *ctx)
+    {
+        iobeam_QueueSetWatermarks(&mQueue, high, low, callback, ctx);
+    }
+    // The send queue, for its pressure and counts of points shed.
+    const IobeamQueue& queue() const
+    {
+        return mQueue;
+    }
+
+    // Limits requests to one every `periodMs`, in bursts of up to `burst`.
+    // With a period of 0, the default, only a 429's `Retry-After` applies.
+    // While requests are held back, `send()` queues points of registered
+    // series (and of keys, which are then registered), so they go out in
+    // one import once a request is allowed.
+    void setRateLimit(uint32_t periodMs, uint16_t burst)
+    {
+        iobeam_LimiterInit(&mLimiter, periodMs, burst);
+    }
+    // The rate limiter, for how many requests it has held back.
+    const IobeamLimiter& limiter() const
+    {
+        return mLimiter;
+    }
+
+    // Batches points passed to `send()`, queueing them until the batch the
+    // link's measured round trip and throughput call for is due (see
+    // iobeam_batch.h). Points wait at most `maxLatencyMs`, and requests
+    // should keep the link busy about `dutyPercent` of the time. A latency
+    // of 0, the default, sends every point as it comes.
+    void setAdaptiveBatching(uint32_t maxLatencyMs, uint8_t dutyPercent)
+    {
+        iobeam_BatcherInit(&mBatcher, maxLatencyMs,
+            IOBEAM_QUEUE_LEN - IOBEAM_QUEUE_LEN / 4, dutyPercent);
+    }
+    // The batch controller, for its estimates of the link and batch size.
+    const IobeamBatcher& batcher() const
+    {
+        return mBatcher;
+    }
+#endif
+
+    // Sends the `n` values of a row (see iobeam_import.h), all taken at
+    // the same time, in one import with a series per field.
+    bool sendRow(const IobeamField *fields, size_t n);
+    bool sendRow(Timeval& timestamp, const IobeamField *fields, size_t n);
+
+    // Sends a block of `n` samples of series `key` in one import, with a
+    // timestamp (in ms) per sample, or regularly spaced every `period` ms
+    // from `start`. The body is streamed through the scratch buffer, so
+    // blocks of any size can be sent.
+    bool sendArray(const char *key, const uint64_t *timestamps,
+        const int32_t *values, size_t n);
+    bool sendArray(const char *key, const uint64_t *timestamps,
+        const float *values, size_t n);
+    bool sendArray(const char *key, Timeval& start, uint32_t period,
+        const int32_t *values, size_t n);
+    bool sendArray(const char *key, Timeval& start, uint32_t period,
+        const float *values, size_t n);
+
+    // Adds a sample to the windowed aggregates `agg` of series `key`, see
+    // iobeam_agg.h. When it finishes a window, that window's aggregates
+    // are sent, each as a series named `key` plus a suffix (e.g.
+    // "temp_max"). Returns false only if that send fails.
+    bool sendAggregated(const char *key, IobeamAgg& agg, double value);
+    // Sends the aggregates of a finished window.
+    bool sendAggregate(const char *key, const IobeamAggResult& r);
+    // Sends the aggregates of the unfinished window of `agg`, if any.
+    bool flushAggregate(const char *key, IobeamAgg& agg);
+
+    // Adds a sample to the change detection filter `f` of series `key`,
+    // see iobeam_filter.h, and sends the samples it passes. Returns false
+    // only if that send fails.
+    bool sendFiltered(const char *key, IobeamFilter& f, double value);
+    // Sends the sample `f` is holding back, if any.
+    bool flushFiltered(const char *key, IobeamFilter& f);
+
+    // Whether the last send of a row, array, aggregate or filtered samples
+    // failed only because the rate limiter held it back, or the server
+    // answered with a 429. Nothing was sent or lost, so the same call can
+    // be made again later; filters and aggregates are left as they were.
+    // Single points are queued instead, and only set this if their key
+    // cannot be added as a series, or one refused with a 429 cannot be
+    // queued.
+    bool retryable() const
+    {
+        return mRetry;
+    }
+
+    // Request statistics since `init()` or the last `resetStats()`. They
+    // are kept up to date as requests run, so reading them is free.
+    const IobeamStats& stats() const
+    {
+        return mStats;
+    }
+    void resetStats()
+    {
+        iobeam_StatsInit(&mStats);
+    }
+
+#if IOBEAM_SCHED_MAX > 0
+    // Adds a task for `runTasks()` to step, see iobeam_sched.h: `run` is
+    // called with `arg` for a job every `period` ms, which should be done
+    // within `deadline` ms (0 for the period, IOBEAM_TASK_BACKGROUND for
+    // none). Returns the task's index, or -1 if IOBEAM_SCHED_MAX are added.
+    int addTask(IobeamTaskFn run, void *arg, uint32_t period,
+        uint32_t deadline = 0)
+    {
+        return iobeam_SchedAdd(&mTasks, run, arg, period, deadline);
+    }
+    // Runs one step of the most urgent task ready, among them the client's
+    // own background tasks that send queued points once they are due and
+    // resync the clock before it drifts past its tolerance. Call it from
+    // `loop()` instead of waiting with `delay()`. Returns the ms until a
+    // task is next ready if none was, which it is safe to sleep for.
+    uint32_t runTasks()
+    {
+        return iobeam_SchedRun(&mTasks);
+    }
+    // Calls `callback` with `ctx` for every job done past its deadline, or
+    // skipped.
+    void setMissCallback(IobeamMissCallback callback, void *ctx)
+    {
+        iobeam_SchedSetMissCallback(&mTasks, callback, ctx);
+    }
+    // The tasks, for how many of their jobs were late and by how much.
+    const IobeamSched& tasks() const
+    {
+        return mTasks;
+    }
+#endif
+
 private:
 #define SCRATCH_BUF_LEN 256
 
@@ -77,25 +289,103 @@ private:
     uint32_t mProjectId;
     const char *mToken;
     char mDeviceId[API_MAX_DEVICE_ID_LEN] = {0};
-    
+
+    // Series registered with `addSeries()`, and points of them queued.
+#if IOBEAM_SERIES_MAX > 0
+    IobeamSeriesTable mSeries;
+#endif
+#if IOBEAM_QUEUE_LEN > 0
+    IobeamQueue mQueue;
+
+    // Limits the rate of requests, see `setRateLimit()`. Once a request is
+    // held back or refused with a 429, single points are queued rather than
+    // sent until the queue has drained.
+    IobeamLimiter mLimiter;
+    bool mBacklog = false;
+
+    // Sizes batches of queued points, see `setAdaptiveBatching()`.
+    IobeamBatcher mBatcher;
+#endif
+
+    // See `retryable()`.
+    bool mRetry = false;
+
+#if IOBEAM_SCHED_MAX > 0
+    // Tasks stepped by `runTasks()`.
+    IobeamSched mTasks;
+#endif
+
     // The network client to use for communicating with iobeam cloud.
     Client& mClient;
 
-    // The approximate start time to use in conjunction with the value from
-    // `millis()` to construct timestamps.
-    Timeval mStart = {0};
+    // Model of global time in terms of `localMillis()`, fed by
+    // `startTimeKeeping()` and used to construct timestamps.
+    IobeamClock mClock;
+
+    // `millis()` wraps after ~49 days, so we extend it to 64-bits.
+    uint32_t mLastMillis = 0;
+    uint32_t mMillisWraps = 0;
+
+    // When set, the `Date` of each response is parsed into `mServerDate`
+    // and used as a low-weight clock sample.
+    bool mDateSync = false;
+    uint32_t mServerDate = 0;
+
+    // EEPROM address of the saved clock state, or -1 if not saved.
+    int mClockAddr = -1;
+    uint64_t mClockSaved = 0;
 
     // This is a 'scratch' space for strings to be written/buffered rather
     // than creating a lot of temporary buffers that tend screw up memory
     // safety if too many are made.
     char mBuf[SCRATCH_BUF_LEN];
 
+    // Pending output not yet written to `mClient`, see `write()`.
+    char mChunk[IOBEAM_CHUNK_LEN];
+    size_t mChunkLen = 0;
+
+    // Request statistics, and the `millis()` at the start of the request in
+    // progress and at the end of its last phase.
+    IobeamStats mStats;
+    uint32_t mReqStart = 0;
+    uint32_t mReqMark = 0;
+
     // A static call needed by the common library to callback to
     // a function pointer.
     static int callWrite(void*, char*, size_t);
+#if IOBEAM_SCHED_MAX > 0
+    static uint64_t callMillis(void*);
+#if IOBEAM_QUEUE_LEN > 0
+    static int uploadTask(IobeamTask*, uint64_t, void*);
+#endif
+    static int syncTask(IobeamTask*, uint64_t, void*);
+#endif
 
-    bool sendFormat(const char *fmt, ...);
-    bool setStartTime(char *rsp, uint32_t relative);
+    template <typename T>
+    bool sendImport(const char *key, Timeval& t, T value);
+    bool sendFilteredPoints(const char *key, const IobeamFilterPoint *pts,
+        size_t n);
+    bool sendBlock(const IobeamBlock& b);
+#if IOBEAM_SERIES_MAX > 0
+    bool sendSeries(Series series, Timeval& t, const IobeamValue& value);
+#endif
+#if IOBEAM_QUEUE_LEN > 0
+    int enqueuePoint(Series series, Timeval& t, const IobeamValue& value);
+    bool backlogged();
+    bool queueDue(uint64_t now);
+    bool sendBatched(int series, Timeval& t, const IobeamValue& value);
+    bool requeue(int series, Timeval& t, const IobeamValue& value);
+    bool sendPriority(Series series, Timeval& t, const IobeamValue& value,
+        uint8_t priority);
+    bool sendQueuedPoints(uint16_t count);
+#endif
+    bool startImport(size_t contentLen, uint64_t& start);
+    bool finishImport(uint64_t start, uint32_t points, size_t contentLen);
+    bool addTimeSample(char *rsp, uint64_t local, uint32_t uncertainty);
+    void addDateSample(uint64_t requestStart);
+    void saveClock();
+    uint64_t localMillis();
+    void now(Timeval& t);
     int readDeviceIdFromMem(unsigned int offset);
     bool processResponse(int code, char *bodyPtr, uint32_t *bodyLen);
 
@@ -105,19 +395,53 @@ private:
 
     void writeTokenHeader();
     void writePostHeaders(const char *resource, size_t contentLen);
+    void writeCommonHeaders(bool hasBody, size_t contentLen);
 
 
     int write(char *msg, size_t msgLen);
     int write(const uint8_t *msg, size_t msgLen);
+    void writePgm(const char *src, size_t len);
+    void writePgmString(const char *src);
+    void flush();
+
+    // Streams a PROGMEM string constant, whose length is known at compile
+    // time, to the client.
+    template <size_t N>
+    void writePgm(const char (&src)[N])
+    {
+        writePgm(src, N - 1);
+    }
 
 
     // Creates a network connection to iobeam cloud.
     bool connect()
     {
+#if IOBEAM_QUEUE_LEN > 0
+        if (!iobeam_LimiterTake(&mLimiter, localMillis())) {
+            mBacklog = true;
+            return false;
+        }
+#endif
+        mChunkLen = 0;
+        mReqStart = millis();
         int code = mClient.connect(API_DEFAULT_SERVER, API_DEFAULT_PORT);
+        mReqMark = millis();
+        iobeam_StatsConnect(&mStats, code > 0, mReqMark - mReqStart);
+        IOBEAM_TRACE(IOBEAM_TRACE_CONNECT, code, mReqMark - mReqStart);
+        if (code <= 0)
+            iobeam_StatsRequest(&mStats, IOBEAM_STATUS_NO_CONNECT, false, 0);
         return code > 0;
     }
 
+    // Closes the connection and records how the request went.
+    void stop(int status, bool ok)
+    {
+        mClient.stop();
+        uint32_t ms = millis() - mReqStart;
+        iobeam_StatsRequest(&mStats, status, ok, ms);
+        IOBEAM_TRACE(IOBEAM_TRACE_CLOSE, status, ms);
+    }
+
     // Reads an HTTP header line into `buf`.
     int readLine(char *buf, size_t bufLen)
     {
@@ -131,6 +455,7 @@ private:
                 char c = mClient.read();
                 if (c == '\r') {  // marks the end of the line
                     mClient.read();  // read past \n too
+                    mStats.bytesReceived += i + 2;
                     memset(buf + i, '\0', bufLen - i);
                     return i;
                 }
@@ -155,21 +480,6 @@ private:
 
         return i;
     }
-
-    // Reads a c-string from PROGMEM and copies up to bufLen
-    // characters to buf. The NUL character is NOT copied.
-    // Returns the number of bytes copied.
-    int readStringFromPgm(char *buf, size_t bufLen, const char *src)
-    {
-        int i = 0;
-        for (; i < bufLen; i++) {
-            char c = (char) pgm_read_byte(src + i);
-            if (c == '\0')
-                break;
-            buf[i] = c;
-        }
-        return i;
-    }
 };
 
 #endif
@@ -0,0 +1,28 @@
+#ifndef IobeamConfig_h
+#define IobeamConfig_h
+
+// Optional parts of the client. Each takes RAM in every `Iobeam` object,
+// so on Arduino they are compiled out unless given a size, here or with -D
+// for the whole build. The Arduino IDE compiles the library apart from the
+// sketch, so defines in the sketch do not reach it: the two would disagree
+// on the layout of `Iobeam`. Uncomment the ones your sketch uses.
+
+// Series registered with `addSeries()`, and sends by handle. The names
+// share a pool, which by default fits 16 characters per series; give it
+// more bytes if yours are longer (a series takes 20 plus its name).
+//#define IOBEAM_SERIES_MAX 4
+//#define IOBEAM_SERIES_POOL_LEN 144
+
+// Points `enqueue()` and the priority sends can hold, with the rate
+// limiter and adaptive batching that hold points back in the queue. Needs
+// IOBEAM_SERIES_MAX.
+//#define IOBEAM_QUEUE_LEN 8
+
+// Tasks `addTask()` can add, counting the client's own: one that resyncs
+// the clock and, with the queue, one that sends it.
+//#define IOBEAM_SCHED_MAX 3
+
+// Events kept by the trace ring, a power of two, see iobeam_trace.h.
+//#define IOBEAM_TRACE_LEN 16
+
+#endif
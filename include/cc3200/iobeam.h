@@ -8,17 +8,46 @@
 #define API_DEFAULT_SERVER  "api.iobeam.com"
 #endif
 #include "../iobeam_common.h"
+#include "../iobeam_clock.h"
+#include "../iobeam_import.h"
+#include "../iobeam_agg.h"
+#include "../iobeam_filter.h"
+#include "../iobeam_series.h"
+#include "../iobeam_queue.h"
+#include "../iobeam_limit.h"
+#include "../iobeam_batch.h"
+#include "../iobeam_stats.h"
+#include "../iobeam_trace.h"
+#include "../iobeam_sched.h"
 
 #include "simplelink.h"
 
 #define TEMP_BUF_LEN 192
 #define IOBEAM_DEVICE_FILE "iobeam-device-id"
-
-#define IMPORT_JSON_START "{\"device_id\":\"%s\",\"project_id\":%"PRIu32"," \
-						  "\"sources\":[{\"name\":\"%s\",\"data\":" \
-						  "[{\"time\":%llu,\"value\":"
-#define IMPORT_JSON_INT "%d}]}]}"
-#define IMPORT_JSON_FLOAT "%f}]}]}"
+#define IOBEAM_CLOCK_FILE "iobeam-clock"
+
+// All requests are built and their responses read in a single scratch arena
+// rather than in buffers on the stack. Its phases reuse the same memory:
+// header lines and the request body are built at the start of the arena,
+// and the response is read into the first TEMP_BUF_LEN bytes with its body
+// copied to the IOBEAM_RSP_BODY_LEN bytes after them.
+//
+// An arena of your own can be given with `iobeam_SetScratch()`; the macro
+// below checks its size at compile time. Unless IOBEAM_NO_DEFAULT_SCRATCH is
+// defined, a static arena is used until then.
+#define IOBEAM_RSP_BODY_LEN 192
+#define IOBEAM_SCRATCH_LEN (TEMP_BUF_LEN + IOBEAM_RSP_BODY_LEN)
+#define IOBEAM_SCRATCH_CHECK(arena) \
+    typedef char _iobeam_scratch_check_##arena[ \
+            sizeof(arena) >= IOBEAM_SCRATCH_LEN ? 1 : -1]
+
+// Returned by sends that the rate limiter held back, or that the server
+// refused with a 429: nothing was sent or lost, and the same call can be
+// made again later. Filters and aggregates are left as they were before
+// the call. Single points are queued instead, see `iobeam_SetRateLimit()`,
+// and only return it if their key cannot be added as a series, or one
+// refused with a 429 cannot be queued.
+#define IOBEAM_RETRY (-2)
 
 typedef struct _iobeam {
     int (*IsRegistered)();
@@ -28,11 +57,44 @@ typedef struct _iobeam {
     int (*SendIntWithTime)(const char *key, uint64_t ts, int64_t val);
     int (*SendFloat)(const char *key, double val);
     int (*SendFloatWithTime)(const char *key, uint64_t ts, double val);
+    int (*SendSeriesInt)(int series, int64_t val);
+    int (*SendSeriesIntWithTime)(int series, uint64_t ts, int64_t val);
+    int (*SendSeriesFloat)(int series, double val);
+    int (*SendSeriesFloatWithTime)(int series, uint64_t ts, double val);
+    int (*QueueInt)(int series, int64_t val);
+    int (*QueueIntWithTime)(int series, uint64_t ts, int64_t val);
+    int (*QueueFloat)(int series, double val);
+    int (*QueueFloatWithTime)(int series, uint64_t ts, double val);
+    int (*SendQueued)();
+    int (*SendDue)();
+    int (*SendPriorityInt)(int series, uint8_t priority, int64_t val);
+    int (*SendPriorityIntWithTime)(int series, uint8_t priority, uint64_t ts,
+            int64_t val);
+    int (*SendPriorityFloat)(int series, uint8_t priority, double val);
+    int (*SendPriorityFloatWithTime)(int series, uint8_t priority,
+            uint64_t ts, double val);
+    int (*SendRow)(const IobeamField *fields, size_t n);
+    int (*SendRowWithTime)(uint64_t ts, const IobeamField *fields, size_t n);
+    int (*SendIntArray)(const char *key, const uint64_t *ts,
+            const int32_t *vals, size_t n);
+    int (*SendFloatArray)(const char *key, const uint64_t *ts,
+            const float *vals, size_t n);
+    int (*SendIntArrayPeriodic)(const char *key, uint64_t start,
+            uint32_t period, const int32_t *vals, size_t n);
+    int (*SendFloatArrayPeriodic)(const char *key, uint64_t start,
+            uint32_t period, const float *vals, size_t n);
+    int (*SendAggregated)(const char *key, IobeamAgg *agg, double val);
+    int (*SendAggregate)(const char *key, const IobeamAggResult *r);
+    int (*FlushAggregate)(const char *key, IobeamAgg *agg);
+    int (*SendFiltered)(const char *key, IobeamFilter *f, double val);
+    int (*FlushFiltered)(const char *key, IobeamFilter *f);
 } Iobeam;
 
 int iobeam_Init(Iobeam *i, uint32_t projId, const char *projToken,
         const char *deviceId);
 static int _iobeam_StartTimeKeeping();
+static int _iobeam_SyncTime();
+static void _iobeam_SaveClock();
 static int _iobeam_IsRegistered();
 static int _iobeam_RegisterDevice();
 static int _iobeam_SendFloat(const char *key, double value);
@@ -41,9 +103,71 @@ static int _iobeam_SendFloatWithTime(const char *key, uint64_t timestamp,
 static int _iobeam_SendInt(const char *key, int64_t value);
 static int _iobeam_SendIntWithTime(const char *key, uint64_t timestamp,
         int64_t value);
+static int _iobeam_SendSeriesInt(int series, int64_t value);
+static int _iobeam_SendSeriesIntWithTime(int series, uint64_t timestamp,
+        int64_t value);
+static int _iobeam_SendSeriesFloat(int series, double value);
+static int _iobeam_SendSeriesFloatWithTime(int series, uint64_t timestamp,
+        double value);
+static int _iobeam_QueueInt(int series, int64_t value);
+static int _iobeam_QueueIntWithTime(int series, uint64_t timestamp,
+        int64_t value);
+static int _iobeam_QueueFloat(int series, double value);
+static int _iobeam_QueueFloatWithTime(int series, uint64_t timestamp,
+        double value);
+static int _iobeam_SendQueued();
+static int _iobeam_SendDue();
+static int _iobeam_SendPriorityInt(int series, uint8_t priority,
+        int64_t value);
+static int _iobeam_SendPriorityIntWithTime(int series, uint8_t priority,
+        uint64_t timestamp, int64_t value);
+static int _iobeam_SendPriorityFloat(int series, uint8_t priority,
+        double value);
+static int _iobeam_SendPriorityFloatWithTime(int series, uint8_t priority,
+        uint64_t timestamp, double value);
+static int _iobeam_SendRow(const IobeamField *fields, size_t n);
+static int _iobeam_SendRowWithTime(uint64_t timestamp,
+        const IobeamField *fields, size_t n);
+static int _iobeam_SendIntArray(const char *key, const uint64_t *timestamps,
+        const int32_t *values, size_t n);
+static int _iobeam_SendFloatArray(const char *key, const uint64_t *timestamps,
+        const float *values, size_t n);
+static int _iobeam_SendIntArrayPeriodic(const char *key, uint64_t start,
+        uint32_t period, const int32_t *values, size_t n);
+static int _iobeam_SendFloatArrayPeriodic(const char *key, uint64_t start,
+        uint32_t period, const float *values, size_t n);
+static int _iobeam_SendAggregated(const char *key, IobeamAgg *agg,
+        double value);
+static int _iobeam_SendAggregate(const char *key, const IobeamAggResult *r);
+static int _iobeam_FlushAggregate(const char *key, IobeamAgg *agg);
+static int _iobeam_SendFiltered(const char *key, IobeamFilter *f,
+        double value);
+static int _iobeam_FlushFiltered(const char *key, IobeamFilter *f);
+int iobeam_SetScratch(char *arena, size_t arenaLen);
+int iobeam_AddSeries(const char *name);
+void iobeam_SetQueuePolicy(uint8_t policy);
+void iobeam_SetQueueWatermarks(uint16_t high, uint16_t low,
+        IobeamPressureCallback callback, void *ctx);
+const IobeamQueue *iobeam_GetQueue();
+void iobeam_SetRateLimit(uint32_t periodMs, uint16_t burst);
+const IobeamLimiter *iobeam_GetLimiter();
+void iobeam_SetAdaptiveBatching(uint32_t maxLatencyMs, uint8_t dutyPercent);
+const IobeamBatcher *iobeam_GetBatcher();
+int iobeam_AddTask(IobeamTaskFn run, void *arg, uint32_t period,
+        uint32_t deadline);
+uint32_t iobeam_RunTasks();
+void iobeam_SetMissCallback(IobeamMissCallback callback, void *ctx);
+const IobeamSched *iobeam_GetTasks();
+const IobeamStats *iobeam_GetStats();
+void iobeam_ResetStats();
+void iobeam_SetClockTolerance(uint32_t msec);
+uint64_t iobeam_TimeAt(uint64_t local);
+void iobeam_SetDateSync(int enabled);
+void iobeam_SetClockPersist(int enabled);
 void iobeam_Finish();
 static void iobeam_Reset() {
     sl_FsDel(IOBEAM_DEVICE_FILE, 0);
+    sl_FsDel(IOBEAM_CLOCK_FILE, 0);
 }
 
 static uint64_t _iobeam_ParseServerTime(const char *getTimeRsp)
@@ -53,10 +177,10 @@ static uint64_t _iobeam_ParseServerTime(const char *getTimeRsp)
     return (uint64_t) strtoll(start, NULL, 10);
 }
 
-static int _iobeam_ReadFromDisk(char *dst, size_t dstLen)
+static int _iobeam_ReadFromDisk(const char *file, char *dst, size_t dstLen)
 {
     long fd;
-    unsigned char *fn = (unsigned char *) IOBEAM_DEVICE_FILE;
+    unsigned char *fn = (unsigned char *) file;
 
     int ret = sl_FsOpen(fn, FS_MODE_OPEN_READ, NULL, &fd);
     if (ret < 0)
@@ -71,10 +195,10 @@ static int _iobeam_ReadFromDisk(char *dst, size_t dstLen)
     return ret;
 }
 
-static int _iobeam_WriteToDisk(char *buf, size_t bufLen)
+static int _iobeam_WriteToDisk(const char *file, char *buf, size_t bufLen)
 {
     long fd;
-    unsigned char *fn = (unsigned char *) IOBEAM_DEVICE_FILE;
+    unsigned char *fn = (unsigned char *) file;
 
     int ret = sl_FsOpen(fn, FS_MODE_OPEN_WRITE, NULL, &fd);
     if (ret == SL_FS_ERR_FILE_NOT_EXISTS) {
@@ -99,13 +223,15 @@ static int _iobeam_WriteToDisk(char *buf, size_t bufLen)
     return ret;
 }
 
-static void _iobeam_WritePostHeaders(char *resource, size_t resourceLen,
+static int _iobeam_WriteHeaders(const char *method, size_t methodLen,
+        const char *resource, size_t resourceLen, int hasBody,
         uint32_t contentLen);
 
 static int _iobeam_ProcessResponse(int wantedCode, char *bodyPtr,
         uint32_t *bodyLen);
 
 static int _iobeam_GetSocket();
+static void _iobeam_ConnectFailed(int err);
 static void _iobeam_CloseSocket();
 static int _iobeam_WriteSocket(char *buf, size_t bufLen);
 static int _iobeam_ReadSocket(char *buf, size_t bufLen, char *prefix,
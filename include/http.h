@@ -4,6 +4,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stdint.h>
 
 #define PROTOCOL "HTTP/1.1"
 #define PROTOCOL_LEN (sizeof(PROTOCOL) - 1)
@@ -14,6 +15,14 @@
 #define HTTP_HEADER_CONTENT_TYPE   "Content-Type"
 #define HTTP_HEADER_CONNECTION     "Connection"
 #define HTTP_HEADER_TOKEN          "Authorization"
+#define HTTP_HEADER_DATE           "Date"
+#define HTTP_HEADER_RETRY_AFTER    "Retry-After"
+#define HTTP_HEADER_RATE_REMAINING "RateLimit-Remaining"
+#define HTTP_HEADER_RATE_RESET     "RateLimit-Reset"
+
+// Rate limit headers recognised by parseRateLimit().
+#define HTTP_RATE_REMAINING 1
+#define HTTP_RATE_RESET     2
 
 #define HTTP_CONTENT_TYPE_JSON     "application/json"
 
@@ -27,6 +36,35 @@
 extern "C" {
 #endif
 
+// Builds an HTTP message head in a buffer by appending the request line
+// and headers at a cursor, so a whole head can be written in one go.
+// Nothing is cleared and nothing is written past `bufLen`. A piece that
+// does not fit is dropped and marks the builder as overflowed, after which
+// all appends fail; the `httpAppend*()` functions return -1 once it has.
+typedef struct _http_builder {
+	char *buf;
+	size_t cap;
+	size_t len;
+	int overflow;
+} HttpBuilder;
+
+void httpBuilderInit(HttpBuilder *b, char *buf, size_t bufLen);
+int httpAppend(HttpBuilder *b, const char *src, size_t srcLen);
+int httpAppendUInt(HttpBuilder *b, uint32_t value);
+int httpAppendRequestLine(HttpBuilder *b, const char *method,
+	size_t methodLen, const char *resource, size_t resourceLen);
+int httpAppendHeader(HttpBuilder *b, const char *key, size_t keyLen,
+	const char *val, size_t valLen);
+int httpAppendHeaderUInt(HttpBuilder *b, const char *key, size_t keyLen,
+	uint32_t val);
+int httpAppendEnd(HttpBuilder *b);
+// Returns the length of the message built so far, or -1 if it overflowed.
+int httpBuilderLen(const HttpBuilder *b);
+
+// Older one-shot builders, each writing a single line into `buf` and
+// returning its length, or -1 if it does not fit. The line is terminated
+// with a NUL when there is room for one after it. The lengths passed in
+// are those of the strings, without their terminating NUL.
 int makeRequest(char *buf, size_t bufLen, const char *method, size_t methodLen,
 	char* rsource, size_t resourceLen);
 int makeGetRequest(char *buf, size_t bufLen, char *resource,
@@ -43,6 +81,9 @@ int readResponseLine(char *buf, size_t bufLen);
 
 int parseResponseCode(char *line);
 int parseContentLength(char *line);
+uint32_t parseDate(char *line);
+int parseRetryAfter(char *line, uint32_t *delay, uint32_t *date);
+int parseRateLimit(char *line, uint32_t *value);
 
 #ifdef __cplusplus
 }
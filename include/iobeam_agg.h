@@ -0,0 +1,97 @@
+#ifndef IOBEAM_AGG_H_
+#define IOBEAM_AGG_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "iobeam_import.h"
+
+// Aggregates uploaded for a window, as a bitmask. Each one goes out as its
+// own series, named after the aggregated series plus a suffix (e.g.
+// "temperature_max").
+#define IOBEAM_AGG_MIN      0x01  // "_min"
+#define IOBEAM_AGG_MAX      0x02  // "_max"
+#define IOBEAM_AGG_MEAN     0x04  // "_mean"
+#define IOBEAM_AGG_COUNT    0x08  // "_count"
+#define IOBEAM_AGG_LAST     0x10  // "_last"
+#define IOBEAM_AGG_DEFAULT  (IOBEAM_AGG_MIN | IOBEAM_AGG_MAX | \
+        IOBEAM_AGG_MEAN | IOBEAM_AGG_COUNT)
+#define IOBEAM_AGG_FIELDS   5
+
+// Longest suffix of an aggregate's series name.
+#define IOBEAM_AGG_SUFFIX_MAX 6
+
+// Longest output of iobeam_ImportAggregateField(), apart from the name.
+#define IOBEAM_AGG_SOURCE_MAX \
+        (IOBEAM_IMPORT_SOURCE_MAX + IOBEAM_AGG_SUFFIX_MAX)
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// The aggregates of one finished window.
+typedef struct _iobeam_agg_result {
+    uint64_t time;  // start of the window (ms)
+    uint32_t count;
+    float min;
+    float max;
+    float mean;
+    float last;
+    uint8_t fields;
+} IobeamAggResult;
+
+// Running aggregates of a series over fixed windows of time. Windows are
+// aligned to multiples of their length, so those of different series and
+// devices line up. Each sample costs the same, whatever the window.
+typedef struct _iobeam_agg {
+    uint32_t window;  // ms
+    uint8_t fields;
+
+    uint64_t start;  // of the current window
+    uint32_t count;  // samples in it, 0 if none yet
+    float min;
+    float max;
+    float last;
+    double sum;
+} IobeamAgg;
+
+// Sets up `agg` for windows of `windowMs` milliseconds, reporting the
+// aggregates in `fields` (IOBEAM_AGG_*).
+void iobeam_AggInit(IobeamAgg *agg, uint32_t windowMs, uint8_t fields);
+
+// Adds a sample taken at `time` (ms). If it falls past the current window,
+// that window is finished first: its aggregates are put in `done` and 1 is
+// returned. Otherwise 0 is returned. NaN samples are ignored. Samples from
+// before the current window (e.g. after the clock was corrected) count
+// towards it.
+int iobeam_AggAdd(IobeamAgg *agg, uint64_t time, float value,
+        IobeamAggResult *done);
+
+// Finishes the current window early, e.g. before sleeping. Returns 1 and
+// fills `done` if it had any samples, otherwise 0.
+int iobeam_AggFlush(IobeamAgg *agg, IobeamAggResult *done);
+
+// Number of aggregates `r` reports.
+uint8_t iobeam_AggFieldCount(const IobeamAggResult *r);
+
+// Encodes aggregate `field` (one IOBEAM_AGG_* bit) of `r` as a whole source
+// of an import, named `name` plus the field's suffix, in the manner of
+// iobeam_ImportSourceStart() and friends. Pass `first` as non-zero if it is
+// the first source of the import. Its length is at most the length of
+// `name` plus IOBEAM_AGG_SOURCE_MAX.
+size_t iobeam_ImportAggregateField(char *dst, const char *name,
+        const IobeamAggResult *r, uint8_t field, int first);
+
+// Encodes all the aggregates of `r` as sources of an import.
+size_t iobeam_ImportAggregate(char *dst, const char *name,
+        const IobeamAggResult *r, int first);
+
+// Encodes a whole import of the aggregates of `r`.
+size_t iobeam_ImportAggregateSingle(char *dst, const char *deviceId,
+        uint32_t projectId, const char *name, const IobeamAggResult *r);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* IOBEAM_AGG_H_ */
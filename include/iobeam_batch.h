@@ -0,0 +1,69 @@
+#ifndef IOBEAM_BATCH_H_
+#define IOBEAM_BATCH_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Shortest flush interval the controller picks, in ms.
+#ifndef IOBEAM_BATCH_MIN_INTERVAL
+#define IOBEAM_BATCH_MIN_INTERVAL 100
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Adaptive sizing of batches of queued points.
+//
+// Each request costs a round trip whatever its size, plus the time to
+// upload its body. The controller learns both from the requests it sees,
+// timing the upload of the body and the rest of the request apart, and
+// picks the flush interval at which requests keep the link busy for `duty`
+// of the time: on a fast link that means small, frequent batches and low
+// latency; on a slow one, larger batches that spread the round trip over
+// more points. Upload time hidden by socket buffers shows up as round
+// trip, which leads to the same larger batches. The interval is kept within
+// [IOBEAM_BATCH_MIN_INTERVAL, `maxLatency`] and the batch, the points
+// expected to arrive within it, within [1, `maxPoints`]. A batch is due
+// once it has that many points or its oldest has waited the interval.
+typedef struct _iobeam_batcher {
+    uint32_t maxLatency;  // ms, or 0 when batching is off
+    uint16_t maxPoints;
+    float duty;           // fraction of the time requests may take
+
+    // Moving averages of what requests show of the link
+    float rtt;         // ms a request takes besides uploading its body
+    float msPerByte;   // inverse of the upload throughput
+    float pointBytes;  // body bytes per point
+    float rate;        // points arriving per ms
+
+    uint32_t interval;  // ms the oldest point may wait
+    uint16_t batch;     // points to send at once
+    uint32_t requests;  // requests learnt from
+    uint64_t since;     // when the oldest waiting point was seen, or 0
+    uint64_t last;      // when the last batch was sent
+} IobeamBatcher;
+
+// Sets up `b` to keep points waiting at most `maxLatency` ms, in batches of
+// at most `maxPoints`, with requests busy `dutyPercent` of the time. Until
+// requests have been timed, every point is due at once. A `maxLatency` of
+// 0 turns batching off.
+void iobeam_BatcherInit(IobeamBatcher *b, uint32_t maxLatency,
+        uint16_t maxPoints, uint8_t dutyPercent);
+
+// Whether the `pending` points waiting at `now` (ms) should be sent.
+// Called whenever points are added, so it can tell how long they have
+// waited.
+int iobeam_BatcherDue(IobeamBatcher *b, uint64_t now, uint16_t pending);
+
+// Learns from a batch of `points`, with a body of `bytes`, whose request
+// took `ms` in all, `writeMs` of them sending the body, and ended at `now`.
+// Picks the next interval and batch.
+void iobeam_BatcherSent(IobeamBatcher *b, uint64_t now, uint16_t points,
+        uint32_t bytes, uint32_t ms, uint32_t writeMs);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* IOBEAM_BATCH_H_ */
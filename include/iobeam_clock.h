@@ -0,0 +1,104 @@
+#ifndef IOBEAM_CLOCK_H_
+#define IOBEAM_CLOCK_H_
+
+#include <stdint.h>
+
+// Number of sync results kept for estimating offset and skew.
+#ifndef IOBEAM_CLOCK_SAMPLES
+#define IOBEAM_CLOCK_SAMPLES 4
+#endif
+
+// Predicted timestamp error (in ms) that is tolerated before a resync is due.
+#ifndef IOBEAM_CLOCK_DEFAULT_TOLERANCE
+#define IOBEAM_CLOCK_DEFAULT_TOLERANCE 1000
+#endif
+
+// Worst case frequency error of the local oscillator, used until the skew
+// has been measured. Ceramic resonators (e.g. Arduino Uno) are ~0.5%.
+#ifndef IOBEAM_CLOCK_MAX_SKEW_PPM
+#define IOBEAM_CLOCK_MAX_SKEW_PPM 5000
+#endif
+
+// Drift the fitted skew cannot account for (temperature, aging).
+#ifndef IOBEAM_CLOCK_WANDER_PPM
+#define IOBEAM_CLOCK_WANDER_PPM 20
+#endif
+
+// Minimum time between saves of the clock state for syncs from `Date`
+// headers, which happen on every import, to limit flash or EEPROM wear.
+#ifndef IOBEAM_CLOCK_SAVE_INTERVAL
+#define IOBEAM_CLOCK_SAVE_INTERVAL (60 * 60 * 1000UL)
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// One sync result: the server time (ms) observed at local time `local` (ms),
+// believed to be correct within `uncertainty` ms.
+typedef struct _iobeam_clock_sample {
+    uint64_t local;
+    int64_t offset;  // server - local
+    float weight;    // 1 / uncertainty^2
+} IobeamClockSample;
+
+// Clock model mapping local (monotonic) milliseconds to server milliseconds:
+//
+//     server = local + offset + skew * (local - anchor)
+//
+// where `offset` and `skew` come from a weighted linear fit over the most
+// recent sync results.
+typedef struct _iobeam_clock {
+    IobeamClockSample samples[IOBEAM_CLOCK_SAMPLES];
+    uint8_t count;
+    uint8_t newest;
+
+    uint32_t tolerance;
+
+    // Fit results, relative to the newest sample.
+    uint64_t anchor;
+    int64_t baseOffset;
+    float offset;
+    float skew;
+
+    // Error model: uncertainty (ms) of the fit at `centroid` (ms relative to
+    // `anchor`) and of the fitted skew.
+    float centroid;
+    float baseError;
+    float skewError;
+
+    // What was known about the skew before any samples, e.g. from a
+    // previous boot. Combined with the fit.
+    float priorSkew;
+    float priorSkewError;
+} IobeamClock;
+
+#define IOBEAM_CLOCK_STATE_MAGIC 0x6b636269UL  // "ibck"
+
+// Compact form of the clock model for persisting across reboots.
+typedef struct _iobeam_clock_state {
+    uint32_t magic;
+    uint32_t error;  // ms, at `local`
+    uint64_t local;
+    int64_t offset;  // server - local, at `local`
+    float skew;
+    float skewError;
+} IobeamClockState;
+
+void iobeam_ClockInit(IobeamClock *clk, uint32_t tolerance);
+int iobeam_ClockIsSynced(const IobeamClock *clk);
+void iobeam_ClockAddSample(IobeamClock *clk, uint64_t local, uint64_t server,
+        uint32_t uncertainty);
+uint64_t iobeam_ClockNow(const IobeamClock *clk, uint64_t local);
+uint32_t iobeam_ClockError(const IobeamClock *clk, uint64_t local);
+int iobeam_ClockSyncDue(const IobeamClock *clk, uint64_t local);
+uint64_t iobeam_ClockNextSync(const IobeamClock *clk);
+void iobeam_ClockSave(const IobeamClock *clk, IobeamClockState *state);
+int iobeam_ClockRestore(IobeamClock *clk, const IobeamClockState *state,
+        uint64_t local, int sameTimeBase);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* IOBEAM_CLOCK_H_ */
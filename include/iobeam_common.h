@@ -8,7 +8,9 @@
     #define API_DEFAULT_SERVER "api.iobeam.com"
 #endif
 
-#define API_DEFAULT_PORT 80
+#ifndef API_DEFAULT_PORT
+    #define API_DEFAULT_PORT 80
+#endif
 #define API_MAX_DEVICE_ID_LEN 49
 #define API_DEVICE_ID_KEY "device_id\":"
 #define API_SERVER_TIME_KEY "server_timestamp\":"
@@ -43,97 +45,6 @@ static int _call_send_func(void *obj, void *f, char *buf, size_t len)
 // Generic version of common functions that work for either C or C++
 //
 
-static void _iobeam_generic_StartGet(void *obj, void *func, char *dst,
-		size_t dstLen, char *resource, size_t resourceLen)
-{
-	int ret = makeGetRequest(dst, dstLen, resource, resourceLen);
-	if (ret < 0)
-		return;
-	_call_send_func(obj, func, dst, ret);
-}
-
-static void _iobeam_generic_StartPost(void *obj, void *func, char* dst,
-		size_t dstLen, char *resource, size_t resourceLen)
-{
-	int ret = makePostRequest(dst, dstLen, resource, resourceLen);
-	if (ret < 0) {
-	    //UART_PRINT("Could not prepare HTTP request\r\n");
-	    return;
-	}
-	_call_send_func(obj, func, dst, ret);
-}
-
-static void _iobeam_generic_WriteHeader(void *obj, void *func, char* dst,
-		size_t dstLen, const char *key, size_t keyLen, const char* val,
-		size_t valLen)
-{
-	int ret = makeHeader(dst, dstLen, key, keyLen, val, valLen);
-    if (ret < 0) {
-    	//UART_PRINT("Could not prepare header\r\n");
-        return;
-    }
-    _call_send_func(obj, func, dst, ret);
-}
-
-static void _iobeam_generic_WriteFormattedHeader(void *obj, void *func,
-		char *dst, size_t dstLen, const char *key, size_t keyLen,
-		const char *fmt, ...)
-{
-	va_list vArgs;
-	va_start(vArgs, fmt);
-	int ret = makeHeaderInFormat(dst, dstLen, key, keyLen, fmt, vArgs);
-	va_end(vArgs);
-	if (ret < 0) {
-		return;
-	}
-	_call_send_func(obj, func, dst, ret);
-}
-
-static inline void _iobeam_generic_WriteCommonHeaders(void *obj, void *func,
-		char *dst, size_t dstLen)
-{
-	_iobeam_generic_WriteHeader(obj, func, dst, dstLen,
-			HTTP_HEADER_HOST,
-			sizeof(HTTP_HEADER_HOST),
-			API_DEFAULT_SERVER,
-			sizeof(API_DEFAULT_SERVER));
-
-	_iobeam_generic_WriteHeader(obj, func, dst, dstLen,
-			HTTP_HEADER_CONNECTION,
-			sizeof(HTTP_HEADER_CONNECTION),
-			HTTP_CONNECTION_CLOSE,
-			sizeof(HTTP_CONNECTION_CLOSE));
-
-	_iobeam_generic_WriteHeader(obj, func, dst, dstLen,
-			HTTP_HEADER_CONTENT_TYPE,
-			sizeof(HTTP_HEADER_CONTENT_TYPE),
-			HTTP_CONTENT_TYPE_JSON,
-			sizeof(HTTP_CONTENT_TYPE_JSON));
-}
-
-static void _iobeam_generic_WriteContentLengthHeader(void *obj, void *func,
-        char *dst, size_t dstLen, uint32_t len)
-{
-	const char *fmt = "%" PRIu32 HEADER_END;
-    _iobeam_generic_WriteFormattedHeader(obj, func, dst, dstLen,
-            HTTP_HEADER_CONTENT_LENGTH, sizeof(HTTP_HEADER_CONTENT_LENGTH),
-            fmt, len);
-}
-
-static void _iobeam_generic_WriteTokenHeader(void *obj, void *func, char *dst,
-    size_t dstLen, const char *token)
-{
-	const char *fmt = "Bearer %s" HEADER_END;
-    _iobeam_generic_WriteFormattedHeader(obj, func, dst, dstLen,
-            HTTP_HEADER_TOKEN, sizeof(HTTP_HEADER_TOKEN),
-            fmt, token);
-}
-
-static void _iobeam_generic_EndHeaders(void *obj, void *func)
-{
-    _call_send_func(obj, func, HEADER_END, sizeof(HEADER_END) - 1);
-}
-
 static inline void _iobeam_generic_WriteBody(void *obj, void *func, char *body,
         size_t bodyLen)
 {
@@ -147,51 +58,6 @@ static inline void _iobeam_generic_WriteBody(void *obj, void *func, char *body,
 // Language specific interfaces for C++ and C
 //
 #ifdef __cplusplus
-static void _iobeam_StartGet(void *obj, netSendFunc_cpp f, char *dst,
-		size_t dstLen, char *resource, size_t resourceLen)
-{
-	_iobeam_generic_StartGet(obj, (void *) f, dst, dstLen, resource,
-			resourceLen);
-}
-
-static void _iobeam_StartPost(void *obj, netSendFunc_cpp f, char* dst,
-		size_t dstLen, char *resource, size_t resourceLen)
-{
-	_iobeam_generic_StartPost(obj, (void *) f, dst, dstLen, resource,
-			resourceLen);
-}
-
-static void _iobeam_WriteHeader(void *obj, netSendFunc_cpp f,
-		char* dst, size_t dstLen, const char *key, size_t keyLen,
-		const char* val, size_t valLen)
-{
-	_iobeam_generic_WriteHeader(obj, (void *) f, dst, dstLen, key, keyLen,
-			val, valLen);
-}
-
-static void _iobeam_WriteCommonHeaders(void *obj, netSendFunc_cpp f,
-		char *dst, size_t dstLen)
-{
-	_iobeam_generic_WriteCommonHeaders(obj, (void *) f, dst, dstLen);
-}
-
-static void _iobeam_WriteContentLengthHeader(void *obj, netSendFunc_cpp f,
-		char *dst, size_t dstLen, uint32_t len)
-{
-	_iobeam_generic_WriteContentLengthHeader(obj, (void *) f, dst, dstLen, len);
-}
-
-static void _iobeam_WriteTokenHeader(void *obj, netSendFunc_cpp f, char *dst,
-		size_t dstLen, const char *token)
-{
-	_iobeam_generic_WriteTokenHeader(obj, (void *) f, dst, dstLen, token);
-}
-
-static void _iobeam_EndHeaders(void *obj, netSendFunc_cpp f)
-{
-	_iobeam_generic_EndHeaders(obj, (void *) f);
-}
-
 static inline void _iobeam_WriteBody(void *obj, netSendFunc_cpp f, char *body,
 		size_t bodyLen)
 {
@@ -201,52 +67,6 @@ static inline void _iobeam_WriteBody(void *obj, netSendFunc_cpp f, char *body,
 #define netSendFunc netSendFunc_cpp
 
 #else
-static void _iobeam_StartGet(netSendFunc f, char *dst,
-		size_t dstLen, char *resource, size_t resourceLen)
-{
-	_iobeam_generic_StartGet(NULL, (void *) f, dst, dstLen, resource,
-			resourceLen);
-}
-
-
-static void _iobeam_StartPost(netSendFunc f, char* dst, size_t dstLen,
-		char *resource, size_t resourceLen)
-{
-	_iobeam_generic_StartPost(NULL, (void *) f, dst, dstLen, resource,
-			resourceLen);
-}
-
-static void _iobeam_WriteHeader(netSendFunc f, char* dst, size_t dstLen,
-		const char *key, size_t keyLen, const char* val, size_t valLen)
-{
-	_iobeam_generic_WriteHeader(NULL, (void *) f, dst, dstLen, key, keyLen,
-			val, valLen);
-}
-
-static void _iobeam_WriteCommonHeaders(netSendFunc f, char *dst,
-		size_t dstLen)
-{
-	_iobeam_generic_WriteCommonHeaders(NULL, (void *) f, dst, dstLen);
-}
-
-static void _iobeam_WriteContentLengthHeader(netSendFunc f, char *dst,
-		size_t dstLen, uint32_t len)
-{
-	_iobeam_generic_WriteContentLengthHeader(NULL, (void *) f, dst, dstLen,
-			len);
-}
-
-static void _iobeam_WriteTokenHeader(netSendFunc f, char *dst, size_t dstLen,
-		const char *token)
-{
-	_iobeam_generic_WriteTokenHeader(NULL, (void *) f, dst, dstLen, token);
-}
-
-static void _iobeam_EndHeaders(netSendFunc f)
-{
-	_iobeam_generic_EndHeaders(NULL, (void *) f);
-}
-
 static inline void _iobeam_WriteBody(netSendFunc f, char *body, size_t bodyLen)
 {
 	_iobeam_generic_WriteBody(NULL, (void *) f, body, bodyLen);
@@ -257,6 +77,19 @@ static inline void _iobeam_WriteBody(netSendFunc f, char *body, size_t bodyLen)
 // Common library functions that do not need function pointer support
 //
 
+// Appends the headers sent with every request.
+static void _iobeam_AppendCommonHeaders(HttpBuilder *b)
+{
+    httpAppendHeader(b, HTTP_HEADER_HOST, sizeof(HTTP_HEADER_HOST) - 1,
+            API_DEFAULT_SERVER, sizeof(API_DEFAULT_SERVER) - 1);
+    httpAppendHeader(b, HTTP_HEADER_CONNECTION,
+            sizeof(HTTP_HEADER_CONNECTION) - 1, HTTP_CONNECTION_CLOSE,
+            sizeof(HTTP_CONNECTION_CLOSE) - 1);
+    httpAppendHeader(b, HTTP_HEADER_CONTENT_TYPE,
+            sizeof(HTTP_HEADER_CONTENT_TYPE) - 1, HTTP_CONTENT_TYPE_JSON,
+            sizeof(HTTP_CONTENT_TYPE_JSON) - 1);
+}
+
 static int _iobeam_ParseDeviceId(char *dst, char *deviceAddRsp)
 {
     // To find the id, we first find the field in JSON (device_id), then
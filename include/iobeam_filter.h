@@ -0,0 +1,74 @@
+#ifndef IOBEAM_FILTER_H_
+#define IOBEAM_FILTER_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Filter modes.
+//
+// A deadband only passes a sample once it differs from the last one passed
+// by more than the allowed deviation, so holding the last passed value
+// reconstructs the series within that deviation.
+//
+// Swinging door trending passes the fewest samples such that drawing
+// straight lines between them reconstructs every sample within the
+// deviation. Samples are held back until it is known whether they are
+// needed, so a passed sample is the one before the sample that showed it
+// was needed.
+#define IOBEAM_FILTER_DEADBAND      0
+#define IOBEAM_FILTER_SWINGING_DOOR 1
+
+// Most samples passed by a single call of iobeam_FilterAdd().
+#define IOBEAM_FILTER_OUT_MAX 2
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct _iobeam_filter_point {
+    uint64_t time;  // ms
+    float value;
+} IobeamFilterPoint;
+
+// Change detection for a slowly changing series, to suppress uploads of
+// samples that add nothing.
+typedef struct _iobeam_filter {
+    uint8_t mode;
+    float absDev;        // deviation allowed, in the series' units
+    float relDev;        // ... or as a fraction of the last passed value
+    uint32_t heartbeat;  // ms after which a sample is passed anyway, or 0
+
+    uint8_t started;
+    uint8_t holding;  // whether `held` is a sample not yet passed
+    IobeamFilterPoint last;  // last passed
+    IobeamFilterPoint held;  // last seen
+    float dev;        // deviation allowed since `last`
+    float slopeLow;   // swinging door: range of slopes from `last` that
+    float slopeHigh;  // keep every held back sample within `dev`
+} IobeamFilter;
+
+// Sets up `f`. The deviation allowed is the larger of `absDev` and
+// `relDev` times the magnitude of the last passed value. With a non-zero
+// `heartbeatMs`, a sample is passed at least that often so flat series
+// still show the device is alive.
+void iobeam_FilterInit(IobeamFilter *f, uint8_t mode, float absDev,
+        float relDev, uint32_t heartbeatMs);
+
+// Adds a sample taken at `time` (ms). The samples that should be uploaded
+// as a result, up to IOBEAM_FILTER_OUT_MAX of them and oldest first, are
+// put in `out` and their number is returned. The first sample is always
+// passed, NaN samples never are, and in swinging door mode samples must
+// have increasing times; others are dropped.
+size_t iobeam_FilterAdd(IobeamFilter *f, uint64_t time, float value,
+        IobeamFilterPoint *out);
+
+// Passes the held back sample, if any, so the series can be reconstructed
+// up to the last sample, e.g. before sleeping. Returns 1 if `out` was
+// filled, otherwise 0.
+size_t iobeam_FilterFlush(IobeamFilter *f, IobeamFilterPoint *out);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* IOBEAM_FILTER_H_ */
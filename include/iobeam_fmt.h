@@ -0,0 +1,43 @@
+#ifndef IOBEAM_FMT_H_
+#define IOBEAM_FMT_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Maximum number of characters written by each of the formatters below.
+#define IOBEAM_FMT_UINT32_MAX 10
+#define IOBEAM_FMT_INT64_MAX 20
+#define IOBEAM_FMT_FLOAT_MAX 16
+#define IOBEAM_FMT_DOUBLE_MAX 24
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Number formatting for the import encoder, without `printf`.
+//
+// Each function writes the text for its value to `dst` and returns the
+// number of characters written. Nothing is allocated and no NUL terminator
+// is written. If `dst` is NULL nothing is written and only the length is
+// returned, so a message can be sized before it is built.
+size_t iobeam_FormatUInt32(char *dst, uint32_t value);
+size_t iobeam_FormatInt32(char *dst, int32_t value);
+size_t iobeam_FormatUInt64(char *dst, uint64_t value);
+size_t iobeam_FormatInt64(char *dst, int64_t value);
+
+// Writes the shortest decimal that reads back as exactly `value`, in
+// plain notation for moderate exponents (e.g. "23.5", "-0.004") and
+// scientific otherwise ("1.5e-7"). Integral values keep a trailing ".0" so
+// they are still read as reals. NaN and infinities, which JSON cannot
+// represent, are written as "null".
+size_t iobeam_FormatFloat(char *dst, float value);
+
+// The same for a double. Where double is no wider than float (AVR), this
+// is iobeam_FormatFloat().
+size_t iobeam_FormatDouble(char *dst, double value);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* IOBEAM_FMT_H_ */
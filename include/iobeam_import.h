@@ -0,0 +1,171 @@
+#ifndef IOBEAM_IMPORT_H_
+#define IOBEAM_IMPORT_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "iobeam_fmt.h"
+
+// Pieces of the JSON body of an import, which looks like:
+//
+//     {"device_id":"<id>","project_id":<id>,"sources":[
+//         {"name":"<series>","data":[{"time":<ms>,"value":<v>},...]},...]}
+#define IMPORT_JSON_DEVICE      "{\"device_id\":\""
+#define IMPORT_JSON_PROJECT     "\",\"project_id\":"
+#define IMPORT_JSON_SOURCES     ",\"sources\":["
+#define IMPORT_JSON_NAME        "{\"name\":\""
+#define IMPORT_JSON_DATA        "\",\"data\":["
+#define IMPORT_JSON_TIME        "{\"time\":"
+#define IMPORT_JSON_VALUE       ",\"value\":"
+#define IMPORT_JSON_POINT_END   "}"
+#define IMPORT_JSON_SOURCE_END  "]}"
+#define IMPORT_JSON_END         "]}"
+
+#define IMPORT_LEN(s) (sizeof(s) - 1)
+
+// Longest possible output of iobeam_ImportPoint().
+#define IOBEAM_IMPORT_POINT_MAX (1 + IMPORT_LEN(IMPORT_JSON_TIME) + \
+        IOBEAM_FMT_INT64_MAX + IMPORT_LEN(IMPORT_JSON_VALUE) + \
+        IOBEAM_FMT_DOUBLE_MAX + IMPORT_LEN(IMPORT_JSON_POINT_END))
+
+// Longest possible output of iobeam_ImportStart() with an iobeam device ID.
+#define IOBEAM_IMPORT_PREFIX_MAX (IMPORT_LEN(IMPORT_JSON_DEVICE) + \
+        API_MAX_DEVICE_ID_LEN + IMPORT_LEN(IMPORT_JSON_PROJECT) + \
+        IOBEAM_FMT_UINT32_MAX + IMPORT_LEN(IMPORT_JSON_SOURCES))
+
+// Longest possible output of iobeam_ImportField(), apart from the escaped
+// name.
+#define IOBEAM_IMPORT_SOURCE_MAX (1 + IMPORT_LEN(IMPORT_JSON_NAME) + \
+        IMPORT_LEN(IMPORT_JSON_DATA) + IOBEAM_IMPORT_POINT_MAX + \
+        IMPORT_LEN(IMPORT_JSON_SOURCE_END))
+
+#define IOBEAM_VALUE_INT    0
+#define IOBEAM_VALUE_FLOAT  1
+#define IOBEAM_VALUE_DOUBLE 2
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// A data point's value, either integral or real. Reals taken as doubles
+// are kept as doubles, so they are sent at the precision they were read.
+typedef struct _iobeam_value {
+    uint8_t type;
+    union {
+        int64_t i;
+        float f;
+        double d;
+    } as;
+} IobeamValue;
+
+// One named value of a row: values of several series taken at the same
+// time, e.g. from one read of a sensor.
+typedef struct _iobeam_field {
+    const char *name;
+    IobeamValue value;
+} IobeamField;
+
+static inline IobeamField iobeam_IntField(const char *name, int64_t value)
+{
+    IobeamField f;
+    f.name = name;
+    f.value.type = IOBEAM_VALUE_INT;
+    f.value.as.i = value;
+    return f;
+}
+
+static inline IobeamField iobeam_FloatField(const char *name, float value)
+{
+    IobeamField f;
+    f.name = name;
+    f.value.type = IOBEAM_VALUE_FLOAT;
+    f.value.as.f = value;
+    return f;
+}
+
+static inline IobeamField iobeam_DoubleField(const char *name, double value)
+{
+    IobeamField f;
+    f.name = name;
+    f.value.type = IOBEAM_VALUE_DOUBLE;
+    f.value.as.d = value;
+    return f;
+}
+
+// A block of samples of one series, e.g. a DMA buffer of ADC readings,
+// with either a timestamp per sample in `times` or, if that is NULL, the
+// times `start`, `start + period`, ... of a regular series. The values are
+// in `ints` or `floats`, whichever is not NULL.
+typedef struct _iobeam_block {
+    const char *name;
+    const uint64_t *times;
+    uint64_t start;
+    uint32_t period;  // ms
+    const int32_t *ints;
+    const float *floats;
+    size_t n;
+} IobeamBlock;
+
+// Position in the points of a block being encoded. The next implicit time
+// is kept as text and stepped by adding the digits of the period, so a
+// regular series is encoded without a 64-bit conversion per point.
+typedef struct _iobeam_block_writer {
+    const IobeamBlock *block;
+    size_t next;  // index of the next point to write
+    char time[IOBEAM_FMT_INT64_MAX + 1];
+    char period[IOBEAM_FMT_UINT32_MAX];
+    uint8_t timeLen;
+    uint8_t periodLen;
+} IobeamBlockWriter;
+
+// Encoder for import bodies. Each function appends its piece to `dst` and
+// returns the number of characters written (no NUL terminator). If `dst` is
+// NULL only the length is returned, so the body can be sized for its
+// content-length header before it is written. Pass `first` as non-zero for
+// the first source of an import and the first point of a source, so no
+// separating comma is written.
+size_t iobeam_ImportStart(char *dst, const char *deviceId, uint32_t projectId);
+
+// Appends the string `s` escaped for JSON: quotes and backslashes get a
+// backslash, and control characters are written as \u00XX. Series names
+// go through this wherever they are written, so their length for a buffer
+// is iobeam_ImportEscape(NULL, name) rather than strlen().
+size_t iobeam_ImportEscape(char *dst, const char *s);
+size_t iobeam_ImportSourceStart(char *dst, const char *name, int first);
+size_t iobeam_ImportSourceStartSuffix(char *dst, const char *name,
+        const char *suffix, int first);
+size_t iobeam_ImportPoint(char *dst, uint64_t time, const IobeamValue *value,
+        int first);
+size_t iobeam_ImportSourceEnd(char *dst);
+size_t iobeam_ImportEnd(char *dst);
+
+// Encodes a whole import with a single point.
+size_t iobeam_ImportSingle(char *dst, const char *deviceId, uint32_t projectId,
+        const char *name, uint64_t time, const IobeamValue *value);
+
+// Encodes a field of a row as a whole source with a single point.
+size_t iobeam_ImportField(char *dst, uint64_t time, const IobeamField *field,
+        int first);
+
+// Encodes a whole import of a row of `n` fields taken at `time`, each of
+// them into its own series.
+size_t iobeam_ImportRow(char *dst, const char *deviceId, uint32_t projectId,
+        uint64_t time, const IobeamField *fields, size_t n);
+
+// Encodes the points of a block a buffer at a time. After init, each call
+// to iobeam_BlockWrite() writes as many whole points as fit in `room`
+// bytes of `dst` (always at least one if `room` is IOBEAM_IMPORT_POINT_MAX
+// or more) and returns their length; `w->next` reaches `n` when they are
+// all written. With a NULL `dst` the rest of the points are measured.
+void iobeam_BlockWriterInit(IobeamBlockWriter *w, const IobeamBlock *block);
+size_t iobeam_BlockWrite(IobeamBlockWriter *w, char *dst, size_t room);
+
+// Encodes a whole import of the block `b` as one source.
+size_t iobeam_ImportBlock(char *dst, const char *deviceId, uint32_t projectId,
+        const IobeamBlock *b);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* IOBEAM_IMPORT_H_ */
@@ -0,0 +1,73 @@
+#ifndef IOBEAM_LIMIT_H_
+#define IOBEAM_LIMIT_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Seconds to hold requests back after a 429 response that does not say
+// how long to wait.
+#ifndef IOBEAM_LIMIT_DEFAULT_RETRY
+#define IOBEAM_LIMIT_DEFAULT_RETRY 30
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Token bucket limiting the rate of requests to the API. Up to `burst`
+// requests can be sent back to back, after which one is allowed every
+// `period` ms. The server can slow it down further: a 429 response holds
+// all requests back for its `Retry-After`, and rate limit headers spread
+// the requests the server says remain over the time until its limit
+// resets. Times are in ms on the client's local clock.
+typedef struct _iobeam_limiter {
+    uint32_t period;        // ms per request, or 0 for no limit of our own
+    uint16_t burst;
+    uint64_t credit;        // ms of requests banked, up to burst * period
+    uint64_t last;          // when `credit` was last topped up
+    uint32_t serverPeriod;  // ms per request the server's limit allows...
+    uint64_t serverUntil;   // ...until it resets
+    uint64_t blockedUntil;  // from `Retry-After`
+    uint32_t throttled;     // requests held back
+    uint32_t limited;       // 429 responses
+} IobeamLimiter;
+
+// Rate limit headers of one response, collected by iobeam_LimiterHeader().
+typedef struct _iobeam_limit_headers {
+    uint32_t retryDelay;  // s, from `Retry-After`
+    uint32_t retryDate;   // s since the epoch, from `Retry-After`
+    uint32_t remaining;
+    uint32_t reset;       // s, or s since the epoch if very large
+    uint8_t has;          // which of them were seen, IOBEAM_LIMIT_HAS_*
+} IobeamLimitHeaders;
+
+#define IOBEAM_LIMIT_HAS_RETRY     0x01
+#define IOBEAM_LIMIT_HAS_REMAINING 0x02
+#define IOBEAM_LIMIT_HAS_RESET     0x04
+
+// Sets up `l` with a limit of its own of one request per `periodMs` (0 for
+// none, so only the server's limits apply) in bursts of up to `burst`.
+void iobeam_LimiterInit(IobeamLimiter *l, uint32_t periodMs, uint16_t burst);
+
+// Time until a request may be sent, in ms, 0 if it may be sent now.
+uint32_t iobeam_LimiterWait(IobeamLimiter *l, uint64_t now);
+
+// Takes the allowance for a request about to be sent. Returns 0, and
+// counts the request as throttled, if it has to wait.
+int iobeam_LimiterTake(IobeamLimiter *l, uint64_t now);
+
+// Checks a response header line for rate limit headers, adding any to
+// `h`. Returns whether it was one.
+int iobeam_LimiterHeader(IobeamLimitHeaders *h, char *line);
+
+// Learns from the headers `h` of a response with `status`, received at
+// `now`. `date` is the response's `Date` (s since the epoch) or 0, needed
+// to make sense of absolute times.
+void iobeam_LimiterResponse(IobeamLimiter *l, uint64_t now, int status,
+        const IobeamLimitHeaders *h, uint32_t date);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* IOBEAM_LIMIT_H_ */
@@ -0,0 +1,18 @@
+#ifndef IOBEAM_PGM_H_
+#define IOBEAM_PGM_H_
+
+// Constant tables shared by both platforms. On AVR they are kept in program
+// memory to save RAM, and must be read with these macros.
+#ifdef ARDUINO
+#include <avr/pgmspace.h>
+#define IOBEAM_PROGMEM PROGMEM
+#define IOBEAM_PGM_BYTE(p) pgm_read_byte(p)
+#define IOBEAM_PGM_COPY(dst, src, len) memcpy_P(dst, src, len)
+#else
+#include <string.h>
+#define IOBEAM_PROGMEM
+#define IOBEAM_PGM_BYTE(p) (*(const unsigned char *) (p))
+#define IOBEAM_PGM_COPY(dst, src, len) memcpy(dst, src, len)
+#endif
+
+#endif /* IOBEAM_PGM_H_ */
@@ -0,0 +1,154 @@
+#ifndef IOBEAM_QUEUE_H_
+#define IOBEAM_QUEUE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "iobeam_import.h"
+#include "iobeam_series.h"
+
+// Most points the send queue holds. Each takes 24 bytes (21 on AVR). On
+// Arduino the queue, and the rate limiting and batching that hold points
+// back in it, are compiled out unless a length is set, see IobeamConfig.h.
+#ifndef IOBEAM_QUEUE_LEN
+#ifdef ARDUINO
+#define IOBEAM_QUEUE_LEN 0
+#else
+#define IOBEAM_QUEUE_LEN 64
+#endif
+#endif
+
+#if IOBEAM_QUEUE_LEN > 0 && IOBEAM_SERIES_MAX == 0
+#error "The send queue holds points of registered series, set IOBEAM_SERIES_MAX"
+#endif
+
+// What a push to a full queue does.
+//
+// Dropping the oldest point keeps the latest data, dropping the newest
+// keeps the history intact. Down-sampling merges a point with the next
+// one of the same series, averaging their values, so a long outage costs
+// resolution rather than whole spans of time. The pair merged is the one
+// standing for the fewest samples, so the queue loses resolution evenly.
+// If no two points share a series, the oldest is dropped instead.
+#define IOBEAM_QUEUE_DROP_OLDEST 0
+#define IOBEAM_QUEUE_DROP_NEWEST 1
+#define IOBEAM_QUEUE_DOWNSAMPLE  2
+
+// Pressure on the queue. It is high from when the queue fills past its
+// high watermark until it drains to its low one, and full while every
+// slot is in use, so a push has to shed a point.
+#define IOBEAM_PRESSURE_NONE 0
+#define IOBEAM_PRESSURE_HIGH 1
+#define IOBEAM_PRESSURE_FULL 2
+
+// Priority classes of queued points. Points of a higher class are kept
+// ahead of all points of lower ones, so the first `depth[URGENT]` points
+// are the urgent ones and can be sent on their own, before the bulk of the
+// queue. Points are shed from the lowest class queued; an urgent point is
+// only refused or dropped when the queue holds nothing but urgent points.
+#define IOBEAM_PRIORITY_BULK   0
+#define IOBEAM_PRIORITY_URGENT 1
+#define IOBEAM_PRIORITIES      2
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Called when the pressure on a queue changes.
+typedef void (*IobeamPressureCallback)(void *ctx, uint8_t pressure);
+
+#if IOBEAM_QUEUE_LEN > 0
+
+// A point waiting to be sent, of the series with handle `series` in the
+// client's series table.
+typedef struct _iobeam_queued_point {
+    uint64_t time;  // ms
+    union {
+        int64_t i;
+        float f;
+        double d;
+    } as;
+    uint16_t weight;  // samples averaged into it by down-sampling
+    uint8_t type;     // IOBEAM_VALUE_*
+    int8_t series;
+    uint8_t priority; // IOBEAM_PRIORITY_*
+} IobeamQueuedPoint;
+
+// Points waiting to be sent, highest priority then oldest first, in a
+// ring. Every point pushed
+// is accounted for: `queued` is the sum of the points still queued, those
+// popped once sent, `droppedOldest` and `merged`.
+typedef struct _iobeam_queue {
+    IobeamQueuedPoint points[IOBEAM_QUEUE_LEN];
+    uint16_t head;
+    uint16_t count;
+    uint16_t depth[IOBEAM_PRIORITIES];  // points queued of each class
+    uint16_t high;     // watermarks, in points
+    uint16_t low;
+    uint8_t policy;
+    uint8_t pressure;
+    IobeamPressureCallback onPressure;
+    void *ctx;
+
+    uint32_t queued;         // points accepted
+    uint32_t droppedOldest;  // points dropped to make room
+    uint32_t droppedNewest;  // points refused because the queue was full
+    uint32_t merged;         // points merged into another by down-sampling
+} IobeamQueue;
+
+// Empties `q` and sets what it does when full. The watermarks start at
+// 3/4 and 1/2 of IOBEAM_QUEUE_LEN, with no callback.
+void iobeam_QueueInit(IobeamQueue *q, uint8_t policy);
+
+// Sets the watermarks of `q` and the function called, with `ctx`, when
+// its pressure changes. `low` should be below `high`.
+void iobeam_QueueSetWatermarks(IobeamQueue *q, uint16_t high, uint16_t low,
+        IobeamPressureCallback callback, void *ctx);
+
+// Adds a point of series `series` taken at `time` (ms) to the class
+// `priority`, shedding one by the queue's policy if it is full. Returns
+// the pressure on the queue after the push, or -1 if the point was
+// refused, so callers can slow down before data is lost.
+int iobeam_QueuePush(IobeamQueue *q, int series, uint64_t time,
+        const IobeamValue *value, uint8_t priority);
+
+// The `i`th point in the order they are sent, which must be below
+// `q->count`.
+const IobeamQueuedPoint *iobeam_QueueAt(const IobeamQueue *q, uint16_t i);
+
+// Removes the `n` first points, e.g. once they have been sent.
+void iobeam_QueuePop(IobeamQueue *q, uint16_t n);
+
+// Encodes the first points of a queue as an import, a source per series
+// in the order of their handles, a buffer at a time like
+// iobeam_BlockWrite(). Each call writes as much as fits in `room` bytes
+// of `dst`, which should hold at least IOBEAM_SERIES_FRAGMENT_MAX, until
+// `w->done` is set. With a NULL `dst` the rest is measured.
+typedef struct _iobeam_queue_writer {
+    const IobeamQueue *queue;
+    const IobeamSeriesTable *series;
+    uint16_t count;   // points to write, from the first
+    uint16_t at;      // offset of the next point to look at
+    int8_t current;   // handle of the series being written
+    uint8_t open;     // whether its source has been started
+    uint8_t first;    // whether its next point is the first
+    uint8_t sources;  // sources started so far
+    uint8_t done;
+} IobeamQueueWriter;
+
+void iobeam_QueueWriterInit(IobeamQueueWriter *w, const IobeamQueue *q,
+        const IobeamSeriesTable *series, uint16_t count);
+size_t iobeam_QueueWrite(IobeamQueueWriter *w, char *dst, size_t room);
+
+// Encodes a whole import of the `count` first points of `q`.
+size_t iobeam_ImportQueue(char *dst, const char *deviceId, uint32_t projectId,
+        const IobeamQueue *q, const IobeamSeriesTable *series,
+        uint16_t count);
+
+#endif /* IOBEAM_QUEUE_LEN > 0 */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* IOBEAM_QUEUE_H_ */
@@ -0,0 +1,138 @@
+#ifndef IOBEAM_SCHED_H_
+#define IOBEAM_SCHED_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Tasks a scheduler holds at most, counting the two the client adds for
+// uploads and clock syncs (only the latter on Arduino without a queue).
+// On Arduino the client's scheduler is compiled out unless this is set,
+// see IobeamConfig.h.
+#ifndef IOBEAM_SCHED_MAX
+#ifdef ARDUINO
+#define IOBEAM_SCHED_MAX 0
+#else
+#define IOBEAM_SCHED_MAX 4
+#endif
+#endif
+
+// How often the client's own task checks whether queued points are due to
+// be sent, and the least time between the checks of its sync task, which
+// otherwise sleeps until the clock is predicted to need a resync, in ms.
+#ifndef IOBEAM_SCHED_UPLOAD_PERIOD
+#define IOBEAM_SCHED_UPLOAD_PERIOD 1000
+#endif
+#ifndef IOBEAM_SCHED_SYNC_PERIOD
+#define IOBEAM_SCHED_SYNC_PERIOD 10000
+#endif
+
+// Deadline of a task that has none: its jobs run when no task with a
+// deadline is ready, and are never late.
+#define IOBEAM_TASK_BACKGROUND 0xFFFFFFFFUL
+
+// What a step of a task returns.
+#define IOBEAM_TASK_RUNNING 0
+#define IOBEAM_TASK_DONE    1
+
+// Stackless coroutines, in the style of protothreads, for jobs that wait
+// without blocking the others. A task function wraps its body in
+// IOBEAM_TASK_BEGIN(t) and IOBEAM_TASK_END(t), and may yield in between;
+// each step runs from where the last one yielded. Local variables do not
+// survive a yield, so keep state in the task's `arg`, and do not yield
+// from inside a `switch`.
+#define IOBEAM_TASK_BEGIN(t) switch ((t)->line) { case 0:
+
+#define IOBEAM_TASK_END(t) } (t)->line = 0; return IOBEAM_TASK_DONE
+
+// Lets the other tasks run, resuming here on the next step.
+#define IOBEAM_TASK_YIELD(t) \
+    do { (t)->line = __LINE__; return IOBEAM_TASK_RUNNING; \
+        case __LINE__:; } while (0)
+
+// Yields until `cond` holds, checking it on every step.
+#define IOBEAM_TASK_WAIT_UNTIL(t, cond) \
+    do { (t)->line = __LINE__; case __LINE__: \
+        if (!(cond)) return IOBEAM_TASK_RUNNING; } while (0)
+
+// Yields until the scheduler's clock reaches `until` (ms), without the
+// task being stepped before then.
+#define IOBEAM_TASK_SLEEP(t, until) \
+    do { (t)->wake = (until); IOBEAM_TASK_YIELD(t); } while (0)
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct _iobeam_task IobeamTask;
+
+// Runs a step of a job of `t` at `now` (ms). Returns IOBEAM_TASK_DONE
+// once the job is finished, or IOBEAM_TASK_RUNNING if it yielded.
+typedef int (*IobeamTaskFn)(IobeamTask *t, uint64_t now, void *arg);
+
+// The clock a scheduler runs on, in ms.
+typedef uint64_t (*IobeamSchedClock)(void *ctx);
+
+// Called when a job of task `task` is done `late` ms after its deadline,
+// or when jobs are skipped, see `IobeamTask.skipped`.
+typedef void (*IobeamMissCallback)(void *ctx, int task, uint32_t late);
+
+// A periodic task. A job is released every `period` ms and should be done
+// within `deadline` ms of its release. Releases keep to the period however
+// long jobs take; if a job is still running, or the scheduler was not run,
+// until the next release has come, the releases missed are skipped so the
+// task does not run back to back to catch up.
+struct _iobeam_task {
+    IobeamTaskFn run;
+    void *arg;
+    uint32_t period;    // ms, or 0 to release a job as soon as one is done
+    uint32_t deadline;  // ms after release, or IOBEAM_TASK_BACKGROUND
+    uint64_t release;   // of the job running, or of the next one
+    uint64_t wake;      // not stepped before this, see IOBEAM_TASK_SLEEP()
+    uint16_t line;      // where the job resumes, see IOBEAM_TASK_BEGIN()
+    uint8_t running;
+    uint32_t jobs;      // jobs done
+    uint32_t missed;    // jobs done late or skipped
+    uint32_t skipped;   // jobs never run
+    uint32_t maxLate;   // ms, the most a job was done late
+};
+
+#if IOBEAM_SCHED_MAX > 0
+
+// Cooperative scheduler of tasks, stepping the ready job with the earliest
+// deadline each time it is run. Jobs are never preempted, so a step should
+// be short: one that blocks (e.g. on a request) holds up every other task,
+// which shows up as missed deadlines.
+typedef struct _iobeam_sched {
+    IobeamTask tasks[IOBEAM_SCHED_MAX];
+    uint8_t count;
+    IobeamSchedClock clock;
+    void *ctx;
+    IobeamMissCallback onMiss;
+    void *missCtx;
+} IobeamSched;
+
+// Sets up `s` with no tasks, running on `clock`.
+void iobeam_SchedInit(IobeamSched *s, IobeamSchedClock clock, void *ctx);
+
+// Adds a task calling `run` with `arg`, whose first job is released now.
+// A `deadline` of 0 is the period, or none if that is 0 too. Returns the
+// task's index, or -1 if the scheduler is full.
+int iobeam_SchedAdd(IobeamSched *s, IobeamTaskFn run, void *arg,
+        uint32_t period, uint32_t deadline);
+
+// Calls `callback` with `ctx` for every job done late or skipped.
+void iobeam_SchedSetMissCallback(IobeamSched *s, IobeamMissCallback callback,
+        void *ctx);
+
+// Runs one step of the ready job with the earliest deadline. Returns 0 if
+// a step was run, otherwise the ms until a task is next ready, which it is
+// safe to sleep for (UINT32_MAX if there are no tasks).
+uint32_t iobeam_SchedRun(IobeamSched *s);
+
+#endif /* IOBEAM_SCHED_MAX > 0 */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* IOBEAM_SCHED_H_ */
@@ -0,0 +1,82 @@
+#ifndef IOBEAM_SERIES_H_
+#define IOBEAM_SERIES_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "iobeam_import.h"
+
+// Bytes of a series' JSON fragment, `,{"name":"<name>","data":[`, besides
+// the escaped name.
+#define IOBEAM_SERIES_FRAGMENT_FIXED (1 + IMPORT_LEN(IMPORT_JSON_NAME) + \
+        IMPORT_LEN(IMPORT_JSON_DATA))
+
+// Most series that can be registered, and the bytes kept for all their
+// JSON fragments (20 plus the escaped name each). The table is part of
+// the client, so on Arduino, where it takes some 40 bytes of RAM per
+// series with names of up to 16 characters, it is compiled out unless a
+// size is set, see IobeamConfig.h.
+#ifndef IOBEAM_SERIES_MAX
+#ifdef ARDUINO
+#define IOBEAM_SERIES_MAX 0
+#else
+#define IOBEAM_SERIES_MAX 16
+#endif
+#endif
+
+#ifndef IOBEAM_SERIES_POOL_LEN
+#ifdef ARDUINO
+#define IOBEAM_SERIES_POOL_LEN \
+        (IOBEAM_SERIES_MAX * (IOBEAM_SERIES_FRAGMENT_FIXED + 16))
+#else
+#define IOBEAM_SERIES_POOL_LEN 512
+#endif
+#endif
+
+// Longest series name, before escaping, and longest fragment kept for one.
+#define IOBEAM_SERIES_NAME_MAX 64
+#define IOBEAM_SERIES_FRAGMENT_MAX (IOBEAM_SERIES_FRAGMENT_FIXED + \
+        2 * IOBEAM_SERIES_NAME_MAX)
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#if IOBEAM_SERIES_MAX > 0
+
+// Registered series. Each name is validated and escaped once, and the part
+// of an import that starts its source, `,{"name":"<name>","data":[`, is
+// kept so sends can copy it as is.
+typedef struct _iobeam_series_table {
+    char pool[IOBEAM_SERIES_POOL_LEN];
+    uint16_t used;
+    uint16_t start[IOBEAM_SERIES_MAX];
+    uint8_t len[IOBEAM_SERIES_MAX];
+    uint8_t count;
+} IobeamSeriesTable;
+
+void iobeam_SeriesInit(IobeamSeriesTable *t);
+
+// Registers the series `name` and returns its handle, a small integer from
+// 0, or -1 if the name is empty, too long, has control characters, or the
+// table is full. Registering a name again returns the same handle.
+int iobeam_SeriesAdd(IobeamSeriesTable *t, const char *name);
+
+// The fragment starting the source of series `handle`, with a leading
+// comma unless it is the `first` source of the import. Returns NULL for an
+// unknown handle.
+const char *iobeam_SeriesSource(const IobeamSeriesTable *t, int handle,
+        int first, size_t *len);
+
+#endif /* IOBEAM_SERIES_MAX > 0 */
+
+// Writes `name` to `dst` escaped for a JSON string, and returns its length,
+// or 0 if it is not a valid series name. Needs up to twice the length of
+// the name.
+size_t iobeam_SeriesEscape(char *dst, const char *name);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* IOBEAM_SERIES_H_ */
@@ -0,0 +1,95 @@
+#ifndef IOBEAM_STATS_H_
+#define IOBEAM_STATS_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Number of latency histogram buckets. Bucket 0 counts latencies under
+// 16 ms, and each one after it covers twice the range of the one before
+// (16-31 ms, 32-63 ms, ...); the last also counts everything above.
+#ifndef IOBEAM_STATS_BUCKETS
+#define IOBEAM_STATS_BUCKETS 10
+#endif
+#define IOBEAM_STATS_BUCKET_SHIFT 4
+
+// Status of requests that failed before a response status was read.
+#define IOBEAM_STATUS_NO_CONNECT (-1)
+#define IOBEAM_STATUS_NO_WRITE (-2)
+#define IOBEAM_STATUS_NO_RESPONSE (-3)
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Classes of failed requests, indexing `IobeamStats.failures`.
+enum {
+    IOBEAM_FAIL_CONNECT = 0,  // could not connect
+    IOBEAM_FAIL_WRITE,        // could not send the request
+    IOBEAM_FAIL_RESPONSE,     // connection closed or malformed response
+    IOBEAM_FAIL_4XX,          // client errors other than 429
+    IOBEAM_FAIL_429,          // rate limited
+    IOBEAM_FAIL_5XX,          // server errors
+    IOBEAM_FAIL_OTHER,        // any other status than the one expected
+    IOBEAM_FAIL_COUNT
+};
+
+// Distribution of one kind of latency, in ms. `min` is UINT32_MAX until
+// something has been added.
+typedef struct _iobeam_latency {
+    uint32_t count;
+    uint32_t min;
+    uint32_t max;
+    uint32_t total;
+    uint16_t histogram[IOBEAM_STATS_BUCKETS];  // saturates at UINT16_MAX
+} IobeamLatency;
+
+// Counters kept by a client since it started (or was last reset). They are
+// updated as requests run, so reading them costs nothing; the 32-bit
+// totals wrap, so compare differences between two readings.
+typedef struct _iobeam_stats {
+    IobeamLatency connect;    // opening the connection
+    IobeamLatency write;      // sending the request, once connected
+    IobeamLatency firstByte;  // from the request sent to the response
+    IobeamLatency request;    // whole requests, connect to close
+
+    uint32_t requests;
+    uint32_t successes;
+    uint32_t failures[IOBEAM_FAIL_COUNT];
+    int16_t lastStatus;  // HTTP status or IOBEAM_STATUS_* of the last one
+
+    uint32_t connects;
+    uint32_t reconnects;  // connections opened after a failed request
+    uint32_t bytesSent;
+    uint32_t bytesReceived;
+    uint32_t pointsSent;  // points in imports the server accepted
+
+    uint8_t lastFailed;
+} IobeamStats;
+
+void iobeam_StatsInit(IobeamStats *stats);
+
+// Adds one latency of `ms` milliseconds.
+void iobeam_LatencyAdd(IobeamLatency *lat, uint32_t ms);
+
+// Mean latency, or 0 if there is none.
+uint32_t iobeam_LatencyMean(const IobeamLatency *lat);
+
+// Upper bound of the latency below which `percent` of those added fall,
+// estimated from the histogram and capped at the maximum seen.
+uint32_t iobeam_LatencyPercentile(const IobeamLatency *lat, uint8_t percent);
+
+// Records an attempt to connect that took `ms`, counting it as a reconnect
+// if the previous request failed.
+void iobeam_StatsConnect(IobeamStats *stats, int connected, uint32_t ms);
+
+// Records the end of a request that took `ms` in total. `status` is the
+// HTTP status of the response or an IOBEAM_STATUS_* code, and `ok` whether
+// it was the status wanted.
+void iobeam_StatsRequest(IobeamStats *stats, int status, int ok,
+        uint32_t ms);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* IOBEAM_STATS_H_ */
@@ -0,0 +1,90 @@
+#ifndef IOBEAM_TRACE_H_
+#define IOBEAM_TRACE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Number of events kept by the trace ring, which must be a power of two,
+// or 0 to compile tracing out. Each event takes 16 bytes, so it is off by
+// default on Arduino, where RAM is scarce.
+#ifndef IOBEAM_TRACE_LEN
+#ifdef ARDUINO
+#define IOBEAM_TRACE_LEN 0
+#else
+#define IOBEAM_TRACE_LEN 64
+#endif
+#endif
+
+#define IOBEAM_TRACE_MAGIC 0x54424f49UL  // "IOBT" in little endian
+#define IOBEAM_TRACE_VERSION 1
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Event IDs. tools/trace_decode.py reads the names from this list, so keep
+// the `IOBEAM_TRACE_<NAME> = <id>,` form. IDs from IOBEAM_TRACE_USER up are
+// free for applications.
+enum {
+    IOBEAM_TRACE_CONNECT = 1,   // a: socket or error, b: ms taken
+    IOBEAM_TRACE_SEND = 2,      // a: bytes given, b: bytes sent or error
+    IOBEAM_TRACE_RECV = 3,      // a: room in buffer, b: bytes read or error
+    IOBEAM_TRACE_STATUS = 4,    // a: response status, b: status wanted
+    IOBEAM_TRACE_HEADERS = 5,   // a: content-length, b: `Date` (sec)
+    IOBEAM_TRACE_CLOSE = 6,     // a: status or IOBEAM_STATUS_*, b: ms taken
+    IOBEAM_TRACE_SYNC = 7,      // a: uncertainty (ms), b: predicted error
+    IOBEAM_TRACE_IMPORT = 8,    // a: points, b: body length
+    IOBEAM_TRACE_MISS = 9,      // a: task, b: ms past its deadline
+    IOBEAM_TRACE_USER = 256
+};
+
+// One event, laid out the same on every platform (all of them little
+// endian) so a ring can be dumped raw and decoded on a host.
+typedef struct _iobeam_trace_event {
+    uint32_t time;  // clock ticks, see `IobeamTraceRing.hz`
+    uint16_t id;
+    uint16_t seq;   // low bits of the event's sequence number
+    int32_t a;
+    int32_t b;
+} IobeamTraceEvent;
+
+typedef uint32_t (*IobeamTraceClock)(void);
+
+typedef struct _iobeam_trace_ring {
+    uint32_t magic;
+    uint8_t version;
+    uint8_t eventSize;
+    uint16_t len;
+    uint32_t hz;    // rate of the clock event times are in
+    uint32_t next;  // sequence number of the next event
+#if IOBEAM_TRACE_LEN > 0
+    IobeamTraceEvent events[IOBEAM_TRACE_LEN];
+#endif
+} IobeamTraceRing;
+
+#if IOBEAM_TRACE_LEN > 0
+
+// Starts tracing, timing events with `clock`, which runs at `hz`. Events
+// are only recorded after this has been called.
+void iobeam_TraceInit(IobeamTraceClock clock, uint32_t hz);
+
+// Records an event, overwriting the oldest one once the ring is full. It
+// only stores five words, so it is cheap enough to leave on in production.
+// It is not safe to call from interrupts.
+void iobeam_Trace(uint16_t id, int32_t a, int32_t b);
+
+// The whole ring, for dumping as raw bytes (e.g. over UART or from a
+// debugger) to be decoded with tools/trace_decode.py.
+const IobeamTraceRing *iobeam_TraceRing();
+
+#define IOBEAM_TRACE(id, a, b) iobeam_Trace(id, (int32_t) (a), (int32_t) (b))
+#else
+#define iobeam_TraceInit(clock, hz)
+#define IOBEAM_TRACE(id, a, b)
+#endif
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* IOBEAM_TRACE_H_ */
@@ -0,0 +1,128 @@
+#include "../include/iobeam_agg.h"
+
+#include <string.h>
+
+// Series name suffixes, in the order of the IOBEAM_AGG_* bits.
+static const char *const SUFFIXES[IOBEAM_AGG_FIELDS] = {
+    "_min", "_max", "_mean", "_count", "_last"
+};
+
+void iobeam_AggInit(IobeamAgg *agg, uint32_t windowMs, uint8_t fields)
+{
+    memset(agg, 0, sizeof(*agg));
+    agg->window = windowMs > 0 ? windowMs : 1;
+    agg->fields = fields;
+}
+
+int iobeam_AggFlush(IobeamAgg *agg, IobeamAggResult *done)
+{
+    if (agg->count == 0)
+        return 0;
+
+    done->time = agg->start;
+    done->count = agg->count;
+    done->min = agg->min;
+    done->max = agg->max;
+    done->mean = (float) (agg->sum / agg->count);
+    done->last = agg->last;
+    done->fields = agg->fields;
+    agg->count = 0;
+    agg->sum = 0;
+    return 1;
+}
+
+int iobeam_AggAdd(IobeamAgg *agg, uint64_t time, float value,
+        IobeamAggResult *done)
+{
+    if (value != value)  // NaN
+        return 0;
+
+    int finished = 0;
+    if (agg->count > 0 && time >= agg->start + agg->window)
+        finished = iobeam_AggFlush(agg, done);
+
+    if (agg->count == 0) {
+        agg->start = time - time % agg->window;
+        agg->min = value;
+        agg->max = value;
+    } else if (value < agg->min) {
+        agg->min = value;
+    } else if (value > agg->max) {
+        agg->max = value;
+    }
+    agg->count++;
+    agg->sum += value;
+    agg->last = value;
+    return finished;
+}
+
+uint8_t iobeam_AggFieldCount(const IobeamAggResult *r)
+{
+    uint8_t n = 0;
+    uint8_t f;
+    for (f = r->fields & ((1 << IOBEAM_AGG_FIELDS) - 1); f; f &= f - 1)
+        n++;
+    return n;
+}
+
+size_t iobeam_ImportAggregateField(char *dst, const char *name,
+        const IobeamAggResult *r, uint8_t field, int first)
+{
+    IobeamValue v;
+    v.type = IOBEAM_VALUE_FLOAT;
+    uint8_t i = 0;
+    switch (field) {
+    case IOBEAM_AGG_MIN:
+        v.as.f = r->min;
+        break;
+    case IOBEAM_AGG_MAX:
+        v.as.f = r->max;
+        i = 1;
+        break;
+    case IOBEAM_AGG_MEAN:
+        v.as.f = r->mean;
+        i = 2;
+        break;
+    case IOBEAM_AGG_COUNT:
+        v.type = IOBEAM_VALUE_INT;
+        v.as.i = r->count;
+        i = 3;
+        break;
+    case IOBEAM_AGG_LAST:
+        v.as.f = r->last;
+        i = 4;
+        break;
+    default:
+        return 0;
+    }
+
+    size_t off = iobeam_ImportSourceStartSuffix(dst, name, SUFFIXES[i],
+            first);
+    off += iobeam_ImportPoint(dst ? dst + off : NULL, r->time, &v, 1);
+    off += iobeam_ImportSourceEnd(dst ? dst + off : NULL);
+    return off;
+}
+
+size_t iobeam_ImportAggregate(char *dst, const char *name,
+        const IobeamAggResult *r, int first)
+{
+    size_t off = 0;
+    uint8_t i;
+    for (i = 0; i < IOBEAM_AGG_FIELDS; i++) {
+        uint8_t field = 1 << i;
+        if (!(r->fields & field))
+            continue;
+        off += iobeam_ImportAggregateField(dst ? dst + off : NULL, name, r,
+                field, first && off == 0);
+    }
+    return off;
+}
+
+size_t iobeam_ImportAggregateSingle(char *dst, const char *deviceId,
+        uint32_t projectId, const char *name, const IobeamAggResult *r)
+{
+    size_t off = iobeam_ImportStart(dst, deviceId, projectId);
+    off += iobeam_ImportAggregate(dst ? dst + off : NULL, name, r, 1);
+    off += iobeam_ImportEnd(dst ? dst + off : NULL);
+    return off;
+}
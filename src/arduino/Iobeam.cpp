@@ -2,14 +2,41 @@
 
 #include <SPI.h>
 #include <EEPROM.h>
-#include <math.h>
 
-Iobeam::Iobeam(Client& client) : mClient(client) { }
+Iobeam::Iobeam(Client& client) : mClient(client)
+{
+#if IOBEAM_SERIES_MAX > 0
+    iobeam_SeriesInit(&mSeries);
+#endif
+#if IOBEAM_QUEUE_LEN > 0
+    iobeam_QueueInit(&mQueue, IOBEAM_QUEUE_DROP_OLDEST);
+    iobeam_LimiterInit(&mLimiter, 0, 1);
+    iobeam_BatcherInit(&mBatcher, 0, 1, 0);
+#endif
+#if IOBEAM_SCHED_MAX > 0
+    iobeam_SchedInit(&mTasks, callMillis, this);
+#if IOBEAM_QUEUE_LEN > 0
+    iobeam_SchedAdd(&mTasks, uploadTask, this, IOBEAM_SCHED_UPLOAD_PERIOD,
+        IOBEAM_TASK_BACKGROUND);
+#endif
+    iobeam_SchedAdd(&mTasks, syncTask, this, 0, IOBEAM_TASK_BACKGROUND);
+#endif
+}
+
+#if IOBEAM_TRACE_LEN > 0
+static uint32_t traceClock()
+{
+    return (uint32_t) micros();
+}
+#endif
 
 void Iobeam::init(uint32_t projId, const char *projToken, int deviceIdAddr) 
 {
     mProjectId = projId;
     mToken = projToken;
+    iobeam_ClockInit(&mClock, IOBEAM_CLOCK_DEFAULT_TOLERANCE);
+    iobeam_StatsInit(&mStats);
+    iobeam_TraceInit(traceClock, 1000000UL);
     if (deviceIdAddr >= 0) {
         readDeviceIdFromMem((unsigned int) deviceIdAddr);
     }
@@ -45,71 +72,177 @@ int Iobeam::readDeviceIdFromMem(unsigned int memoryOffset)
 }
 
 int Iobeam::callWrite(void *obj, char * c, size_t l) {
-    ((Iobeam *) obj)->write(c, l);
+    return ((Iobeam *) obj)->write(c, l);
+}
+
+#if IOBEAM_SCHED_MAX > 0
+uint64_t Iobeam::callMillis(void *obj) {
+    return ((Iobeam *) obj)->localMillis();
+}
+
+// The client's background tasks. Each job is a single step: a request
+// cannot be split, so an upload or sync holds up the other tasks for as
+// long as it takes, and a batch is the most an upload step sends.
+#if IOBEAM_QUEUE_LEN > 0
+int Iobeam::uploadTask(IobeamTask *t, uint64_t now, void *obj)
+{
+    (void) t;
+    (void) now;
+    ((Iobeam *) obj)->sendDue();
+    return IOBEAM_TASK_DONE;
 }
+#endif
+
+// When the sync task should next check `clk`: once the model predicts its
+// error will pass the tolerance, but no sooner than IOBEAM_SCHED_SYNC_PERIOD
+// ms from `now`, so a failed sync is not retried back to back.
+static uint64_t syncWake(const IobeamClock *clk, uint64_t now)
+{
+    uint64_t wake = now + IOBEAM_SCHED_SYNC_PERIOD;
+    if (iobeam_ClockIsSynced(clk)) {
+        uint64_t next = iobeam_ClockNextSync(clk);
+        if (next > wake)
+            wake = next;
+    }
+    return wake;
+}
+
+// Resyncs ahead of the next send needing it, which would then wait for it.
+int Iobeam::syncTask(IobeamTask *t, uint64_t now, void *obj)
+{
+    Iobeam *iobeam = (Iobeam *) obj;
+    IOBEAM_TASK_BEGIN(t);
+    IOBEAM_TASK_SLEEP(t, syncWake(&iobeam->mClock, now));
+    if (iobeam_ClockIsSynced(&iobeam->mClock) &&
+            iobeam_ClockNextSync(&iobeam->mClock) <= now) {
+        IOBEAM_DEBUG("Clock error over tolerance, resyncing\n");
+        iobeam->startTimeKeeping();
+    }
+    IOBEAM_TASK_END(t);
+}
+#endif
 
 // Tells iobeam to begin keeping track of the (approximate) global time.
 //
 // This call uses an API in the iobeam cloud and some simple math to roughly
-// estimate the start time of this sketch with relation to the global clock.
-// The client can then use this approximation to assign timestamps rather than
-// the user having to manage it.
+// estimate the global time with relation to `localMillis()`. Each call adds
+// a sync result to the clock model, which learns both the offset and the
+// skew of our clock so later syncs are needed less often. The client can
+// then use this model to assign timestamps rather than the user having to
+// manage it.
 bool Iobeam::startTimeKeeping()
 {
     if (!connect())
         return false;
 
-    uint32_t start = (uint32_t) millis();
+    uint64_t start = localMillis();
     startGet(API_GET_TIME);
-    _iobeam_WriteCommonHeaders(this, callWrite, mBuf, SCRATCH_BUF_LEN);
+    writeCommonHeaders(false, 0);
     writeTokenHeader();
-    _iobeam_EndHeaders(this, callWrite);
+    write((char *) HEADER_END, sizeof(HEADER_END) - 1);
     
     uint32_t rspSize = 0;
     bool success = processResponse(200, mBuf, &rspSize);
     if (success && rspSize > 0) {
-        uint32_t elapsed = (uint32_t)(millis() - start);
-        uint32_t relative = (elapsed / 2) + start;
-        success = setStartTime(mBuf, relative);
+        uint32_t half = (uint32_t) ((localMillis() - start) / 2);
+        success = addTimeSample(mBuf, start + half, half);
+        IOBEAM_TRACE(IOBEAM_TRACE_SYNC, half,
+            iobeam_ClockError(&mClock, localMillis()));
+        if (success)
+            saveClock();
     }
 
     return success;
 }
 
-// Approximates the 'start' time of this sketch, in terms of real world time.
+// Enables saving the clock state to EEPROM at the provided memory location
+// on each sync, and restores the state saved by a previous boot if there is
+// one. `millis()` restarts on every boot, so only the learned skew of the
+// clock carries over, but that makes the syncs after a reboot much rarer.
 //
-// Given a timestamp response message from the iobeam server, and a calculated
-// `relative` offset for when that timestamp is from, this function sets
-// `mStart` equal to a time that subjects that relative offset from the
-// given timestamp. `relative` should be calculated by taking the number
-// of millis() before the timestamp request, and adding half the elapsed time
-// to it, to estimate the cost of one-way of the round trip.
-bool Iobeam::setStartTime(char *getTimeRsp, uint32_t relative)
-{
-    // First parse out seconds, and subtract any whole seconds from `relative`
+// Returns the amount of bytes of EEPROM used for the state.
+int Iobeam::persistClock(unsigned int memoryOffset)
+{
+    IobeamClockState state;
+    EEPROM.get(memoryOffset, state);
+    int ret = iobeam_ClockRestore(&mClock, &state, localMillis(), 0);
+    (void) ret;  // only printed with debugging on
+    IOBEAM_DEBUG("Clock restore: ");
+    IOBEAM_DEBUG(ret);
+    IOBEAM_DEBUG("\n");
+
+    mClockAddr = memoryOffset;
+    return sizeof(IobeamClockState);
+}
+
+// Writes the clock state to EEPROM, if enabled. `EEPROM.put()` only writes
+// the bytes that changed.
+void Iobeam::saveClock()
+{
+    if (mClockAddr < 0)
+        return;
+
+    IobeamClockState state;
+    iobeam_ClockSave(&mClock, &state);
+    EEPROM.put(mClockAddr, state);
+    mClockSaved = localMillis();
+}
+
+// Adds a sync result to the clock model.
+//
+// Given a timestamp response message from the iobeam server, and the
+// `local` time that timestamp is believed to be from, this function feeds
+// the pair to `mClock`. `local` should be calculated by taking the value of
+// `localMillis()` before the timestamp request, and adding half the elapsed
+// time to it, to estimate the cost of one-way of the round trip; that half
+// is also the `uncertainty` of the result.
+bool Iobeam::addTimeSample(char *getTimeRsp, uint64_t local,
+    uint32_t uncertainty)
+{
     char *start = strstr(getTimeRsp, "sec\":");
+    if (!start)
+        return false;
     start += (sizeof("sec\":") - 1);
-    mStart.sec = (uint32_t) strtol(start, NULL, 10);
-    mStart.sec -= relative / 1000;
-    
-    // Parse out milliseconds and determine the number of `relative` msecs
+    uint64_t server = (uint64_t) strtoul(start, NULL, 10) * 1000;
+
     start = strstr(getTimeRsp, "usec\":");
+    if (!start)
+        return false;
     start += (sizeof("usec\":") - 1);
-    int msec = strtol(start, NULL, 10) / 1000;
-    int relMsec = relative % 1000;
-
-    // If there are more msecs than the timestamp, need to carry over;
-    // otherwise, simple subtraction.
-    if (relMsec > msec) {
-        mStart.sec -= 1;
-        mStart.msec = (uint32_t) (1000 + msec - relMsec);
-    } else {
-        mStart.msec = (uint32_t) (msec - relMsec);
-    }
-    
+    server += strtoul(start, NULL, 10) / 1000;
+
+    iobeam_ClockAddSample(&mClock, local, server, uncertainty);
     return true;
 }
 
+// Returns the milliseconds elapsed since boot as a 64-bit value that does
+// not wrap like `millis()`. Must be called at least once every ~49 days.
+uint64_t Iobeam::localMillis()
+{
+    uint32_t m = (uint32_t) millis();
+    if (m < mLastMillis)
+        mMillisWraps++;
+    mLastMillis = m;
+    return ((uint64_t) mMillisWraps << 32) | m;
+}
+
+// Fills `t` with our best estimate of global time, first resyncing if the
+// clock model predicts more error than the tolerance allows.
+void Iobeam::now(Timeval& t)
+{
+    uint64_t local = localMillis();
+    if (iobeam_ClockIsSynced(&mClock) &&
+            iobeam_ClockSyncDue(&mClock, local)) {
+        IOBEAM_DEBUG("Clock error over tolerance, resyncing\n");
+        startTimeKeeping();
+        local = localMillis();
+    }
+
+    uint64_t ms = iobeam_ClockNow(&mClock, local);
+    t.sec = (uint32_t) (ms / 1000);
+    t.msec = (uint32_t) (ms % 1000);
+}
+
 // Registers this device with iobeam and stores the device ID at the
 // provided memory location in EEPROM. It will return early if an ID
 // already exists.
@@ -168,104 +301,729 @@ int Iobeam::registerDevice(unsigned int memoryOffset)
     return -1;
 }
 
+// Formatting of each type of import value, picked at compile time by
+// `sendImport()`.
+template <typename T> struct ImportValue;
+
+template <> struct ImportValue<int> {
+    static const size_t MAX_LEN = IOBEAM_FMT_UINT32_MAX + 1;  // and a sign
+    static size_t format(char *dst, int value)
+    {
+        return iobeam_FormatInt32(dst, value);
+    }
+    static void set(IobeamValue *v, int value)
+    {
+        v->type = IOBEAM_VALUE_INT;
+        v->as.i = value;
+    }
+};
+
+template <> struct ImportValue<double> {
+    static const size_t MAX_LEN = IOBEAM_FMT_DOUBLE_MAX;
+    static size_t format(char *dst, double value)
+    {
+        // Shortest decimal that reads back as the same double, which keeps
+        // the sign and leading zeros of the fraction (e.g. -0.5, 1.05).
+        return iobeam_FormatDouble(dst, value);
+    }
+    static void set(IobeamValue *v, double value)
+    {
+        v->type = IOBEAM_VALUE_DOUBLE;
+        v->as.d = value;
+    }
+};
+
+// Length of all the fixed segments of an import.
+static constexpr size_t IMPORT_FIXED_LEN = sizeof(importDevice) +
+    sizeof(importProject) + sizeof(importName) + sizeof(importTime) +
+    sizeof(importValue) + sizeof(importEnd) - 6;
+
 // Common function for the two types of sending/import requests.
-bool Iobeam::sendFormat(const char *fmt, ...) {
-    if (!connect()) {
+//
+// The JSON skeleton is resolved at compile time for the value type `T`, so
+// only the device ID, project ID, series name, time and value are
+// formatted, each once, and no format string is parsed. The skeleton is
+// streamed to the client straight from PROGMEM.
+template <typename T>
+bool Iobeam::sendImport(const char *key, Timeval& t, T value)
+{
+    IobeamValue v;
+    ImportValue<T>::set(&v, value);
+    mRetry = false;
+#if IOBEAM_QUEUE_LEN > 0
+    if (backlogged()) {
+        int series = iobeam_SeriesAdd(&mSeries, key);
+        if (series >= 0)
+            return sendBatched(series, t, v);
+        // The key cannot be queued, and a request would be held back too
+        if (mBacklog) {
+            mRetry = true;
+            return false;
+        }
+    }
+#endif
+
+    char projectStr[IOBEAM_FMT_UINT32_MAX];
+    char timeStr[IOBEAM_FMT_INT64_MAX];
+    char valueStr[ImportValue<T>::MAX_LEN];
+    const size_t projectLen = iobeam_FormatUInt32(projectStr, mProjectId);
+    const size_t timeLen = iobeam_FormatUInt64(timeStr,
+        (uint64_t) t.sec * 1000 + t.msec);
+    const size_t valueLen = ImportValue<T>::format(valueStr, value);
+    const size_t deviceLen = strlen(mDeviceId);
+    // The key is escaped into `mBuf` once the headers are out.
+    const size_t keyLen = iobeam_ImportEscape(NULL, key);
+    if (keyLen > SCRATCH_BUF_LEN) {
         return false;
     }
+    const size_t contentLen = IMPORT_FIXED_LEN + deviceLen + projectLen +
+        keyLen + timeLen + valueLen;
 
-    va_list args;
-    va_start(args, fmt);
-    const size_t contentLen = vsnprintf(NULL, 0, fmt, args);
-    va_end(args);
+    uint64_t start;
+    if (!startImport(contentLen, start)) {
+        return false;
+    }
 
-    writePostHeaders(API_IMPORTS, contentLen);
-        
-    va_start(args, fmt);
-    vsnprintf(mBuf, contentLen + 1, fmt, args);
-    _iobeam_WriteBody(this, callWrite, mBuf, contentLen);
-    va_end(args);
-    
-    return processResponse(200, NULL, NULL);
+    // The body is streamed straight to the client, so it does not need to
+    // fit in `mBuf`.
+    writePgm(importDevice);
+    write(mDeviceId, deviceLen);
+    writePgm(importProject);
+    write(projectStr, projectLen);
+    writePgm(importName);
+    write(mBuf, iobeam_ImportEscape(mBuf, key));
+    writePgm(importTime);
+    write(timeStr, timeLen);
+    writePgm(importValue);
+    write(valueStr, valueLen);
+    writePgm(importEnd);
+
+    bool success = finishImport(start, 1, contentLen);
+#if IOBEAM_QUEUE_LEN > 0
+    if (!success && mStats.lastStatus == 429) {
+        return requeue(iobeam_SeriesAdd(&mSeries, key), t, v);
+    }
+#endif
+    return success;
+}
+
+#if IOBEAM_QUEUE_LEN > 0
+// Whether single points should be queued rather than sent: when batching
+// them, and from when the rate limiter holds requests back until the
+// backlog has gone out, as one larger import once a request is allowed.
+bool Iobeam::backlogged()
+{
+    if (iobeam_LimiterWait(&mLimiter, localMillis()) > 0)
+        mBacklog = true;
+    return mBatcher.maxLatency > 0 || mBacklog;
+}
+
+// Queues a point and, if the batch is due and a request is allowed, sends
+// it with the rest of the queue. A point kept queued counts as a success,
+// unless sending the queue failed other than with a 429.
+bool Iobeam::sendBatched(int series, Timeval& t, const IobeamValue& value)
+{
+    if (iobeam_QueuePush(&mQueue, series, (uint64_t) t.sec * 1000 + t.msec,
+            &value, IOBEAM_PRIORITY_BULK) < 0) {
+        return false;
+    }
+    if (!queueDue(localMillis())) {
+        return true;
+    }
+    return sendQueuedPoints(mQueue.count) || mStats.lastStatus == 429;
+}
+
+// Keeps a point whose import was refused with a 429 to be sent later, if
+// its series can be queued. If not, `retryable()` stays set.
+bool Iobeam::requeue(int series, Timeval& t, const IobeamValue& value)
+{
+    return series >= 0 && iobeam_QueuePush(&mQueue, series,
+        (uint64_t) t.sec * 1000 + t.msec, &value, IOBEAM_PRIORITY_BULK) >= 0;
+}
+#endif
+
+// Feeds the `Date` of the last response to the clock model. The header only
+// has whole seconds, so it is taken to be from the middle of that second,
+// making it a low-weight sample compared to a timestamp GET.
+void Iobeam::addDateSample(uint64_t requestStart)
+{
+    uint32_t half = (uint32_t) ((localMillis() - requestStart) / 2);
+    iobeam_ClockAddSample(&mClock, requestStart + half,
+        (uint64_t) mServerDate * 1000 + 500, half + 500);
+    if (localMillis() - mClockSaved > IOBEAM_CLOCK_SAVE_INTERVAL)
+        saveClock();
 }
 
 bool Iobeam::send(char *key, double value)
 {
     Timeval t = {0};
-    uint32_t tOff = (uint32_t) millis();
-    t.sec = mStart.sec + (tOff / 1000);
-    t.msec = mStart.msec + (tOff % 1000);
-    if (t.msec > 1000) {
-        t.sec += 1;
-        t.msec -= 1000;
-    }
+    now(t);
     return send(key, t, value);
 }
 
-bool Iobeam::send(char *key, Timeval& t, double value) {
-    // Formats are stored in program space to save memory.
-    const size_t FMT_SIZE = sizeof(importStart) + sizeof(importFloat);
-    char format[FMT_SIZE] = {0};
-    readStringFromPgm(format, sizeof(importStart) - 1, importStart);
-    readStringFromPgm(format + sizeof(importStart) - 1,
-        sizeof(importFloat), importFloat);
-
-    int intval = trunc(value);
-    int decval = trunc((value - intval) * 10000);
-    
-    return sendFormat(format, mDeviceId, mProjectId, key, t.sec, t.msec,
-        intval, decval);
+bool Iobeam::send(char *key, Timeval& t, double value)
+{
+    return sendImport(key, t, value);
 }
 
 bool Iobeam::send(char *key, int value)
 {
     Timeval t = {0};
-    uint32_t tOff = (uint32_t) millis();
-    t.sec = mStart.sec + (tOff / 1000);
-    t.msec = mStart.msec + (tOff % 1000);
-    if (t.msec > 1000) {
-        t.sec += 1;
-        t.msec -= 1000;
-    }
+    now(t);
     return send(key, t, value);
 }
 
 bool Iobeam::send(char *key, Timeval& t, int value)
 {
-    // Formats are stored in program space to save memory.
-    const size_t FMT_SIZE = sizeof(importStart) + sizeof(importInt);
-    char format[FMT_SIZE] = {0};
-    int offset = 0;
-    offset += readStringFromPgm(format, sizeof(importStart) - 1,
-        importStart);
-    readStringFromPgm(format + offset, sizeof(importInt), importInt);
+    return sendImport(key, t, value);
+}
+
+#if IOBEAM_SERIES_MAX > 0
+Iobeam::Series Iobeam::addSeries(const char *name)
+{
+    return (Series) iobeam_SeriesAdd(&mSeries, name);
+}
+
+bool Iobeam::send(Series series, Timeval& t, double value)
+{
+    IobeamValue v;
+    v.type = IOBEAM_VALUE_DOUBLE;
+    v.as.d = value;
+    return sendSeries(series, t, v);
+}
+
+bool Iobeam::send(Series series, Timeval& t, int value)
+{
+    IobeamValue v;
+    v.type = IOBEAM_VALUE_INT;
+    v.as.i = value;
+    return sendSeries(series, t, v);
+}
+
+bool Iobeam::send(Series series, double value)
+{
+    Timeval t = {0};
+    now(t);
+    return send(series, t, value);
+}
+
+bool Iobeam::send(Series series, int value)
+{
+    Timeval t = {0};
+    now(t);
+    return send(series, t, value);
+}
+
+// Sends a point to a registered series. The start of its source is copied
+// from the series table, so the name is neither measured nor escaped again.
+bool Iobeam::sendSeries(Series series, Timeval& t, const IobeamValue& value)
+{
+    size_t sourceLen;
+    const char *source = iobeam_SeriesSource(&mSeries, series, 1, &sourceLen);
+    mRetry = false;
+    if (!source) {
+        return false;
+    }
+#if IOBEAM_QUEUE_LEN > 0
+    if (backlogged()) {
+        return sendBatched(series, t, value);
+    }
+#endif
+
+    char point[IOBEAM_IMPORT_POINT_MAX];
+    const size_t pointLen = iobeam_ImportPoint(point,
+        (uint64_t) t.sec * 1000 + t.msec, &value, 1);
+    const size_t contentLen = iobeam_ImportStart(NULL, mDeviceId,
+        mProjectId) + sourceLen + pointLen +
+        IMPORT_LEN(IMPORT_JSON_SOURCE_END) + IMPORT_LEN(IMPORT_JSON_END);
+
+    uint64_t start;
+    if (!startImport(contentLen, start)) {
+        return false;
+    }
+
+    write(mBuf, iobeam_ImportStart(mBuf, mDeviceId, mProjectId));
+    write((char *) source, sourceLen);
+    write(point, pointLen);
+    size_t off = iobeam_ImportSourceEnd(mBuf);
+    off += iobeam_ImportEnd(mBuf + off);
+    write(mBuf, off);
+
+    bool success = finishImport(start, 1, contentLen);
+#if IOBEAM_QUEUE_LEN > 0
+    if (!success && mStats.lastStatus == 429) {
+        return requeue(series, t, value);
+    }
+#endif
+    return success;
+}
+#endif
+
+#if IOBEAM_QUEUE_LEN > 0
+int Iobeam::enqueue(Series series, Timeval& t, double value)
+{
+    IobeamValue v;
+    v.type = IOBEAM_VALUE_DOUBLE;
+    v.as.d = value;
+    return enqueuePoint(series, t, v);
+}
+
+int Iobeam::enqueue(Series series, Timeval& t, int value)
+{
+    IobeamValue v;
+    v.type = IOBEAM_VALUE_INT;
+    v.as.i = value;
+    return enqueuePoint(series, t, v);
+}
+
+int Iobeam::enqueue(Series series, double value)
+{
+    Timeval t = {0};
+    now(t);
+    return enqueue(series, t, value);
+}
+
+int Iobeam::enqueue(Series series, int value)
+{
+    Timeval t = {0};
+    now(t);
+    return enqueue(series, t, value);
+}
 
-    return sendFormat(format, mDeviceId, mProjectId, key, t.sec, t.msec,
-        value);
+int Iobeam::enqueuePoint(Series series, Timeval& t, const IobeamValue& value)
+{
+    size_t len;
+    if (!iobeam_SeriesSource(&mSeries, series, 1, &len)) {
+        return -1;
+    }
+    int pressure = iobeam_QueuePush(&mQueue, series,
+        (uint64_t) t.sec * 1000 + t.msec, &value, IOBEAM_PRIORITY_BULK);
+    if (mBatcher.maxLatency > 0) {
+        iobeam_BatcherDue(&mBatcher, localMillis(), mQueue.count);
+    }
+    return pressure;
+}
+
+bool Iobeam::sendQueued()
+{
+    return sendQueuedPoints(mQueue.count);
+}
+
+bool Iobeam::sendDue()
+{
+    return queueDue(localMillis()) && sendQueuedPoints(mQueue.count);
+}
+
+// Whether the queued points are due to be sent and a request is allowed.
+// With batching off, any queued points are due.
+bool Iobeam::queueDue(uint64_t now)
+{
+    if (mBatcher.maxLatency > 0 &&
+            !iobeam_BatcherDue(&mBatcher, now, mQueue.count)) {
+        return false;
+    }
+    return mQueue.count > 0 && iobeam_LimiterWait(&mLimiter, now) == 0;
+}
+
+// The `count` first queued points are encoded into `mBuf` and streamed, a
+// source per series.
+bool Iobeam::sendQueuedPoints(uint16_t count)
+{
+    if (count == 0) {
+        return true;
+    }
+    const size_t contentLen = iobeam_ImportQueue(NULL, mDeviceId, mProjectId,
+        &mQueue, &mSeries, count);
+
+    const uint64_t began = localMillis();
+    const uint32_t written = mStats.write.total;
+    uint64_t start;
+    if (!startImport(contentLen, start)) {
+        return false;
+    }
+
+    write(mBuf, iobeam_ImportStart(mBuf, mDeviceId, mProjectId));
+    IobeamQueueWriter w;
+    iobeam_QueueWriterInit(&w, &mQueue, &mSeries, count);
+    while (!w.done)
+        write(mBuf, iobeam_QueueWrite(&w, mBuf, SCRATCH_BUF_LEN));
+    write(mBuf, iobeam_ImportEnd(mBuf));
+
+    bool success = finishImport(start, count, contentLen);
+    if (success) {
+        iobeam_QueuePop(&mQueue, count);
+        if (mQueue.count == 0)
+            mBacklog = false;
+        // Only whole batches are learnt from, so urgent points sent ahead
+        // of the bulk do not skew the arrival rate.
+        if (mQueue.count == 0) {
+            const uint64_t now = localMillis();
+            iobeam_BatcherSent(&mBatcher, now, count, contentLen,
+                (uint32_t) (now - began), mStats.write.total - written);
+        }
+    }
+    return success;
+}
+
+bool Iobeam::send(Series series, Timeval& t, double value, uint8_t priority)
+{
+    IobeamValue v;
+    v.type = IOBEAM_VALUE_DOUBLE;
+    v.as.d = value;
+    return sendPriority(series, t, v, priority);
+}
+
+bool Iobeam::send(Series series, Timeval& t, int value, uint8_t priority)
+{
+    IobeamValue v;
+    v.type = IOBEAM_VALUE_INT;
+    v.as.i = value;
+    return sendPriority(series, t, v, priority);
+}
+
+bool Iobeam::send(Series series, double value, uint8_t priority)
+{
+    Timeval t = {0};
+    now(t);
+    return send(series, t, value, priority);
+}
+
+bool Iobeam::send(Series series, int value, uint8_t priority)
+{
+    Timeval t = {0};
+    now(t);
+    return send(series, t, value, priority);
+}
+
+// Urgent points are kept at the front of the queue, so they are sent on
+// their own as its first `depth[IOBEAM_PRIORITY_URGENT]` points.
+bool Iobeam::sendPriority(Series series, Timeval& t, const IobeamValue& value,
+    uint8_t priority)
+{
+    size_t len;
+    if (!iobeam_SeriesSource(&mSeries, series, 1, &len)) {
+        return false;
+    }
+    if (iobeam_QueuePush(&mQueue, series, (uint64_t) t.sec * 1000 + t.msec,
+            &value, priority) < 0) {
+        return false;
+    }
+    if (priority == IOBEAM_PRIORITY_BULK) {
+        return true;
+    }
+    return sendQueuedPoints(mQueue.depth[IOBEAM_PRIORITY_URGENT]);
+}
+#endif
+
+bool Iobeam::sendRow(const IobeamField *fields, size_t n)
+{
+    Timeval t = {0};
+    now(t);
+    return sendRow(t, fields, n);
+}
+
+// The body is streamed a field at a time from `mBuf`, so rows of any
+// number of fields can be sent.
+bool Iobeam::sendRow(Timeval& t, const IobeamField *fields, size_t n)
+{
+    mRetry = false;
+    for (size_t i = 0; i < n; i++) {
+        if (iobeam_ImportEscape(NULL, fields[i].name) +
+                IOBEAM_IMPORT_SOURCE_MAX >
+                SCRATCH_BUF_LEN) {
+            return false;
+        }
+    }
+    const uint64_t time = (uint64_t) t.sec * 1000 + t.msec;
+    const size_t contentLen = iobeam_ImportRow(NULL, mDeviceId, mProjectId,
+        time, fields, n);
+
+    uint64_t start;
+    if (!startImport(contentLen, start)) {
+        return false;
+    }
+
+    write(mBuf, iobeam_ImportStart(mBuf, mDeviceId, mProjectId));
+    for (size_t i = 0; i < n; i++)
+        write(mBuf, iobeam_ImportField(mBuf, time, &fields[i], i == 0));
+    write(mBuf, iobeam_ImportEnd(mBuf));
+
+    return finishImport(start, n, contentLen);
+}
+
+bool Iobeam::sendArray(const char *key, const uint64_t *timestamps,
+    const int32_t *values, size_t n)
+{
+    IobeamBlock b = {0};
+    b.name = key;
+    b.times = timestamps;
+    b.ints = values;
+    b.n = n;
+    return sendBlock(b);
+}
+
+bool Iobeam::sendArray(const char *key, const uint64_t *timestamps,
+    const float *values, size_t n)
+{
+    IobeamBlock b = {0};
+    b.name = key;
+    b.times = timestamps;
+    b.floats = values;
+    b.n = n;
+    return sendBlock(b);
+}
+
+bool Iobeam::sendArray(const char *key, Timeval& start, uint32_t period,
+    const int32_t *values, size_t n)
+{
+    IobeamBlock b = {0};
+    b.name = key;
+    b.start = (uint64_t) start.sec * 1000 + start.msec;
+    b.period = period;
+    b.ints = values;
+    b.n = n;
+    return sendBlock(b);
+}
+
+bool Iobeam::sendArray(const char *key, Timeval& start, uint32_t period,
+    const float *values, size_t n)
+{
+    IobeamBlock b = {0};
+    b.name = key;
+    b.start = (uint64_t) start.sec * 1000 + start.msec;
+    b.period = period;
+    b.floats = values;
+    b.n = n;
+    return sendBlock(b);
+}
+
+// Points are encoded into `mBuf` as many at a time as fit, and streamed.
+bool Iobeam::sendBlock(const IobeamBlock& b)
+{
+    mRetry = false;
+    if (b.n == 0) {
+        return true;
+    }
+    if (iobeam_ImportEscape(NULL, b.name) + IOBEAM_IMPORT_SOURCE_MAX >
+            SCRATCH_BUF_LEN) {
+        return false;
+    }
+    const size_t contentLen = iobeam_ImportBlock(NULL, mDeviceId, mProjectId,
+        &b);
+
+    uint64_t start;
+    if (!startImport(contentLen, start)) {
+        return false;
+    }
+
+    write(mBuf, iobeam_ImportStart(mBuf, mDeviceId, mProjectId));
+    write(mBuf, iobeam_ImportSourceStart(mBuf, b.name, 1));
+    IobeamBlockWriter w;
+    iobeam_BlockWriterInit(&w, &b);
+    while (w.next < b.n)
+        write(mBuf, iobeam_BlockWrite(&w, mBuf, SCRATCH_BUF_LEN));
+    size_t off = iobeam_ImportSourceEnd(mBuf);
+    off += iobeam_ImportEnd(mBuf + off);
+    write(mBuf, off);
+
+    return finishImport(start, b.n, contentLen);
+}
+
+// A send that can be retried leaves `agg` as it was, see `retryable()`.
+bool Iobeam::sendAggregated(const char *key, IobeamAgg& agg, double value)
+{
+    Timeval t = {0};
+    now(t);
+    IobeamAggResult r;
+    IobeamAgg before = agg;
+    if (!iobeam_AggAdd(&agg, (uint64_t) t.sec * 1000 + t.msec, (float) value,
+            &r)) {
+        return true;
+    }
+    bool success = sendAggregate(key, r);
+    if (!success && mRetry)
+        agg = before;
+    return success;
+}
+
+bool Iobeam::flushAggregate(const char *key, IobeamAgg& agg)
+{
+    IobeamAggResult r;
+    IobeamAgg before = agg;
+    if (!iobeam_AggFlush(&agg, &r))
+        return true;
+    bool success = sendAggregate(key, r);
+    if (!success && mRetry)
+        agg = before;
+    return success;
+}
+
+// A send that can be retried leaves `f` as it was, see `retryable()`.
+bool Iobeam::sendFiltered(const char *key, IobeamFilter& f, double value)
+{
+    Timeval t = {0};
+    now(t);
+    IobeamFilterPoint pts[IOBEAM_FILTER_OUT_MAX];
+    IobeamFilter before = f;
+    size_t n = iobeam_FilterAdd(&f, (uint64_t) t.sec * 1000 + t.msec,
+        (float) value, pts);
+    bool success = sendFilteredPoints(key, pts, n);
+    if (!success && mRetry)
+        f = before;
+    return success;
+}
+
+bool Iobeam::flushFiltered(const char *key, IobeamFilter& f)
+{
+    IobeamFilterPoint pt;
+    IobeamFilter before = f;
+    size_t n = iobeam_FilterFlush(&f, &pt);
+    bool success = sendFilteredPoints(key, &pt, n);
+    if (!success && mRetry)
+        f = before;
+    return success;
+}
+
+// Sends the samples passed by a filter as one import, streaming each part
+// of the body from `mBuf`.
+bool Iobeam::sendFilteredPoints(const char *key, const IobeamFilterPoint *pts,
+    size_t n)
+{
+    mRetry = false;
+    if (n == 0)
+        return true;
+    if (iobeam_ImportEscape(NULL, key) + IMPORT_LEN(IMPORT_JSON_NAME) +
+            IMPORT_LEN(IMPORT_JSON_DATA) + 1 > SCRATCH_BUF_LEN) {
+        return false;
+    }
+
+    IobeamValue v[IOBEAM_FILTER_OUT_MAX];
+    size_t contentLen = iobeam_ImportStart(NULL, mDeviceId, mProjectId) +
+        iobeam_ImportSourceStart(NULL, key, 1) + iobeam_ImportSourceEnd(NULL) +
+        iobeam_ImportEnd(NULL);
+    for (size_t i = 0; i < n; i++) {
+        v[i].type = IOBEAM_VALUE_FLOAT;
+        v[i].as.f = pts[i].value;
+        contentLen += iobeam_ImportPoint(NULL, pts[i].time, &v[i], i == 0);
+    }
+
+    uint64_t start;
+    if (!startImport(contentLen, start)) {
+        return false;
+    }
+
+    write(mBuf, iobeam_ImportStart(mBuf, mDeviceId, mProjectId));
+    write(mBuf, iobeam_ImportSourceStart(mBuf, key, 1));
+    for (size_t i = 0; i < n; i++)
+        write(mBuf, iobeam_ImportPoint(mBuf, pts[i].time, &v[i], i == 0));
+    size_t off = iobeam_ImportSourceEnd(mBuf);
+    off += iobeam_ImportEnd(mBuf + off);
+    write(mBuf, off);
+
+    return finishImport(start, n, contentLen);
+}
+
+// Sends the aggregates of a window as one import, with a series per
+// aggregate. Each part of the body is built in `mBuf` and written out
+// before the next, so the whole body never needs to fit in RAM.
+bool Iobeam::sendAggregate(const char *key, const IobeamAggResult& r)
+{
+    mRetry = false;
+    const size_t keyLen = iobeam_ImportEscape(NULL, key);
+    if (keyLen + IOBEAM_AGG_SOURCE_MAX > SCRATCH_BUF_LEN) {
+        return false;
+    }
+    const size_t contentLen = iobeam_ImportAggregateSingle(NULL, mDeviceId,
+        mProjectId, key, &r);
+    const uint8_t points = iobeam_AggFieldCount(&r);
+
+    uint64_t start;
+    if (!startImport(contentLen, start)) {
+        return false;
+    }
+
+    write(mBuf, iobeam_ImportStart(mBuf, mDeviceId, mProjectId));
+    bool first = true;
+    for (uint8_t i = 0; i < IOBEAM_AGG_FIELDS; i++) {
+        uint8_t field = 1 << i;
+        if (!(r.fields & field))
+            continue;
+        write(mBuf, iobeam_ImportAggregateField(mBuf, key, &r, field, first));
+        first = false;
+    }
+    write(mBuf, iobeam_ImportEnd(mBuf));
+
+    return finishImport(start, points, contentLen);
+}
+
+// Connects and sends the headers of an import of `contentLen` bytes,
+// setting `start` to when they were sent. If the rate limiter holds the
+// request back, `retryable()` is set.
+bool Iobeam::startImport(size_t contentLen, uint64_t& start)
+{
+#if IOBEAM_QUEUE_LEN > 0
+    const uint32_t throttled = mLimiter.throttled;
+    if (!connect()) {
+        mRetry = mLimiter.throttled != throttled;
+        return false;
+    }
+#else
+    if (!connect()) {
+        mRetry = false;
+        return false;
+    }
+#endif
+    start = localMillis();
+    writePostHeaders(API_IMPORTS, contentLen);
+    return true;
+}
+
+// Reads the response to an import of `points` points whose body has been
+// sent. If it was refused with a 429, `retryable()` is set.
+bool Iobeam::finishImport(uint64_t start, uint32_t points, size_t contentLen)
+{
+    IOBEAM_TRACE(IOBEAM_TRACE_IMPORT, points, contentLen);
+    bool success = processResponse(200, NULL, NULL);
+    if (success) {
+        mStats.pointsSent += points;
+        if (mServerDate > 0)
+            addDateSample(start);
+    } else {
+        mRetry = mStats.lastStatus == 429;
+    }
+    return success;
 }
 
 // Writes the POST header for API calls for a resource.
 void Iobeam::writePostHeaders(const char *resource, size_t contentLen)
 {
     startPost(resource);
-    _iobeam_WriteCommonHeaders(this, callWrite, mBuf, SCRATCH_BUF_LEN);
-    _iobeam_WriteContentLengthHeader(this, callWrite, mBuf,
-        SCRATCH_BUF_LEN, contentLen);
+    writeCommonHeaders(true, contentLen);
     writeTokenHeader();
-    _iobeam_EndHeaders(this, callWrite);
+    write((char *) HEADER_END, sizeof(HEADER_END) - 1);
 }
 
-void Iobeam::startHeaders(const char *method, const char *resource)
+// Writes the headers every request has, plus the content-length of ones
+// with a body, built in `mBuf` in one go. They have a fixed size, so they
+// always fit.
+void Iobeam::writeCommonHeaders(bool hasBody, size_t contentLen)
 {
-    int offset = 0;
+    HttpBuilder b;
+    httpBuilderInit(&b, mBuf, SCRATCH_BUF_LEN);
+    _iobeam_AppendCommonHeaders(&b);
+    if (hasBody) {
+        httpAppendHeaderUInt(&b, HTTP_HEADER_CONTENT_LENGTH,
+            sizeof(HTTP_HEADER_CONTENT_LENGTH) - 1, contentLen);
+    }
+    write(mBuf, b.len);
+}
 
-    offset += readStringFromPgm(mBuf, SCRATCH_BUF_LEN, method);
-    offset += readStringFromPgm(mBuf + offset, SCRATCH_BUF_LEN - offset,
-        resource);
-    offset += readStringFromPgm(mBuf + offset, SCRATCH_BUF_LEN - offset,
-        HTTP11);
-    memcpy(mBuf + offset, HEADER_END, sizeof(HEADER_END) - 1);
-    write(mBuf, offset + 2);   
+void Iobeam::startHeaders(const char *method, const char *resource)
+{
+    writePgmString(method);
+    writePgmString(resource);
+    writePgmString(HTTP11);
+    write((char *) HEADER_END, sizeof(HEADER_END) - 1);
 }
 
 void Iobeam::startGet(const char *resource)
@@ -281,14 +1039,9 @@ void Iobeam::startPost(const char *resource)
 // We write our own token header write so as to save a copy to RAM.
 void Iobeam::writeTokenHeader()
 {
-    int offset = 0;
-    memset(mBuf, '\0', SCRATCH_BUF_LEN);
-
-    offset += readStringFromPgm(mBuf, SCRATCH_BUF_LEN, HTTP_TOKEN_PREFIX);
-    offset += readStringFromPgm(mBuf + offset, SCRATCH_BUF_LEN - offset,
-        mToken);
-    memcpy(mBuf + offset, HEADER_END, sizeof(HEADER_END) - 1);
-    write(mBuf, offset + 2);
+    writePgmString(HTTP_TOKEN_PREFIX);
+    writePgmString(mToken);
+    write((char *) HEADER_END, sizeof(HEADER_END) - 1);
 }
 
 int Iobeam::write(char *msg, size_t msgLen)
@@ -296,49 +1049,128 @@ int Iobeam::write(char *msg, size_t msgLen)
     return write((const uint8_t *) msg, msgLen);
 }
 
+// Queues `msg` to be sent. Small writes are gathered in `mChunk` so they
+// go out to the client together; ones that do not fit are written
+// directly. `flush()` sends whatever is left.
 int Iobeam::write(const uint8_t *msg, size_t msgLen) 
 {
-    mClient.write(msg, msgLen);
     IOBEAM_VERBOSE_W(msg, msgLen);
+    if (mChunkLen + msgLen > IOBEAM_CHUNK_LEN) {
+        flush();
+        if (msgLen >= IOBEAM_CHUNK_LEN) {
+            size_t sent = mClient.write(msg, msgLen);
+            mStats.bytesSent += sent;
+            IOBEAM_TRACE(IOBEAM_TRACE_SEND, msgLen, sent);
+            return msgLen;
+        }
+    }
+    memcpy(mChunk + mChunkLen, msg, msgLen);
+    mChunkLen += msgLen;
     return msgLen;
 }
 
+// Streams `len` bytes from PROGMEM to the client, a chunk at a time, so
+// constants never need a copy in RAM.
+void Iobeam::writePgm(const char *src, size_t len)
+{
+    while (len > 0) {
+        if (mChunkLen == IOBEAM_CHUNK_LEN)
+            flush();
+        size_t n = IOBEAM_CHUNK_LEN - mChunkLen;
+        if (n > len)
+            n = len;
+        memcpy_P(mChunk + mChunkLen, src, n);
+        IOBEAM_VERBOSE_W(mChunk + mChunkLen, n);
+        mChunkLen += n;
+        src += n;
+        len -= n;
+    }
+}
+
+void Iobeam::writePgmString(const char *src)
+{
+    writePgm(src, strlen_P(src));
+}
+
+void Iobeam::flush()
+{
+    if (mChunkLen > 0) {
+        size_t sent = mClient.write((const uint8_t *) mChunk, mChunkLen);
+        mStats.bytesSent += sent;
+        IOBEAM_TRACE(IOBEAM_TRACE_SEND, mChunkLen, sent);
+        mChunkLen = 0;
+    }
+}
+
 bool Iobeam::processResponse(int code, char *bodyPtr, uint32_t *bodyLen)
 {
     // First check the response code. If wrong, close connection and
     // return as unsuccessful.
     bool correctCode = false;
-    int ret = readLine(mBuf, SCRATCH_BUF_LEN);
+    flush();
+    uint32_t now = millis();
+    iobeam_LatencyAdd(&mStats.write, now - mReqMark);
+    mReqMark = now;
+
+    while (!mClient.available() && mClient.connected());
+    iobeam_LatencyAdd(&mStats.firstByte, millis() - mReqMark);
+    readLine(mBuf, SCRATCH_BUF_LEN);
     int returnCode = parseResponseCode(mBuf);
     correctCode = returnCode == code;
-    if (!correctCode) {
-        mClient.stop();
+    IOBEAM_TRACE(IOBEAM_TRACE_STATUS, returnCode, code);
+    // A 429 says how long to back off in its headers, so those are read
+    // before giving up on the request.
+    const bool limited = !correctCode && returnCode == 429;
+    if (!correctCode && !limited) {
+        stop(returnCode > 0 ? returnCode : IOBEAM_STATUS_NO_RESPONSE, false);
         IOBEAM_VERBOSE("Wrong code received: ");
         IOBEAM_VERBOSE(returnCode);
         IOBEAM_VERBOSE("\n");
         return false;
     }
 
-    // Extract the body if caller has provided a pointer for it to go,
-    // otherwise we're done.
-    if (bodyPtr) {
-        uint32_t contentLen = 0;
-        while (1) {
-            ret = readLine(mBuf, SCRATCH_BUF_LEN);
-            if (ret <= 0) // err or finished headers
-                break;
-
+    // Go through the headers if the caller has provided a pointer for the
+    // body to go, we want the server's time or its rate limits, otherwise
+    // we're done.
+    uint32_t contentLen = 0;
+    IobeamLimitHeaders limits = {0};
+    mServerDate = 0;
+#if IOBEAM_QUEUE_LEN > 0
+    const bool headersRead = bodyPtr || mDateSync || limited ||
+        mLimiter.period > 0;
+#else
+    const bool headersRead = bodyPtr || mDateSync || limited;
+#endif
+    if (headersRead) {
+        while (readLine(mBuf, SCRATCH_BUF_LEN) > 0) {  // err or finished
             int temp = parseContentLength(mBuf);
             if (temp >= 0) {
                 contentLen = (uint32_t) temp;
-                break;
+            } else if (!iobeam_LimiterHeader(&limits, mBuf) &&
+                    (mDateSync || limited)) {
+                uint32_t date = parseDate(mBuf);
+                if (date > 0)
+                    mServerDate = date;
             }
         }
+#if IOBEAM_QUEUE_LEN > 0
+        iobeam_LimiterResponse(&mLimiter, localMillis(), returnCode, &limits,
+            mServerDate);
+#endif
+    }
+    if (limited) {
+#if IOBEAM_QUEUE_LEN > 0
+        mBacklog = true;
+#endif
+        stop(returnCode, false);
+        IOBEAM_VERBOSE("Rate limited by server.\n");
+        return false;
+    }
 
+    if (bodyPtr) {
         *bodyLen = contentLen;
-        if (bodyPtr && contentLen > 0) {
-            while(readLine(mBuf, SCRATCH_BUF_LEN) > 0);  // skips to body
-
+        mStats.bytesReceived += contentLen;
+        if (contentLen > 0) {
             int i = 0;
             while (i < contentLen) {
                 if (mClient.available() > 0) {
@@ -351,14 +1183,29 @@ bool Iobeam::processResponse(int code, char *bodyPtr, uint32_t *bodyLen)
         }
     } else {
         // The YunClient is broken in that it doesn't clear its buffers on
-        // stop() calls. So we must read the whole message to not have
-        // issues on the next request.
+        // stop() calls. So we must read the whole message, headers (unless
+        // they were read above) and body, to not have issues on the next
+        // request.
         // TODO: Write a client that extends YunClient with fixes.
         #ifdef ARDUINO_AVR_YUN
-            while(readLine(mBuf, SCRATCH_BUF_LEN) > 0);    
+            if (!headersRead) {
+                while (readLine(mBuf, SCRATCH_BUF_LEN) > 0) {
+                    int temp = parseContentLength(mBuf);
+                    if (temp >= 0)
+                        contentLen = (uint32_t) temp;
+                }
+            }
+            for (uint32_t i = 0; i < contentLen; ) {
+                if (mClient.available() > 0) {
+                    mClient.read();
+                    i++;
+                } else if (!mClient.connected()) {
+                    break;
+                }
+            }
         #endif
     }
 
-    mClient.stop();
+    stop(returnCode, true);
     return true;
 }
@@ -0,0 +1,94 @@
+#include "../include/iobeam_batch.h"
+
+#include <string.h>
+
+// Weight the estimates give each new request, so they follow a link whose
+// speed drifts within ten or so requests.
+#define IOBEAM_BATCH_GAIN 0.125f
+
+// A round trip this much longer or shorter than the estimate, in ms or as
+// a fraction of it (the larger), means the link has changed, so the
+// estimate starts over from it.
+#define IOBEAM_BATCH_CHANGE_MS 20.0f
+#define IOBEAM_BATCH_CHANGE    0.5f
+
+void iobeam_BatcherInit(IobeamBatcher *b, uint32_t maxLatency,
+        uint16_t maxPoints, uint8_t dutyPercent)
+{
+    memset(b, 0, sizeof(*b));
+    b->maxLatency = maxLatency;
+    b->maxPoints = maxPoints > 0 ? maxPoints : 1;
+    b->duty = (dutyPercent > 0 && dutyPercent <= 100 ? dutyPercent : 10) /
+            100.0f;
+    b->batch = 1;
+}
+
+int iobeam_BatcherDue(IobeamBatcher *b, uint64_t now, uint16_t pending)
+{
+    if (pending == 0) {
+        b->since = 0;
+        return 0;
+    }
+    if (b->since == 0)
+        b->since = now;
+    return pending >= b->batch || now - b->since >= b->interval;
+}
+
+// Moves the average `avg` towards `sample`.
+static inline float _iobeam_BatcherAverage(float avg, float sample)
+{
+    return avg + (sample - avg) * IOBEAM_BATCH_GAIN;
+}
+
+void iobeam_BatcherSent(IobeamBatcher *b, uint64_t now, uint16_t points,
+        uint32_t bytes, uint32_t ms, uint32_t writeMs)
+{
+    b->since = 0;
+    if (points == 0 || bytes == 0)
+        return;
+
+    float rtt = (float) (ms > writeMs ? ms - writeMs : 0);
+    float msPerByte = (float) writeMs / bytes;
+    float perPoint = (float) bytes / points;
+    float rate = b->last > 0 && now > b->last ?
+            (float) points / (float) (now - b->last) : 0;
+    if (b->requests == 0) {
+        b->rtt = rtt;
+        b->msPerByte = msPerByte;
+        b->pointBytes = perPoint;
+        b->rate = rate;
+    } else {
+        float off = rtt > b->rtt ? rtt - b->rtt : b->rtt - rtt;
+        float allowed = IOBEAM_BATCH_CHANGE * b->rtt;
+        if (off > (allowed > IOBEAM_BATCH_CHANGE_MS ? allowed :
+                IOBEAM_BATCH_CHANGE_MS)) {
+            b->rtt = rtt;
+        } else {
+            b->rtt = _iobeam_BatcherAverage(b->rtt, rtt);
+        }
+        b->msPerByte = _iobeam_BatcherAverage(b->msPerByte, msPerByte);
+        b->pointBytes = _iobeam_BatcherAverage(b->pointBytes, perPoint);
+        if (rate > 0)
+            b->rate = _iobeam_BatcherAverage(b->rate, rate);
+    }
+    b->requests++;
+    b->last = now;
+
+    // Requests for the points arriving over an interval I take
+    // rtt + msPerByte * pointBytes * rate * I, which should be duty * I.
+    // If uploading alone takes more than that, the link is the limit and
+    // batches are as large as allowed.
+    float load = b->msPerByte * b->pointBytes * b->rate;
+    float interval = b->duty > load ? b->rtt / (b->duty - load) :
+            (float) b->maxLatency;
+    if (interval > b->maxLatency)
+        interval = (float) b->maxLatency;
+    if (interval < IOBEAM_BATCH_MIN_INTERVAL)
+        interval = IOBEAM_BATCH_MIN_INTERVAL;
+    b->interval = (uint32_t) interval;
+
+    float batch = b->rate * interval;
+    if (batch > b->maxPoints)
+        batch = b->maxPoints;
+    b->batch = batch > 1 ? (uint16_t) batch : 1;
+}
@@ -5,33 +5,136 @@
 #include "uart_if.h"
 #endif
 
-#include "systick.h"
+#include "hw_types.h"
+#include "prcm.h"
 
 #define DEBUG_LEVEL 0
 #include "../../include/cc3200/iobeam.h"
 #include "../../include/iobeam_log.h"
 
+#if IOBEAM_SERIES_MAX == 0 || IOBEAM_QUEUE_LEN == 0 || IOBEAM_SCHED_MAX == 0
+#error "The CC3200 client needs the series table, send queue and scheduler"
+#endif
+
 static unsigned long _apiIp = 0;
 static int _currSock = 0;
-static uint64_t _time = 0;  // Our best estimate of global time
+static IobeamClock _clock;  // Maps getMillis() to global time
+static int _dateSync = 0;  // Whether to sync from response `Date` headers
+static uint32_t _serverDate = 0;  // `Date` of the last response, if parsed
+
+// Request statistics. `_reqStatus` follows the request in progress through
+// its phases, so whichever of them it fails in is recorded when the socket
+// is closed.
+static IobeamStats _stats;
+static uint64_t _reqStart = 0;  // before connecting
+static uint64_t _reqMark = 0;  // end of the last phase
+static int _reqStatus = IOBEAM_STATUS_NO_CONNECT;
+static int _reqOk = 0;
+
+// Scratch arena shared by every phase of a request, see IOBEAM_SCRATCH_LEN.
+#ifndef IOBEAM_NO_DEFAULT_SCRATCH
+static char _defaultScratch[IOBEAM_SCRATCH_LEN];
+static char *_scratch = _defaultScratch;
+#else
+static char *_scratch = NULL;
+#endif
+#define RSP_BODY(scratch) ((scratch) + TEMP_BUF_LEN)
 
 static uint32_t _projectId = 0;
 static char _deviceId[API_MAX_DEVICE_ID_LEN + 1] = {0};
 static const char *_projectToken;
 
-// _millis tracks how many millis has been passed since tracking starts
-static uint64_t _millis = {0};
+// Registered series, and the start of every import, which only changes
+// with the device ID. It is built on first use, so 0 means not yet.
+static IobeamSeriesTable _series;
+static char _importPrefix[IOBEAM_IMPORT_PREFIX_MAX];
+static size_t _importPrefixLen = 0;
+
+// Points of registered series waiting for `SendQueued()`.
+static IobeamQueue _queue;
 
-// Callback for SysTick to update the number of millis that passed
-static void _update_timer()
+// Limits the rate of requests, see `iobeam_SetRateLimit()`. Once a request
+// is held back or refused with a 429, single points are queued rather than
+// sent until the queue has drained.
+static IobeamLimiter _limiter;
+static int _backlog = 0;
+
+// Sizes batches of queued points, see `iobeam_SetAdaptiveBatching()`.
+static IobeamBatcher _batcher;
+
+// Tasks stepped by `iobeam_RunTasks()`.
+static IobeamSched _tasks;
+
+// Time is read on demand from the 32.768 kHz slow clock counter. It is a
+// free-running 48-bit counter that keeps going in low power modes, so unlike
+// a 1 ms SysTick it needs no interrupts and does not keep the CPU awake. It
+// also keeps counting through hibernation, which lets a saved clock state be
+// restored after waking from it; a power-on or brown-out reset restarts it.
+#define SLOW_CLK_HZ 32768
+
+static int _clockPersist = 0;  // Whether to save clock state to disk
+static uint64_t _clockSaved = 0;  // When clock state was last saved
+
+// Get the current # of millis counted by the slow clock
+static uint64_t getMillis()
 {
-    _millis += 1;
+    return (PRCMSlowClkCtrGet() * 1000) / SLOW_CLK_HZ;
 }
 
-// Get the current # of millis that have elapsed since iobeam started
-static uint64_t getMillis()
+#if IOBEAM_TRACE_LEN > 0
+// Trace events are timed in raw slow clock ticks (~30.5 us), which saves
+// the division of `getMillis()`.
+static uint32_t _iobeam_TraceClock()
+{
+    return (uint32_t) PRCMSlowClkCtrGet();
+}
+#endif
+
+static uint64_t _iobeam_SchedClock(void *ctx)
 {
-    return _millis;
+    (void) ctx;
+    return getMillis();
+}
+
+// The client's background tasks. Each job is a single step: a request
+// cannot be split, so an upload or sync holds up the other tasks for as
+// long as it takes, and a batch is the most an upload step sends.
+static int _iobeam_UploadTask(IobeamTask *t, uint64_t now, void *arg)
+{
+    (void) t;
+    (void) now;
+    (void) arg;
+    _iobeam_SendDue();
+    return IOBEAM_TASK_DONE;
+}
+
+// When the sync task should next check the clock: once the clock model
+// predicts its error will pass the tolerance, but no sooner than
+// IOBEAM_SCHED_SYNC_PERIOD ms from `now`, so a failed sync is not retried
+// back to back.
+static uint64_t _iobeam_SyncWake(uint64_t now)
+{
+    uint64_t wake = now + IOBEAM_SCHED_SYNC_PERIOD;
+    if (iobeam_ClockIsSynced(&_clock)) {
+        uint64_t next = iobeam_ClockNextSync(&_clock);
+        if (next > wake)
+            wake = next;
+    }
+    return wake;
+}
+
+// Resyncs ahead of the next send needing it, which would then wait for it.
+static int _iobeam_SyncTask(IobeamTask *t, uint64_t now, void *arg)
+{
+    (void) arg;
+    IOBEAM_TASK_BEGIN(t);
+    IOBEAM_TASK_SLEEP(t, _iobeam_SyncWake(now));
+    if (iobeam_ClockIsSynced(&_clock) && iobeam_ClockNextSync(&_clock) <= now) {
+        IOBEAM_DEBUG("Clock error %lu ms, resyncing\r\n",
+                (unsigned long) iobeam_ClockError(&_clock, now));
+        _iobeam_SyncTime();
+    }
+    IOBEAM_TASK_END(t);
 }
 
 int iobeam_Init(Iobeam *i, uint32_t projId, const char *projToken,
@@ -49,14 +152,24 @@ int iobeam_Init(Iobeam *i, uint32_t projId, const char *projToken,
             len = API_MAX_DEVICE_ID_LEN;
         memcpy(_deviceId, deviceId, len);
     } else {  // Check on disk
-        _iobeam_ReadFromDisk(_deviceId, API_MAX_DEVICE_ID_LEN);
+        _iobeam_ReadFromDisk(IOBEAM_DEVICE_FILE, _deviceId,
+                API_MAX_DEVICE_ID_LEN);
         IOBEAM_DEBUG("startup device id: %s\r\n", _deviceId);
     }
     _projectToken = projToken;
-    SysTickPeriodSet(80000);
-    SysTickIntRegister(_update_timer);
-    SysTickIntEnable();
-    SysTickEnable();
+    iobeam_ClockInit(&_clock, IOBEAM_CLOCK_DEFAULT_TOLERANCE);
+    iobeam_StatsInit(&_stats);
+    iobeam_TraceInit(_iobeam_TraceClock, SLOW_CLK_HZ);
+    iobeam_SeriesInit(&_series);
+    _importPrefixLen = 0;
+    iobeam_QueueInit(&_queue, IOBEAM_QUEUE_DROP_OLDEST);
+    iobeam_LimiterInit(&_limiter, 0, 1);
+    iobeam_BatcherInit(&_batcher, 0, 1, 0);
+    iobeam_SchedInit(&_tasks, _iobeam_SchedClock, NULL);
+    iobeam_SchedAdd(&_tasks, _iobeam_UploadTask, NULL,
+            IOBEAM_SCHED_UPLOAD_PERIOD, IOBEAM_TASK_BACKGROUND);
+    iobeam_SchedAdd(&_tasks, _iobeam_SyncTask, NULL, 0,
+            IOBEAM_TASK_BACKGROUND);
 
     i->IsRegistered = _iobeam_IsRegistered;
     i->StartTimeKeeping = _iobeam_StartTimeKeeping;
@@ -65,6 +178,31 @@ int iobeam_Init(Iobeam *i, uint32_t projId, const char *projToken,
     i->SendIntWithTime = _iobeam_SendIntWithTime;
     i->SendFloat = _iobeam_SendFloat;
     i->SendFloatWithTime = _iobeam_SendFloatWithTime;
+    i->SendSeriesInt = _iobeam_SendSeriesInt;
+    i->SendSeriesIntWithTime = _iobeam_SendSeriesIntWithTime;
+    i->SendSeriesFloat = _iobeam_SendSeriesFloat;
+    i->SendSeriesFloatWithTime = _iobeam_SendSeriesFloatWithTime;
+    i->QueueInt = _iobeam_QueueInt;
+    i->QueueIntWithTime = _iobeam_QueueIntWithTime;
+    i->QueueFloat = _iobeam_QueueFloat;
+    i->QueueFloatWithTime = _iobeam_QueueFloatWithTime;
+    i->SendQueued = _iobeam_SendQueued;
+    i->SendDue = _iobeam_SendDue;
+    i->SendPriorityInt = _iobeam_SendPriorityInt;
+    i->SendPriorityIntWithTime = _iobeam_SendPriorityIntWithTime;
+    i->SendPriorityFloat = _iobeam_SendPriorityFloat;
+    i->SendPriorityFloatWithTime = _iobeam_SendPriorityFloatWithTime;
+    i->SendRow = _iobeam_SendRow;
+    i->SendRowWithTime = _iobeam_SendRowWithTime;
+    i->SendIntArray = _iobeam_SendIntArray;
+    i->SendFloatArray = _iobeam_SendFloatArray;
+    i->SendIntArrayPeriodic = _iobeam_SendIntArrayPeriodic;
+    i->SendFloatArrayPeriodic = _iobeam_SendFloatArrayPeriodic;
+    i->SendAggregated = _iobeam_SendAggregated;
+    i->SendAggregate = _iobeam_SendAggregate;
+    i->FlushAggregate = _iobeam_FlushAggregate;
+    i->SendFiltered = _iobeam_SendFiltered;
+    i->FlushFiltered = _iobeam_FlushFiltered;
 
     return 0;
 }
@@ -74,8 +212,26 @@ static int _iobeam_IsRegistered()
     return _deviceId[0] != '\0';
 }
 
+// Starts tracking global time. If the clock is already within tolerance,
+// e.g. because its state was restored from disk, this returns immediately
+// and the clock will resync once it is no longer.
 static int _iobeam_StartTimeKeeping()
 {
+    if (iobeam_ClockIsSynced(&_clock) && !iobeam_ClockSyncDue(&_clock,
+            getMillis())) {
+        return 1;
+    }
+    return _iobeam_SyncTime();
+}
+
+// Fetches the global time from iobeam and adds it to the clock model.
+static int _iobeam_SyncTime()
+{
+    if (!_scratch) {
+        IOBEAM_ERR("No scratch arena set.\r\n");
+        return -1;
+    }
+
     _currSock = _iobeam_GetSocket();
 
     if (_currSock < 0) {
@@ -84,30 +240,227 @@ static int _iobeam_StartTimeKeeping()
         return -1;
     }
 
-    char buf[256] = {0};
     uint64_t start = getMillis();
-    _iobeam_StartGet(_iobeam_WriteSocket, buf, sizeof(buf), RESOURCE_GET_TIME,
-            sizeof(RESOURCE_GET_TIME) - 1);
-    _iobeam_WriteCommonHeaders(_iobeam_WriteSocket, buf, sizeof(buf));
-    _iobeam_WriteTokenHeader(_iobeam_WriteSocket, buf, sizeof(buf),
-            _projectToken);
-    _iobeam_EndHeaders(_iobeam_WriteSocket);
+    if (_iobeam_WriteHeaders(HTTP_METHOD_GET, sizeof(HTTP_METHOD_GET) - 1,
+            RESOURCE_GET_TIME, sizeof(RESOURCE_GET_TIME) - 1, 0, 0) < 0) {
+        _iobeam_CloseSocket();
+        return -1;
+    }
 
+    char *body = RSP_BODY(_scratch);
     uint32_t rspSize = 0;
-    int success = _iobeam_ProcessResponse(200, buf, &rspSize);
+    int success = _iobeam_ProcessResponse(200, body, &rspSize);
     if (success && rspSize > 0) {
-        uint64_t elapsed = getMillis() - start;
-        uint64_t offset = (elapsed / 2) + start;
-        _time = _iobeam_ParseServerTime(buf) - offset;
+        // The server time is assumed to be from halfway through the round
+        // trip, which is off by at most half of it.
+        uint64_t half = (getMillis() - start) / 2;
+        iobeam_ClockAddSample(&_clock, start + half,
+                _iobeam_ParseServerTime(body), (uint32_t) half);
+        IOBEAM_TRACE(IOBEAM_TRACE_SYNC, half,
+                iobeam_ClockError(&_clock, getMillis()));
+        _iobeam_SaveClock();
     }
     return success;
 }
 
+// Writes the clock state to disk, if enabled.
+static void _iobeam_SaveClock()
+{
+    if (!_clockPersist)
+        return;
+
+    IobeamClockState state;
+    iobeam_ClockSave(&_clock, &state);
+    if (_iobeam_WriteToDisk(IOBEAM_CLOCK_FILE, (char *) &state,
+            sizeof(state)) > 0) {
+        _clockSaved = getMillis();
+    }
+}
+
+// Enables saving the clock state to disk on each sync, and restores the
+// state saved by a previous boot if there is one. When waking from
+// hibernation the slow clock has kept counting, so the restored state is
+// usually good enough to send with right away, and the next sync only
+// happens once it is due. After any other reset the counter may have
+// restarted, and since a saved time that happens to be behind the new count
+// cannot be told apart from one it counted past, only the skew is restored.
+void iobeam_SetClockPersist(int enabled)
+{
+    _clockPersist = enabled;
+    if (!enabled)
+        return;
+
+    IobeamClockState state;
+    int ret = _iobeam_ReadFromDisk(IOBEAM_CLOCK_FILE, (char *) &state,
+            sizeof(state));
+    if (ret == sizeof(state)) {
+        int sameTimeBase = PRCMSysResetCauseGet() == PRCM_HIB_EXIT;
+        ret = iobeam_ClockRestore(&_clock, &state, getMillis(),
+                sameTimeBase);
+        IOBEAM_DEBUG("clock restore: %d\r\n", ret);
+    }
+}
+
+// Sets the scratch arena used for requests, which must be at least
+// IOBEAM_SCRATCH_LEN bytes and must not be used by anything else while a
+// request is in progress.
+int iobeam_SetScratch(char *arena, size_t arenaLen)
+{
+    if (arena == NULL || arenaLen < IOBEAM_SCRATCH_LEN)
+        return -1;
+
+    _scratch = arena;
+    return 0;
+}
+
+// Returns the client's request statistics, which stay valid (and keep
+// being updated) for as long as the client is used.
+const IobeamStats *iobeam_GetStats()
+{
+    return &_stats;
+}
+
+void iobeam_ResetStats()
+{
+    iobeam_StatsInit(&_stats);
+}
+
+// Sets what queueing a point does once the queue is full, see
+// iobeam_queue.h. The default is IOBEAM_QUEUE_DROP_OLDEST.
+void iobeam_SetQueuePolicy(uint8_t policy)
+{
+    _queue.policy = policy;
+}
+
+void iobeam_SetQueueWatermarks(uint16_t high, uint16_t low,
+        IobeamPressureCallback callback, void *ctx)
+{
+    iobeam_QueueSetWatermarks(&_queue, high, low, callback, ctx);
+}
+
+// The send queue, for its pressure and counts of points shed.
+const IobeamQueue *iobeam_GetQueue()
+{
+    return &_queue;
+}
+
+// Limits requests to one every `periodMs`, in bursts of up to `burst`.
+// With a period of 0, the default, only the limits the server reports in
+// its responses apply.
+void iobeam_SetRateLimit(uint32_t periodMs, uint16_t burst)
+{
+    iobeam_LimiterInit(&_limiter, periodMs, burst);
+}
+
+// The rate limiter, for how many requests it has held back.
+const IobeamLimiter *iobeam_GetLimiter()
+{
+    return &_limiter;
+}
+
+// Batches points sent one at a time, queueing them until the batch the
+// link's measured round trip and throughput call for is due, see
+// iobeam_batch.h. Points wait at most `maxLatencyMs`, and requests should
+// keep the link busy about `dutyPercent` of the time. A latency of 0, the
+// default, sends every point as it comes.
+void iobeam_SetAdaptiveBatching(uint32_t maxLatencyMs, uint8_t dutyPercent)
+{
+    iobeam_BatcherInit(&_batcher, maxLatencyMs,
+            IOBEAM_QUEUE_LEN - IOBEAM_QUEUE_LEN / 4, dutyPercent);
+}
+
+// The batch controller, for its estimates of the link and current batch.
+const IobeamBatcher *iobeam_GetBatcher()
+{
+    return &_batcher;
+}
+
+// Adds a task for `iobeam_RunTasks()` to step, see iobeam_sched.h: `run`
+// is called with `arg` for a job every `period` ms, which should be done
+// within `deadline` ms (0 for the period, IOBEAM_TASK_BACKGROUND for none).
+// Returns the task's index, or -1 if IOBEAM_SCHED_MAX are added.
+int iobeam_AddTask(IobeamTaskFn run, void *arg, uint32_t period,
+        uint32_t deadline)
+{
+    return iobeam_SchedAdd(&_tasks, run, arg, period, deadline);
+}
+
+// Runs one step of the most urgent task ready, among them the client's own
+// background tasks that send queued points once they are due and resync
+// the clock before it drifts past its tolerance. Call it from the main
+// loop instead of waiting with a delay. Returns the ms until a task is next
+// ready if none was, which it is safe to sleep for.
+uint32_t iobeam_RunTasks()
+{
+    return iobeam_SchedRun(&_tasks);
+}
+
+// Calls `callback` with `ctx` for every job done past its deadline, or
+// skipped.
+void iobeam_SetMissCallback(IobeamMissCallback callback, void *ctx)
+{
+    iobeam_SchedSetMissCallback(&_tasks, callback, ctx);
+}
+
+const IobeamSched *iobeam_GetTasks()
+{
+    return &_tasks;
+}
+
+void iobeam_SetClockTolerance(uint32_t msec)
+{
+    _clock.tolerance = msec;
+}
+
+void iobeam_SetDateSync(int enabled)
+{
+    _dateSync = enabled;
+}
+
+// Feeds the `Date` of the last response to the clock model. The header only
+// has whole seconds, so it is taken to be from the middle of that second,
+// making it a low-weight sample compared to a timestamp GET.
+static void _iobeam_AddDateSample(uint64_t requestStart)
+{
+    uint64_t half = (getMillis() - requestStart) / 2;
+    iobeam_ClockAddSample(&_clock, requestStart + half,
+            (uint64_t) _serverDate * 1000 + 500, (uint32_t) half + 500);
+    if (getMillis() - _clockSaved > IOBEAM_CLOCK_SAVE_INTERVAL)
+        _iobeam_SaveClock();
+}
+
+// Returns our best estimate of global time, first resyncing if the clock
+// model predicts more error than the tolerance allows.
+static uint64_t _iobeam_Now()
+{
+    uint64_t now = getMillis();
+    if (iobeam_ClockIsSynced(&_clock) && iobeam_ClockSyncDue(&_clock, now)) {
+        IOBEAM_DEBUG("Clock error %lu ms, resyncing\r\n",
+                (unsigned long) iobeam_ClockError(&_clock, now));
+        _iobeam_SyncTime();
+        now = getMillis();
+    }
+    return iobeam_ClockNow(&_clock, now);
+}
+
+// Returns the global time of `local`, a reading of the slow clock in ms
+// ((PRCMSlowClkCtrGet() * 1000) / 32768), e.g. when a sample was taken by
+// an interrupt. The clock is resynced first if it is due.
+uint64_t iobeam_TimeAt(uint64_t local)
+{
+    _iobeam_Now();
+    return iobeam_ClockNow(&_clock, local);
+}
+
 static int _iobeam_RegisterDevice()
 {
     if (_iobeam_IsRegistered()) {
         return 1;
     }
+    if (!_scratch) {
+        IOBEAM_ERR("No scratch arena set.\r\n");
+        return -1;
+    }
     _currSock = _iobeam_GetSocket();
 
     if (_currSock < 0) {
@@ -119,97 +472,763 @@ static int _iobeam_RegisterDevice()
     const char *fmt = ADD_DEVICE_JSON;
     const uint32_t contentLen = snprintf(NULL, 0, fmt, _projectId);
 
-    _iobeam_WritePostHeaders(RESOURCE_ADD_DEVICE,
-            sizeof(RESOURCE_ADD_DEVICE) - 1, contentLen);
+    if (_iobeam_WriteHeaders(HTTP_METHOD_POST, sizeof(HTTP_METHOD_POST) - 1,
+            RESOURCE_ADD_DEVICE, sizeof(RESOURCE_ADD_DEVICE) - 1, 1,
+            contentLen) < 0) {
+        _iobeam_CloseSocket();
+        return -1;
+    }
 
-    char buf[256] = {0};
-    snprintf(buf, contentLen + 1, fmt, _projectId);
-    _iobeam_WriteBody(_iobeam_WriteSocket, buf, contentLen);
-    IOBEAM_VERBOSE("\r\n\r\n");
+    snprintf(_scratch, contentLen + 1, fmt, _projectId);
+    _iobeam_WriteBody(_iobeam_WriteSocket, _scratch, contentLen);
 
+    char *body = RSP_BODY(_scratch);
     uint32_t rspSize = 0;
-    int success = _iobeam_ProcessResponse(201, buf, &rspSize);
+    int success = _iobeam_ProcessResponse(201, body, &rspSize);
     if (success && rspSize > 0) {
-        success = _iobeam_ParseDeviceId(_deviceId, buf);
-        success = _iobeam_WriteToDisk(_deviceId, rspSize) > 0;
+        int idLen = _iobeam_ParseDeviceId(_deviceId, body);
+        _importPrefixLen = 0;
+        success = idLen > 0 && _iobeam_WriteToDisk(IOBEAM_DEVICE_FILE,
+                _deviceId, idLen) > 0;
     }
     return success;
 }
 
-static int _iobeam_Send(const char *fmt, ...)
+// Connects and sends the headers of an import of `contentLen` bytes,
+// setting `start` to when they were sent. Returns IOBEAM_RETRY if the rate
+// limiter held the request back.
+static int _iobeam_StartImport(uint32_t contentLen, uint64_t *start)
 {
-    va_list args;
-    va_start(args, fmt);
-    const size_t contentLen = vsnprintf(NULL, 0, fmt, args);
-    va_end(args);
-
+    const uint32_t throttled = _limiter.throttled;
     _currSock = _iobeam_GetSocket();
     if (_currSock < 0) {
         IOBEAM_ERR("Unable to get TCP socket.\r\n");
         _currSock = 0;
+        return _limiter.throttled != throttled ? IOBEAM_RETRY : -1;
+    }
+
+    *start = getMillis();
+    if (_iobeam_WriteHeaders(HTTP_METHOD_POST, sizeof(HTTP_METHOD_POST) - 1,
+            RESOURCE_IMPORTS, sizeof(RESOURCE_IMPORTS) - 1, 1,
+            contentLen) < 0) {
+        _iobeam_CloseSocket();
+        return -1;
+    }
+    return 0;
+}
+
+// Reads the response to an import of `points` points whose body has been
+// sent. Returns IOBEAM_RETRY if it was refused with a 429.
+static int _iobeam_FinishImport(uint64_t start, uint32_t points,
+        uint32_t contentLen)
+{
+    IOBEAM_TRACE(IOBEAM_TRACE_IMPORT, points, contentLen);
+    int success = _iobeam_ProcessResponse(200, NULL, NULL);
+    if (success > 0) {
+        _stats.pointsSent += points;
+        if (_serverDate > 0)
+            _iobeam_AddDateSample(start);
+    } else if (_reqStatus == 429) {
+        return IOBEAM_RETRY;
+    }
+    return success;
+}
+
+// Whether single points should be queued rather than sent: when batching
+// them, and from when the rate limiter holds requests back until the
+// backlog has gone out, as one larger import once a request is allowed.
+static int _iobeam_Backlogged()
+{
+    if (iobeam_LimiterWait(&_limiter, getMillis()) > 0)
+        _backlog = 1;
+    return _batcher.maxLatency > 0 || _backlog;
+}
+
+// Queues a point and, if a request is allowed and the batch is due, sends
+// it with the rest of the queue. Returns 1 if it was sent, 0 if it was
+// kept queued, or -1 if it was not queued or sending the queue failed
+// other than with a 429 (the points stay queued).
+static int _iobeam_SendBatched(int series, uint64_t timestamp,
+        const IobeamValue *value)
+{
+    if (iobeam_QueuePush(&_queue, series, timestamp, value,
+            IOBEAM_PRIORITY_BULK) < 0) {
+        return -1;
+    }
+    int sent = _iobeam_SendDue();
+    if (sent < 0 && _reqStatus != 429)
+        return -1;
+    return sent > 0 ? 1 : 0;
+}
+
+// Keeps a point whose import was refused with a 429 to be sent later, if
+// the series can be queued. Returns 0 if it was kept, otherwise
+// IOBEAM_RETRY, as it was not sent either.
+static int _iobeam_Requeue(int series, uint64_t timestamp,
+        const IobeamValue *value)
+{
+    if (series < 0 || iobeam_QueuePush(&_queue, series, timestamp, value,
+            IOBEAM_PRIORITY_BULK) < 0) {
+        return IOBEAM_RETRY;
+    }
+    return 0;
+}
+
+// Sends a point of series `key`. Its name is interned as a series if the
+// point has to be queued. If it cannot be (the table is full or the key is
+// invalid) while requests are held back, IOBEAM_RETRY is returned rather
+// than trying a request that would be held back too.
+static int _iobeam_Send(const char *key, uint64_t timestamp,
+        const IobeamValue *value)
+{
+    if (!_scratch) {
+        IOBEAM_ERR("No scratch arena set.\r\n");
+        return -1;
+    }
+    if (_iobeam_Backlogged()) {
+        int series = iobeam_SeriesAdd(&_series, key);
+        if (series >= 0)
+            return _iobeam_SendBatched(series, timestamp, value);
+        if (_backlog)
+            return IOBEAM_RETRY;
+    }
+
+    const size_t contentLen = iobeam_ImportSingle(NULL, _deviceId, _projectId,
+            key, timestamp, value);
+    if (contentLen > IOBEAM_SCRATCH_LEN) {
+        IOBEAM_ERR("Import too large: %u bytes.\r\n", (unsigned) contentLen);
+        return -1;
+    }
+
+    uint64_t start;
+    int ret = _iobeam_StartImport(contentLen, &start);
+    if (ret < 0)
+        return ret;
+
+    // The headers are out, so the body can reuse the arena.
+    iobeam_ImportSingle(_scratch, _deviceId, _projectId, key, timestamp,
+            value);
+    _iobeam_WriteBody(_iobeam_WriteSocket, _scratch, contentLen);
+    int success = _iobeam_FinishImport(start, 1, contentLen);
+    if (success <= 0 && _reqStatus == 429)
+        return _iobeam_Requeue(iobeam_SeriesAdd(&_series, key), timestamp,
+                value);
+    return success;
+}
+
+// Registers a series to send to by handle, see iobeam_SeriesAdd(). Its
+// name is checked and escaped here, once, so sends to it do no string work
+// beyond copying. Series must be added after `iobeam_Init()`.
+int iobeam_AddSeries(const char *name)
+{
+    int handle = iobeam_SeriesAdd(&_series, name);
+    if (handle < 0)
+        IOBEAM_ERR("Unable to add series: %s\r\n", name);
+    return handle;
+}
+
+// Sends a point to a registered series. The body is put together from the
+// cached import prefix and series fragment, so only the point itself is
+// formatted.
+static int _iobeam_SendSeries(int series, uint64_t timestamp,
+        const IobeamValue *value)
+{
+    if (!_scratch) {
+        IOBEAM_ERR("No scratch arena set.\r\n");
+        return -1;
+    }
+
+    size_t sourceLen;
+    const char *source = iobeam_SeriesSource(&_series, series, 1, &sourceLen);
+    if (!source) {
+        IOBEAM_ERR("Unknown series: %d\r\n", series);
+        return -1;
+    }
+    if (_iobeam_Backlogged())
+        return _iobeam_SendBatched(series, timestamp, value);
+    if (_importPrefixLen == 0) {
+        _importPrefixLen = iobeam_ImportStart(_importPrefix, _deviceId,
+                _projectId);
+    }
+
+    char point[IOBEAM_IMPORT_POINT_MAX];
+    const size_t pointLen = iobeam_ImportPoint(point, timestamp, value, 1);
+    const size_t contentLen = _importPrefixLen + sourceLen + pointLen +
+            IMPORT_LEN(IMPORT_JSON_SOURCE_END) + IMPORT_LEN(IMPORT_JSON_END);
+    if (contentLen > IOBEAM_SCRATCH_LEN) {
+        IOBEAM_ERR("Import too large: %u bytes.\r\n", (unsigned) contentLen);
+        return -1;
+    }
+
+    uint64_t start;
+    int ret = _iobeam_StartImport(contentLen, &start);
+    if (ret < 0)
+        return ret;
+
+    size_t off = 0;
+    memcpy(_scratch, _importPrefix, _importPrefixLen);
+    off += _importPrefixLen;
+    memcpy(_scratch + off, source, sourceLen);
+    off += sourceLen;
+    memcpy(_scratch + off, point, pointLen);
+    off += pointLen;
+    off += iobeam_ImportSourceEnd(_scratch + off);
+    off += iobeam_ImportEnd(_scratch + off);
+    _iobeam_WriteBody(_iobeam_WriteSocket, _scratch, off);
+    int success = _iobeam_FinishImport(start, 1, contentLen);
+    if (success <= 0 && _reqStatus == 429)
+        return _iobeam_Requeue(series, timestamp, value);
+    return success;
+}
+
+static int _iobeam_SendSeriesInt(int series, int64_t value)
+{
+    return _iobeam_SendSeriesIntWithTime(series, _iobeam_Now(), value);
+}
+
+static int _iobeam_SendSeriesIntWithTime(int series, uint64_t timestamp,
+        int64_t value)
+{
+    IobeamValue v;
+    v.type = IOBEAM_VALUE_INT;
+    v.as.i = value;
+    return _iobeam_SendSeries(series, timestamp, &v);
+}
+
+static int _iobeam_SendSeriesFloat(int series, double value)
+{
+    return _iobeam_SendSeriesFloatWithTime(series, _iobeam_Now(), value);
+}
+
+static int _iobeam_SendSeriesFloatWithTime(int series, uint64_t timestamp,
+        double value)
+{
+    IobeamValue v;
+    v.type = IOBEAM_VALUE_DOUBLE;
+    v.as.d = value;
+    return _iobeam_SendSeries(series, timestamp, &v);
+}
+
+// For bodies built in the arena a piece at a time: writes out the `off`
+// bytes built so far if another `len` would not fit after them, and
+// returns where the next piece goes.
+static size_t _iobeam_MakeRoom(size_t off, size_t len)
+{
+    if (off + len <= IOBEAM_SCRATCH_LEN)
+        return off;
+    _iobeam_WriteSocket(_scratch, off);
+    return 0;
+}
+
+// Queues a point of a registered series to be sent by `SendQueued()`.
+// Returns the pressure on the queue (IOBEAM_PRESSURE_*), or -1 if the
+// point was not queued.
+static int _iobeam_QueuePoint(int series, uint64_t timestamp,
+        const IobeamValue *value)
+{
+    size_t len;
+    if (!iobeam_SeriesSource(&_series, series, 1, &len)) {
+        IOBEAM_ERR("Unknown series: %d\r\n", series);
+        return -1;
+    }
+    int pressure = iobeam_QueuePush(&_queue, series, timestamp, value,
+            IOBEAM_PRIORITY_BULK);
+    if (_batcher.maxLatency > 0)
+        iobeam_BatcherDue(&_batcher, getMillis(), _queue.count);
+    return pressure;
+}
+
+static int _iobeam_QueueInt(int series, int64_t value)
+{
+    return _iobeam_QueueIntWithTime(series, _iobeam_Now(), value);
+}
+
+static int _iobeam_QueueIntWithTime(int series, uint64_t timestamp,
+        int64_t value)
+{
+    IobeamValue v;
+    v.type = IOBEAM_VALUE_INT;
+    v.as.i = value;
+    return _iobeam_QueuePoint(series, timestamp, &v);
+}
+
+static int _iobeam_QueueFloat(int series, double value)
+{
+    return _iobeam_QueueFloatWithTime(series, _iobeam_Now(), value);
+}
+
+static int _iobeam_QueueFloatWithTime(int series, uint64_t timestamp,
+        double value)
+{
+    IobeamValue v;
+    v.type = IOBEAM_VALUE_DOUBLE;
+    v.as.d = value;
+    return _iobeam_QueuePoint(series, timestamp, &v);
+}
+
+// Sends the `count` first queued points in one import, with a source per
+// series, and removes them from the queue if it succeeds. Returns 0 if
+// there was nothing to send, or the rate limiter is holding requests back.
+static int _iobeam_SendQueuedPoints(uint16_t count)
+{
+    if (count == 0 || iobeam_LimiterWait(&_limiter, getMillis()) > 0)
+        return 0;
+    if (!_scratch) {
+        IOBEAM_ERR("No scratch arena set.\r\n");
+        return -1;
+    }
+
+    const size_t contentLen = iobeam_ImportQueue(NULL, _deviceId, _projectId,
+            &_queue, &_series, count);
+
+    uint64_t start;
+    const uint64_t began = getMillis();
+    const uint32_t written = _stats.write.total;
+    int ret = _iobeam_StartImport(contentLen, &start);
+    if (ret < 0)
+        return ret;
+
+    size_t off = iobeam_ImportStart(_scratch, _deviceId, _projectId);
+    IobeamQueueWriter w;
+    iobeam_QueueWriterInit(&w, &_queue, &_series, count);
+    while (!w.done) {
+        off = _iobeam_MakeRoom(off, IOBEAM_SERIES_FRAGMENT_MAX);
+        off += iobeam_QueueWrite(&w, _scratch + off,
+                IOBEAM_SCRATCH_LEN - off);
+    }
+    off = _iobeam_MakeRoom(off, IMPORT_LEN(IMPORT_JSON_END));
+    off += iobeam_ImportEnd(_scratch + off);
+    _iobeam_WriteSocket(_scratch, off);
+
+    int success = _iobeam_FinishImport(start, count, contentLen);
+    if (success > 0) {
+        iobeam_QueuePop(&_queue, count);
+        if (_queue.count == 0)
+            _backlog = 0;
+        // Only whole batches are learnt from, so urgent points sent ahead
+        // of the bulk do not skew the arrival rate.
+        if (_queue.count == 0) {
+            const uint64_t now = getMillis();
+            iobeam_BatcherSent(&_batcher, now, count, contentLen,
+                    (uint32_t) (now - began), _stats.write.total - written);
+        }
+    }
+    return success;
+}
+
+static int _iobeam_SendQueued()
+{
+    return _iobeam_SendQueuedPoints(_queue.count);
+}
+
+// Sends the queued points if the batch is due and the rate limiter allows
+// a request. With batching off, any queued points are due. Returns 0 if
+// nothing was sent.
+static int _iobeam_SendDue()
+{
+    const uint64_t now = getMillis();
+    if (_batcher.maxLatency > 0 &&
+            !iobeam_BatcherDue(&_batcher, now, _queue.count)) {
+        return 0;
+    }
+    if (iobeam_LimiterWait(&_limiter, now) > 0)
+        return 0;
+    return _iobeam_SendQueuedPoints(_queue.count);
+}
+
+// Queues a point of a registered series in the class `priority`. Bulk
+// points wait for the queue to be sent. Urgent points go ahead of them,
+// and are sent straight away in an import of only the urgent points, or
+// with the first request the rate limiter allows. Returns 1 if the point
+// was sent, 0 if it is queued, or -1 if it was not queued.
+static int _iobeam_SendPriority(int series, uint8_t priority,
+        uint64_t timestamp, const IobeamValue *value)
+{
+    size_t len;
+    if (!iobeam_SeriesSource(&_series, series, 1, &len)) {
+        IOBEAM_ERR("Unknown series: %d\r\n", series);
+        return -1;
+    }
+    if (iobeam_QueuePush(&_queue, series, timestamp, value, priority) < 0)
+        return -1;
+    if (priority == IOBEAM_PRIORITY_BULK)
+        return 0;
+    return _iobeam_SendQueuedPoints(_queue.depth[IOBEAM_PRIORITY_URGENT]) > 0
+            ? 1 : 0;
+}
+
+static int _iobeam_SendPriorityInt(int series, uint8_t priority,
+        int64_t value)
+{
+    return _iobeam_SendPriorityIntWithTime(series, priority, _iobeam_Now(),
+            value);
+}
+
+static int _iobeam_SendPriorityIntWithTime(int series, uint8_t priority,
+        uint64_t timestamp, int64_t value)
+{
+    IobeamValue v;
+    v.type = IOBEAM_VALUE_INT;
+    v.as.i = value;
+    return _iobeam_SendPriority(series, priority, timestamp, &v);
+}
+
+static int _iobeam_SendPriorityFloat(int series, uint8_t priority,
+        double value)
+{
+    return _iobeam_SendPriorityFloatWithTime(series, priority, _iobeam_Now(),
+            value);
+}
+
+static int _iobeam_SendPriorityFloatWithTime(int series, uint8_t priority,
+        uint64_t timestamp, double value)
+{
+    IobeamValue v;
+    v.type = IOBEAM_VALUE_DOUBLE;
+    v.as.d = value;
+    return _iobeam_SendPriority(series, priority, timestamp, &v);
+}
+
+static int _iobeam_SendRow(const IobeamField *fields, size_t n)
+{
+    return _iobeam_SendRowWithTime(_iobeam_Now(), fields, n);
+}
+
+// Sends the `n` values of a row, all taken at `timestamp`, as one import
+// with a series per field. The body is built and sent a field at a time,
+// so it can be larger than the arena.
+static int _iobeam_SendRowWithTime(uint64_t timestamp,
+        const IobeamField *fields, size_t n)
+{
+    if (!_scratch) {
+        IOBEAM_ERR("No scratch arena set.\r\n");
+        return -1;
+    }
+
+    size_t i;
+    for (i = 0; i < n; i++) {
+        if (iobeam_ImportEscape(NULL, fields[i].name) +
+                IOBEAM_IMPORT_SOURCE_MAX >
+                IOBEAM_SCRATCH_LEN) {
+            IOBEAM_ERR("Series name too long: %s\r\n", fields[i].name);
+            return -1;
+        }
+    }
+    const size_t contentLen = iobeam_ImportRow(NULL, _deviceId, _projectId,
+            timestamp, fields, n);
+
+    uint64_t start;
+    int ret = _iobeam_StartImport(contentLen, &start);
+    if (ret < 0)
+        return ret;
+
+    size_t off = iobeam_ImportStart(_scratch, _deviceId, _projectId);
+    for (i = 0; i < n; i++) {
+        off = _iobeam_MakeRoom(off, iobeam_ImportEscape(NULL,
+                fields[i].name) + IOBEAM_IMPORT_SOURCE_MAX);
+        off += iobeam_ImportField(_scratch + off, timestamp, &fields[i],
+                i == 0);
+    }
+    off = _iobeam_MakeRoom(off, IMPORT_LEN(IMPORT_JSON_END));
+    off += iobeam_ImportEnd(_scratch + off);
+    _iobeam_WriteSocket(_scratch, off);
+    return _iobeam_FinishImport(start, n, contentLen);
+}
+
+// Sends all the samples of a block as one import. The points are encoded
+// straight into the arena, as many as fit at a time, so blocks of any size
+// can be sent.
+static int _iobeam_SendBlock(const IobeamBlock *b)
+{
+    if (b->n == 0)
+        return 0;
+    if (!_scratch) {
+        IOBEAM_ERR("No scratch arena set.\r\n");
+        return -1;
+    }
+
+    const size_t nameLen = iobeam_ImportEscape(NULL, b->name);
+    if (nameLen + IOBEAM_IMPORT_SOURCE_MAX > IOBEAM_SCRATCH_LEN) {
+        IOBEAM_ERR("Series name too long: %s\r\n", b->name);
+        return -1;
+    }
+    const size_t contentLen = iobeam_ImportBlock(NULL, _deviceId, _projectId,
+            b);
+
+    uint64_t start;
+    int ret = _iobeam_StartImport(contentLen, &start);
+    if (ret < 0)
+        return ret;
+
+    size_t off = iobeam_ImportStart(_scratch, _deviceId, _projectId);
+    off = _iobeam_MakeRoom(off, nameLen + IOBEAM_IMPORT_SOURCE_MAX);
+    off += iobeam_ImportSourceStart(_scratch + off, b->name, 1);
+    IobeamBlockWriter w;
+    iobeam_BlockWriterInit(&w, b);
+    while (w.next < b->n) {
+        off = _iobeam_MakeRoom(off, IOBEAM_IMPORT_POINT_MAX);
+        off += iobeam_BlockWrite(&w, _scratch + off,
+                IOBEAM_SCRATCH_LEN - off);
+    }
+    off = _iobeam_MakeRoom(off, IMPORT_LEN(IMPORT_JSON_SOURCE_END) +
+            IMPORT_LEN(IMPORT_JSON_END));
+    off += iobeam_ImportSourceEnd(_scratch + off);
+    off += iobeam_ImportEnd(_scratch + off);
+    _iobeam_WriteSocket(_scratch, off);
+    return _iobeam_FinishImport(start, b->n, contentLen);
+}
+
+static int _iobeam_SendIntArray(const char *key, const uint64_t *timestamps,
+        const int32_t *values, size_t n)
+{
+    IobeamBlock b = {0};
+    b.name = key;
+    b.times = timestamps;
+    b.ints = values;
+    b.n = n;
+    return _iobeam_SendBlock(&b);
+}
+
+static int _iobeam_SendFloatArray(const char *key, const uint64_t *timestamps,
+        const float *values, size_t n)
+{
+    IobeamBlock b = {0};
+    b.name = key;
+    b.times = timestamps;
+    b.floats = values;
+    b.n = n;
+    return _iobeam_SendBlock(&b);
+}
+
+static int _iobeam_SendIntArrayPeriodic(const char *key, uint64_t start,
+        uint32_t period, const int32_t *values, size_t n)
+{
+    IobeamBlock b = {0};
+    b.name = key;
+    b.start = start;
+    b.period = period;
+    b.ints = values;
+    b.n = n;
+    return _iobeam_SendBlock(&b);
+}
+
+static int _iobeam_SendFloatArrayPeriodic(const char *key, uint64_t start,
+        uint32_t period, const float *values, size_t n)
+{
+    IobeamBlock b = {0};
+    b.name = key;
+    b.start = start;
+    b.period = period;
+    b.floats = values;
+    b.n = n;
+    return _iobeam_SendBlock(&b);
+}
+
+// Sends the aggregates of a finished window as one import, with a series
+// per aggregate. The body can be larger than the arena, so it is built and
+// sent a few sources at a time.
+static int _iobeam_SendAggregate(const char *key, const IobeamAggResult *r)
+{
+    if (!_scratch) {
+        IOBEAM_ERR("No scratch arena set.\r\n");
+        return -1;
+    }
+
+    const size_t keyLen = iobeam_ImportEscape(NULL, key);
+    if (keyLen + IOBEAM_AGG_SOURCE_MAX > IOBEAM_SCRATCH_LEN) {
+        IOBEAM_ERR("Series name too long: %s\r\n", key);
+        return -1;
+    }
+    const size_t contentLen = iobeam_ImportAggregateSingle(NULL, _deviceId,
+            _projectId, key, r);
+
+    uint64_t start;
+    int ret = _iobeam_StartImport(contentLen, &start);
+    if (ret < 0)
+        return ret;
+
+    size_t off = iobeam_ImportStart(_scratch, _deviceId, _projectId);
+    int first = 1;
+    uint8_t i;
+    for (i = 0; i < IOBEAM_AGG_FIELDS; i++) {
+        uint8_t field = 1 << i;
+        if (!(r->fields & field))
+            continue;
+        off = _iobeam_MakeRoom(off, keyLen + IOBEAM_AGG_SOURCE_MAX);
+        off += iobeam_ImportAggregateField(_scratch + off, key, r, field,
+                first);
+        first = 0;
+    }
+    off = _iobeam_MakeRoom(off, IMPORT_LEN(IMPORT_JSON_END));
+    off += iobeam_ImportEnd(_scratch + off);
+    _iobeam_WriteSocket(_scratch, off);
+    return _iobeam_FinishImport(start, iobeam_AggFieldCount(r), contentLen);
+}
+
+// Encodes an import of the filtered samples `pts` of series `key`.
+static size_t _iobeam_EncodeFiltered(char *dst, const char *key,
+        const IobeamFilterPoint *pts, size_t n)
+{
+    size_t off = iobeam_ImportStart(dst, _deviceId, _projectId);
+    off += iobeam_ImportSourceStart(dst ? dst + off : NULL, key, 1);
+    size_t i;
+    for (i = 0; i < n; i++) {
+        IobeamValue v;
+        v.type = IOBEAM_VALUE_FLOAT;
+        v.as.f = pts[i].value;
+        off += iobeam_ImportPoint(dst ? dst + off : NULL, pts[i].time, &v,
+                i == 0);
+    }
+    off += iobeam_ImportSourceEnd(dst ? dst + off : NULL);
+    off += iobeam_ImportEnd(dst ? dst + off : NULL);
+    return off;
+}
+
+static int _iobeam_SendFilteredPoints(const char *key,
+        const IobeamFilterPoint *pts, size_t n)
+{
+    if (n == 0)
+        return 0;
+    if (!_scratch) {
+        IOBEAM_ERR("No scratch arena set.\r\n");
+        return -1;
+    }
+
+    const size_t contentLen = _iobeam_EncodeFiltered(NULL, key, pts, n);
+    if (contentLen > IOBEAM_SCRATCH_LEN) {
+        IOBEAM_ERR("Import too large: %u bytes.\r\n", (unsigned) contentLen);
         return -1;
     }
 
-    _iobeam_WritePostHeaders(RESOURCE_IMPORTS, sizeof(RESOURCE_IMPORTS) - 1,
-            contentLen);
+    uint64_t start;
+    int ret = _iobeam_StartImport(contentLen, &start);
+    if (ret < 0)
+        return ret;
+
+    _iobeam_EncodeFiltered(_scratch, key, pts, n);
+    _iobeam_WriteBody(_iobeam_WriteSocket, _scratch, contentLen);
+    return _iobeam_FinishImport(start, n, contentLen);
+}
+
+// Adds a sample to the change detection filter `f`, timestamped with
+// global time, and sends whatever samples it passes. Returns 0 if the
+// filter suppressed them all. If IOBEAM_RETRY is returned, `f` is left as
+// it was, so the sample can be added again later.
+static int _iobeam_SendFiltered(const char *key, IobeamFilter *f,
+        double value)
+{
+    IobeamFilterPoint pts[IOBEAM_FILTER_OUT_MAX];
+    IobeamFilter before = *f;
+    size_t n = iobeam_FilterAdd(f, _iobeam_Now(), (float) value, pts);
+    int ret = _iobeam_SendFilteredPoints(key, pts, n);
+    if (ret == IOBEAM_RETRY)
+        *f = before;
+    return ret;
+}
 
-    char buf[256] = {0};
-    va_start(args, fmt);
-    vsnprintf(buf, contentLen + 1, fmt, args);
-    _iobeam_WriteBody(_iobeam_WriteSocket, buf, contentLen);
-    va_end(args);
+// Sends the sample `f` is holding back, if any, e.g. before sleeping.
+static int _iobeam_FlushFiltered(const char *key, IobeamFilter *f)
+{
+    IobeamFilterPoint pt;
+    IobeamFilter before = *f;
+    size_t n = iobeam_FilterFlush(f, &pt);
+    int ret = _iobeam_SendFilteredPoints(key, &pt, n);
+    if (ret == IOBEAM_RETRY)
+        *f = before;
+    return ret;
+}
 
-    IOBEAM_VERBOSE("\r\n\r\n");
-    return _iobeam_ProcessResponse(200, NULL, NULL);
+// Adds a sample to `agg`, timestamped with global time. Only once it
+// finishes a window are that window's aggregates sent, so this returns 0
+// if nothing was sent. If IOBEAM_RETRY is returned, `agg` is left as it
+// was, so the sample can be added again later.
+static int _iobeam_SendAggregated(const char *key, IobeamAgg *agg,
+        double value)
+{
+    IobeamAggResult r;
+    IobeamAgg before = *agg;
+    if (!iobeam_AggAdd(agg, _iobeam_Now(), (float) value, &r))
+        return 0;
+    int ret = _iobeam_SendAggregate(key, &r);
+    if (ret == IOBEAM_RETRY)
+        *agg = before;
+    return ret;
+}
+
+// Sends the aggregates of the unfinished window of `agg`, if it has any
+// samples, e.g. before going to sleep.
+static int _iobeam_FlushAggregate(const char *key, IobeamAgg *agg)
+{
+    IobeamAggResult r;
+    IobeamAgg before = *agg;
+    if (!iobeam_AggFlush(agg, &r))
+        return 0;
+    int ret = _iobeam_SendAggregate(key, &r);
+    if (ret == IOBEAM_RETRY)
+        *agg = before;
+    return ret;
 }
 
 static int _iobeam_SendInt(const char *key, int64_t value)
 {
-    return _iobeam_SendIntWithTime(key, _time + getMillis(), value);
+    return _iobeam_SendIntWithTime(key, _iobeam_Now(), value);
 }
 
 static int _iobeam_SendIntWithTime(const char *key, uint64_t timestamp,
         int64_t value)
 {
-#define FMT_SIZE (sizeof(IMPORT_JSON_START) + sizeof(IMPORT_JSON_INT))
-    char format[FMT_SIZE] = {0};
-    memcpy(format, IMPORT_JSON_START, sizeof(IMPORT_JSON_START) - 1);
-    memcpy(format + sizeof(IMPORT_JSON_START) - 1, IMPORT_JSON_INT,
-            sizeof(IMPORT_JSON_INT) - 1);
-
-    return _iobeam_Send(format, _deviceId, _projectId, key, timestamp, value);
-#undef FMT_SIZE
+    IobeamValue v;
+    v.type = IOBEAM_VALUE_INT;
+    v.as.i = value;
+    return _iobeam_Send(key, timestamp, &v);
 }
 
 static int _iobeam_SendFloat(const char *key, double value)
 {
-    return _iobeam_SendFloatWithTime(key, _time + getMillis(), value);
+    return _iobeam_SendFloatWithTime(key, _iobeam_Now(), value);
 }
 
 static int _iobeam_SendFloatWithTime(const char *key, uint64_t timestamp,
         double value)
 {
-#define FMT_SIZE sizeof(IMPORT_JSON_START) + sizeof(IMPORT_JSON_FLOAT)
-    char format[FMT_SIZE];
-    memcpy(format, IMPORT_JSON_START, sizeof(IMPORT_JSON_START) - 1);
-    memcpy(format + sizeof(IMPORT_JSON_START) - 1, IMPORT_JSON_FLOAT,
-            sizeof(IMPORT_JSON_FLOAT) - 1);
+    IobeamValue v;
+    v.type = IOBEAM_VALUE_DOUBLE;
+    v.as.d = value;
+    return _iobeam_Send(key, timestamp, &v);
+}
 
-    return _iobeam_Send(format, _deviceId, _projectId, key, timestamp, value);
-#undef FMT_SIZE
+// Appends the authorization header for a project token.
+static void _iobeam_AppendTokenHeader(HttpBuilder *b, const char *token)
+{
+    static const char prefix[] = HTTP_HEADER_TOKEN ": Bearer ";
+    httpAppend(b, prefix, sizeof(prefix) - 1);
+    httpAppend(b, token, strlen(token));
+    httpAppend(b, HEADER_END, sizeof(HEADER_END) - 1);
 }
 
-static void _iobeam_WritePostHeaders(char *resource, size_t resourceLen,
+// Builds the whole head of a request in the scratch arena and sends it with
+// a single write. Requests with a body also get a content-length header.
+static int _iobeam_WriteHeaders(const char *method, size_t methodLen,
+        const char *resource, size_t resourceLen, int hasBody,
         uint32_t contentLen)
 {
-    char buf[256] = {0};
-    const size_t BUF_LEN = sizeof(buf);
-    _iobeam_StartPost(_iobeam_WriteSocket, buf, BUF_LEN, resource, resourceLen);
-    _iobeam_WriteCommonHeaders(_iobeam_WriteSocket, buf, BUF_LEN);
-    _iobeam_WriteContentLengthHeader(_iobeam_WriteSocket, buf, BUF_LEN,
-            contentLen);
-    _iobeam_WriteTokenHeader(_iobeam_WriteSocket, buf, BUF_LEN, _projectToken);
-    _iobeam_EndHeaders(_iobeam_WriteSocket);
+    HttpBuilder b;
+    httpBuilderInit(&b, _scratch, IOBEAM_SCRATCH_LEN);
+    httpAppendRequestLine(&b, method, methodLen, resource, resourceLen);
+    _iobeam_AppendCommonHeaders(&b);
+    if (hasBody) {
+        httpAppendHeaderUInt(&b, HTTP_HEADER_CONTENT_LENGTH,
+                sizeof(HTTP_HEADER_CONTENT_LENGTH) - 1, contentLen);
+    }
+    _iobeam_AppendTokenHeader(&b, _projectToken);
+    httpAppendEnd(&b);
+
+    int len = httpBuilderLen(&b);
+    if (len < 0) {
+        IOBEAM_ERR("Request headers do not fit in scratch.\r\n");
+        return -1;
+    }
+    return _iobeam_WriteSocket(_scratch, len);
 }
 
 static int _iobeam_WriteSocket(char *buf, size_t bufLen)
@@ -217,8 +1236,11 @@ static int _iobeam_WriteSocket(char *buf, size_t bufLen)
     if (_currSock == 0)
         return -1;
 
-    IOBEAM_VERBOSE("%s", buf);
-    return sl_Send(_currSock, buf, bufLen, 0);
+    int ret = sl_Send(_currSock, buf, bufLen, 0);
+    IOBEAM_TRACE(IOBEAM_TRACE_SEND, bufLen, ret);
+    if (ret > 0)
+        _stats.bytesSent += ret;
+    return ret;
 }
 
 static inline char *_iobeam_MoveToNextLine(char *buf)
@@ -235,33 +1257,36 @@ static inline char *_iobeam_MoveToNextLine(char *buf)
     return pos;
 }
 
+// Reads the response into the first TEMP_BUF_LEN bytes of the scratch
+// arena. If `bodyPtr` is set, the body is copied there; it must have room
+// for IOBEAM_RSP_BODY_LEN bytes.
 static int _iobeam_ProcessResponse(int wantedCode, char *bodyPtr,
         uint32_t *bodyLen)
 {
-    char buf[TEMP_BUF_LEN] = {0};
-    size_t maxLen = sizeof(buf) - 1;
-
-    int totalBytesRead = 0;
-    int totalBytesParsed = 0;
-    int bytesParsed = 0;
+    char *buf = _scratch;
+    size_t maxLen = TEMP_BUF_LEN - 1;
+    buf[maxLen] = '\0';
 
     int correctCode = 0;
-    int unparsedBytes = _iobeam_ReadSocket(buf, maxLen, NULL, 0);
-    if (unparsedBytes < 0) {
-        _iobeam_CloseSocket();
-        return -1;
-    }
-    totalBytesRead += unparsedBytes;
+    int limited = 0;
+    IobeamLimitHeaders limits;
+    memset(&limits, 0, sizeof(limits));
+    _serverDate = 0;
+
+    // The request has been sent once its response is read
+    uint64_t now = getMillis();
+    iobeam_LatencyAdd(&_stats.write, (uint32_t) (now - _reqMark));
+    _reqMark = now;
+    _reqStatus = IOBEAM_STATUS_NO_RESPONSE;
 
-    int rspCode = parseResponseCode(buf);
-    IOBEAM_DEBUG("Rsp code %d %d\r\n", wantedCode, rspCode);
-    if (rspCode != wantedCode) {
+    int bytesInBuf = _iobeam_ReadSocket(buf, maxLen, NULL, 0);
+    if (bytesInBuf <= 0) {
         _iobeam_CloseSocket();
         return -1;
     }
-    correctCode = 1;
+    iobeam_LatencyAdd(&_stats.firstByte, (uint32_t) (getMillis() - _reqMark));
 
-    // Find the body length
+    // Check the status line, then find the body length
     char *next;
     char *prev = buf;
     int cLen = 0;
@@ -271,24 +1296,41 @@ static int _iobeam_ProcessResponse(int wantedCode, char *bodyPtr,
         // No full line left in buffer, need to read more, making sure to keep
         // data we haven't processed as well.
         if (!next) {
-            int leftover = maxLen - bytesParsed;
-            if (leftover <= 0)
-                leftover = 0;
-            unparsedBytes = _iobeam_ReadSocket(buf, maxLen, prev, leftover);
-            totalBytesRead += (unparsedBytes - leftover);
-            bytesParsed = 0;
+            int leftover = bytesInBuf - (prev - buf);
+            int ret = _iobeam_ReadSocket(buf, maxLen, prev, leftover);
+            if (ret <= leftover) {  // error, closed or line too long
+                _reqStatus = IOBEAM_STATUS_NO_RESPONSE;
+                _reqOk = 0;
+                _iobeam_CloseSocket();
+                return -1;
+            }
+            bytesInBuf = ret;
             prev = buf;
             continue;
         }
 
+        if (!correctCode && !limited) {
+            int rspCode = parseResponseCode(prev);
+            IOBEAM_TRACE(IOBEAM_TRACE_STATUS, rspCode, wantedCode);
+            if (rspCode > 0)
+                _reqStatus = rspCode;
+            _reqOk = rspCode == wantedCode;
+            // The headers of a 429 say how long to back off for
+            limited = rspCode == 429 && rspCode != wantedCode;
+            if (rspCode != wantedCode && !limited) {
+                _iobeam_CloseSocket();
+                return -1;
+            }
+            correctCode = !limited;
+            prev = next;
+            continue;
+        }
+
         int len = (next - prev) / sizeof(char);
-        bytesParsed += len;
-        totalBytesParsed += len;
         len -= 2;  // Header length: total minus \r\n (2)
 
         if (len <= 0)  // Reached the end of the headers
             break;
-        IOBEAM_VERBOSE("%s\r\n", prev);
 
         // Body length not yet known, check if this header is it
         if (cLen == 0) {
@@ -298,19 +1340,39 @@ static int _iobeam_ProcessResponse(int wantedCode, char *bodyPtr,
                     cLen = 0;
             }
         }
+        if ((_dateSync || limited) && (prev[0] == 'd' || prev[0] == 'D')) {
+            _serverDate = parseDate(prev);
+        }
+        if (prev[0] == 'r' || prev[0] == 'R' || prev[0] == 'x' ||
+                prev[0] == 'X') {
+            iobeam_LimiterHeader(&limits, prev);
+        }
         prev = next;
     }  // At this point, 'next' points to the start of the body
+    IOBEAM_TRACE(IOBEAM_TRACE_HEADERS, cLen, _serverDate);
+    iobeam_LimiterResponse(&_limiter, getMillis(), _reqStatus, &limits,
+            _serverDate);
+    if (limited) {
+        _backlog = 1;
+        _iobeam_CloseSocket();
+        return -1;
+    }
 
-    // Rsp size = header size (totalByesParsed) + body size (cLen)
-    // If they aren't equal, we still have bytes to read from buffer
-    if ((totalBytesParsed + cLen) != totalBytesRead) {
-        int leftover = maxLen - bytesParsed;
-        unparsedBytes = _iobeam_ReadSocket(buf, maxLen, next, leftover);
-        totalBytesRead += unparsedBytes - leftover;
-        next = buf;
+    // Read the rest of the body, as far as it fits in the buffer
+    int bodyInBuf = bytesInBuf - (next - buf);
+    while (bodyInBuf < cLen && bodyInBuf < (int) maxLen) {
+        int ret = _iobeam_ReadSocket(buf, maxLen, next, bodyInBuf);
+        next = buf;  // what we had is now at the start
+        if (ret <= bodyInBuf)
+            break;
+        bodyInBuf = ret;
     }
 
     if (bodyPtr && cLen > 0) {
+        if (cLen > bodyInBuf)
+            cLen = bodyInBuf;
+        if (cLen > IOBEAM_RSP_BODY_LEN - 1)
+            cLen = IOBEAM_RSP_BODY_LEN - 1;
         memcpy(bodyPtr, next, cLen);
         bodyPtr[cLen] = '\0';
         *bodyLen = cLen;
@@ -323,22 +1385,23 @@ static int _iobeam_ProcessResponse(int wantedCode, char *bodyPtr,
 static int _iobeam_ReadSocket(char *buf, size_t bufLen, char *prefix,
         size_t prefixLen)
 {
-    // Safely copy prefix to buffer
+    // The prefix is the unparsed end of `buf` itself, so it is moved
+    // rather than staged through a temporary copy.
     int offset = 0;
     if (prefixLen > 0 && prefix != NULL) {
-        char temp[TEMP_BUF_LEN];
-        memcpy(temp, prefix, prefixLen);
-        memset(buf, '\0', bufLen);
-        memcpy(buf, temp, prefixLen);
+        memmove(buf, prefix, prefixLen);
         offset += prefixLen;
     }
+    memset(buf + offset, '\0', bufLen - offset);
 
     int ret = sl_Recv(_currSock, buf + offset, bufLen - offset, 0);
+    IOBEAM_TRACE(IOBEAM_TRACE_RECV, bufLen - offset, ret);
     if (ret < 0) {
         IOBEAM_ERR("err: %d\r\n", ret);
         return ret;
     } else {
         offset += ret;
+        _stats.bytesReceived += ret;
     }
 
     return offset;
@@ -351,11 +1414,23 @@ static int _iobeam_GetSocket()
     int sock;
     int err;
 
+    if (!iobeam_LimiterTake(&_limiter, getMillis())) {
+        _backlog = 1;
+        IOBEAM_ERR("Rate limited for %u ms.\r\n",
+                (unsigned) iobeam_LimiterWait(&_limiter, getMillis()));
+        return -1;
+    }
+
+    _reqStart = getMillis();
+    _reqStatus = IOBEAM_STATUS_NO_CONNECT;
+    _reqOk = 0;
     if (_apiIp == 0) {
         err = sl_NetAppDnsGetHostByName(API_DEFAULT_SERVER,
                 sizeof(API_DEFAULT_SERVER), &_apiIp, SL_AF_INET);
-        if (err < 0)
+        if (err < 0) {
+            _iobeam_ConnectFailed(err);
             return -1;
+        }
     }
 
     //filling the TCP server socket address
@@ -367,6 +1442,7 @@ static int _iobeam_GetSocket()
     // creating a TCP socket
     sock = sl_Socket(SL_AF_INET, SL_SOCK_STREAM, 0);
     if (sock < 0) {
+        _iobeam_ConnectFailed(sock);
         return -1;
     }
 
@@ -374,16 +1450,35 @@ static int _iobeam_GetSocket()
     err = sl_Connect(sock, (SlSockAddr_t *) &sAddr, addrSize);
     if (err < 0) {
         sl_Close(sock);
+        _iobeam_ConnectFailed(err);
         return err;
     }
 
+    _reqMark = getMillis();
+    iobeam_StatsConnect(&_stats, 1, (uint32_t) (_reqMark - _reqStart));
+    IOBEAM_TRACE(IOBEAM_TRACE_CONNECT, sock, _reqMark - _reqStart);
+    _reqStatus = IOBEAM_STATUS_NO_WRITE;
     return sock;
 }
 
+// A request that could not connect never has a socket to close, so it is
+// recorded here instead.
+static void _iobeam_ConnectFailed(int err)
+{
+    IOBEAM_TRACE(IOBEAM_TRACE_CONNECT, err, getMillis() - _reqStart);
+    iobeam_StatsConnect(&_stats, 0, 0);
+    iobeam_StatsRequest(&_stats, IOBEAM_STATUS_NO_CONNECT, 0, 0);
+}
+
+// Closes the socket of the request in progress and records how it went.
 static inline void _iobeam_CloseSocket()
 {
-    if (_currSock > 0)
+    if (_currSock > 0) {
         sl_Close(_currSock);
+        uint32_t ms = (uint32_t) (getMillis() - _reqStart);
+        iobeam_StatsRequest(&_stats, _reqStatus, _reqOk, ms);
+        IOBEAM_TRACE(IOBEAM_TRACE_CLOSE, _reqStatus, ms);
+    }
     _currSock = 0;
 }
 
@@ -396,10 +1491,14 @@ void iobeam_Finish()
     _apiIp = 0;
     _projectId = 0;
     _projectToken = NULL;
-    _time = 0;
-    SysTickDisable();
-    SysTickIntDisable();
-    SysTickIntUnregister();
+    iobeam_ClockInit(&_clock, IOBEAM_CLOCK_DEFAULT_TOLERANCE);
+    _clockPersist = 0;
+    _clockSaved = 0;
     memset(_deviceId, '\0', sizeof(_deviceId));
+    iobeam_SeriesInit(&_series);
+    _importPrefixLen = 0;
+    iobeam_QueueInit(&_queue, IOBEAM_QUEUE_DROP_OLDEST);
+    iobeam_LimiterInit(&_limiter, 0, 1);
+    iobeam_BatcherInit(&_batcher, 0, 1, 0);
 }
 #endif /* #ifndef ARDUINO */
\ No newline at end of file
@@ -0,0 +1,227 @@
+#include "../include/iobeam_clock.h"
+
+#include <math.h>
+#include <string.h>
+
+#define PPM(x) ((float) (x) / 1000000.0f)
+
+// Index of the sample `age` syncs before the newest one.
+static inline int _iobeam_ClockIndex(const IobeamClock *clk, int age)
+{
+    return (clk->newest + IOBEAM_CLOCK_SAMPLES - age) % IOBEAM_CLOCK_SAMPLES;
+}
+
+void iobeam_ClockInit(IobeamClock *clk, uint32_t tolerance)
+{
+    memset(clk, 0, sizeof(IobeamClock));
+    clk->tolerance = tolerance;
+    clk->skewError = PPM(IOBEAM_CLOCK_MAX_SKEW_PPM);
+    clk->priorSkewError = clk->skewError;
+}
+
+int iobeam_ClockIsSynced(const IobeamClock *clk)
+{
+    return clk->count > 0;
+}
+
+// Weighted least squares fit of (offset - baseOffset) against
+// (local - anchor), anchored at the newest sample so that extrapolation
+// only involves small numbers.
+static void _iobeam_ClockFit(IobeamClock *clk)
+{
+    const IobeamClockSample *n = &clk->samples[clk->newest];
+    clk->anchor = n->local;
+    clk->baseOffset = n->offset;
+
+    float sw = 0, sx = 0, sy = 0;
+    int i;
+    for (i = 0; i < clk->count; i++) {
+        const IobeamClockSample *s = &clk->samples[i];
+        sw += s->weight;
+        sx += s->weight * (float) (int64_t) (s->local - clk->anchor);
+        sy += s->weight * (float) (s->offset - clk->baseOffset);
+    }
+    const float xm = sx / sw;
+    const float ym = sy / sw;
+
+    // Second pass around the centroid to avoid cancellation in float.
+    float sxx = 0, sxy = 0;
+    for (i = 0; i < clk->count; i++) {
+        const IobeamClockSample *s = &clk->samples[i];
+        float dx = (float) (int64_t) (s->local - clk->anchor) - xm;
+        float dy = (float) (s->offset - clk->baseOffset) - ym;
+        sxx += s->weight * dx * dx;
+        sxy += s->weight * dx * dy;
+    }
+
+    // The fitted skew has a weight (inverse variance) of `sxx`, so it is
+    // combined with the prior the same way.
+    const float maxSkew = PPM(IOBEAM_CLOCK_MAX_SKEW_PPM);
+    float skew = clk->priorSkew;
+    float skewErr = clk->priorSkewError;
+    if (clk->count > 1 && sxx > 0) {
+        float priorW = 1.0f / (skewErr * skewErr);
+        skew = (priorW * skew + sxy) / (priorW + sxx);
+        skewErr = 1.0f / sqrtf(priorW + sxx);
+    }
+    if (skew > maxSkew)
+        skew = maxSkew;
+    else if (skew < -maxSkew)
+        skew = -maxSkew;
+    if (skewErr > maxSkew)
+        skewErr = maxSkew;
+
+    clk->skew = skew;
+    clk->offset = ym - skew * xm;
+    clk->centroid = xm;
+    clk->baseError = 1.0f / sqrtf(sw);
+    clk->skewError = skewErr;
+}
+
+// Adds a sync result to the model. A sample taken too soon after the
+// newest one to add information about the skew is merged into it instead of
+// evicting an older sample, which keeps the samples spread over time.
+void iobeam_ClockAddSample(IobeamClock *clk, uint64_t local, uint64_t server,
+        uint32_t uncertainty)
+{
+    const float u = uncertainty > 0 ? (float) uncertainty : 1.0f;
+    const float w = 1.0f / (u * u);
+    const int64_t offset = (int64_t) (server - local);
+
+    int merge = 0;
+    if (clk->count > 0) {
+        const IobeamClockSample *n = &clk->samples[clk->newest];
+        const IobeamClockSample *o =
+                &clk->samples[_iobeam_ClockIndex(clk, clk->count - 1)];
+        int64_t gap = (int64_t) (local - n->local);
+        uint64_t span = n->local - o->local;
+
+        merge = gap <= 0 || (clk->count == IOBEAM_CLOCK_SAMPLES &&
+                (uint64_t) gap * (IOBEAM_CLOCK_SAMPLES - 1) < span);
+    }
+
+    if (merge) {
+        IobeamClockSample *n = &clk->samples[clk->newest];
+        const float total = n->weight + w;
+        const float frac = w / total;
+        n->local += (int64_t) ((float) (int64_t) (local - n->local) * frac);
+        n->offset += (int64_t) ((float) (offset - n->offset) * frac);
+        n->weight = total;
+    } else {
+        if (clk->count > 0)
+            clk->newest = (clk->newest + 1) % IOBEAM_CLOCK_SAMPLES;
+        if (clk->count < IOBEAM_CLOCK_SAMPLES)
+            clk->count++;
+
+        IobeamClockSample *n = &clk->samples[clk->newest];
+        n->local = local;
+        n->offset = offset;
+        n->weight = w;
+    }
+
+    _iobeam_ClockFit(clk);
+}
+
+// Returns the estimated server time (ms) at local time `local` (ms). Before
+// the first sync this is just `local`.
+uint64_t iobeam_ClockNow(const IobeamClock *clk, uint64_t local)
+{
+    float dx = (float) (int64_t) (local - clk->anchor);
+    float corr = clk->offset + clk->skew * dx;
+    int64_t rounded = (int64_t) (corr >= 0 ? corr + 0.5f : corr - 0.5f);
+    return local + clk->baseOffset + rounded;
+}
+
+// Predicted error (ms) at `dx` ms after the newest sample: the standard
+// error of the fit at that point, plus unmodelled drift since the last sync.
+static float _iobeam_ClockErrorAt(const IobeamClock *clk, float dx)
+{
+    float d = dx - clk->centroid;
+    float fit = sqrtf(clk->baseError * clk->baseError +
+            clk->skewError * clk->skewError * d * d);
+    return fit + PPM(IOBEAM_CLOCK_WANDER_PPM) * fabsf(dx);
+}
+
+// Returns the predicted error bound (ms) of iobeam_ClockNow at `local`.
+uint32_t iobeam_ClockError(const IobeamClock *clk, uint64_t local)
+{
+    if (clk->count == 0)
+        return UINT32_MAX;
+
+    float err = _iobeam_ClockErrorAt(clk,
+            (float) (int64_t) (local - clk->anchor));
+    if (err >= (float) UINT32_MAX)
+        return UINT32_MAX;
+    return (uint32_t) err;
+}
+
+int iobeam_ClockSyncDue(const IobeamClock *clk, uint64_t local)
+{
+    return iobeam_ClockError(clk, local) > clk->tolerance;
+}
+
+// Returns the local time (ms) at which the predicted error will exceed the
+// tolerance, i.e. when the next sync should happen.
+uint64_t iobeam_ClockNextSync(const IobeamClock *clk)
+{
+    const float tol = (float) clk->tolerance;
+    if (clk->count == 0 || _iobeam_ClockErrorAt(clk, 0) >= tol)
+        return clk->anchor;
+
+    // The error grows monotonically after the newest sample, so bisect for
+    // where it crosses the tolerance.
+    float lo = 0;
+    float hi = 1000;
+    while (_iobeam_ClockErrorAt(clk, hi) < tol && hi < 1e12f)
+        hi *= 2;
+    int i;
+    for (i = 0; i < 24; i++) {
+        float mid = (lo + hi) / 2;
+        if (_iobeam_ClockErrorAt(clk, mid) < tol)
+            lo = mid;
+        else
+            hi = mid;
+    }
+    return clk->anchor + (uint64_t) lo;
+}
+
+void iobeam_ClockSave(const IobeamClock *clk, IobeamClockState *state)
+{
+    memset(state, 0, sizeof(IobeamClockState));
+    state->magic = IOBEAM_CLOCK_STATE_MAGIC;
+    state->local = clk->anchor;
+    state->offset = (int64_t) (iobeam_ClockNow(clk, clk->anchor) - clk->anchor);
+    state->error = iobeam_ClockError(clk, clk->anchor);
+    state->skew = clk->skew;
+    state->skewError = clk->skewError;
+}
+
+// Restores a saved clock model. The skew always carries over, as it is a
+// property of the oscillator. The offset only does if the local time base
+// kept counting since the save (`sameTimeBase`, and `local` is not before the
+// saved time); it is restored as a sample with the error it had when saved,
+// which then grows as usual. Otherwise the skew is used from the next sync.
+//
+// Returns 0 if the offset was restored, 1 if only the skew was, and -1 if
+// `state` is not valid.
+int iobeam_ClockRestore(IobeamClock *clk, const IobeamClockState *state,
+        uint64_t local, int sameTimeBase)
+{
+    if (state->magic != IOBEAM_CLOCK_STATE_MAGIC || !(state->skewError > 0))
+        return -1;
+
+    // The skew wanders across reboots, never trust it more than that.
+    const float minErr = PPM(IOBEAM_CLOCK_WANDER_PPM);
+    clk->priorSkew = state->skew;
+    clk->priorSkewError = state->skewError < minErr ? minErr : state->skewError;
+
+    if (sameTimeBase && state->local <= local) {
+        iobeam_ClockAddSample(clk, state->local, state->local + state->offset,
+                state->error);
+        return 0;
+    }
+
+    if (clk->count > 0)
+        _iobeam_ClockFit(clk);
+    return 1;
+}
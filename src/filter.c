@@ -0,0 +1,103 @@
+#include "../include/iobeam_filter.h"
+
+#include <string.h>
+
+void iobeam_FilterInit(IobeamFilter *f, uint8_t mode, float absDev,
+        float relDev, uint32_t heartbeatMs)
+{
+    memset(f, 0, sizeof(*f));
+    f->mode = mode;
+    f->absDev = absDev >= 0 ? absDev : -absDev;
+    f->relDev = relDev >= 0 ? relDev : -relDev;
+    f->heartbeat = heartbeatMs;
+}
+
+// Makes `p` the last passed sample, starting a new segment from it.
+static void _iobeam_FilterPass(IobeamFilter *f, const IobeamFilterPoint *p)
+{
+    f->last = *p;
+    f->holding = 0;
+    float mag = p->value >= 0 ? p->value : -p->value;
+    f->dev = f->relDev * mag;
+    if (f->dev < f->absDev)
+        f->dev = f->absDev;
+}
+
+// Narrows the slopes a segment from `last` may have to those that keep
+// `p` within `dev` of it.
+static void _iobeam_FilterNarrow(IobeamFilter *f, const IobeamFilterPoint *p,
+        int first)
+{
+    float dt = (float) (p->time - f->last.time);
+    float low = (p->value - f->dev - f->last.value) / dt;
+    float high = (p->value + f->dev - f->last.value) / dt;
+    if (first || low > f->slopeLow)
+        f->slopeLow = low;
+    if (first || high < f->slopeHigh)
+        f->slopeHigh = high;
+}
+
+size_t iobeam_FilterAdd(IobeamFilter *f, uint64_t time, float value,
+        IobeamFilterPoint *out)
+{
+    if (value != value)  // NaN
+        return 0;
+
+    IobeamFilterPoint p;
+    p.time = time;
+    p.value = value;
+    if (!f->started) {
+        f->started = 1;
+        _iobeam_FilterPass(f, &p);
+        out[0] = p;
+        return 1;
+    }
+
+    if (f->mode == IOBEAM_FILTER_DEADBAND) {
+        float diff = value - f->last.value;
+        if (diff < 0)
+            diff = -diff;
+        int due = f->heartbeat > 0 && time - f->last.time >= f->heartbeat;
+        if (diff <= f->dev && !due)
+            return 0;
+        _iobeam_FilterPass(f, &p);
+        out[0] = p;
+        return 1;
+    }
+
+    // Swinging door. The line from `last` to the held back sample is
+    // within `dev` of every sample between them. If the line to this one
+    // would be too, it replaces the held one; otherwise the held one is
+    // passed and a new segment starts from it.
+    if (time <= (f->holding ? f->held.time : f->last.time))
+        return 0;
+
+    size_t n = 0;
+    if (f->holding) {
+        float slope = (value - f->last.value) /
+                (float) (time - f->last.time);
+        if (slope < f->slopeLow || slope > f->slopeHigh) {
+            out[n++] = f->held;
+            _iobeam_FilterPass(f, &f->held);
+        }
+    }
+    _iobeam_FilterNarrow(f, &p, !f->holding);
+    f->held = p;
+    f->holding = 1;
+
+    if (f->heartbeat > 0 && time - f->last.time >= f->heartbeat) {
+        out[n++] = p;
+        _iobeam_FilterPass(f, &p);
+    }
+    return n;
+}
+
+size_t iobeam_FilterFlush(IobeamFilter *f, IobeamFilterPoint *out)
+{
+    if (!f->holding)
+        return 0;
+
+    out[0] = f->held;
+    _iobeam_FilterPass(f, &f->held);
+    return 1;
+}
@@ -0,0 +1,734 @@
+#include "../include/iobeam_fmt.h"
+#include "../include/iobeam_pgm.h"
+
+#include <float.h>
+#include <string.h>
+
+// "00", "01", ..., "99": digits are emitted two at a time.
+static const char DIGIT_PAIRS[200] IOBEAM_PROGMEM = {
+    '0','0','0','1','0','2','0','3','0','4','0','5','0','6','0','7','0','8','0','9',
+    '1','0','1','1','1','2','1','3','1','4','1','5','1','6','1','7','1','8','1','9',
+    '2','0','2','1','2','2','2','3','2','4','2','5','2','6','2','7','2','8','2','9',
+    '3','0','3','1','3','2','3','3','3','4','3','5','3','6','3','7','3','8','3','9',
+    '4','0','4','1','4','2','4','3','4','4','4','5','4','6','4','7','4','8','4','9',
+    '5','0','5','1','5','2','5','3','5','4','5','5','5','6','5','7','5','8','5','9',
+    '6','0','6','1','6','2','6','3','6','4','6','5','6','6','6','7','6','8','6','9',
+    '7','0','7','1','7','2','7','3','7','4','7','5','7','6','7','7','7','8','7','9',
+    '8','0','8','1','8','2','8','3','8','4','8','5','8','6','8','7','8','8','8','9',
+    '9','0','9','1','9','2','9','3','9','4','9','5','9','6','9','7','9','8','9','9'
+};
+
+// Number of decimal digits in `v`. The comparisons are summed rather than
+// branched on, which compilers turn into flag-setting instructions.
+static inline size_t _iobeam_Digits32(uint32_t v)
+{
+    return 1 + (v >= 10UL) + (v >= 100UL) + (v >= 1000UL) + (v >= 10000UL) +
+            (v >= 100000UL) + (v >= 1000000UL) + (v >= 10000000UL) +
+            (v >= 100000000UL) + (v >= 1000000000UL);
+}
+
+// Writes the `len` lowest digits of `v` ending just before `end`, two at a
+// time, zero-padding if `v` has fewer digits.
+static inline void _iobeam_WriteDigits(char *end, uint32_t v, size_t len)
+{
+    while (len >= 2) {
+        uint32_t q = v / 100;
+        const char *pair = DIGIT_PAIRS + 2 * (v - q * 100);
+        *--end = (char) IOBEAM_PGM_BYTE(pair + 1);
+        *--end = (char) IOBEAM_PGM_BYTE(pair);
+        v = q;
+        len -= 2;
+    }
+    if (len)
+        *--end = (char) ('0' + v % 10);
+}
+
+size_t iobeam_FormatUInt32(char *dst, uint32_t value)
+{
+    size_t len = _iobeam_Digits32(value);
+    if (dst)
+        _iobeam_WriteDigits(dst + len, value, len);
+    return len;
+}
+
+size_t iobeam_FormatInt32(char *dst, int32_t value)
+{
+    if (value >= 0)
+        return iobeam_FormatUInt32(dst, (uint32_t) value);
+
+    if (dst)
+        *dst++ = '-';
+    return 1 + iobeam_FormatUInt32(dst, 0 - (uint32_t) value);
+}
+
+// 64-bit values are split into 8-digit chunks so only the split needs 64-bit
+// division, which is a library call on 32-bit (and 8-bit) targets.
+size_t iobeam_FormatUInt64(char *dst, uint64_t value)
+{
+    if (value <= UINT32_MAX)
+        return iobeam_FormatUInt32(dst, (uint32_t) value);
+
+    uint64_t hi = value / 100000000UL;
+    uint32_t lo = (uint32_t) (value - hi * 100000000UL);
+    size_t len;
+    if (hi <= UINT32_MAX) {
+        len = iobeam_FormatUInt32(dst, (uint32_t) hi);
+    } else {
+        uint32_t top = (uint32_t) (hi / 100000000UL);
+        uint32_t mid = (uint32_t) (hi - (uint64_t) top * 100000000UL);
+        len = iobeam_FormatUInt32(dst, top);
+        if (dst)
+            _iobeam_WriteDigits(dst + len + 8, mid, 8);
+        len += 8;
+    }
+    if (dst)
+        _iobeam_WriteDigits(dst + len + 8, lo, 8);
+    return len + 8;
+}
+
+size_t iobeam_FormatInt64(char *dst, int64_t value)
+{
+    if (value >= 0)
+        return iobeam_FormatUInt64(dst, (uint64_t) value);
+
+    if (dst)
+        *dst++ = '-';
+    return 1 + iobeam_FormatUInt64(dst, 0 - (uint64_t) value);
+}
+
+//
+// Shortest round-trip float formatting, following the Ryu algorithm
+// (Ulf Adams, "Ryu: Fast Float-to-String Conversion", PLDI 2018). The
+// decimal interval that rounds back to the input is computed with 32x64-bit
+// multiplications against precomputed powers of 5, then digits are removed
+// until the shortest representation in the interval is left.
+//
+
+#define FLOAT_MANTISSA_BITS 23
+#define FLOAT_BIAS 127
+#define FLOAT_POW5_INV_BITCOUNT 59
+#define FLOAT_POW5_BITCOUNT 61
+
+// floor(2^(pow5bits(q) - 1 + 59) / 5^q) + 1
+static const uint64_t FLOAT_POW5_INV_SPLIT[31] IOBEAM_PROGMEM = {
+    576460752303423489ULL, 461168601842738791ULL,
+    368934881474191033ULL, 295147905179352826ULL,
+    472236648286964522ULL, 377789318629571618ULL,
+    302231454903657294ULL, 483570327845851670ULL,
+    386856262276681336ULL, 309485009821345069ULL,
+    495176015714152110ULL, 396140812571321688ULL,
+    316912650057057351ULL, 507060240091291761ULL,
+    405648192073033409ULL, 324518553658426727ULL,
+    519229685853482763ULL, 415383748682786211ULL,
+    332306998946228969ULL, 531691198313966350ULL,
+    425352958651173080ULL, 340282366920938464ULL,
+    544451787073501542ULL, 435561429658801234ULL,
+    348449143727040987ULL, 557518629963265579ULL,
+    446014903970612463ULL, 356811923176489971ULL,
+    570899077082383953ULL, 456719261665907162ULL,
+    365375409332725730ULL,
+};
+
+// floor(5^i / 2^(pow5bits(i) - 61))
+static const uint64_t FLOAT_POW5_SPLIT[47] IOBEAM_PROGMEM = {
+    1152921504606846976ULL, 1441151880758558720ULL,
+    1801439850948198400ULL, 2251799813685248000ULL,
+    1407374883553280000ULL, 1759218604441600000ULL,
+    2199023255552000000ULL, 1374389534720000000ULL,
+    1717986918400000000ULL, 2147483648000000000ULL,
+    1342177280000000000ULL, 1677721600000000000ULL,
+    2097152000000000000ULL, 1310720000000000000ULL,
+    1638400000000000000ULL, 2048000000000000000ULL,
+    1280000000000000000ULL, 1600000000000000000ULL,
+    2000000000000000000ULL, 1250000000000000000ULL,
+    1562500000000000000ULL, 1953125000000000000ULL,
+    1220703125000000000ULL, 1525878906250000000ULL,
+    1907348632812500000ULL, 1192092895507812500ULL,
+    1490116119384765625ULL, 1862645149230957031ULL,
+    1164153218269348144ULL, 1455191522836685180ULL,
+    1818989403545856475ULL, 2273736754432320594ULL,
+    1421085471520200371ULL, 1776356839400250464ULL,
+    2220446049250313080ULL, 1387778780781445675ULL,
+    1734723475976807094ULL, 2168404344971008868ULL,
+    1355252715606880542ULL, 1694065894508600678ULL,
+    2117582368135750847ULL, 1323488980084844279ULL,
+    1654361225106055349ULL, 2067951531382569187ULL,
+    1292469707114105741ULL, 1615587133892632177ULL,
+    2019483917365790221ULL,
+};
+
+// ceil(log2(5^e)), or 1 for e == 0
+static inline int32_t _iobeam_Pow5Bits(int32_t e)
+{
+    return (int32_t) ((((uint32_t) e) * 1217359UL) >> 19) + 1;
+}
+
+// floor(log10(2^e))
+static inline uint32_t _iobeam_Log10Pow2(int32_t e)
+{
+    return (((uint32_t) e) * 78913UL) >> 18;
+}
+
+// floor(log10(5^e))
+static inline uint32_t _iobeam_Log10Pow5(int32_t e)
+{
+    return (((uint32_t) e) * 732923UL) >> 20;
+}
+
+static inline int _iobeam_MultipleOfPow5(uint32_t value, uint32_t p)
+{
+    uint32_t count = 0;
+    while (value % 5 == 0) {
+        value /= 5;
+        count++;
+    }
+    return count >= p;
+}
+
+static inline int _iobeam_MultipleOfPow2(uint32_t value, uint32_t p)
+{
+    return (value & ((1UL << p) - 1)) == 0;
+}
+
+// (m * table[index]) >> shift, for shift > 32
+static inline uint32_t _iobeam_MulShift(uint32_t m, const uint64_t *table,
+        uint32_t index, int32_t shift)
+{
+    uint64_t factor;
+    IOBEAM_PGM_COPY(&factor, table + index, sizeof(factor));
+
+    const uint64_t lo = (uint64_t) m * (uint32_t) factor;
+    const uint64_t hi = (uint64_t) m * (uint32_t) (factor >> 32);
+    return (uint32_t) (((lo >> 32) + hi) >> (shift - 32));
+}
+
+// Computes the shortest `*digits` * 10^`*exponent` that rounds to the
+// float with the given IEEE fields.
+static void _iobeam_FloatToDecimal(uint32_t ieeeMantissa,
+        uint32_t ieeeExponent, uint32_t *digits, int32_t *exponent)
+{
+    int32_t e2;
+    uint32_t m2;
+    if (ieeeExponent == 0) {
+        e2 = 1 - FLOAT_BIAS - FLOAT_MANTISSA_BITS - 2;
+        m2 = ieeeMantissa;
+    } else {
+        e2 = (int32_t) ieeeExponent - FLOAT_BIAS - FLOAT_MANTISSA_BITS - 2;
+        m2 = (1UL << FLOAT_MANTISSA_BITS) | ieeeMantissa;
+    }
+    const int acceptBounds = (m2 & 1) == 0;
+
+    // Interval of values that round to this float, scaled by 4.
+    const uint32_t mv = 4 * m2;
+    const uint32_t mp = 4 * m2 + 2;
+    const uint32_t mmShift = ieeeMantissa != 0 || ieeeExponent <= 1;
+    const uint32_t mm = 4 * m2 - 1 - mmShift;
+
+    // Convert the interval to decimal.
+    uint32_t vr, vp, vm;
+    int32_t e10;
+    int vmIsTrailingZeros = 0;
+    int vrIsTrailingZeros = 0;
+    uint8_t lastRemovedDigit = 0;
+    if (e2 >= 0) {
+        const uint32_t q = _iobeam_Log10Pow2(e2);
+        e10 = (int32_t) q;
+        const int32_t k = FLOAT_POW5_INV_BITCOUNT + _iobeam_Pow5Bits(q) - 1;
+        const int32_t i = -e2 + (int32_t) q + k;
+        vr = _iobeam_MulShift(mv, FLOAT_POW5_INV_SPLIT, q, i);
+        vp = _iobeam_MulShift(mp, FLOAT_POW5_INV_SPLIT, q, i);
+        vm = _iobeam_MulShift(mm, FLOAT_POW5_INV_SPLIT, q, i);
+        if (q != 0 && (vp - 1) / 10 <= vm / 10) {
+            // One removed digit is needed even if the loop below won't run.
+            const int32_t l = FLOAT_POW5_INV_BITCOUNT +
+                    _iobeam_Pow5Bits(q - 1) - 1;
+            lastRemovedDigit = (uint8_t) (_iobeam_MulShift(mv,
+                    FLOAT_POW5_INV_SPLIT, q - 1, -e2 + (int32_t) q - 1 + l) % 10);
+        }
+        if (q <= 9) {
+            // Only one of mp, mv and mm can be a multiple of 5, if any.
+            if (mv % 5 == 0)
+                vrIsTrailingZeros = _iobeam_MultipleOfPow5(mv, q);
+            else if (acceptBounds)
+                vmIsTrailingZeros = _iobeam_MultipleOfPow5(mm, q);
+            else
+                vp -= _iobeam_MultipleOfPow5(mp, q);
+        }
+    } else {
+        const uint32_t q = _iobeam_Log10Pow5(-e2);
+        e10 = (int32_t) q + e2;
+        const int32_t i = -e2 - (int32_t) q;
+        const int32_t k = _iobeam_Pow5Bits(i) - FLOAT_POW5_BITCOUNT;
+        int32_t j = (int32_t) q - k;
+        vr = _iobeam_MulShift(mv, FLOAT_POW5_SPLIT, i, j);
+        vp = _iobeam_MulShift(mp, FLOAT_POW5_SPLIT, i, j);
+        vm = _iobeam_MulShift(mm, FLOAT_POW5_SPLIT, i, j);
+        if (q != 0 && (vp - 1) / 10 <= vm / 10) {
+            j = (int32_t) q - 1 -
+                    (_iobeam_Pow5Bits(i + 1) - FLOAT_POW5_BITCOUNT);
+            lastRemovedDigit = (uint8_t) (_iobeam_MulShift(mv,
+                    FLOAT_POW5_SPLIT, i + 1, j) % 10);
+        }
+        if (q <= 1) {
+            // mv = 4 * m2 always has at least two trailing 0 bits, mm has one
+            // iff mmShift == 1 and mp = mv + 2 always has one.
+            vrIsTrailingZeros = 1;
+            if (acceptBounds)
+                vmIsTrailingZeros = mmShift == 1;
+            else
+                --vp;
+        } else if (q < 31) {
+            vrIsTrailingZeros = _iobeam_MultipleOfPow2(mv, q - 1);
+        }
+    }
+
+    // Remove digits while the interval still holds a shorter number.
+    int32_t removed = 0;
+    uint32_t output;
+    if (vmIsTrailingZeros || vrIsTrailingZeros) {
+        // Rare case, where exact ties need care.
+        while (vp / 10 > vm / 10) {
+            vmIsTrailingZeros &= vm % 10 == 0;
+            vrIsTrailingZeros &= lastRemovedDigit == 0;
+            lastRemovedDigit = (uint8_t) (vr % 10);
+            vr /= 10;
+            vp /= 10;
+            vm /= 10;
+            ++removed;
+        }
+        if (vmIsTrailingZeros) {
+            while (vm % 10 == 0) {
+                vrIsTrailingZeros &= lastRemovedDigit == 0;
+                lastRemovedDigit = (uint8_t) (vr % 10);
+                vr /= 10;
+                vp /= 10;
+                vm /= 10;
+                ++removed;
+            }
+        }
+        if (vrIsTrailingZeros && lastRemovedDigit == 5 && vr % 2 == 0)
+            lastRemovedDigit = 4;  // round half to even
+        output = vr + ((vr == vm && (!acceptBounds || !vmIsTrailingZeros)) ||
+                lastRemovedDigit >= 5);
+    } else {
+        while (vp / 10 > vm / 10) {
+            lastRemovedDigit = (uint8_t) (vr % 10);
+            vr /= 10;
+            vp /= 10;
+            vm /= 10;
+            ++removed;
+        }
+        output = vr + (vr == vm || lastRemovedDigit >= 5);
+    }
+
+    *digits = output;
+    *exponent = e10 + removed;
+}
+
+// Lays out the `len` digits at `p`, worth digits * 10^`exp`, as
+// iobeam_FormatFloat() describes. Returns the end of the text.
+static char *_iobeam_LayOutDecimal(char *p, int32_t len, int32_t exp)
+{
+    const int32_t point = len + exp;  // digits before the decimal point
+    if (point > 0 && point <= 9) {
+        if (exp >= 0) {  // ddd000.0
+            p += len;
+            memset(p, '0', exp);
+            p += exp;
+            memcpy(p, ".0", 2);
+            return p + 2;
+        }
+        // ddd.ddd
+        memmove(p + point + 1, p + point, len - point);
+        p[point] = '.';
+        return p + len + 1;
+    }
+    if (point <= 0 && point > -4) {  // 0.000ddd
+        memmove(p + 2 - point, p, len);
+        memcpy(p, "0.", 2);
+        memset(p + 2, '0', -point);
+        return p + 2 - point + len;
+    }
+
+    // d.ddde-xx
+    if (len > 1) {
+        memmove(p + 2, p + 1, len - 1);
+        p[1] = '.';
+        p += len + 1;
+    } else {
+        p += 1;
+    }
+    *p++ = 'e';
+    int32_t e = point - 1;
+    if (e < 0) {
+        *p++ = '-';
+        e = -e;
+    }
+    return p + iobeam_FormatUInt32(p, (uint32_t) e);
+}
+
+size_t iobeam_FormatFloat(char *dst, float value)
+{
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    const uint32_t ieeeMantissa = bits & ((1UL << FLOAT_MANTISSA_BITS) - 1);
+    const uint32_t ieeeExponent = (bits >> FLOAT_MANTISSA_BITS) & 0xff;
+
+    if (ieeeExponent == 0xff) {
+        if (dst)
+            memcpy(dst, "null", 4);
+        return 4;
+    }
+
+    char buf[IOBEAM_FMT_FLOAT_MAX];
+    char *p = buf;
+    if (bits >> 31)
+        *p++ = '-';
+
+    if (ieeeExponent == 0 && ieeeMantissa == 0) {
+        memcpy(p, "0.0", 3);
+        p += 3;
+    } else {
+        uint32_t digits;
+        int32_t exp;
+        _iobeam_FloatToDecimal(ieeeMantissa, ieeeExponent, &digits, &exp);
+        const int32_t len = (int32_t) _iobeam_Digits32(digits);
+        _iobeam_WriteDigits(p + len, digits, len);
+        p = _iobeam_LayOutDecimal(p, len, exp);
+    }
+
+    size_t len = (size_t) (p - buf);
+    if (dst)
+        memcpy(dst, buf, len);
+    return len;
+}
+
+#if DBL_MANT_DIG > FLT_MANT_DIG
+
+//
+// The same for doubles, which need powers of 5 to 128 bits. A table of all
+// of them would take some 10 KB, so only every 26th is kept and the others
+// are computed from it with one more multiplication, as in Ryu's small
+// table variant. The 2-bit corrections in the offset tables make the
+// computed values exactly those of the full tables.
+//
+
+#define DOUBLE_MANTISSA_BITS 52
+#define DOUBLE_BIAS 1023
+#define DOUBLE_POW5_INV_BITCOUNT 125
+#define DOUBLE_POW5_BITCOUNT 125
+#define DOUBLE_POW5_STEP 26
+
+// 5^i
+static const uint64_t DOUBLE_POW5[DOUBLE_POW5_STEP] = {
+    1ULL, 5ULL, 25ULL, 125ULL, 625ULL, 3125ULL, 15625ULL, 78125ULL,
+    390625ULL, 1953125ULL, 9765625ULL, 48828125ULL, 244140625ULL,
+    1220703125ULL, 6103515625ULL, 30517578125ULL, 152587890625ULL,
+    762939453125ULL, 3814697265625ULL, 19073486328125ULL,
+    95367431640625ULL, 476837158203125ULL, 2384185791015625ULL,
+    11920928955078125ULL, 59604644775390625ULL, 298023223876953125ULL,
+};
+
+// floor(5^i / 2^(pow5bits(i) - 125)) for every 26th i, low half first
+static const uint64_t DOUBLE_POW5_SPLIT2[13][2] = {
+    { 0ULL, 1152921504606846976ULL },
+    { 0ULL, 1490116119384765625ULL },
+    { 1032610780636961552ULL, 1925929944387235853ULL },
+    { 7910200175544436838ULL, 1244603055572228341ULL },
+    { 16941905809032713930ULL, 1608611746708759036ULL },
+    { 13024893955298202172ULL, 2079081953128979843ULL },
+    { 6607496772837067824ULL, 1343575221513417750ULL },
+    { 17332926989895652603ULL, 1736530273035216783ULL },
+    { 13037379183483547984ULL, 2244412773384604712ULL },
+    { 1605989338741628675ULL, 1450417759929778918ULL },
+    { 9630225068416591280ULL, 1874621017369538693ULL },
+    { 665883850346957067ULL, 1211445438634777304ULL },
+    { 14931890668723713708ULL, 1565756531257009982ULL },
+};
+
+// floor(2^(pow5bits(q) - 1 + 125) / 5^q) for every 26th q, low half first
+static const uint64_t DOUBLE_POW5_INV_SPLIT2[15][2] = {
+    { 0ULL, 2305843009213693952ULL },
+    { 5955668970331000883ULL, 1784059615882449851ULL },
+    { 8982663654677661701ULL, 1380349269358112757ULL },
+    { 7286864317269821293ULL, 2135987035920910082ULL },
+    { 7005857020398200552ULL, 1652639921975621497ULL },
+    { 17965325103354776696ULL, 1278668206209430417ULL },
+    { 8928596168509315047ULL, 1978643211784836272ULL },
+    { 10075671573058298857ULL, 1530901034580419511ULL },
+    { 597001226353042381ULL, 1184477304306571148ULL },
+    { 1527430471115325345ULL, 1832889850782397517ULL },
+    { 12533209867169019541ULL, 1418129833677084982ULL },
+    { 5577825024675947041ULL, 2194449627517475473ULL },
+    { 11006974540203867550ULL, 1697873161311732311ULL },
+    { 10313493231639821581ULL, 1313665730009899186ULL },
+    { 12701016819766672772ULL, 2032799256770390445ULL },
+};
+
+// Added to the low half of the computed values, 2 bits per power
+static const uint32_t DOUBLE_POW5_OFFSETS[21] = {
+    0x00000000UL, 0x00000000UL, 0x00000000UL, 0x00000000UL, 0x40000000UL,
+    0x59695995UL, 0x55545555UL, 0x56555515UL, 0x41150504UL, 0x40555410UL,
+    0x44555145UL, 0x44504540UL, 0x45555550UL, 0x40004000UL, 0x96440440UL,
+    0x55565565UL, 0x54454045UL, 0x40154151UL, 0x55559155UL, 0x51405555UL,
+    0x00000105UL,
+};
+
+static const uint32_t DOUBLE_POW5_INV_OFFSETS[19] = {
+    0x54544554UL, 0x04055545UL, 0x10041000UL, 0x00400414UL, 0x40010000UL,
+    0x41155555UL, 0x00000454UL, 0x00010044UL, 0x40000000UL, 0x44000041UL,
+    0x50454450UL, 0x55550054UL, 0x51655554UL, 0x40004000UL, 0x01000001UL,
+    0x00010500UL, 0x51515411UL, 0x05555554UL, 0x00000000UL,
+};
+
+// Low half of the 128-bit product of `a` and `b`, setting `*hi` to the
+// high half, from 32x32-bit multiplications.
+static inline uint64_t _iobeam_Mul128(uint64_t a, uint64_t b, uint64_t *hi)
+{
+    const uint64_t b00 = (uint64_t) (uint32_t) a * (uint32_t) b;
+    const uint64_t b01 = (uint64_t) (uint32_t) a * (uint32_t) (b >> 32);
+    const uint64_t b10 = (uint64_t) (uint32_t) (a >> 32) * (uint32_t) b;
+    const uint64_t b11 = (uint64_t) (uint32_t) (a >> 32) * (uint32_t) (b >> 32);
+    const uint64_t mid1 = b10 + (b00 >> 32);
+    const uint64_t mid2 = b01 + (uint32_t) mid1;
+    *hi = b11 + (mid1 >> 32) + (mid2 >> 32);
+    return (mid2 << 32) | (uint32_t) b00;
+}
+
+// (hi:lo) >> dist, for 0 < dist < 64
+static inline uint64_t _iobeam_ShiftRight128(uint64_t lo, uint64_t hi,
+        uint32_t dist)
+{
+    return (hi << (64 - dist)) | (lo >> dist);
+}
+
+// `mul` * 5^`off` >> `delta`, for the entries between those of the tables
+static inline void _iobeam_Pow5Step(const uint64_t *mul, int32_t off,
+        int32_t delta, uint64_t *result)
+{
+    const uint64_t m = DOUBLE_POW5[off];
+    uint64_t high1, high0;
+    const uint64_t low1 = _iobeam_Mul128(m, mul[1], &high1);
+    const uint64_t low0 = _iobeam_Mul128(m, mul[0], &high0);
+    const uint64_t sum = high0 + low1;
+    if (sum < high0)
+        ++high1;
+    result[0] = _iobeam_ShiftRight128(low0, sum, delta);
+    result[1] = _iobeam_ShiftRight128(sum, high1, delta);
+}
+
+// floor(5^i / 2^(pow5bits(i) - 125)), low half first
+static void _iobeam_DoublePow5(int32_t i, uint64_t *result)
+{
+    const int32_t base = i / DOUBLE_POW5_STEP;
+    const int32_t base2 = base * DOUBLE_POW5_STEP;
+    const int32_t off = i - base2;
+    const uint64_t *mul = DOUBLE_POW5_SPLIT2[base];
+    if (off == 0) {
+        result[0] = mul[0];
+        result[1] = mul[1];
+        return;
+    }
+    _iobeam_Pow5Step(mul, off, _iobeam_Pow5Bits(i) - _iobeam_Pow5Bits(base2),
+            result);
+    result[0] += (DOUBLE_POW5_OFFSETS[i / 16] >> ((i % 16) << 1)) & 3;
+}
+
+// floor(2^(pow5bits(i) - 1 + 125) / 5^i) + 1, low half first
+static void _iobeam_DoublePow5Inv(int32_t i, uint64_t *result)
+{
+    const int32_t base = (i + DOUBLE_POW5_STEP - 1) / DOUBLE_POW5_STEP;
+    const int32_t base2 = base * DOUBLE_POW5_STEP;
+    const int32_t off = base2 - i;
+    const uint64_t *mul = DOUBLE_POW5_INV_SPLIT2[base];
+    if (off == 0) {
+        result[0] = mul[0] + 1;
+        result[1] = mul[1];
+        return;
+    }
+    _iobeam_Pow5Step(mul, off, _iobeam_Pow5Bits(base2) - _iobeam_Pow5Bits(i),
+            result);
+    result[0] += 1 + ((DOUBLE_POW5_INV_OFFSETS[i / 16] >> ((i % 16) << 1)) & 3);
+}
+
+// (m * mul) >> shift, for 64 < shift < 128
+static inline uint64_t _iobeam_MulShift64(uint64_t m, const uint64_t *mul,
+        int32_t shift)
+{
+    uint64_t high1, high0;
+    const uint64_t low1 = _iobeam_Mul128(m, mul[1], &high1);
+    _iobeam_Mul128(m, mul[0], &high0);
+    const uint64_t sum = high0 + low1;
+    if (sum < high0)
+        ++high1;
+    return _iobeam_ShiftRight128(sum, high1, (uint32_t) (shift - 64));
+}
+
+static inline int _iobeam_MultipleOfPow5_64(uint64_t value, uint32_t p)
+{
+    uint32_t count = 0;
+    while (value % 5 == 0) {
+        value /= 5;
+        count++;
+    }
+    return count >= p;
+}
+
+// Computes the shortest `*digits` * 10^`*exponent` that rounds to the
+// double with the given IEEE fields, as _iobeam_FloatToDecimal() does.
+static void _iobeam_DoubleToDecimal(uint64_t ieeeMantissa,
+        uint32_t ieeeExponent, uint64_t *digits, int32_t *exponent)
+{
+    int32_t e2;
+    uint64_t m2;
+    if (ieeeExponent == 0) {
+        e2 = 1 - DOUBLE_BIAS - DOUBLE_MANTISSA_BITS - 2;
+        m2 = ieeeMantissa;
+    } else {
+        e2 = (int32_t) ieeeExponent - DOUBLE_BIAS - DOUBLE_MANTISSA_BITS - 2;
+        m2 = (1ULL << DOUBLE_MANTISSA_BITS) | ieeeMantissa;
+    }
+    const int acceptBounds = (m2 & 1) == 0;
+
+    // Interval of values that round to this double, scaled by 4.
+    const uint64_t mv = 4 * m2;
+    const uint32_t mmShift = ieeeMantissa != 0 || ieeeExponent <= 1;
+
+    // Convert the interval to decimal.
+    uint64_t vr, vp, vm;
+    uint64_t pow5[2];
+    int32_t e10;
+    int vmIsTrailingZeros = 0;
+    int vrIsTrailingZeros = 0;
+    if (e2 >= 0) {
+        // The digit the float version works out separately is kept here,
+        // by stopping one power of 10 short.
+        const uint32_t q = _iobeam_Log10Pow2(e2) - (e2 > 3);
+        e10 = (int32_t) q;
+        const int32_t k = DOUBLE_POW5_INV_BITCOUNT + _iobeam_Pow5Bits(q) - 1;
+        const int32_t i = -e2 + (int32_t) q + k;
+        _iobeam_DoublePow5Inv(q, pow5);
+        vr = _iobeam_MulShift64(4 * m2, pow5, i);
+        vp = _iobeam_MulShift64(4 * m2 + 2, pow5, i);
+        vm = _iobeam_MulShift64(4 * m2 - 1 - mmShift, pow5, i);
+        if (q <= 21) {
+            // Only one of mp, mv and mm can be a multiple of 5, if any.
+            if (mv % 5 == 0)
+                vrIsTrailingZeros = _iobeam_MultipleOfPow5_64(mv, q);
+            else if (acceptBounds)
+                vmIsTrailingZeros = _iobeam_MultipleOfPow5_64(
+                        mv - 1 - mmShift, q);
+            else
+                vp -= _iobeam_MultipleOfPow5_64(mv + 2, q);
+        }
+    } else {
+        const uint32_t q = _iobeam_Log10Pow5(-e2) - (-e2 > 1);
+        e10 = (int32_t) q + e2;
+        const int32_t i = -e2 - (int32_t) q;
+        const int32_t k = _iobeam_Pow5Bits(i) - DOUBLE_POW5_BITCOUNT;
+        const int32_t j = (int32_t) q - k;
+        _iobeam_DoublePow5(i, pow5);
+        vr = _iobeam_MulShift64(4 * m2, pow5, j);
+        vp = _iobeam_MulShift64(4 * m2 + 2, pow5, j);
+        vm = _iobeam_MulShift64(4 * m2 - 1 - mmShift, pow5, j);
+        if (q <= 1) {
+            // mv = 4 * m2 always has at least two trailing 0 bits, mm has one
+            // iff mmShift == 1 and mp = mv + 2 always has one.
+            vrIsTrailingZeros = 1;
+            if (acceptBounds)
+                vmIsTrailingZeros = mmShift == 1;
+            else
+                --vp;
+        } else if (q < 63) {
+            vrIsTrailingZeros = (mv & ((1ULL << q) - 1)) == 0;
+        }
+    }
+
+    // Remove digits while the interval still holds a shorter number.
+    int32_t removed = 0;
+    uint8_t lastRemovedDigit = 0;
+    uint64_t output;
+    if (vmIsTrailingZeros || vrIsTrailingZeros) {
+        // Rare case, where exact ties need care.
+        while (vp / 10 > vm / 10) {
+            vmIsTrailingZeros &= vm % 10 == 0;
+            vrIsTrailingZeros &= lastRemovedDigit == 0;
+            lastRemovedDigit = (uint8_t) (vr % 10);
+            vr /= 10;
+            vp /= 10;
+            vm /= 10;
+            ++removed;
+        }
+        if (vmIsTrailingZeros) {
+            while (vm % 10 == 0) {
+                vrIsTrailingZeros &= lastRemovedDigit == 0;
+                lastRemovedDigit = (uint8_t) (vr % 10);
+                vr /= 10;
+                vp /= 10;
+                vm /= 10;
+                ++removed;
+            }
+        }
+        if (vrIsTrailingZeros && lastRemovedDigit == 5 && vr % 2 == 0)
+            lastRemovedDigit = 4;  // round half to even
+        output = vr + ((vr == vm && (!acceptBounds || !vmIsTrailingZeros)) ||
+                lastRemovedDigit >= 5);
+    } else {
+        while (vp / 10 > vm / 10) {
+            lastRemovedDigit = (uint8_t) (vr % 10);
+            vr /= 10;
+            vp /= 10;
+            vm /= 10;
+            ++removed;
+        }
+        output = vr + (vr == vm || lastRemovedDigit >= 5);
+    }
+
+    *digits = output;
+    *exponent = e10 + removed;
+}
+
+size_t iobeam_FormatDouble(char *dst, double value)
+{
+    uint64_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    const uint64_t ieeeMantissa = bits & ((1ULL << DOUBLE_MANTISSA_BITS) - 1);
+    const uint32_t ieeeExponent =
+            (uint32_t) (bits >> DOUBLE_MANTISSA_BITS) & 0x7ff;
+
+    if (ieeeExponent == 0x7ff) {
+        if (dst)
+            memcpy(dst, "null", 4);
+        return 4;
+    }
+
+    char buf[IOBEAM_FMT_DOUBLE_MAX];
+    char *p = buf;
+    if (bits >> 63)
+        *p++ = '-';
+
+    if (ieeeExponent == 0 && ieeeMantissa == 0) {
+        memcpy(p, "0.0", 3);
+        p += 3;
+    } else {
+        uint64_t digits;
+        int32_t exp;
+        _iobeam_DoubleToDecimal(ieeeMantissa, ieeeExponent, &digits, &exp);
+        p = _iobeam_LayOutDecimal(p, (int32_t) iobeam_FormatUInt64(p, digits),
+                exp);
+    }
+
+    size_t len = (size_t) (p - buf);
+    if (dst)
+        memcpy(dst, buf, len);
+    return len;
+}
+
+#else
+
+size_t iobeam_FormatDouble(char *dst, double value)
+{
+    return iobeam_FormatFloat(dst, (float) value);
+}
+
+#endif
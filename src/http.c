@@ -1,16 +1,92 @@
 #include "../include/http.h"
+#include "../include/iobeam_fmt.h"
 
-int makeRequest(char *buf, size_t bufLen, const char *method, size_t methodLen,
-	char *resource, size_t resourceLen)
+void httpBuilderInit(HttpBuilder *b, char *buf, size_t bufLen)
+{
+	b->buf = buf;
+	b->cap = bufLen;
+	b->len = 0;
+	b->overflow = 0;
+}
+
+int httpAppend(HttpBuilder *b, const char *src, size_t srcLen)
 {
-	int lineLen = methodLen + 1 + resourceLen + 1 + PROTOCOL_LEN + 2;
-	if (lineLen > bufLen)  // buffer too small
+	if (b->overflow || srcLen > b->cap - b->len) {
+		b->overflow = 1;
 		return -1;
+	}
+	memcpy(b->buf + b->len, src, srcLen);
+	b->len += srcLen;
+	return 0;
+}
 
-	// Uses more storage space, could go with memcpy/memset.
-	memset(buf, '\0', bufLen);
-	int ret = snprintf(buf, bufLen, "%s %s %s" HEADER_END, method, resource, PROTOCOL);
-	return ret;
+int httpAppendUInt(HttpBuilder *b, uint32_t value)
+{
+	if (b->overflow || iobeam_FormatUInt32(NULL, value) > b->cap - b->len) {
+		b->overflow = 1;
+		return -1;
+	}
+	b->len += iobeam_FormatUInt32(b->buf + b->len, value);
+	return 0;
+}
+
+int httpAppendRequestLine(HttpBuilder *b, const char *method,
+	size_t methodLen, const char *resource, size_t resourceLen)
+{
+	httpAppend(b, method, methodLen);
+	httpAppend(b, " ", 1);
+	httpAppend(b, resource, resourceLen);
+	httpAppend(b, " " PROTOCOL HEADER_END, 1 + PROTOCOL_LEN + 2);
+	return b->overflow ? -1 : 0;
+}
+
+int httpAppendHeader(HttpBuilder *b, const char *key, size_t keyLen,
+	const char *val, size_t valLen)
+{
+	httpAppend(b, key, keyLen);
+	httpAppend(b, ": ", 2);
+	httpAppend(b, val, valLen);
+	httpAppend(b, HEADER_END, 2);
+	return b->overflow ? -1 : 0;
+}
+
+int httpAppendHeaderUInt(HttpBuilder *b, const char *key, size_t keyLen,
+	uint32_t val)
+{
+	httpAppend(b, key, keyLen);
+	httpAppend(b, ": ", 2);
+	httpAppendUInt(b, val);
+	httpAppend(b, HEADER_END, 2);
+	return b->overflow ? -1 : 0;
+}
+
+int httpAppendEnd(HttpBuilder *b)
+{
+	return httpAppend(b, HEADER_END, 2);
+}
+
+int httpBuilderLen(const HttpBuilder *b)
+{
+	return b->overflow ? -1 : (int) b->len;
+}
+
+// Terminates the line built by one of the one-shot builders, if it fits
+// with room to spare, and returns its length.
+static int _httpTerminate(HttpBuilder *b)
+{
+	int len = httpBuilderLen(b);
+	if (len >= 0 && (size_t) len < b->cap)
+		b->buf[len] = '\0';
+	return len;
+}
+
+int makeRequest(char *buf, size_t bufLen, const char *method, size_t methodLen,
+	char *resource, size_t resourceLen)
+{
+	HttpBuilder b;
+	httpBuilderInit(&b, buf, bufLen);
+	httpAppendRequestLine(&b, method, methodLen, resource, resourceLen);
+	return _httpTerminate(&b);
 }
 
 int makeGetRequest(char *buf, size_t bufLen, char *resource,
@@ -30,21 +106,25 @@ int makePostRequest(char *buf, size_t bufLen, char *resource,
 int makeHeader(char *buf, size_t bufLen, const char* key, size_t keyLen,
 	const char* val, size_t valLen)
 {
-	int lineLen = keyLen + 2 + valLen + 2; // 2 = ": ", 2 = "\r\n"
-	if (lineLen > bufLen)
-		return -1;
-
-	memset(buf, '\0', bufLen);
-	int ret = snprintf(buf, bufLen, "%s: %s" HEADER_END, key, val);
-	return ret;
+	HttpBuilder b;
+	httpBuilderInit(&b, buf, bufLen);
+	httpAppendHeader(&b, key, keyLen, val, valLen);
+	return _httpTerminate(&b);
 }
 
 int makeHeaderInFormat(char *buf, size_t bufLen, const char *key, size_t keyLen,
 		const char *valFmt, va_list vArgs)
 {
-	memset(buf, '\0', bufLen);
-	int keyOff = snprintf(buf, bufLen, "%s: ", key);
+	HttpBuilder b;
+	httpBuilderInit(&b, buf, bufLen);
+	httpAppend(&b, key, keyLen);
+	httpAppend(&b, ": ", 2);
+	int keyOff = httpBuilderLen(&b);
+	if (keyOff < 0 || (size_t) keyOff >= bufLen)
+		return -1;
 	int ret = vsnprintf(buf + keyOff, bufLen - keyOff, valFmt, vArgs);
+	if (ret < 0 || (size_t) ret >= bufLen - keyOff)
+		return -1;
 
 	return ret + keyOff;
 }
@@ -65,8 +145,131 @@ int parseContentLength(char *line)
 	return ret;
 }
 
+// Checks (case-insensitively) whether `line` is the header `key`.
+// Returns a pointer to the start of its value, or NULL if it is not.
+static char *_httpHeaderValue(char *line, const char *key)
+{
+	while (*key) {
+		char c = *line++;
+		if (c >= 'A' && c <= 'Z')
+			c += 'a' - 'A';
+		char k = *key++;
+		if (k >= 'A' && k <= 'Z')
+			k += 'a' - 'A';
+		if (c != k)
+			return NULL;
+	}
+	if (*line != ':')
+		return NULL;
+	line++;
+	while (*line == ' ')
+		line++;
+	return line;
+}
+
+// Days since 1970-01-01 for a date in the proleptic Gregorian calendar.
+static int32_t _httpDaysFromCivil(int32_t y, int32_t m, int32_t d)
+{
+	y -= m <= 2;
+	int32_t era = y / 400;
+	int32_t yoe = y - era * 400;
+	int32_t doy = (153 * (m + (m > 2 ? -3 : 9)) + 2) / 5 + d - 1;
+	int32_t doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+	return era * 146097 + doe - 719468;
+}
+
+// Parses a date in the IMF-fixdate format (RFC 7231), e.g.
+// "Sun, 18 Oct 2015 20:49:13 GMT", into seconds since the epoch. Returns 0
+// if it is not valid.
+static uint32_t _httpParseDate(char *p)
+{
+	static const char months[] = "JanFebMarAprMayJunJulAugSepOctNovDec";
+	p = strchr(p, ',');  // skip the day name
+	if (!p)
+		return 0;
+	int32_t day = strtol(p + 1, &p, 10);
+	while (*p == ' ')
+		p++;
+
+	int32_t month = 0;
+	while (month < 12 && strncmp(p, months + month * 3, 3) != 0)
+		month++;
+	if (month == 12)
+		return 0;
+
+	int32_t year = strtol(p + 3, &p, 10);
+	int32_t hour = strtol(p, &p, 10);
+	if (*p != ':')
+		return 0;
+	int32_t min = strtol(p + 1, &p, 10);
+	if (*p != ':')
+		return 0;
+	int32_t sec = strtol(p + 1, &p, 10);
+	if (year < 1970 || day < 1 || day > 31 || hour > 23 || min > 59 ||
+			sec > 60)
+		return 0;
+
+	uint32_t days = (uint32_t) _httpDaysFromCivil(year, month + 1, day);
+	return days * 86400UL + hour * 3600UL + min * 60UL + sec;
+}
+
+// Parses a `Date` header, e.g. "Date: Sun, 18 Oct 2015 20:49:13 GMT", into
+// seconds since the epoch. Returns 0 if the line is not a valid Date
+// header.
+uint32_t parseDate(char *line)
+{
+	char *p = _httpHeaderValue(line, HTTP_HEADER_DATE);
+	return p ? _httpParseDate(p) : 0;
+}
+
+// Parses a `Retry-After` header, which holds either a delay in seconds,
+// put in `delay`, or a date, put in `date` as seconds since the epoch; the
+// other is set to 0. Returns 0 if the line is not a valid Retry-After
+// header.
+int parseRetryAfter(char *line, uint32_t *delay, uint32_t *date)
+{
+	char *p = _httpHeaderValue(line, HTTP_HEADER_RETRY_AFTER);
+	if (!p)
+		return 0;
+
+	*delay = 0;
+	*date = 0;
+	if (*p >= '0' && *p <= '9') {
+		*delay = strtoul(p, NULL, 10);
+		return 1;
+	}
+	*date = _httpParseDate(p);
+	return *date > 0;
+}
+
+// Parses a `RateLimit-Remaining` or `RateLimit-Reset` header (as proposed
+// for standardisation), or the same with the common `X-` prefix. The first
+// number of its value is put in `value`. Returns which header it is
+// (HTTP_RATE_*), or 0 if it is neither.
+int parseRateLimit(char *line, uint32_t *value)
+{
+	if (*line == 'x' || *line == 'X') {
+		if (line[1] != '-')
+			return 0;
+		line += 2;
+	}
+
+	int which = HTTP_RATE_REMAINING;
+	char *p = _httpHeaderValue(line, HTTP_HEADER_RATE_REMAINING);
+	if (!p) {
+		which = HTTP_RATE_RESET;
+		p = _httpHeaderValue(line, HTTP_HEADER_RATE_RESET);
+	}
+	if (!p || *p < '0' || *p > '9')
+		return 0;
+	*value = strtoul(p, NULL, 10);
+	return which;
+}
+
 int parseResponseCode(char *line)
 {
 	char *spacePos = strchr(line, ' ');
-    return (int) strtol(spacePos, NULL, 10);
+	if (!spacePos)
+		return -1;
+	return (int) strtol(spacePos, NULL, 10);
 }
@@ -0,0 +1,216 @@
+#include "../include/iobeam_import.h"
+
+#include <string.h>
+
+// Appends `len` bytes of `src` to `dst`, if there is a `dst`.
+static inline size_t _iobeam_Append(char *dst, const char *src, size_t len)
+{
+    if (dst)
+        memcpy(dst, src, len);
+    return len;
+}
+
+#define APPEND(dst, off, s) \
+    ((off) += _iobeam_Append((dst) ? (dst) + (off) : NULL, s, IMPORT_LEN(s)))
+
+#define APPEND_STR(dst, off, s) \
+    ((off) += _iobeam_Append((dst) ? (dst) + (off) : NULL, s, strlen(s)))
+
+#define AT(dst, off) ((dst) ? (dst) + (off) : NULL)
+
+size_t iobeam_ImportEscape(char *dst, const char *s)
+{
+    size_t off = 0;
+    for (; *s != '\0'; s++) {
+        unsigned char c = (unsigned char) *s;
+        if (c < 0x20) {
+            if (dst) {
+                uint8_t low = c & 0xf;
+                memcpy(dst + off, "\\u00", 4);
+                dst[off + 4] = (char) ('0' + (c >> 4));
+                dst[off + 5] = (char) (low < 10 ? '0' + low : 'a' + low - 10);
+            }
+            off += 6;
+            continue;
+        }
+        if (c == '"' || c == '\\') {
+            if (dst)
+                dst[off] = '\\';
+            off++;
+        }
+        if (dst)
+            dst[off] = (char) c;
+        off++;
+    }
+    return off;
+}
+
+size_t iobeam_ImportStart(char *dst, const char *deviceId, uint32_t projectId)
+{
+    size_t off = 0;
+    APPEND(dst, off, IMPORT_JSON_DEVICE);
+    APPEND_STR(dst, off, deviceId);
+    APPEND(dst, off, IMPORT_JSON_PROJECT);
+    off += iobeam_FormatUInt32(AT(dst, off), projectId);
+    APPEND(dst, off, IMPORT_JSON_SOURCES);
+    return off;
+}
+
+size_t iobeam_ImportSourceStart(char *dst, const char *name, int first)
+{
+    return iobeam_ImportSourceStartSuffix(dst, name, NULL, first);
+}
+
+// Starts a source named `name` followed by `suffix`, if there is one.
+size_t iobeam_ImportSourceStartSuffix(char *dst, const char *name,
+        const char *suffix, int first)
+{
+    size_t off = 0;
+    if (!first)
+        APPEND(dst, off, ",");
+    APPEND(dst, off, IMPORT_JSON_NAME);
+    off += iobeam_ImportEscape(AT(dst, off), name);
+    if (suffix)
+        APPEND_STR(dst, off, suffix);
+    APPEND(dst, off, IMPORT_JSON_DATA);
+    return off;
+}
+
+size_t iobeam_ImportPoint(char *dst, uint64_t time, const IobeamValue *value,
+        int first)
+{
+    size_t off = 0;
+    if (!first)
+        APPEND(dst, off, ",");
+    APPEND(dst, off, IMPORT_JSON_TIME);
+    off += iobeam_FormatUInt64(AT(dst, off), time);
+    APPEND(dst, off, IMPORT_JSON_VALUE);
+    if (value->type == IOBEAM_VALUE_FLOAT)
+        off += iobeam_FormatFloat(AT(dst, off), value->as.f);
+    else if (value->type == IOBEAM_VALUE_DOUBLE)
+        off += iobeam_FormatDouble(AT(dst, off), value->as.d);
+    else
+        off += iobeam_FormatInt64(AT(dst, off), value->as.i);
+    APPEND(dst, off, IMPORT_JSON_POINT_END);
+    return off;
+}
+
+size_t iobeam_ImportSourceEnd(char *dst)
+{
+    return _iobeam_Append(dst, IMPORT_JSON_SOURCE_END,
+            IMPORT_LEN(IMPORT_JSON_SOURCE_END));
+}
+
+size_t iobeam_ImportEnd(char *dst)
+{
+    return _iobeam_Append(dst, IMPORT_JSON_END, IMPORT_LEN(IMPORT_JSON_END));
+}
+
+size_t iobeam_ImportField(char *dst, uint64_t time, const IobeamField *field,
+        int first)
+{
+    size_t off = iobeam_ImportSourceStart(dst, field->name, first);
+    off += iobeam_ImportPoint(AT(dst, off), time, &field->value, 1);
+    off += iobeam_ImportSourceEnd(AT(dst, off));
+    return off;
+}
+
+size_t iobeam_ImportRow(char *dst, const char *deviceId, uint32_t projectId,
+        uint64_t time, const IobeamField *fields, size_t n)
+{
+    size_t off = iobeam_ImportStart(dst, deviceId, projectId);
+    size_t i;
+    for (i = 0; i < n; i++)
+        off += iobeam_ImportField(AT(dst, off), time, &fields[i], i == 0);
+    off += iobeam_ImportEnd(AT(dst, off));
+    return off;
+}
+
+size_t iobeam_ImportSingle(char *dst, const char *deviceId, uint32_t projectId,
+        const char *name, uint64_t time, const IobeamValue *value)
+{
+    size_t off = iobeam_ImportStart(dst, deviceId, projectId);
+    off += iobeam_ImportSourceStart(AT(dst, off), name, 1);
+    off += iobeam_ImportPoint(AT(dst, off), time, value, 1);
+    off += iobeam_ImportSourceEnd(AT(dst, off));
+    off += iobeam_ImportEnd(AT(dst, off));
+    return off;
+}
+
+void iobeam_BlockWriterInit(IobeamBlockWriter *w, const IobeamBlock *block)
+{
+    w->block = block;
+    w->next = 0;
+    w->timeLen = 0;
+    w->periodLen = 0;
+    if (!block->times) {
+        w->timeLen = (uint8_t) iobeam_FormatUInt64(w->time, block->start);
+        w->periodLen = (uint8_t) iobeam_FormatUInt32(w->period,
+                block->period);
+    }
+}
+
+// Adds the period to the text of the next implicit time, a digit at a time
+// from the right.
+static void _iobeam_BlockStep(IobeamBlockWriter *w)
+{
+    int i = w->timeLen - 1;
+    int j = w->periodLen - 1;
+    uint8_t carry = 0;
+    while (j >= 0 || carry) {
+        if (i < 0) {
+            if (w->timeLen == sizeof(w->time))
+                return;
+            memmove(w->time + 1, w->time, w->timeLen);
+            w->time[0] = '0';
+            w->timeLen++;
+            i = 0;
+        }
+        uint8_t d = (w->time[i] - '0') + carry;
+        if (j >= 0)
+            d += w->period[j] - '0';
+        carry = d >= 10;
+        w->time[i] = '0' + (carry ? d - 10 : d);
+        i--;
+        j--;
+    }
+}
+
+size_t iobeam_BlockWrite(IobeamBlockWriter *w, char *dst, size_t room)
+{
+    const IobeamBlock *b = w->block;
+    size_t off = 0;
+    while (w->next < b->n &&
+            (!dst || off + IOBEAM_IMPORT_POINT_MAX <= room)) {
+        if (w->next > 0)
+            APPEND(dst, off, ",");
+        APPEND(dst, off, IMPORT_JSON_TIME);
+        if (b->times) {
+            off += iobeam_FormatUInt64(AT(dst, off), b->times[w->next]);
+        } else {
+            off += _iobeam_Append(AT(dst, off), w->time, w->timeLen);
+            _iobeam_BlockStep(w);
+        }
+        APPEND(dst, off, IMPORT_JSON_VALUE);
+        if (b->floats)
+            off += iobeam_FormatFloat(AT(dst, off), b->floats[w->next]);
+        else
+            off += iobeam_FormatInt32(AT(dst, off), b->ints[w->next]);
+        APPEND(dst, off, IMPORT_JSON_POINT_END);
+        w->next++;
+    }
+    return off;
+}
+
+size_t iobeam_ImportBlock(char *dst, const char *deviceId, uint32_t projectId,
+        const IobeamBlock *b)
+{
+    IobeamBlockWriter w;
+    iobeam_BlockWriterInit(&w, b);
+    size_t off = iobeam_ImportStart(dst, deviceId, projectId);
+    off += iobeam_ImportSourceStart(AT(dst, off), b->name, 1);
+    off += iobeam_BlockWrite(&w, AT(dst, off), (size_t) -1);
+    off += iobeam_ImportSourceEnd(AT(dst, off));
+    off += iobeam_ImportEnd(AT(dst, off));
+    return off;
+}
@@ -0,0 +1,105 @@
+#include "../include/iobeam_limit.h"
+#include "../include/http.h"
+
+#include <string.h>
+
+// Resets larger than this are times since the epoch rather than delays.
+#define IOBEAM_LIMIT_EPOCH_MIN 1000000000UL
+
+void iobeam_LimiterInit(IobeamLimiter *l, uint32_t periodMs, uint16_t burst)
+{
+    memset(l, 0, sizeof(*l));
+    l->period = periodMs;
+    l->burst = burst > 0 ? burst : 1;
+    l->credit = (uint64_t) l->period * l->burst;
+}
+
+// Period currently allowed between requests, the slower of ours and the
+// server's.
+static uint32_t _iobeam_LimiterPeriod(const IobeamLimiter *l, uint64_t now)
+{
+    if (now < l->serverUntil && l->serverPeriod > l->period)
+        return l->serverPeriod;
+    return l->period;
+}
+
+uint32_t iobeam_LimiterWait(IobeamLimiter *l, uint64_t now)
+{
+    if (now < l->blockedUntil)
+        return (uint32_t) (l->blockedUntil - now);
+
+    uint32_t period = _iobeam_LimiterPeriod(l, now);
+    uint64_t elapsed = now > l->last ? now - l->last : 0;
+    uint64_t credit = l->credit + elapsed;
+    uint64_t max = (uint64_t) period * l->burst;
+    l->credit = credit < max ? credit : max;
+    l->last = now;
+    return l->credit >= period ? 0 : (uint32_t) (period - l->credit);
+}
+
+int iobeam_LimiterTake(IobeamLimiter *l, uint64_t now)
+{
+    if (iobeam_LimiterWait(l, now) > 0) {
+        l->throttled++;
+        return 0;
+    }
+    l->credit -= _iobeam_LimiterPeriod(l, now);
+    return 1;
+}
+
+int iobeam_LimiterHeader(IobeamLimitHeaders *h, char *line)
+{
+    uint32_t value;
+    switch (parseRateLimit(line, &value)) {
+    case HTTP_RATE_REMAINING:
+        h->remaining = value;
+        h->has |= IOBEAM_LIMIT_HAS_REMAINING;
+        return 1;
+    case HTTP_RATE_RESET:
+        h->reset = value;
+        h->has |= IOBEAM_LIMIT_HAS_RESET;
+        return 1;
+    }
+    if (parseRetryAfter(line, &h->retryDelay, &h->retryDate)) {
+        h->has |= IOBEAM_LIMIT_HAS_RETRY;
+        return 1;
+    }
+    return 0;
+}
+
+void iobeam_LimiterResponse(IobeamLimiter *l, uint64_t now, int status,
+        const IobeamLimitHeaders *h, uint32_t date)
+{
+    // Seconds until the server's limit resets, if it said
+    uint32_t reset = 0;
+    if (h->has & IOBEAM_LIMIT_HAS_RESET) {
+        reset = h->reset;
+        if (reset >= IOBEAM_LIMIT_EPOCH_MIN)
+            reset = date > 0 && reset > date ? reset - date : 0;
+    }
+
+    if (status == 429) {
+        l->limited++;
+        uint32_t wait = IOBEAM_LIMIT_DEFAULT_RETRY;
+        if (h->has & IOBEAM_LIMIT_HAS_RETRY) {
+            if (h->retryDate == 0)
+                wait = h->retryDelay;
+            else if (date > 0)
+                wait = h->retryDate > date ? h->retryDate - date : 0;
+        } else if (reset > 0) {
+            wait = reset;
+        }
+        l->blockedUntil = now + wait * 1000ULL;
+        l->credit = 0;
+        return;
+    }
+
+    if ((h->has & IOBEAM_LIMIT_HAS_REMAINING) && reset > 0) {
+        if (h->remaining == 0) {
+            l->blockedUntil = now + reset * 1000ULL;
+        } else {
+            l->serverPeriod = (uint32_t) (reset * 1000ULL / h->remaining);
+            l->serverUntil = now + reset * 1000ULL;
+        }
+    }
+}
@@ -0,0 +1,303 @@
+#include "../include/iobeam_queue.h"
+
+#include <string.h>
+
+#if IOBEAM_QUEUE_LEN > 0
+
+// Slot of the `i`th oldest point.
+static inline uint16_t _iobeam_QueueSlot(const IobeamQueue *q, uint16_t i)
+{
+    uint32_t slot = (uint32_t) q->head + i;
+    return (uint16_t) (slot >= IOBEAM_QUEUE_LEN ? slot - IOBEAM_QUEUE_LEN
+            : slot);
+}
+
+static inline IobeamQueuedPoint *_iobeam_QueuePoint(IobeamQueue *q,
+        uint16_t i)
+{
+    return &q->points[_iobeam_QueueSlot(q, i)];
+}
+
+void iobeam_QueueInit(IobeamQueue *q, uint8_t policy)
+{
+    memset(q, 0, sizeof(*q));
+    q->policy = policy;
+    q->high = IOBEAM_QUEUE_LEN - IOBEAM_QUEUE_LEN / 4;
+    q->low = IOBEAM_QUEUE_LEN / 2;
+}
+
+// Works out the pressure after the queue has changed size, telling the
+// callback if it is different.
+static void _iobeam_QueueUpdatePressure(IobeamQueue *q)
+{
+    uint8_t pressure;
+    if (q->count >= IOBEAM_QUEUE_LEN)
+        pressure = IOBEAM_PRESSURE_FULL;
+    else if (q->count >= q->high ||
+            (q->pressure != IOBEAM_PRESSURE_NONE && q->count > q->low))
+        pressure = IOBEAM_PRESSURE_HIGH;
+    else
+        pressure = IOBEAM_PRESSURE_NONE;
+
+    if (pressure != q->pressure) {
+        q->pressure = pressure;
+        if (q->onPressure)
+            q->onPressure(q->ctx, pressure);
+    }
+}
+
+void iobeam_QueueSetWatermarks(IobeamQueue *q, uint16_t high, uint16_t low,
+        IobeamPressureCallback callback, void *ctx)
+{
+    q->high = high;
+    q->low = low;
+    q->onPressure = callback;
+    q->ctx = ctx;
+    _iobeam_QueueUpdatePressure(q);
+}
+
+// Offset of the first point of class `priority`, after all those of
+// higher classes.
+static uint16_t _iobeam_QueueFirstOf(const IobeamQueue *q, uint8_t priority)
+{
+    uint16_t i = 0;
+    uint8_t c;
+    for (c = priority + 1; c < IOBEAM_PRIORITIES; c++)
+        i += q->depth[c];
+    return i;
+}
+
+// Lowest class of the points queued, whose points are the last ones.
+static uint8_t _iobeam_QueueLowest(const IobeamQueue *q)
+{
+    uint8_t c = 0;
+    while (c + 1 < IOBEAM_PRIORITIES && q->depth[c] == 0)
+        c++;
+    return c;
+}
+
+// Removes the `i`th point, moving the later ones down.
+static void _iobeam_QueueRemove(IobeamQueue *q, uint16_t i)
+{
+    q->depth[_iobeam_QueuePoint(q, i)->priority]--;
+    for (; i + 1 < q->count; i++)
+        *_iobeam_QueuePoint(q, i) = *_iobeam_QueuePoint(q, i + 1);
+    q->count--;
+}
+
+// Averages `b` into `a`, weighting each by the samples already in it.
+static void _iobeam_QueueMergeInto(IobeamQueuedPoint *a,
+        const IobeamQueuedPoint *b)
+{
+    uint32_t total = (uint32_t) a->weight + b->weight;
+    if (a->type == IOBEAM_VALUE_FLOAT) {
+        a->as.f = (a->as.f * a->weight + b->as.f * b->weight) / total;
+    } else if (a->type == IOBEAM_VALUE_DOUBLE) {
+        a->as.d = (a->as.d * a->weight + b->as.d * b->weight) / total;
+    } else {
+        int64_t sum = a->as.i * a->weight + b->as.i * b->weight;
+        int64_t half = (int64_t) (total / 2);
+        a->as.i = (sum >= 0 ? sum + half : sum - half) / (int64_t) total;
+    }
+    a->weight = (uint16_t) (total > UINT16_MAX ? UINT16_MAX : total);
+}
+
+// Frees a slot by merging the point and next one of the same series that
+// together stand for the fewest samples, the oldest such pair on a tie.
+// Only points of the lowest class queued are merged. Returns 0 if no two
+// of them can be.
+static int _iobeam_QueueMerge(IobeamQueue *q)
+{
+    uint32_t best = UINT32_MAX;
+    uint16_t bestI = 0;
+    uint16_t bestJ = 0;
+    uint16_t i, j;
+    for (i = _iobeam_QueueFirstOf(q, _iobeam_QueueLowest(q));
+            i + 1 < q->count; i++) {
+        const IobeamQueuedPoint *a = _iobeam_QueuePoint(q, i);
+        for (j = i + 1; j < q->count; j++) {
+            const IobeamQueuedPoint *b = _iobeam_QueuePoint(q, j);
+            if (b->series == a->series && b->type == a->type)
+                break;
+        }
+        if (j == q->count)
+            continue;
+
+        uint32_t weight = (uint32_t) a->weight +
+                _iobeam_QueuePoint(q, j)->weight;
+        if (weight < best) {
+            best = weight;
+            bestI = i;
+            bestJ = j;
+            if (weight == 2)
+                break;  // two single samples, can't do better
+        }
+    }
+    if (best == UINT32_MAX)
+        return 0;
+
+    _iobeam_QueueMergeInto(_iobeam_QueuePoint(q, bestI),
+            _iobeam_QueuePoint(q, bestJ));
+    _iobeam_QueueRemove(q, bestJ);
+    q->merged++;
+    return 1;
+}
+
+// Drops the oldest point of the lowest class queued.
+static void _iobeam_QueueDropOldest(IobeamQueue *q)
+{
+    uint16_t i = _iobeam_QueueFirstOf(q, _iobeam_QueueLowest(q));
+    if (i == 0) {
+        q->depth[_iobeam_QueuePoint(q, 0)->priority]--;
+        q->head = _iobeam_QueueSlot(q, 1);
+        q->count--;
+    } else {
+        _iobeam_QueueRemove(q, i);
+    }
+    q->droppedOldest++;
+}
+
+int iobeam_QueuePush(IobeamQueue *q, int series, uint64_t time,
+        const IobeamValue *value, uint8_t priority)
+{
+    if (priority >= IOBEAM_PRIORITIES)
+        priority = IOBEAM_PRIORITIES - 1;
+    if (q->count == IOBEAM_QUEUE_LEN) {
+        // Only points of the lowest class queued are shed for a new one
+        uint8_t lowest = _iobeam_QueueLowest(q);
+        if (priority < lowest || (priority == lowest &&
+                q->policy == IOBEAM_QUEUE_DROP_NEWEST)) {
+            q->droppedNewest++;
+            return -1;
+        }
+        if (q->policy != IOBEAM_QUEUE_DOWNSAMPLE || !_iobeam_QueueMerge(q))
+            _iobeam_QueueDropOldest(q);
+    }
+
+    // After every point of its class or higher ones
+    uint16_t at = _iobeam_QueueFirstOf(q, priority) + q->depth[priority];
+    uint16_t i;
+    for (i = q->count; i > at; i--)
+        *_iobeam_QueuePoint(q, i) = *_iobeam_QueuePoint(q, i - 1);
+
+    IobeamQueuedPoint *p = _iobeam_QueuePoint(q, at);
+    p->time = time;
+    p->type = value->type;
+    if (value->type == IOBEAM_VALUE_FLOAT)
+        p->as.f = value->as.f;
+    else if (value->type == IOBEAM_VALUE_DOUBLE)
+        p->as.d = value->as.d;
+    else
+        p->as.i = value->as.i;
+    p->weight = 1;
+    p->series = (int8_t) series;
+    p->priority = priority;
+    q->depth[priority]++;
+    q->count++;
+    q->queued++;
+    _iobeam_QueueUpdatePressure(q);
+    return q->pressure;
+}
+
+const IobeamQueuedPoint *iobeam_QueueAt(const IobeamQueue *q, uint16_t i)
+{
+    return &q->points[_iobeam_QueueSlot(q, i)];
+}
+
+void iobeam_QueuePop(IobeamQueue *q, uint16_t n)
+{
+    if (n > q->count)
+        n = q->count;
+    // The first points are those of the highest classes
+    uint16_t left = n;
+    uint8_t c = IOBEAM_PRIORITIES;
+    while (left > 0 && c-- > 0) {
+        uint16_t take = left < q->depth[c] ? left : q->depth[c];
+        q->depth[c] -= take;
+        left -= take;
+    }
+    q->head = _iobeam_QueueSlot(q, n);
+    q->count -= n;
+    _iobeam_QueueUpdatePressure(q);
+}
+
+void iobeam_QueueWriterInit(IobeamQueueWriter *w, const IobeamQueue *q,
+        const IobeamSeriesTable *series, uint16_t count)
+{
+    memset(w, 0, sizeof(*w));
+    w->queue = q;
+    w->series = series;
+    w->count = count < q->count ? count : q->count;
+}
+
+size_t iobeam_QueueWrite(IobeamQueueWriter *w, char *dst, size_t room)
+{
+    size_t off = 0;
+    while (w->current < IOBEAM_SERIES_MAX) {
+        // Next point of the series being written
+        uint16_t i = w->at;
+        while (i < w->count && iobeam_QueueAt(w->queue, i)->series !=
+                w->current) {
+            i++;
+        }
+
+        if (!w->open) {
+            size_t len = 0;
+            const char *frag = i < w->count ? iobeam_SeriesSource(w->series,
+                    w->current, w->sources == 0, &len) : NULL;
+            if (!frag) {
+                w->current++;
+                w->at = 0;
+                continue;
+            }
+            if (dst && off + len > room)
+                return off;
+            if (dst)
+                memcpy(dst + off, frag, len);
+            off += len;
+            w->open = 1;
+            w->first = 1;
+            w->sources++;
+            w->at = i;
+        } else if (i == w->count) {
+            if (dst && off + IMPORT_LEN(IMPORT_JSON_SOURCE_END) > room)
+                return off;
+            off += iobeam_ImportSourceEnd(dst ? dst + off : NULL);
+            w->open = 0;
+            w->current++;
+            w->at = 0;
+        } else {
+            if (dst && off + IOBEAM_IMPORT_POINT_MAX > room)
+                return off;
+            const IobeamQueuedPoint *p = iobeam_QueueAt(w->queue, i);
+            IobeamValue v;
+            v.type = p->type;
+            if (p->type == IOBEAM_VALUE_FLOAT)
+                v.as.f = p->as.f;
+            else if (p->type == IOBEAM_VALUE_DOUBLE)
+                v.as.d = p->as.d;
+            else
+                v.as.i = p->as.i;
+            off += iobeam_ImportPoint(dst ? dst + off : NULL, p->time, &v,
+                    w->first);
+            w->first = 0;
+            w->at = i + 1;
+        }
+    }
+    w->done = 1;
+    return off;
+}
+
+size_t iobeam_ImportQueue(char *dst, const char *deviceId, uint32_t projectId,
+        const IobeamQueue *q, const IobeamSeriesTable *series,
+        uint16_t count)
+{
+    IobeamQueueWriter w;
+    iobeam_QueueWriterInit(&w, q, series, count);
+    size_t off = iobeam_ImportStart(dst, deviceId, projectId);
+    off += iobeam_QueueWrite(&w, dst ? dst + off : NULL, (size_t) -1);
+    off += iobeam_ImportEnd(dst ? dst + off : NULL);
+    return off;
+}
+
+#endif /* IOBEAM_QUEUE_LEN > 0 */
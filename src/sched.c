@@ -0,0 +1,128 @@
+#include "../include/iobeam_sched.h"
+#include "../include/iobeam_trace.h"
+
+#include <string.h>
+
+#if IOBEAM_SCHED_MAX > 0
+
+void iobeam_SchedInit(IobeamSched *s, IobeamSchedClock clock, void *ctx)
+{
+    memset(s, 0, sizeof(*s));
+    s->clock = clock;
+    s->ctx = ctx;
+}
+
+int iobeam_SchedAdd(IobeamSched *s, IobeamTaskFn run, void *arg,
+        uint32_t period, uint32_t deadline)
+{
+    if (s->count >= IOBEAM_SCHED_MAX)
+        return -1;
+
+    IobeamTask *t = &s->tasks[s->count];
+    memset(t, 0, sizeof(*t));
+    t->run = run;
+    t->arg = arg;
+    t->period = period;
+    if (deadline == 0)
+        deadline = period > 0 ? period : IOBEAM_TASK_BACKGROUND;
+    t->deadline = deadline;
+    t->release = s->clock(s->ctx);
+    return s->count++;
+}
+
+void iobeam_SchedSetMissCallback(IobeamSched *s, IobeamMissCallback callback,
+        void *ctx)
+{
+    s->onMiss = callback;
+    s->missCtx = ctx;
+}
+
+static void _iobeam_SchedMiss(IobeamSched *s, int i, uint32_t late)
+{
+    IobeamTask *t = &s->tasks[i];
+    t->missed++;
+    if (late > t->maxLate)
+        t->maxLate = late;
+    IOBEAM_TRACE(IOBEAM_TRACE_MISS, i, late);
+    if (s->onMiss)
+        s->onMiss(s->missCtx, i, late);
+}
+
+// Releases the job of task `i` due at `now`, skipping to the latest release
+// if others have come since.
+static void _iobeam_SchedRelease(IobeamSched *s, int i, uint64_t now)
+{
+    IobeamTask *t = &s->tasks[i];
+    if (t->period > 0 && now - t->release >= t->period) {
+        uint32_t n = (uint32_t) ((now - t->release) / t->period);
+        uint64_t missedDeadline = t->release + t->deadline;
+        t->release += (uint64_t) n * t->period;
+        t->skipped += n;
+        if (t->deadline != IOBEAM_TASK_BACKGROUND) {
+            t->missed += n - 1;
+            _iobeam_SchedMiss(s, i, now > missedDeadline ?
+                    (uint32_t) (now - missedDeadline) : 0);
+        }
+    }
+    t->running = 1;
+    t->wake = 0;
+}
+
+// Deadline of the job of `t`, for picking the earliest.
+static uint64_t _iobeam_SchedDeadline(const IobeamTask *t)
+{
+    return t->release + t->deadline;
+}
+
+uint32_t iobeam_SchedRun(IobeamSched *s)
+{
+    uint64_t now = s->clock(s->ctx);
+    uint64_t next = UINT64_MAX;
+    int best = -1;
+    int i;
+
+    for (i = 0; i < s->count; i++) {
+        IobeamTask *t = &s->tasks[i];
+        if (!t->running) {
+            if (now < t->release) {
+                if (t->release < next)
+                    next = t->release;
+                continue;
+            }
+            _iobeam_SchedRelease(s, i, now);
+        }
+        if (now < t->wake) {
+            if (t->wake < next)
+                next = t->wake;
+            continue;
+        }
+        if (best < 0 || _iobeam_SchedDeadline(t) <
+                _iobeam_SchedDeadline(&s->tasks[best])) {
+            best = i;
+        }
+    }
+
+    if (best < 0) {
+        if (next == UINT64_MAX)
+            return UINT32_MAX;
+        return next - now < UINT32_MAX ? (uint32_t) (next - now) : UINT32_MAX;
+    }
+
+    IobeamTask *t = &s->tasks[best];
+    if (t->run(t, now, t->arg) != IOBEAM_TASK_DONE)
+        return 0;
+
+    // The job counts as done when its last step returns, however long the
+    // step took
+    uint64_t end = s->clock(s->ctx);
+    uint64_t deadline = _iobeam_SchedDeadline(t);
+    t->running = 0;
+    t->line = 0;
+    t->jobs++;
+    if (t->deadline != IOBEAM_TASK_BACKGROUND && end > deadline)
+        _iobeam_SchedMiss(s, best, (uint32_t) (end - deadline));
+    t->release = t->period > 0 ? t->release + t->period : end;
+    return 0;
+}
+
+#endif /* IOBEAM_SCHED_MAX > 0 */
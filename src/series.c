@@ -0,0 +1,67 @@
+#include "../include/iobeam_series.h"
+
+#include <string.h>
+
+size_t iobeam_SeriesEscape(char *dst, const char *name)
+{
+    size_t i;
+    for (i = 0; name[i] != '\0'; i++) {
+        unsigned char c = (unsigned char) name[i];
+        if (c < 0x20 || c == 0x7f || i >= IOBEAM_SERIES_NAME_MAX)
+            return 0;
+    }
+    return iobeam_ImportEscape(dst, name);
+}
+
+#if IOBEAM_SERIES_MAX > 0
+
+void iobeam_SeriesInit(IobeamSeriesTable *t)
+{
+    memset(t, 0, sizeof(*t));
+}
+
+int iobeam_SeriesAdd(IobeamSeriesTable *t, const char *name)
+{
+    char frag[IOBEAM_SERIES_FRAGMENT_MAX];
+    size_t len = 0;
+    frag[len++] = ',';
+    memcpy(frag + len, IMPORT_JSON_NAME, IMPORT_LEN(IMPORT_JSON_NAME));
+    len += IMPORT_LEN(IMPORT_JSON_NAME);
+    size_t nameLen = iobeam_SeriesEscape(frag + len, name);
+    if (nameLen == 0)
+        return -1;
+    len += nameLen;
+    memcpy(frag + len, IMPORT_JSON_DATA, IMPORT_LEN(IMPORT_JSON_DATA));
+    len += IMPORT_LEN(IMPORT_JSON_DATA);
+
+    uint8_t i;
+    for (i = 0; i < t->count; i++) {
+        if (t->len[i] == len && memcmp(t->pool + t->start[i], frag, len) == 0)
+            return i;
+    }
+    if (t->count == IOBEAM_SERIES_MAX || t->used + len > IOBEAM_SERIES_POOL_LEN)
+        return -1;
+
+    memcpy(t->pool + t->used, frag, len);
+    t->start[t->count] = t->used;
+    t->len[t->count] = (uint8_t) len;
+    t->used += len;
+    return t->count++;
+}
+
+const char *iobeam_SeriesSource(const IobeamSeriesTable *t, int handle,
+        int first, size_t *len)
+{
+    if (handle < 0 || handle >= t->count)
+        return NULL;
+
+    const char *frag = t->pool + t->start[handle];
+    *len = t->len[handle];
+    if (first) {
+        frag++;
+        (*len)--;
+    }
+    return frag;
+}
+
+#endif /* IOBEAM_SERIES_MAX > 0 */
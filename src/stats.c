@@ -0,0 +1,106 @@
+#include "../include/iobeam_stats.h"
+
+#include <string.h>
+
+void iobeam_StatsInit(IobeamStats *stats)
+{
+    memset(stats, 0, sizeof(*stats));
+    stats->connect.min = UINT32_MAX;
+    stats->write.min = UINT32_MAX;
+    stats->firstByte.min = UINT32_MAX;
+    stats->request.min = UINT32_MAX;
+}
+
+void iobeam_LatencyAdd(IobeamLatency *lat, uint32_t ms)
+{
+    // Bucket of `ms` is the position of its top bit, past the first
+    // IOBEAM_STATS_BUCKET_SHIFT, found by shifting rather than with a log.
+    uint8_t bucket = 0;
+    uint32_t v = ms >> IOBEAM_STATS_BUCKET_SHIFT;
+    while (v > 0 && bucket < IOBEAM_STATS_BUCKETS - 1) {
+        v >>= 1;
+        bucket++;
+    }
+    if (lat->histogram[bucket] < UINT16_MAX)
+        lat->histogram[bucket]++;
+
+    lat->count++;
+    lat->total += ms;
+    if (ms < lat->min)
+        lat->min = ms;
+    if (ms > lat->max)
+        lat->max = ms;
+}
+
+uint32_t iobeam_LatencyMean(const IobeamLatency *lat)
+{
+    if (lat->count == 0)
+        return 0;
+    return lat->total / lat->count;
+}
+
+uint32_t iobeam_LatencyPercentile(const IobeamLatency *lat, uint8_t percent)
+{
+    uint32_t sum = 0;
+    uint8_t i;
+    for (i = 0; i < IOBEAM_STATS_BUCKETS; i++)
+        sum += lat->histogram[i];
+    if (sum == 0)
+        return 0;
+
+    // Rank of the wanted latency, rounded up
+    uint32_t rank = (uint32_t) (((uint64_t) sum * percent + 99) / 100);
+    uint32_t seen = 0;
+    for (i = 0; i < IOBEAM_STATS_BUCKETS - 1; i++) {
+        seen += lat->histogram[i];
+        if (seen >= rank && seen > 0)
+            break;
+    }
+
+    if (i == IOBEAM_STATS_BUCKETS - 1)
+        return lat->max;
+    uint32_t bound = (1UL << (IOBEAM_STATS_BUCKET_SHIFT + i)) - 1;
+    return bound < lat->max ? bound : lat->max;
+}
+
+void iobeam_StatsConnect(IobeamStats *stats, int connected, uint32_t ms)
+{
+    stats->connects++;
+    if (stats->lastFailed)
+        stats->reconnects++;
+    if (connected)
+        iobeam_LatencyAdd(&stats->connect, ms);
+}
+
+// Failure class of a request that ended with `status`.
+static uint8_t _iobeam_FailureClass(int status)
+{
+    switch (status) {
+    case IOBEAM_STATUS_NO_CONNECT:
+        return IOBEAM_FAIL_CONNECT;
+    case IOBEAM_STATUS_NO_WRITE:
+        return IOBEAM_FAIL_WRITE;
+    case IOBEAM_STATUS_NO_RESPONSE:
+        return IOBEAM_FAIL_RESPONSE;
+    case 429:
+        return IOBEAM_FAIL_429;
+    }
+    if (status >= 400 && status < 500)
+        return IOBEAM_FAIL_4XX;
+    if (status >= 500 && status < 600)
+        return IOBEAM_FAIL_5XX;
+    return IOBEAM_FAIL_OTHER;
+}
+
+void iobeam_StatsRequest(IobeamStats *stats, int status, int ok, uint32_t ms)
+{
+    stats->requests++;
+    stats->lastStatus = (int16_t) status;
+    stats->lastFailed = !ok;
+    if (ok)
+        stats->successes++;
+    else
+        stats->failures[_iobeam_FailureClass(status)]++;
+    if (status != IOBEAM_STATUS_NO_CONNECT)
+        iobeam_LatencyAdd(&stats->request, ms);
+}
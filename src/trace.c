@@ -0,0 +1,41 @@
+#include "../include/iobeam_trace.h"
+
+#if IOBEAM_TRACE_LEN > 0
+
+#if (IOBEAM_TRACE_LEN & (IOBEAM_TRACE_LEN - 1)) != 0
+#error "IOBEAM_TRACE_LEN must be a power of two"
+#endif
+
+static IobeamTraceRing _ring;
+static IobeamTraceClock _clock = 0;
+
+void iobeam_TraceInit(IobeamTraceClock clock, uint32_t hz)
+{
+    _ring.magic = IOBEAM_TRACE_MAGIC;
+    _ring.version = IOBEAM_TRACE_VERSION;
+    _ring.eventSize = sizeof(IobeamTraceEvent);
+    _ring.len = IOBEAM_TRACE_LEN;
+    _ring.hz = hz;
+    _clock = clock;
+}
+
+void iobeam_Trace(uint16_t id, int32_t a, int32_t b)
+{
+    if (!_clock)
+        return;
+
+    IobeamTraceEvent *e = &_ring.events[_ring.next & (IOBEAM_TRACE_LEN - 1)];
+    e->time = _clock();
+    e->id = id;
+    e->seq = (uint16_t) _ring.next;
+    e->a = a;
+    e->b = b;
+    _ring.next++;
+}
+
+const IobeamTraceRing *iobeam_TraceRing()
+{
+    return &_ring;
+}
+
+#endif /* IOBEAM_TRACE_LEN > 0 */
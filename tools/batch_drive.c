@@ -0,0 +1,99 @@
+// Drives the CC3200 client's adaptive batching (include/iobeam_batch.h)
+// against a real server, printing once a second what it has learnt of the
+// link and the batch it picked.
+//
+// Build from the repository root (Linux), start the mock API with the
+// link conditions to test, e.g. a round trip that jumps from 20 ms to
+// 400 ms and back, and run:
+//
+//     cc -O2 -Itools/host -o batch_drive tools/batch_drive.c
+//         tools/host/sl_host.c src/*.c -lm
+//     tools/mock_server.py --stats 0 --rtt-steps 0:20,20:400,40:20 &
+//     ./batch_drive 127.0.0.1 8080 60
+//
+// Arguments are the server's address and port, the seconds to run for,
+// and optionally the points sent per second (default 20), the most a
+// point may wait in ms (default 10000) and the duty percent (default 10).
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../src/cc3200/iobeam.c"
+
+#define PROJECT_ID 1234
+#define TOKEN "eyJ0eXAiOiJKV1QiLCJhbGciOiJIUzI1NiJ9.eyJwaWQiOjEyMzQsInBpZCI6MX0" \
+        ".dGVzdHRva2VudGVzdHRva2VudGVzdHRva2Vu"
+#define DEVICE_ID "d4e1b1f0c2a34f87"
+
+static void sleepMs(uint32_t ms)
+{
+    struct timespec ts;
+    ts.tv_sec = ms / 1000;
+    ts.tv_nsec = (long) (ms % 1000) * 1000000L;
+    nanosleep(&ts, NULL);
+}
+
+int main(int argc, char **argv)
+{
+    if (argc < 4) {
+        fprintf(stderr, "usage: %s ip port seconds [points/s] [latency ms] "
+                "[duty %%]\n", argv[0]);
+        return 2;
+    }
+    const uint32_t seconds = (uint32_t) atoi(argv[3]);
+    const uint32_t rate = argc > 4 ? (uint32_t) atoi(argv[4]) : 20;
+    const uint32_t latency = argc > 5 ? (uint32_t) atoi(argv[5]) : 10000;
+    const uint8_t duty = (uint8_t) (argc > 6 ? atoi(argv[6]) : 10);
+    if (slhost_UseServer(argv[1], (uint16_t) atoi(argv[2])) < 0 ||
+            rate == 0) {
+        fprintf(stderr, "bad arguments\n");
+        return 2;
+    }
+
+    Iobeam iobeam;
+    iobeam_Init(&iobeam, PROJECT_ID, TOKEN, DEVICE_ID);
+    iobeam_SetAdaptiveBatching(latency, duty);
+    int temp = iobeam_AddSeries("temp");
+    const IobeamBatcher *b = iobeam_GetBatcher();
+    const IobeamStats *stats = iobeam_GetStats();
+
+    printf("%5s %8s %10s %8s %9s %6s %8s %8s %7s\n", "sec", "rtt ms",
+            "up B/s", "pts/s", "interval", "batch", "req/s", "sent/s",
+            "failed");
+    const uint64_t start = getMillis();
+    uint64_t nextPoint = start;
+    uint64_t nextReport = start + 1000;
+    uint32_t lastRequests = 0;
+    uint32_t lastSent = 0;
+    uint32_t failed = 0;
+    uint32_t n = 0;
+    while (getMillis() - start < (uint64_t) seconds * 1000) {
+        uint64_t now = getMillis();
+        if (now >= nextPoint) {
+            if (iobeam.SendSeriesFloat(temp, 20.0 + (n++ % 100) / 10.0) < 0)
+                failed++;
+            nextPoint += 1000 / rate;
+        } else if (iobeam.SendDue() < 0) {
+            failed++;
+        }
+
+        if (now >= nextReport) {
+            float up = b->msPerByte > 0 ? 1000.0f / b->msPerByte : 0;
+            printf("%5" PRIu64 " %8.1f %10.0f %8.1f %9" PRIu32 " %6u "
+                    "%8" PRIu32 " %8" PRIu32 " %7" PRIu32 "\n",
+                    (now - start) / 1000, b->rtt, up, b->rate * 1000,
+                    b->interval, b->batch, stats->requests - lastRequests,
+                    stats->pointsSent - lastSent, failed);
+            fflush(stdout);
+            lastRequests = stats->requests;
+            lastSent = stats->pointsSent;
+            nextReport += 1000;
+        }
+        now = getMillis();
+        if (nextPoint > now)
+            sleepMs((uint32_t) (nextPoint - now < 5 ? nextPoint - now : 5));
+    }
+    return 0;
+}
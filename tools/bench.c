@@ -0,0 +1,287 @@
+// Host micro-benchmarks of the encoding and parsing hot paths, reporting
+// time, bytes on the wire and heap allocations per operation.
+//
+// Build and run from the repository root (Linux, glibc):
+//
+//     cc -O2 -Itools/host -o bench tools/bench.c tools/host/sl_host.c
+//         src/*.c -lm
+//     ./bench              # table
+//     ./bench -j           # one JSON object per line, for comparing runs
+//
+// The CC3200 client is compiled in with the host port in tools/host, so
+// its request and response paths run unchanged against in-memory sockets.
+// The Arduino client encodes imports from the same formatters and JSON
+// segments (src/fmt.c, include/iobeam_import.h), so its body encoding
+// costs about the same as `import_*` here.
+//
+// Allocations are counted by wrapping glibc's malloc family, including
+// calls made inside libc (e.g. by printf).
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../src/cc3200/iobeam.c"
+
+#define REPEATS 5
+#define ITERATIONS 200000
+
+//
+// Allocation counting
+//
+
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t n, size_t size);
+extern void *__libc_realloc(void *p, size_t size);
+extern void __libc_free(void *p);
+
+static uint64_t allocs = 0;
+
+void *malloc(size_t size)
+{
+    allocs++;
+    return __libc_malloc(size);
+}
+
+void *calloc(size_t n, size_t size)
+{
+    allocs++;
+    return __libc_calloc(n, size);
+}
+
+void *realloc(void *p, size_t size)
+{
+    allocs++;
+    return __libc_realloc(p, size);
+}
+
+void free(void *p)
+{
+    __libc_free(p);
+}
+
+//
+// Harness
+//
+
+static int json = 0;
+static volatile size_t sink;
+
+typedef struct {
+    const char *name;
+    double nsPerOp;
+    double bytesPerOp;
+    double allocsPerOp;
+} Result;
+
+static double nowNs()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static void report(const Result *r)
+{
+    if (json) {
+        printf("{\"bench\":\"%s\",\"ns_per_op\":%.1f,\"bytes_per_op\":%.1f,"
+                "\"allocs_per_op\":%.2f}\n", r->name, r->nsPerOp,
+                r->bytesPerOp, r->allocsPerOp);
+    } else {
+        printf("%-28s %10.1f %10.1f %10.2f\n", r->name, r->nsPerOp,
+                r->bytesPerOp, r->allocsPerOp);
+    }
+}
+
+// Runs `body` `iters` times per repeat and reports the fastest repeat.
+// `body` evaluates to the number of bytes it produced, sent or parsed.
+#define BENCH(benchName, iters, body) do { \
+    Result r = { benchName, 1e30, 0, 0 }; \
+    int rep; \
+    for (rep = 0; rep < REPEATS; rep++) { \
+        uint64_t bytes = 0; \
+        uint64_t allocStart = allocs; \
+        long it; \
+        double start = nowNs(); \
+        for (it = 0; it < (iters); it++) \
+            bytes += (body); \
+        double ns = (nowNs() - start) / (iters); \
+        if (ns < r.nsPerOp) \
+            r.nsPerOp = ns; \
+        r.bytesPerOp = (double) bytes / (iters); \
+        r.allocsPerOp = (double) (allocs - allocStart) / (iters); \
+    } \
+    report(&r); \
+} while (0)
+
+//
+// Inputs
+//
+
+#define PROJECT_ID 1234
+#define TOKEN "eyJ0eXAiOiJKV1QiLCJhbGciOiJIUzI1NiJ9.eyJwaWQiOjEyMzQsInBpZCI6MX0" \
+        ".dGVzdHRva2VudGVzdHRva2VudGVzdHRva2Vu"
+#define DEVICE_ID "d4e1b1f0c2a34f87"
+#define SERIES "temperature"
+
+static const char IMPORT_RSP[] =
+        "HTTP/1.1 200 OK\r\n"
+        "Server: nginx\r\n"
+        "Date: Sun, 18 Oct 2015 20:49:13 GMT\r\n"
+        "Content-Type: application/json\r\n"
+        "content-length: 0\r\n"
+        "Connection: close\r\n"
+        "\r\n";
+
+static const char TIME_RSP[] =
+        "HTTP/1.1 200 OK\r\n"
+        "Server: nginx\r\n"
+        "Date: Sun, 18 Oct 2015 20:49:13 GMT\r\n"
+        "Content-Type: application/json\r\n"
+        "Content-Length: 34\r\n"
+        "Connection: close\r\n"
+        "\r\n"
+        "{\"server_timestamp\":1445201353123}";
+
+static const char DEVICE_RSP[] =
+        "{\"project_id\":1234,\"device_id\":\"" DEVICE_ID "\","
+        "\"device_name\":null,\"created\":\"2015-10-18 20:49:13 +0000\"}";
+
+// The import encoding used before the allocation-free encoder, kept here
+// for comparison.
+#define LEGACY_IMPORT_FLOAT "{\"device_id\":\"%s\",\"project_id\":%" PRIu32 \
+        ",\"sources\":[{\"name\":\"%s\",\"data\":[{\"time\":%llu," \
+        "\"value\":%f}]}]}"
+
+static int legacyImport(char *buf, size_t bufLen, const char *fmt, ...)
+{
+    va_list args;
+    va_start(args, fmt);
+    int len = vsnprintf(NULL, 0, fmt, args);
+    va_end(args);
+    va_start(args, fmt);
+    vsnprintf(buf, bufLen, fmt, args);
+    va_end(args);
+    return len;
+}
+
+static int headerInFormat(char *buf, size_t bufLen, const char *fmt, ...)
+{
+    va_list args;
+    va_start(args, fmt);
+    int len = makeHeaderInFormat(buf, bufLen, HTTP_HEADER_CONTENT_LENGTH,
+            sizeof(HTTP_HEADER_CONTENT_LENGTH) - 1, fmt, args);
+    va_end(args);
+    return len;
+}
+
+static size_t buildHead(char *buf, size_t bufLen, uint32_t contentLen)
+{
+    HttpBuilder b;
+    httpBuilderInit(&b, buf, bufLen);
+    httpAppendRequestLine(&b, HTTP_METHOD_POST, sizeof(HTTP_METHOD_POST) - 1,
+            RESOURCE_IMPORTS, sizeof(RESOURCE_IMPORTS) - 1);
+    _iobeam_AppendCommonHeaders(&b);
+    httpAppendHeaderUInt(&b, HTTP_HEADER_CONTENT_LENGTH,
+            sizeof(HTTP_HEADER_CONTENT_LENGTH) - 1, contentLen);
+    _iobeam_AppendTokenHeader(&b, TOKEN);
+    httpAppendEnd(&b);
+    return b.len;
+}
+
+static size_t processResponse(const char *rsp, size_t rspLen, size_t chunk)
+{
+    uint32_t bodyLen = 0;
+    slhost_SetResponse(rsp, rspLen, chunk);
+    _currSock = 3;
+    _iobeam_ProcessResponse(200, RSP_BODY(_scratch), &bodyLen);
+    return rspLen;
+}
+
+static size_t sendSample(int64_t i)
+{
+    uint64_t before = slhost_Stats()->bytesSent;
+    _iobeam_SendIntWithTime(SERIES, 1445201353123ULL + i, i);
+    return slhost_Stats()->bytesSent - before;
+}
+
+static size_t sendFloatSample(int64_t i)
+{
+    uint64_t before = slhost_Stats()->bytesSent;
+    _iobeam_SendFloatWithTime(SERIES, 1445201353123ULL + i,
+            21.5 + (double) (i % 100) / 16);
+    return slhost_Stats()->bytesSent - before;
+}
+
+int main(int argc, char **argv)
+{
+    json = argc > 1 && strcmp(argv[1], "-j") == 0;
+    if (!json) {
+        printf("%-28s %10s %10s %10s\n", "bench", "ns/op", "bytes/op",
+                "allocs/op");
+    }
+
+    Iobeam iobeam;
+    iobeam_Init(&iobeam, PROJECT_ID, TOKEN, DEVICE_ID);
+
+    char buf[512];
+    const char rspLine[] = "HTTP/1.1 201 Created";
+    char lenLine[] = "content-length: 1234";
+    char dateLine[] = "Date: Sun, 18 Oct 2015 20:49:13 GMT";
+    char deviceRsp[sizeof(DEVICE_RSP)];
+    char deviceId[API_MAX_DEVICE_ID_LEN + 1];
+    memcpy(deviceRsp, DEVICE_RSP, sizeof(DEVICE_RSP));
+
+    IobeamValue intValue;
+    intValue.type = IOBEAM_VALUE_INT;
+    intValue.as.i = 1234567;
+    IobeamValue floatValue;
+    floatValue.type = IOBEAM_VALUE_FLOAT;
+    floatValue.as.f = 23.4375f;
+
+    // HTTP message head
+    BENCH("makeRequest", ITERATIONS, makeRequest(buf, sizeof(buf),
+            HTTP_METHOD_POST, sizeof(HTTP_METHOD_POST) - 1, RESOURCE_IMPORTS,
+            sizeof(RESOURCE_IMPORTS) - 1));
+    BENCH("makeHeader", ITERATIONS, makeHeader(buf, sizeof(buf),
+            HTTP_HEADER_HOST, sizeof(HTTP_HEADER_HOST) - 1, API_DEFAULT_SERVER,
+            sizeof(API_DEFAULT_SERVER) - 1));
+    BENCH("makeHeaderInFormat", ITERATIONS, headerInFormat(buf, sizeof(buf),
+            "%" PRIu32 HEADER_END, (uint32_t) it));
+    BENCH("http_head_builder", ITERATIONS, buildHead(buf, sizeof(buf),
+            (uint32_t) it));
+
+    // Import bodies
+    BENCH("import_int", ITERATIONS, iobeam_ImportSingle(buf, DEVICE_ID,
+            PROJECT_ID, SERIES, 1445201353123ULL + it, &intValue));
+    BENCH("import_float", ITERATIONS, iobeam_ImportSingle(buf, DEVICE_ID,
+            PROJECT_ID, SERIES, 1445201353123ULL + it, &floatValue));
+    BENCH("import_float_printf", ITERATIONS, legacyImport(buf, sizeof(buf),
+            LEGACY_IMPORT_FLOAT, DEVICE_ID, (uint32_t) PROJECT_ID, SERIES,
+            1445201353123ULL + it, 23.4375));
+
+    // Response parsing
+    BENCH("parseResponseCode", ITERATIONS, (sink += parseResponseCode(
+            (char *) rspLine), sizeof(rspLine) - 1));
+    BENCH("parseContentLength", ITERATIONS,
+            (sink += parseContentLength(lenLine), sizeof(lenLine) - 1));
+    BENCH("parseDate", ITERATIONS,
+            (sink += parseDate(dateLine), sizeof(dateLine) - 1));
+    BENCH("_iobeam_ParseDeviceId", ITERATIONS, (sink += _iobeam_ParseDeviceId(
+            deviceId, deviceRsp), sizeof(deviceRsp) - 1));
+    BENCH("processResponse", ITERATIONS, processResponse(IMPORT_RSP,
+            sizeof(IMPORT_RSP) - 1, 0));
+    BENCH("processResponse_body", ITERATIONS, processResponse(TIME_RSP,
+            sizeof(TIME_RSP) - 1, 0));
+    BENCH("processResponse_chunked", ITERATIONS, processResponse(TIME_RSP,
+            sizeof(TIME_RSP) - 1, 64));
+
+    // Whole requests through the client, bytes are what it sends
+    slhost_SetResponse(IMPORT_RSP, sizeof(IMPORT_RSP) - 1, 0);
+    BENCH("send_int", ITERATIONS, sendSample(it));
+    BENCH("send_float", ITERATIONS, sendFloatSample(it));
+
+    iobeam_Finish();
+    return 0;
+}
@@ -0,0 +1,262 @@
+// Host benchmark and round-trip check of the number formatters in
+// src/fmt.c, compared against snprintf.
+//
+// Build and run from the repository root:
+//
+//     cc -O2 -o fmt_bench tools/fmt_bench.c src/fmt.c
+//     ./fmt_bench                 # ns/op of each formatter and snprintf
+//     ./fmt_bench verify [stride] # round-trip every float, check integers
+//
+// `verify` parses the output for every finite float bit pattern back with
+// strtof and requires the exact same bits. Every `stride`-th float (default
+// 101) is also checked to be no longer than the shortest "%.*e" that
+// round-trips. Doubles are checked the same way, on random bit patterns
+// rather than all of them. It takes the best part of half an hour.
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../include/iobeam_fmt.h"
+
+#define ITERATIONS 2000000
+#define INPUTS 1024
+
+static volatile size_t sink;
+
+static double nowNs()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static uint64_t xorshift(uint64_t *s)
+{
+    *s ^= *s << 13;
+    *s ^= *s >> 7;
+    *s ^= *s << 17;
+    return *s;
+}
+
+static void bench()
+{
+    static uint32_t u32[INPUTS];
+    static int64_t i64[INPUTS];
+    static float f32[INPUTS];
+    static double f64[INPUTS];
+    uint64_t seed = 88172645463325252ULL;
+    int i;
+    for (i = 0; i < INPUTS; i++) {
+        u32[i] = (uint32_t) xorshift(&seed) >> (xorshift(&seed) % 32);
+        i64[i] = (int64_t) xorshift(&seed) >> (xorshift(&seed) % 64);
+        f32[i] = (float) ((double) (int32_t) xorshift(&seed) / 1000.0);
+        f64[i] = (double) (int64_t) xorshift(&seed) / 1e12;
+    }
+
+    char buf[64];
+    double start;
+
+#define BENCH(name, expr) \
+    start = nowNs(); \
+    for (i = 0; i < ITERATIONS; i++) { \
+        int k = i % INPUTS; \
+        (void) k; \
+        sink += (size_t) (expr); \
+    } \
+    printf("%-24s %8.1f ns/op\n", name, (nowNs() - start) / ITERATIONS);
+
+    BENCH("iobeam_FormatUInt32", iobeam_FormatUInt32(buf, u32[k]));
+    BENCH("snprintf %" PRIu32, snprintf(buf, sizeof(buf), "%" PRIu32, u32[k]));
+    BENCH("iobeam_FormatInt64", iobeam_FormatInt64(buf, i64[k]));
+    BENCH("snprintf %" PRId64, snprintf(buf, sizeof(buf), "%" PRId64, i64[k]));
+    BENCH("iobeam_FormatFloat", iobeam_FormatFloat(buf, f32[k]));
+    BENCH("snprintf %.9g", snprintf(buf, sizeof(buf), "%.9g", f32[k]));
+    BENCH("snprintf %f", snprintf(buf, sizeof(buf), "%f", f32[k]));
+    BENCH("iobeam_FormatDouble", iobeam_FormatDouble(buf, f64[k]));
+    BENCH("snprintf %.17g", snprintf(buf, sizeof(buf), "%.17g", f64[k]));
+#undef BENCH
+}
+
+// Number of significant digits in a formatted number.
+static int significantDigits(const char *s)
+{
+    char digits[64];
+    int n = 0;
+    for (; *s && *s != 'e'; s++) {
+        if (*s >= '0' && *s <= '9')
+            digits[n++] = *s;
+    }
+    int start = 0;
+    while (start < n && digits[start] == '0')
+        start++;
+    while (n > start && digits[n - 1] == '0')
+        n--;
+    return n - start;
+}
+
+static int shortestDigits(float f)
+{
+    char buf[64];
+    int p;
+    for (p = 0; p < 9; p++) {
+        snprintf(buf, sizeof(buf), "%.*e", p, f);
+        if (strtof(buf, NULL) == f)
+            return significantDigits(buf);
+    }
+    return 9;
+}
+
+static int verifyFloats(uint64_t stride)
+{
+    int failures = 0;
+    char buf[IOBEAM_FMT_FLOAT_MAX + 1];
+    uint64_t i;
+    for (i = 0; i <= UINT32_MAX; i++) {
+        uint32_t bits = (uint32_t) i;
+        if (((bits >> 23) & 0xff) == 0xff)
+            continue;  // NaN and infinities
+
+        float f;
+        memcpy(&f, &bits, sizeof(f));
+        size_t len = iobeam_FormatFloat(buf, f);
+        buf[len] = '\0';
+        if (len > IOBEAM_FMT_FLOAT_MAX || iobeam_FormatFloat(NULL, f) != len) {
+            printf("bad length: %08" PRIx32 " %s\n", bits, buf);
+            failures++;
+            continue;
+        }
+
+        float back = strtof(buf, NULL);
+        uint32_t backBits;
+        memcpy(&backBits, &back, sizeof(backBits));
+        if (backBits != bits) {
+            printf("round-trip: %08" PRIx32 " %s\n", bits, buf);
+            failures++;
+        } else if (i % stride == 0 && f != 0 &&
+                significantDigits(buf) > shortestDigits(f)) {
+            printf("not shortest: %08" PRIx32 " %s\n", bits, buf);
+            failures++;
+        }
+
+        if (failures > 20)
+            break;
+        if ((i & 0x0fffffff) == 0)
+            fprintf(stderr, "floats: %3d%%\n", (int) (i * 100 >> 32));
+    }
+    return failures;
+}
+
+static int shortestDigitsDouble(double d)
+{
+    char buf[64];
+    int p;
+    for (p = 0; p < 17; p++) {
+        snprintf(buf, sizeof(buf), "%.*e", p, d);
+        if (strtod(buf, NULL) == d)
+            return significantDigits(buf);
+    }
+    return 17;
+}
+
+static int verifyDouble(uint64_t bits, int shortest)
+{
+    char buf[IOBEAM_FMT_DOUBLE_MAX + 1];
+    double d;
+    memcpy(&d, &bits, sizeof(d));
+    size_t len = iobeam_FormatDouble(buf, d);
+    buf[len] = '\0';
+    if (len > IOBEAM_FMT_DOUBLE_MAX || iobeam_FormatDouble(NULL, d) != len) {
+        printf("bad length: %016" PRIx64 " %s\n", bits, buf);
+        return 1;
+    }
+
+    double back = strtod(buf, NULL);
+    uint64_t backBits;
+    memcpy(&backBits, &back, sizeof(backBits));
+    if (backBits != bits) {
+        printf("round-trip: %016" PRIx64 " %s\n", bits, buf);
+        return 1;
+    }
+    if (shortest && d != 0 &&
+            significantDigits(buf) > shortestDigitsDouble(d)) {
+        printf("not shortest: %016" PRIx64 " %s\n", bits, buf);
+        return 1;
+    }
+    return 0;
+}
+
+static int verifyDoubles(uint64_t stride)
+{
+    int failures = 0;
+    uint64_t seed = 88172645463325252ULL;
+    uint64_t i;
+    // Every power of 2, and its neighbours, where the interval is uneven
+    for (i = 1; i < 0x7ff; i++) {
+        failures += verifyDouble(i << 52, 1) + verifyDouble((i << 52) - 1, 1);
+        failures += verifyDouble((i << 52) + 1, 1);
+    }
+    for (i = 0; i < 50000000 && failures <= 20; i++) {
+        uint64_t bits = xorshift(&seed) >> (i % 3 == 0 ? i % 64 : 0);
+        if (((bits >> 52) & 0x7ff) == 0x7ff)
+            continue;  // NaN and infinities
+        failures += verifyDouble(bits, i % stride == 0);
+    }
+    return failures;
+}
+
+static int checkInt64(int64_t v)
+{
+    char a[32], b[32];
+    size_t len = iobeam_FormatInt64(a, v);
+    a[len] = '\0';
+    snprintf(b, sizeof(b), "%" PRId64, v);
+    if (strcmp(a, b) != 0 || iobeam_FormatInt64(NULL, v) != len) {
+        printf("int64: %s != %s\n", a, b);
+        return 1;
+    }
+    if (v >= 0 && v <= UINT32_MAX) {
+        len = iobeam_FormatUInt32(a, (uint32_t) v);
+        a[len] = '\0';
+        if (strcmp(a, b) != 0) {
+            printf("uint32: %s != %s\n", a, b);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static int verifyInts()
+{
+    int failures = 0;
+    uint64_t seed = 2463534242ULL;
+    int64_t p = 1;
+    int i;
+    for (i = 0; i < 19; i++, p *= 10) {
+        failures += checkInt64(p) + checkInt64(p - 1) + checkInt64(p + 1);
+        failures += checkInt64(-p) + checkInt64(-p + 1) + checkInt64(-p - 1);
+    }
+    failures += checkInt64(INT64_MAX) + checkInt64(INT64_MIN);
+    failures += checkInt64(UINT32_MAX) + checkInt64((int64_t) UINT32_MAX + 1);
+    for (i = 0; i < 10000000; i++)
+        failures += checkInt64((int64_t) xorshift(&seed) >> (i % 64));
+    return failures;
+}
+
+int main(int argc, char **argv)
+{
+    if (argc > 1 && strcmp(argv[1], "verify") == 0) {
+        uint64_t stride = argc > 2 ? strtoull(argv[2], NULL, 10) : 101;
+        int failures = verifyInts();
+        printf("integers: %d failures\n", failures);
+        int floatFailures = verifyFloats(stride ? stride : 1);
+        printf("floats: %d failures\n", floatFailures);
+        int doubleFailures = verifyDoubles(stride ? stride : 1);
+        printf("doubles: %d failures\n", doubleFailures);
+        return failures + floatFailures + doubleFailures > 0;
+    }
+
+    bench();
+    return 0;
+}
@@ -0,0 +1,10 @@
+// Host stand-in for the CC3200 SDK's common.h, see sl_host.h.
+#ifndef __COMMON__H__
+#define __COMMON__H__
+
+#include <stdio.h>
+#include <stdarg.h>
+
+#define UART_PRINT printf
+
+#endif
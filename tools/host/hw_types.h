@@ -0,0 +1 @@
+// Host stand-in for the CC3200 SDK's hw_types.h, see sl_host.h.
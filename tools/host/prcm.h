@@ -0,0 +1,21 @@
+// Host stand-in for the CC3200 SDK's prcm.h, see sl_host.h.
+#ifndef __PRCM_H__
+#define __PRCM_H__
+
+// 32.768 kHz ticks of the host's monotonic clock.
+unsigned long long PRCMSlowClkCtrGet(void);
+
+// Causes of the last reset, with the SDK's values.
+#define PRCM_POWER_ON   0x00000000
+#define PRCM_LPDS_EXIT  0x00000001
+#define PRCM_CORE_RESET 0x00000003
+#define PRCM_MCU_RESET  0x00000004
+#define PRCM_WDT_RESET  0x00000005
+#define PRCM_SOC_RESET  0x00000006
+#define PRCM_HIB_EXIT   0x00000007
+
+// The host's monotonic clock keeps counting between runs, as the slow clock
+// does through hibernation, so every run is a wake from hibernation.
+unsigned long PRCMSysResetCauseGet(void);
+
+#endif
@@ -0,0 +1,53 @@
+// Host stand-in for the subset of the SimpleLink API used by the CC3200
+// client, see sl_host.h.
+#ifndef __SIMPLELINK_H__
+#define __SIMPLELINK_H__
+
+#include <stdint.h>
+
+#define SL_AF_INET 2
+#define SL_SOCK_STREAM 1
+#define SL_FS_ERR_FILE_NOT_EXISTS (-11)
+
+#define FS_MODE_OPEN_READ 0
+#define FS_MODE_OPEN_WRITE 1
+#define FS_MODE_OPEN_CREATE(maxSize, flags) (2)
+#define _FS_FILE_OPEN_FLAG_COMMIT 1
+#define _FS_FILE_PUBLIC_WRITE 2
+
+typedef struct {
+    unsigned short sin_family;
+    unsigned short sin_port;
+    struct {
+        unsigned long s_addr;
+    } sin_addr;
+} SlSockAddrIn_t;
+
+typedef struct {
+    unsigned short sa_family;
+} SlSockAddr_t;
+
+long sl_FsDel(const unsigned char *name, unsigned long token);
+long sl_FsOpen(const unsigned char *name, unsigned long mode,
+        unsigned long *token, long *fd);
+long sl_FsRead(long fd, unsigned long offset, unsigned char *data,
+        unsigned long len);
+long sl_FsWrite(long fd, unsigned long offset, unsigned char *data,
+        unsigned long len);
+short sl_FsClose(long fd, unsigned char *cert, unsigned char *signature,
+        unsigned long sigLen);
+
+short sl_NetAppDnsGetHostByName(const char *name, unsigned short nameLen,
+        unsigned long *ip, unsigned char family);
+unsigned short sl_Htons(unsigned short v);
+unsigned long sl_Htonl(unsigned long v);
+
+short sl_Socket(short domain, short type, short protocol);
+short sl_Connect(short sd, const SlSockAddr_t *addr, short addrLen);
+short sl_Close(short sd);
+short sl_Send(short sd, const void *buf, short len, short flags);
+short sl_Recv(short sd, void *buf, short len, short flags);
+
+#include "sl_host.h"
+
+#endif
@@ -0,0 +1,243 @@
+#include "simplelink.h"
+#include "prcm.h"
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#define SENT_KEEP 4096
+#define MAX_FILES 4
+#define MAX_FILE_LEN 512
+
+static const char *_rsp = "";
+static size_t _rspLen = 0;
+static size_t _rspChunk = 0;
+static size_t _rspPos = 0;
+
+static SlHostStats _stats;
+static char _sent[SENT_KEEP];
+static size_t _sentLen = 0;
+
+static uint64_t _clockOffsetMs = 0;
+
+// Server real sockets connect to, if `_useServer`
+static int _useServer = 0;
+static struct sockaddr_in _server;
+
+typedef struct {
+    char name[32];
+    unsigned char data[MAX_FILE_LEN];
+    unsigned long len;
+    int used;
+} HostFile;
+
+static HostFile _files[MAX_FILES];
+
+void slhost_SetResponse(const char *rsp, size_t rspLen, size_t chunk)
+{
+    _rsp = rsp;
+    _rspLen = rspLen;
+    _rspChunk = chunk;
+    _rspPos = 0;
+}
+
+const SlHostStats *slhost_Stats()
+{
+    return &_stats;
+}
+
+void slhost_ResetStats()
+{
+    memset(&_stats, 0, sizeof(_stats));
+    _sentLen = 0;
+}
+
+const char *slhost_Sent(size_t *len)
+{
+    *len = _sentLen;
+    return _sent;
+}
+
+void slhost_AdvanceClock(uint64_t ms)
+{
+    _clockOffsetMs += ms;
+}
+
+int slhost_UseServer(const char *ip, uint16_t port)
+{
+    _useServer = 0;
+    if (!ip)
+        return 0;
+    memset(&_server, 0, sizeof(_server));
+    _server.sin_family = AF_INET;
+    _server.sin_port = htons(port);
+    if (inet_pton(AF_INET, ip, &_server.sin_addr) != 1)
+        return -1;
+    _useServer = 1;
+    return 0;
+}
+
+unsigned long long PRCMSlowClkCtrGet(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    unsigned long long ms = (unsigned long long) ts.tv_sec * 1000 +
+            ts.tv_nsec / 1000000 + _clockOffsetMs;
+    return ms * 32768 / 1000;
+}
+
+unsigned long PRCMSysResetCauseGet(void)
+{
+    return PRCM_HIB_EXIT;
+}
+
+short sl_NetAppDnsGetHostByName(const char *name, unsigned short nameLen,
+        unsigned long *ip, unsigned char family)
+{
+    *ip = 0x7f000001;
+    return 0;
+}
+
+unsigned short sl_Htons(unsigned short v)
+{
+    return (unsigned short) ((v >> 8) | (v << 8));
+}
+
+unsigned long sl_Htonl(unsigned long v)
+{
+    return ((v >> 24) & 0xff) | ((v >> 8) & 0xff00) |
+            ((v << 8) & 0xff0000) | ((v << 24) & 0xff000000UL);
+}
+
+short sl_Socket(short domain, short type, short protocol)
+{
+    if (_useServer)
+        return (short) socket(AF_INET, SOCK_STREAM, 0);
+    return 3;
+}
+
+short sl_Connect(short sd, const SlSockAddr_t *addr, short addrLen)
+{
+    _stats.connects++;
+    _rspPos = 0;
+    if (_useServer && connect(sd, (const struct sockaddr *) &_server,
+            sizeof(_server)) < 0) {
+        return -1;
+    }
+    return 0;
+}
+
+short sl_Close(short sd)
+{
+    if (_useServer)
+        close(sd);
+    return 0;
+}
+
+short sl_Send(short sd, const void *buf, short len, short flags)
+{
+    if (_useServer)
+        len = (short) send(sd, buf, len, MSG_NOSIGNAL);
+    if (len < 0)
+        return len;
+    _stats.sends++;
+    _stats.bytesSent += len;
+    if (_sentLen + len <= SENT_KEEP) {
+        memcpy(_sent + _sentLen, buf, len);
+        _sentLen += len;
+    }
+    return len;
+}
+
+short sl_Recv(short sd, void *buf, short len, short flags)
+{
+    if (_useServer) {
+        ssize_t got = recv(sd, buf, len, 0);
+        _stats.recvs++;
+        if (got > 0)
+            _stats.bytesReceived += got;
+        return (short) got;
+    }
+
+    size_t n = _rspLen - _rspPos;
+    if (n > (size_t) len)
+        n = len;
+    if (_rspChunk > 0 && n > _rspChunk)
+        n = _rspChunk;
+    memcpy(buf, _rsp + _rspPos, n);
+    _rspPos += n;
+    _stats.recvs++;
+    _stats.bytesReceived += n;
+    return (short) n;
+}
+
+static HostFile *_slhost_FindFile(const unsigned char *name, int create)
+{
+    int i;
+    HostFile *empty = NULL;
+    for (i = 0; i < MAX_FILES; i++) {
+        if (_files[i].used && strcmp(_files[i].name, (const char *) name) == 0)
+            return &_files[i];
+        if (!_files[i].used && !empty)
+            empty = &_files[i];
+    }
+    if (!create || !empty)
+        return NULL;
+
+    strncpy(empty->name, (const char *) name, sizeof(empty->name) - 1);
+    empty->len = 0;
+    empty->used = 1;
+    return empty;
+}
+
+long sl_FsDel(const unsigned char *name, unsigned long token)
+{
+    HostFile *f = _slhost_FindFile(name, 0);
+    if (!f)
+        return SL_FS_ERR_FILE_NOT_EXISTS;
+    f->used = 0;
+    return 0;
+}
+
+long sl_FsOpen(const unsigned char *name, unsigned long mode,
+        unsigned long *token, long *fd)
+{
+    HostFile *f = _slhost_FindFile(name, mode != FS_MODE_OPEN_READ);
+    if (!f)
+        return SL_FS_ERR_FILE_NOT_EXISTS;
+    *fd = (long) (f - _files);
+    return 0;
+}
+
+long sl_FsRead(long fd, unsigned long offset, unsigned char *data,
+        unsigned long len)
+{
+    HostFile *f = &_files[fd];
+    if (offset >= f->len)
+        return 0;
+    if (len > f->len - offset)
+        len = f->len - offset;
+    memcpy(data, f->data + offset, len);
+    return (long) len;
+}
+
+long sl_FsWrite(long fd, unsigned long offset, unsigned char *data,
+        unsigned long len)
+{
+    HostFile *f = &_files[fd];
+    if (offset + len > MAX_FILE_LEN)
+        return -1;
+    memcpy(f->data + offset, data, len);
+    if (offset + len > f->len)
+        f->len = offset + len;
+    return (long) len;
+}
+
+short sl_FsClose(long fd, unsigned char *cert, unsigned char *signature,
+        unsigned long sigLen)
+{
+    return 0;
+}
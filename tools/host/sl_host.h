@@ -0,0 +1,42 @@
+// Host port of the CC3200 client, for benchmarks and tests on Linux.
+//
+// The headers in this directory stand in for the CC3200 SDK, so that
+// src/cc3200/iobeam.c compiles unchanged with `-Itools/host`. Sockets are
+// served from memory: each connection reads back the canned response set
+// with `slhost_SetResponse()`, and everything sent is counted (and kept,
+// up to a limit) so the bytes on the wire can be measured. Sockets can
+// instead be real TCP connections to a server, e.g. tools/mock_server.py,
+// with `slhost_UseServer()`. Files live in memory too. The slow clock is
+// the host's monotonic clock.
+#ifndef SL_HOST_H_
+#define SL_HOST_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct _slhost_stats {
+    uint64_t connects;
+    uint64_t sends;
+    uint64_t bytesSent;
+    uint64_t recvs;
+    uint64_t bytesReceived;
+} SlHostStats;
+
+// Sets the response returned on every connection. At most `chunk` bytes
+// are returned per receive, or as many as asked for if it is 0.
+void slhost_SetResponse(const char *rsp, size_t rspLen, size_t chunk);
+
+// Statistics since the last reset, and the last `len` bytes sent.
+const SlHostStats *slhost_Stats();
+void slhost_ResetStats();
+const char *slhost_Sent(size_t *len);
+
+// Adds `ms` to the slow clock, on top of the host's clock.
+void slhost_AdvanceClock(uint64_t ms);
+
+// Connects sockets to the server at IPv4 address `ip` and `port`, whatever
+// address the client asks for, or back to canned responses if `ip` is
+// NULL. Returns -1 if `ip` is not a valid address.
+int slhost_UseServer(const char *ip, uint16_t port);
+
+#endif /* SL_HOST_H_ */
@@ -0,0 +1,345 @@
+#!/usr/bin/env python3
+"""Local stand-in for the iobeam API, for end-to-end tests of the clients.
+
+Implements the three endpoints the clients use, with the response shapes
+they parse:
+
+    POST /v1/devices            201 {"project_id":..,"device_id":".."}
+    GET  /v1/devices/timestamp  200 {"server_timestamp":<ms>}, or with
+                                    ?timefmt=TIMEVAL (Arduino)
+                                    {"server_timestamp":{"sec":..,"usec":..}}
+    POST /v1/imports            200, after checking the body
+
+Every response carries a `Date` header, for clients with date sync on.
+Network conditions and faults can be injected: round trip time (fixed,
+or changing over the run with --rtt-steps) and jitter, bandwidth, stalls
+in the middle of a response, connection resets and 429/503 responses
+(with `Retry-After`). Each received point is logged
+as a JSON line, and a summary of imports/sec and points/sec is printed
+periodically, so encoder correctness and throughput can be checked in the
+same run.
+
+Run with e.g.:
+
+    tools/mock_server.py --port 8080 --rtt 80 --p503 0.05 --log points.jsonl
+
+and build the client with API_DEFAULT_SERVER/API_DEFAULT_PORT pointing at
+it (e.g. -DAPI_DEFAULT_SERVER='"192.168.1.10"' -DAPI_DEFAULT_PORT=8080).
+"""
+
+import argparse
+import email.utils
+import json
+import random
+import socket
+import struct
+import sys
+import threading
+import time
+from http.server import BaseHTTPRequestHandler, ThreadingHTTPServer
+from urllib.parse import parse_qs, urlparse
+
+
+def _reject_constant(name):
+    raise ValueError("%s is not valid JSON" % name)
+
+
+class Stats:
+    def __init__(self):
+        self.lock = threading.Lock()
+        self.requests = 0
+        self.imports = 0
+        self.points = 0
+        self.bad = 0
+        self.faults = 0
+        self.bytes_in = 0
+
+    def add(self, **kw):
+        with self.lock:
+            for k, v in kw.items():
+                setattr(self, k, getattr(self, k) + v)
+
+    def snapshot(self):
+        with self.lock:
+            return (self.requests, self.imports, self.points, self.bad,
+                    self.faults, self.bytes_in)
+
+
+class Handler(BaseHTTPRequestHandler):
+    protocol_version = "HTTP/1.1"
+    server_version = "iobeam-mock"
+    sys_version = ""
+
+    # Set by main()
+    opts = None
+    started = 0
+    stats = None
+    log = None
+    log_lock = threading.Lock()
+    next_device = [0]
+
+    def log_message(self, fmt, *args):
+        if self.opts.verbose:
+            sys.stderr.write("%s %s\n" % (self.address_string(), fmt % args))
+
+    # Network conditions
+
+    def rtt(self):
+        """Round trip time now, from the last of --rtt-steps reached."""
+        rtt = self.opts.rtt
+        elapsed = time.time() - self.started
+        for at, ms in self.opts.rtt_steps:
+            if elapsed >= at:
+                rtt = ms
+        return rtt
+
+    def delay(self):
+        """Sleeps for half a round trip, with jitter. Called once before
+        the request is read and once before the response is written, so
+        each request costs a full round trip."""
+        o = self.opts
+        ms = self.rtt() / 2.0 + random.uniform(-o.jitter, o.jitter) / 2.0
+        if ms > 0:
+            time.sleep(ms / 1000.0)
+
+    def handle_one_request(self):
+        # The request's half of the round trip
+        self.delay()
+        BaseHTTPRequestHandler.handle_one_request(self)
+
+    def throttle(self, nbytes):
+        if self.opts.bandwidth > 0:
+            time.sleep(nbytes / float(self.opts.bandwidth))
+
+    def reset(self):
+        """Aborts the connection with a RST instead of a FIN."""
+        self.stats.add(faults=1)
+        self.connection.setsockopt(socket.SOL_SOCKET, socket.SO_LINGER,
+                                   struct.pack("ii", 1, 0))
+        self.close_connection = True
+        self.connection.close()
+
+    def respond(self, code, body=b"", headers=None):
+        o = self.opts
+        self.delay()
+        if random.random() < o.reset:
+            self.reset()
+            return
+        if code < 300:
+            r = random.random()
+            if r < o.p429:
+                code, body = 429, b'{"errors":["rate limited"]}'
+            elif r < o.p429 + o.p503:
+                code, body = 503, b'{"errors":["unavailable"]}'
+            if code >= 400:
+                self.stats.add(faults=1)
+                headers = {"Retry-After": str(o.retry_after)}
+
+        head = ["HTTP/1.1 %d %s" % (code, self.responses.get(code, ("",))[0]),
+                "Server: iobeam-mock",
+                "Date: " + email.utils.formatdate(usegmt=True),
+                "Content-Type: application/json",
+                "Content-Length: %d" % len(body),
+                "Connection: close"]
+        for k, v in (headers or {}).items():
+            head.append("%s: %s" % (k, v))
+        data = ("\r\n".join(head) + "\r\n\r\n").encode() + body
+
+        # Write in small segments, so bandwidth limits and stalls land in
+        # the middle of the response as they would on a real network.
+        stall_at = -1
+        if random.random() < o.stall:
+            stall_at = random.randrange(1, max(2, len(data)))
+        seg = o.segment
+        try:
+            for i in range(0, len(data), seg):
+                chunk = data[i:i + seg]
+                if i <= stall_at < i + seg:
+                    self.wfile.flush()
+                    self.stats.add(faults=1)
+                    time.sleep(o.stall_ms / 1000.0)
+                self.wfile.write(chunk)
+                self.wfile.flush()
+                self.throttle(len(chunk))
+        except (BrokenPipeError, ConnectionResetError):
+            pass
+        self.close_connection = True
+
+    def read_body(self):
+        length = int(self.headers.get("Content-Length", 0))
+        body = self.rfile.read(length) if length > 0 else b""
+        self.throttle(len(body))
+        self.stats.add(bytes_in=len(body))
+        return body
+
+    def authorized(self):
+        auth = self.headers.get("Authorization", "")
+        if not auth.startswith("Bearer ") or len(auth) <= len("Bearer "):
+            self.respond(401, b'{"errors":["missing token"]}')
+            return False
+        return True
+
+    def bad_request(self, why, body):
+        self.stats.add(bad=1)
+        sys.stderr.write("bad request: %s: %r\n" % (why, body[:200]))
+        self.respond(400, json.dumps({"errors": [why]}).encode())
+
+    # Endpoints
+
+    def do_GET(self):
+        self.stats.add(requests=1)
+        url = urlparse(self.path)
+        if url.path != "/v1/devices/timestamp":
+            self.respond(404, b'{"errors":["not found"]}')
+            return
+        if not self.authorized():
+            return
+
+        now = time.time() + self.opts.clock_offset / 1000.0
+        fmt = parse_qs(url.query).get("timefmt", [""])[0]
+        if fmt == "TIMEVAL":
+            ts = {"sec": int(now), "usec": int((now % 1) * 1e6)}
+        else:
+            ts = int(now * 1000)
+        self.respond(200, json.dumps({"server_timestamp": ts},
+                                     separators=(",", ":")).encode())
+
+    def do_POST(self):
+        self.stats.add(requests=1)
+        body = self.read_body()
+        if not self.authorized():
+            return
+        if self.path == "/v1/devices":
+            self.add_device(body)
+        elif self.path == "/v1/imports":
+            self.add_import(body)
+        else:
+            self.respond(404, b'{"errors":["not found"]}')
+
+    def add_device(self, body):
+        try:
+            req = json.loads(body)
+            project = int(req["project_id"])
+        except (ValueError, KeyError, TypeError):
+            self.bad_request("invalid device JSON", body)
+            return
+        with self.log_lock:
+            self.next_device[0] += 1
+            n = self.next_device[0]
+        device = "mock%012d" % n
+        rsp = {"project_id": project, "device_id": device,
+               "device_name": None,
+               "created": time.strftime("%Y-%m-%d %H:%M:%S +0000",
+                                        time.gmtime())}
+        self.respond(201, json.dumps(rsp, separators=(",", ":")).encode())
+
+    def add_import(self, body):
+        try:
+            # Reject NaN/Infinity, which are not JSON
+            req = json.loads(body, parse_constant=_reject_constant)
+            device = req["device_id"]
+            project = int(req["project_id"])
+            points = []
+            for src in req["sources"]:
+                name = src["name"]
+                for p in src["data"]:
+                    points.append((name, int(p["time"]), p["value"]))
+        except (ValueError, KeyError, TypeError) as e:
+            self.bad_request("invalid import JSON: %s" % e, body)
+            return
+
+        self.stats.add(imports=1, points=len(points))
+        if self.log:
+            received = time.time()
+            with self.log_lock:
+                for name, t, v in points:
+                    self.log.write(json.dumps({
+                        "received": round(received, 3), "project": project,
+                        "device": device, "series": name, "time": t,
+                        "value": v}) + "\n")
+                self.log.flush()
+        self.respond(200)
+
+
+def report(stats, interval):
+    last = stats.snapshot()
+    while True:
+        time.sleep(interval)
+        cur = stats.snapshot()
+        d = [c - l for c, l in zip(cur, last)]
+        last = cur
+        sys.stderr.write(
+            "%.1f req/s  %.1f imports/s  %.1f points/s  %.0f B/s in  "
+            "bad %d  faults %d\n" % (d[0] / interval, d[1] / interval,
+                                     d[2] / interval, d[5] / interval,
+                                     d[3], d[4]))
+
+
+def rtt_steps(arg):
+    """Parses `sec:ms,...` into sorted (sec, ms) pairs."""
+    steps = []
+    for step in arg.split(","):
+        at, ms = step.split(":")
+        steps.append((float(at), float(ms)))
+    return sorted(steps)
+
+
+def main():
+    ap = argparse.ArgumentParser(description=__doc__.split("\n")[0])
+    ap.add_argument("--host", default="0.0.0.0")
+    ap.add_argument("--port", type=int, default=8080)
+    ap.add_argument("--rtt", type=float, default=0,
+                    help="round trip time to add, in ms")
+    ap.add_argument("--rtt-steps", type=rtt_steps, default=[],
+                    help="RTT changes over the run, as sec:ms,... from "
+                    "the server's start, e.g. 0:20,30:400,60:50")
+    ap.add_argument("--jitter", type=float, default=0,
+                    help="random +/- variation of the RTT, in ms")
+    ap.add_argument("--bandwidth", type=float, default=0,
+                    help="bytes/sec each way, 0 for unlimited")
+    ap.add_argument("--segment", type=int, default=536,
+                    help="size of the segments responses are written in")
+    ap.add_argument("--stall", type=float, default=0,
+                    help="probability of a stall within a response")
+    ap.add_argument("--stall-ms", type=float, default=2000,
+                    help="length of a stall, in ms")
+    ap.add_argument("--reset", type=float, default=0,
+                    help="probability of resetting instead of responding")
+    ap.add_argument("--p429", type=float, default=0,
+                    help="probability of answering 429 Too Many Requests")
+    ap.add_argument("--p503", type=float, default=0,
+                    help="probability of answering 503 Service Unavailable")
+    ap.add_argument("--retry-after", type=int, default=1,
+                    help="Retry-After of 429/503 responses, in seconds")
+    ap.add_argument("--clock-offset", type=float, default=0,
+                    help="offset of the server clock, in ms")
+    ap.add_argument("--log", help="file to append received points to")
+    ap.add_argument("--stats", type=float, default=5,
+                    help="seconds between throughput reports, 0 for none")
+    ap.add_argument("--seed", type=int, help="random seed")
+    ap.add_argument("-v", "--verbose", action="store_true")
+    opts = ap.parse_args()
+
+    if opts.seed is not None:
+        random.seed(opts.seed)
+    Handler.opts = opts
+    Handler.started = time.time()
+    Handler.stats = Stats()
+    if opts.log:
+        Handler.log = open(opts.log, "a")
+    if opts.stats > 0:
+        threading.Thread(target=report, args=(Handler.stats, opts.stats),
+                         daemon=True).start()
+
+    server = ThreadingHTTPServer((opts.host, opts.port), Handler)
+    server.daemon_threads = True
+    sys.stderr.write("iobeam mock listening on %s:%d\n" % (opts.host,
+                                                            opts.port))
+    try:
+        server.serve_forever()
+    except KeyboardInterrupt:
+        pass
+
+
+if __name__ == "__main__":
+    main()
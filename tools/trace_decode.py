@@ -0,0 +1,122 @@
+#!/usr/bin/env python3
+"""Decodes a dump of the client's trace ring (see include/iobeam_trace.h).
+
+The ring is dumped as the raw bytes of `*iobeam_TraceRing()`, e.g. saved
+from a debugger's memory view or printed in hex over the UART. The dump may
+be binary or hex text (any whitespace, with or without `0x`); leading bytes
+before the ring's magic are skipped. Events are printed oldest first:
+
+    tools/trace_decode.py ring.bin
+    tools/trace_decode.py --hex uart.log
+    tools/trace_decode.py --json ring.bin > events.jsonl
+
+Event and status names are read from the headers, so they stay in sync with
+the firmware.
+"""
+
+import argparse
+import json
+import os
+import re
+import struct
+import sys
+
+HEADER = struct.Struct("<IBBHII")
+EVENT = struct.Struct("<IHHii")
+MAGIC = 0x54424F49
+
+INCLUDE = os.path.join(os.path.dirname(os.path.abspath(__file__)), "..",
+                       "include")
+
+
+def read_names(header, pattern):
+    names = {}
+    try:
+        with open(os.path.join(INCLUDE, header)) as f:
+            for m in re.finditer(pattern, f.read()):
+                names[int(m.group(2))] = m.group(1)
+    except OSError:
+        pass
+    return names
+
+
+EVENTS = read_names("iobeam_trace.h", r"IOBEAM_TRACE_(\w+) = (\d+),")
+STATUSES = read_names("iobeam_stats.h",
+                      r"#define IOBEAM_STATUS_(\w+) \((-\d+)\)")
+# Events whose first argument is a status
+STATUS_ARG = ("STATUS", "CLOSE")
+
+
+def load(path, is_hex):
+    with open(path, "rb") as f:
+        data = f.read()
+    if is_hex:
+        text = re.sub(rb"0x", b"", data)
+        data = bytes.fromhex(re.sub(rb"[^0-9a-fA-F]", b"", text).decode())
+    start = data.find(struct.pack("<I", MAGIC))
+    if start < 0:
+        sys.exit("no trace ring found (magic missing)")
+    return data[start:]
+
+
+def decode(data):
+    magic, version, event_size, length, hz, nxt = HEADER.unpack_from(data)
+    if version != 1 or event_size != EVENT.size:
+        sys.exit("unsupported ring: version %d, %d byte events" %
+                 (version, event_size))
+    need = HEADER.size + length * event_size
+    if len(data) < need:
+        sys.exit("dump is truncated: %d of %d bytes" % (len(data), need))
+
+    count = min(nxt, length)
+    events = []
+    for seq in range(nxt - count, nxt):
+        off = HEADER.size + (seq % length) * event_size
+        t, eid, eseq, a, b = EVENT.unpack_from(data, off)
+        if eseq != seq & 0xFFFF:
+            # Written while being dumped, or the dump is corrupt
+            sys.stderr.write("warning: slot %d holds event %d, expected %d\n"
+                             % (seq % length, eseq, seq & 0xFFFF))
+        events.append((seq, t, eid, a, b))
+    return hz, nxt, events
+
+
+def main():
+    ap = argparse.ArgumentParser(description=__doc__.split("\n")[0])
+    ap.add_argument("dump")
+    ap.add_argument("--hex", action="store_true",
+                    help="the dump is hex text rather than binary")
+    ap.add_argument("--json", action="store_true",
+                    help="print one JSON object per event")
+    opts = ap.parse_args()
+
+    hz, total, events = decode(load(opts.dump, opts.hex))
+    if not opts.json:
+        print("%d events recorded, last %d kept, clock %d Hz" %
+              (total, len(events), hz))
+        print("%8s %12s %10s  %-10s %s" % ("seq", "ms", "+ms", "event",
+                                           "args"))
+
+    # Times are a wrapping 32-bit counter, so only differences are used.
+    elapsed = 0
+    prev = events[0][1] if events else 0
+    for seq, t, eid, a, b in events:
+        delta = (t - prev) & 0xFFFFFFFF
+        elapsed += delta
+        prev = t
+        name = EVENTS.get(eid, "USER+%d" % (eid - 256) if eid >= 256
+                          else "#%d" % eid)
+        ms = elapsed * 1000.0 / hz
+        if opts.json:
+            print(json.dumps({"seq": seq, "ms": round(ms, 3), "event": name,
+                              "a": a, "b": b}))
+            continue
+        sa = str(a)
+        if name in STATUS_ARG and a in STATUSES:
+            sa = STATUSES[a]
+        print("%8d %12.3f %10.3f  %-10s %s %d" % (
+            seq, ms, delta * 1000.0 / hz, name, sa, b))
+
+
+if __name__ == "__main__":
+    main()